@@ -7,8 +7,16 @@
 #include "Linked-List/linked_list.h"
 #include "MexprEnums.h"
 #include "MexprTree.h"
+#include "MexprBudget.h"
 
+/*
+ * The limit of the expression string and of the tokens on the lex
+ * stack. The library and its users must be built with the same value,
+ * e.g. -DBUFFER_LEN=4194304 of "make bench-scale" for huge expressions.
+ */
+#ifndef BUFFER_LEN
 #define BUFFER_LEN 512
+#endif
 #define MAX_STACK_INDEX (BUFFER_LEN / 2)
 
 typedef struct lex_data {
@@ -35,17 +43,80 @@ extern void parser_stack_reset(void);
 #define CHECKPOINT(checkpoint_index) \
     { checkpoint_index = lex_stack_pointer(); }
 #define RESTORE_CHECKPOINT(checkpoint_index) \
-    { yyrewind(lex_stack_pointer() - checkpoint_index); }
+    { parse_count_rewind(__func__, lex_stack_pointer() - checkpoint_index); \
+      yyrewind(lex_stack_pointer() - checkpoint_index); }
+
+/*
+ * Statistics of the last parse, reset by init_buffer().
+ *
+ * The rewinds are counted per grammar rule, where E' and the other
+ * rules with dollar are counted as their base rules, e.g. E. The
+ * rewinds of other parsers using RESTORE_CHECKPOINT() are counted as
+ * PARSE_RULE_OTHER. The tokens lexed again after the rewinds are
+ * counted as re-lexed.
+ */
+typedef enum parse_rule {
+    PARSE_RULE_E,
+    PARSE_RULE_T,
+    PARSE_RULE_F,
+    PARSE_RULE_Q,
+    PARSE_RULE_I,
+    PARSE_RULE_P,
+    PARSE_RULE_G,
+    PARSE_RULE_S,
+    PARSE_RULE_J,
+    PARSE_RULE_K,
+    PARSE_RULE_D,
+    PARSE_RULE_L,
+    PARSE_RULE_OTHER,
+    PARSE_RULES
+} parse_rule;
+
+typedef struct parse_stats {
+    /* The parsers tried, more than one by build_mathexpr_tree_any() */
+    int parsers;
+
+    unsigned long tokens_lexed;
+    unsigned long tokens_relexed;
+
+    /* The rewinds that popped any token, and the popped tokens */
+    unsigned long rewinds[PARSE_RULES];
+    unsigned long rewound_tokens[PARSE_RULES];
+
+    /* The maximum depth of the recursion of rules */
+    int max_depth;
+} parse_stats;
+
+extern void parse_get_stats(parse_stats *stats);
+extern const char *parse_rule_name(parse_rule rule);
+
+/*
+ * The error of the last parse : MEXPR_OK on success, a budget error
+ * of MexprBudget.h when the parse was stopped, or MEXPR_ERR_SYNTAX.
+ */
+extern mexpr_error parse_last_error(void);
+
+/* Used by the rules of the grammar */
+extern void parse_count_rewind(const char *rule_func, int n);
+extern bool parse_rule_enter(void);
+extern void parse_rule_leave(void);
+extern void parse_fail(mexpr_error error);
 
 /*
  * Parse one string, construct a tree and evalute it.
  */
 extern void init_buffer(char *target);
+extern void init_buffer_budget(char *target, const mexpr_budget *budget);
 extern bool parsed_format_validation(char *s);
 extern bool start_mathexpr_parse();
 extern bool start_ineq_mathexpr_parse();
 extern bool start_logical_mathexpr_parse();
 extern linked_list *convert_infix_to_postfix(lex_data *infix, int size_in);
+extern tree *build_mathexpr_tree(bool (*parser)(void), char *target);
+extern tree *build_mathexpr_tree_budget(bool (*parser)(void), char *target,
+					const mexpr_budget *budget);
+extern tree *build_mathexpr_tree_any(bool (*parsers[])(void), int nparsers,
+				     char *target, parse_stats *stats);
 void resolve_and_evaluate_test(bool (*parser)(void), char *target, void *app_data_src,
 			       tr_node *(*app_access_cb)(struct variable *, void *));
 
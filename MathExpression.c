@@ -1,8 +1,12 @@
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include "ExportedParser.h"
 #include "MexprEnums.h"
+#include "MexprMetrics.h"
+#include "MexprStats.h"
+#include "MexprTrace.h"
 
 /*
  * The production rules for math expression that avoid left recursion :
@@ -57,8 +61,8 @@ static bool D(void);
 static bool L(void);
 
 /* E  -> T E' */
-bool
-E(void){
+static bool
+E_body(void){
     int CKP;
 
     CHECKPOINT(CKP);
@@ -81,7 +85,7 @@ E(void){
 
 /* E' -> + T E' | - T E' | $ */
 static bool
-E_dash(void){
+E_dash_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -135,7 +139,7 @@ E_dash(void){
 
 /* T  -> F T' */
 static bool
-T(void){
+T_body(void){
     int CKP;
 
     CHECKPOINT(CKP);
@@ -158,7 +162,7 @@ T(void){
 
 /* T' -> * F T' | / F T' | % F T' | $ */
 static bool
-T_dash(void){
+T_dash_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -225,7 +229,7 @@ T_dash(void){
 
 /* F -> INT | DOUBLE | VAR | ( E ) | G ( E , E ) | P ( E ) */
 static bool
-F(void){
+F_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -311,8 +315,8 @@ F(void){
     return false;
 }
 
-bool
-Q(void){
+static bool
+Q_body(void){
     int CKP;
 
     CHECKPOINT(CKP);
@@ -337,7 +341,7 @@ Q(void){
 }
 
 static bool
-I(void){
+I_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -361,7 +365,7 @@ I(void){
 }
 
 static bool
-P(void){
+P_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -383,7 +387,7 @@ P(void){
 }
 
 static bool
-G(void){
+G_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -404,8 +408,8 @@ G(void){
 }
 
 /* S -> J S' */
-bool
-S(void){
+static bool
+S_body(void){
     int CKP;
 
     CHECKPOINT(CKP);
@@ -428,7 +432,7 @@ S(void){
 
 /* S' -> OR J S' | $ */
 static bool
-S_dash(void){
+S_dash_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -456,7 +460,7 @@ S_dash(void){
 
 /* J -> K J' */
 static bool
-J(void){
+J_body(void){
     int CKP;
 
     CHECKPOINT(CKP);
@@ -479,7 +483,7 @@ J(void){
 
 /* J' ->  AND K J' | $ */
 static bool
-J_dash(void){
+J_dash_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -506,7 +510,7 @@ J_dash(void){
 }
 
 static bool
-K(void){
+K_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -572,7 +576,7 @@ K(void){
 
 /* K' -> L Q K' | $ */
 static bool
-K_dash(void){
+K_dash_body(void){
     int CKP;
 
     CHECKPOINT(CKP);
@@ -601,7 +605,7 @@ K_dash(void){
 
 /* D  ->  Q L Q */
 static bool
-D(void){
+D_body(void){
     int CKP;
 
     CHECKPOINT(CKP);
@@ -628,7 +632,7 @@ D(void){
 
 /* L -> AND | OR */
 static bool
-L(void){
+L_body(void){
     int token_code, CKP;
 
     CHECKPOINT(CKP);
@@ -656,6 +660,106 @@ L(void){
     return false;
 }
 
+/*
+ * Each rule runs its body between parse_rule_enter() and
+ * parse_rule_leave(), which record the depth of the recursion.
+ * The rule fails without its body once the parse is stopped.
+ */
+#define RULE_WITH_DEPTH(body)			\
+    bool result;				\
+						\
+    if (!parse_rule_enter())			\
+	return false;				\
+    result = body();				\
+    parse_rule_leave();				\
+						\
+    return result;
+
+bool
+E(void){
+    RULE_WITH_DEPTH(E_body);
+}
+
+static bool
+E_dash(void){
+    RULE_WITH_DEPTH(E_dash_body);
+}
+
+static bool
+T(void){
+    RULE_WITH_DEPTH(T_body);
+}
+
+static bool
+T_dash(void){
+    RULE_WITH_DEPTH(T_dash_body);
+}
+
+static bool
+F(void){
+    RULE_WITH_DEPTH(F_body);
+}
+
+bool
+Q(void){
+    RULE_WITH_DEPTH(Q_body);
+}
+
+static bool
+I(void){
+    RULE_WITH_DEPTH(I_body);
+}
+
+static bool
+P(void){
+    RULE_WITH_DEPTH(P_body);
+}
+
+static bool
+G(void){
+    RULE_WITH_DEPTH(G_body);
+}
+
+bool
+S(void){
+    RULE_WITH_DEPTH(S_body);
+}
+
+static bool
+S_dash(void){
+    RULE_WITH_DEPTH(S_dash_body);
+}
+
+static bool
+J(void){
+    RULE_WITH_DEPTH(J_body);
+}
+
+static bool
+J_dash(void){
+    RULE_WITH_DEPTH(J_dash_body);
+}
+
+static bool
+K(void){
+    RULE_WITH_DEPTH(K_body);
+}
+
+static bool
+K_dash(void){
+    RULE_WITH_DEPTH(K_dash_body);
+}
+
+static bool
+D(void){
+    RULE_WITH_DEPTH(D_body);
+}
+
+static bool
+L(void){
+    RULE_WITH_DEPTH(L_body);
+}
+
 /*
  * The caller of E()
  */
@@ -663,10 +767,14 @@ bool
 start_mathexpr_parse(){
     bool parse_result;
     int token_code;
+    MEXPR_STAGE_BEGIN(start);
 
     parse_result = E();
+    token_code = cyylex();
 
-    if ((token_code = cyylex()) != PARSER_EOF){
+    MEXPR_STAGE_END(MEXPR_STAGE_PARSE, start);
+
+    if (token_code != PARSER_EOF){
 	return false;
     }else{
 	if (!parse_result){
@@ -684,10 +792,14 @@ bool
 start_ineq_mathexpr_parse(){
     bool parse_result;
     int token_code;
+    MEXPR_STAGE_BEGIN(start);
 
     parse_result = Q();
+    token_code = cyylex();
 
-    if ((token_code = cyylex()) != PARSER_EOF){
+    MEXPR_STAGE_END(MEXPR_STAGE_PARSE, start);
+
+    if (token_code != PARSER_EOF){
 	return false;
     }else{
 	if (!parse_result){
@@ -705,10 +817,14 @@ bool
 start_logical_mathexpr_parse(){
     bool parse_result;
     int token_code;
+    MEXPR_STAGE_BEGIN(start);
 
     parse_result = S();
+    token_code = cyylex();
 
-    if ((token_code = cyylex()) != PARSER_EOF){
+    MEXPR_STAGE_END(MEXPR_STAGE_PARSE, start);
+
+    if (token_code != PARSER_EOF){
 	return false;
     }else{
 	if (!parse_result){
@@ -718,3 +834,121 @@ start_logical_mathexpr_parse(){
 	}
     }
 }
+
+/* FNV-1a hash of the expression, which identifies it in the traces */
+static uint64_t
+expression_hash(const char *target){
+    uint64_t h = 14695981039346656037ull;
+
+    if (target == NULL)
+	return 0;
+
+    for (; *target != '\0'; target++)
+	h = (h ^ (unsigned char) *target) * 1099511628211ull;
+
+    return h;
+}
+
+/* build_mathexpr_tree_budget() without the metrics */
+static tree *
+build_tree(bool (*parser)(void), char *target, const mexpr_budget *budget){
+    uint64_t hash = expression_hash(target);
+    linked_list *postfix;
+    tree *t;
+
+    MEXPR_TRACE2(parse__start, hash, target);
+
+    init_buffer_budget(target, budget);
+
+    if (parser() == false){
+	parse_fail(MEXPR_ERR_SYNTAX);
+	MEXPR_TRACE2(parse__end, hash, (int) parse_last_error());
+	return NULL;
+    }
+    MEXPR_TRACE2(parse__end, hash, (int) MEXPR_OK);
+
+    postfix = convert_infix_to_postfix(lstack.main_data,
+				       lex_stack_pointer());
+    t = convert_postfix_to_tree(postfix);
+    t->hash = hash;
+    if (budget != NULL)
+	tree_set_budget(t, budget);
+    MEXPR_TRACE2(tree__build, hash, ll_get_length(postfix));
+    ll_destroy(postfix);
+
+    return t;
+}
+
+/*
+ * Parse 'target' by 'parser' and convert it into a tree.
+ *
+ * Return NULL if the string doesn't match the grammar of 'parser' or
+ * the parse exceeds the budget. parse_last_error() tells the reason.
+ * The returned tree doesn't refer to the lex stack. Therefore, it
+ * stays valid after other strings are parsed. Free it by destroy_tree().
+ */
+tree *
+build_mathexpr_tree(bool (*parser)(void), char *target){
+    return build_mathexpr_tree_budget(parser, target, NULL);
+}
+
+/*
+ * build_mathexpr_tree() under 'budget' instead of the default one of
+ * mexpr_set_budget(). The tree keeps 'max_eval_nodes' of 'budget' for
+ * its evaluations. Callers of different trust levels can hold their
+ * own budgets this way.
+ */
+tree *
+build_mathexpr_tree_budget(bool (*parser)(void), char *target,
+			   const mexpr_budget *budget){
+    uint64_t start = mexpr_metrics_begin();
+    tree *t;
+
+    t = build_tree(parser, target, budget);
+    mexpr_metrics_parse(parse_last_error(), start);
+
+    return t;
+}
+
+/*
+ * Try the parsers in order and return the tree of the first one that
+ * accepts 'target', or NULL with parse_last_error() of the last one.
+ *
+ * The metrics count one parse with its final outcome, not the parsers
+ * that rejected the string before. When 'stats' isn't NULL, it sums up
+ * the statistics of the parses tried, with the maximum of their depths.
+ */
+tree *
+build_mathexpr_tree_any(bool (*parsers[])(void), int nparsers,
+			char *target, parse_stats *stats){
+    uint64_t start = mexpr_metrics_begin();
+    parse_stats last;
+    tree *t = NULL;
+    int i, j;
+
+    assert(nparsers > 0);
+
+    if (stats != NULL)
+	memset(stats, 0, sizeof(parse_stats));
+
+    for (i = 0; i < nparsers && t == NULL; i++){
+	t = build_tree(parsers[i], target, NULL);
+	if (stats == NULL)
+	    continue;
+
+	parse_get_stats(&last);
+	stats->parsers += last.parsers;
+	stats->tokens_lexed += last.tokens_lexed;
+	stats->tokens_relexed += last.tokens_relexed;
+	for (j = 0; j < PARSE_RULES; j++){
+	    stats->rewinds[j] += last.rewinds[j];
+	    stats->rewound_tokens[j] += last.rewound_tokens[j];
+	}
+	if (last.max_depth > stats->max_depth)
+	    stats->max_depth = last.max_depth;
+    }
+
+    mexpr_metrics_parse(parse_last_error(), start);
+
+    return t;
+}
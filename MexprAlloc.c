@@ -0,0 +1,275 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprAlloc.h"
+
+/*
+ * Each block starts with the header that keeps the requested size
+ * and the site for the counters of mexpr_free(), and the index of
+ * the allocator of the block. The union keeps the memory after the
+ * header aligned for any type.
+ */
+typedef union alloc_header {
+    struct {
+	size_t size;
+	int site;
+	int allocator;
+    } h;
+    max_align_t align;
+} alloc_header;
+
+static void *
+default_malloc(size_t size, void *ctx){
+    (void) ctx;
+
+    return malloc(size);
+}
+
+static void
+default_free(void *p, void *ctx){
+    (void) ctx;
+
+    free(p);
+}
+
+static void *
+default_realloc(void *p, size_t size, void *ctx){
+    (void) ctx;
+
+    return realloc(p, size);
+}
+
+/*
+ * The allocators set so far, indexed by the headers of blocks, and
+ * the index of the current one. An entry is written before its index
+ * gets current, and never changes after that.
+ */
+static pthread_mutex_t allocators_lock = PTHREAD_MUTEX_INITIALIZER;
+static mexpr_allocator allocators[MEXPR_ALLOCATORS] = {
+    { default_malloc, default_free, NULL, default_realloc }
+};
+static int nallocators = 1;
+static int current;
+
+/* Updated by any thread, so by the relaxed atomic operations */
+static mexpr_alloc_stats counters;
+
+void
+mexpr_set_allocator(const mexpr_allocator *allocator){
+    mexpr_allocator *a;
+    int i;
+
+    if (allocator == NULL){
+	__atomic_store_n(&current, 0, __ATOMIC_RELEASE);
+	return;
+    }
+
+    assert(allocator->malloc_fn != NULL && allocator->free_fn != NULL);
+
+    pthread_mutex_lock(&allocators_lock);
+    for (i = 0; i < nallocators; i++){
+	a = &allocators[i];
+	if (a->malloc_fn == allocator->malloc_fn &&
+	    a->free_fn == allocator->free_fn && a->ctx == allocator->ctx &&
+	    a->realloc_fn == allocator->realloc_fn)
+	    break;
+    }
+    if (i == nallocators){
+	if (nallocators == MEXPR_ALLOCATORS){
+	    fprintf(stderr, "more than %d allocators are set\n",
+		    MEXPR_ALLOCATORS);
+	    exit(-1);
+	}
+	allocators[nallocators++] = *allocator;
+    }
+    __atomic_store_n(&current, i, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&allocators_lock);
+}
+
+void *
+mexpr_malloc(size_t size, mexpr_alloc_site site){
+    int index = __atomic_load_n(&current, __ATOMIC_ACQUIRE);
+    mexpr_allocator *a = &allocators[index];
+    mexpr_alloc_site_stats *s;
+    alloc_header *header;
+
+    assert(site >= 0 && site < MEXPR_ALLOC_SITES);
+
+    header = (alloc_header *) a->malloc_fn(sizeof(alloc_header) + size,
+					   a->ctx);
+    if (header == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+    header->h.size = size;
+    header->h.site = site;
+    header->h.allocator = index;
+
+    s = &counters.sites[site];
+    __atomic_add_fetch(&s->allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->allocated_bytes, size, __ATOMIC_RELAXED);
+
+    return header + 1;
+}
+
+void *
+mexpr_realloc(void *p, size_t size, mexpr_alloc_site site){
+    mexpr_alloc_site_stats *s;
+    alloc_header *header;
+    mexpr_allocator *a;
+    size_t old_size;
+    void *q;
+
+    if (p == NULL)
+	return mexpr_malloc(size, site);
+
+    header = (alloc_header *) p - 1;
+    assert(header->h.site == (int) site);
+    a = &allocators[header->h.allocator];
+    old_size = header->h.size;
+
+    if (a->realloc_fn == NULL){
+	q = mexpr_malloc(size, site);
+	memcpy(q, p, old_size < size ? old_size : size);
+	mexpr_free(p);
+	return q;
+    }
+
+    header = (alloc_header *) a->realloc_fn(header,
+					    sizeof(alloc_header) + size,
+					    a->ctx);
+    if (header == NULL){
+	perror("realloc");
+	exit(-1);
+    }
+    header->h.size = size;
+
+    /* Count the block as freed by the old size and allocated again */
+    s = &counters.sites[site];
+    __atomic_add_fetch(&s->allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->allocated_bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->freed_bytes, old_size, __ATOMIC_RELAXED);
+
+    return header + 1;
+}
+
+char *
+mexpr_strdup(const char *s, mexpr_alloc_site site){
+    size_t len = strlen(s);
+    char *copy;
+
+    copy = (char *) mexpr_malloc(len + 1, site);
+    memcpy(copy, s, len + 1);
+
+    return copy;
+}
+
+void *
+mexpr_xrealloc(void *p, size_t size){
+    if ((p = realloc(p, size)) == NULL){
+	perror("realloc");
+	exit(-1);
+    }
+
+    return p;
+}
+
+void
+mexpr_free(void *p){
+    mexpr_alloc_site_stats *s;
+    alloc_header *header;
+    mexpr_allocator *a;
+
+    if (p == NULL)
+	return;
+
+    header = (alloc_header *) p - 1;
+    a = &allocators[header->h.allocator];
+    s = &counters.sites[header->h.site];
+    __atomic_add_fetch(&s->frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->freed_bytes, header->h.size, __ATOMIC_RELAXED);
+
+    a->free_fn(header, a->ctx);
+}
+
+size_t
+mexpr_alloc_size(void *p){
+    return p == NULL ? 0 : ((alloc_header *) p - 1)->h.size;
+}
+
+const char *
+mexpr_alloc_site_name(mexpr_alloc_site site){
+    switch(site){
+	case MEXPR_ALLOC_LEXER:
+	    return "lexer";
+	case MEXPR_ALLOC_TREE:
+	    return "tree";
+	case MEXPR_ALLOC_RESULT:
+	    return "result";
+	case MEXPR_ALLOC_APPLICATION:
+	    return "application";
+	case MEXPR_ALLOC_RULES:
+	    return "rules";
+	case MEXPR_ALLOC_CODE:
+	    return "code";
+	case MEXPR_ALLOC_DATA:
+	    return "data";
+	case MEXPR_ALLOC_COUNTERS:
+	    return "counters";
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
+
+void
+mexpr_alloc_get_stats(mexpr_alloc_stats *stats){
+    mexpr_alloc_site_stats *s, *d;
+    int i;
+
+    for (i = 0; i < MEXPR_ALLOC_SITES; i++){
+	s = &counters.sites[i];
+	d = &stats->sites[i];
+	d->allocations = __atomic_load_n(&s->allocations, __ATOMIC_RELAXED);
+	d->frees = __atomic_load_n(&s->frees, __ATOMIC_RELAXED);
+	d->allocated_bytes = __atomic_load_n(&s->allocated_bytes,
+					     __ATOMIC_RELAXED);
+	d->freed_bytes = __atomic_load_n(&s->freed_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t
+mexpr_alloc_live_bytes(void){
+    mexpr_alloc_stats stats;
+    uint64_t live = 0;
+    int i;
+
+    mexpr_alloc_get_stats(&stats);
+    for (i = 0; i < MEXPR_ALLOC_SITES; i++)
+	live += stats.sites[i].allocated_bytes - stats.sites[i].freed_bytes;
+
+    return live;
+}
+
+void
+mexpr_alloc_report(FILE *fp){
+    mexpr_alloc_stats stats;
+    mexpr_alloc_site_stats *s;
+    int i;
+
+    mexpr_alloc_get_stats(&stats);
+
+    fprintf(fp, "%-12s %12s %12s %14s %12s\n", "site", "allocations",
+	    "frees", "bytes", "live bytes");
+    for (i = 0; i < MEXPR_ALLOC_SITES; i++){
+	s = &stats.sites[i];
+	fprintf(fp, "%-12s %12lu %12lu %14lu %12lu\n",
+		mexpr_alloc_site_name(i), (unsigned long) s->allocations,
+		(unsigned long) s->frees, (unsigned long) s->allocated_bytes,
+		(unsigned long) (s->allocated_bytes - s->freed_bytes));
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef __MEXPR_ALLOC__
+#define __MEXPR_ALLOC__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Memory of the library.
+ *
+ * The token strings of the lexer, the trees and their nodes, the
+ * results of operators, and the tables of the rule sets, the compiled
+ * forms of trees and the CSV tables are allocated through one
+ * allocator, malloc() and free() by default. Each allocation is
+ * counted for the site that requested it, so the live bytes of each
+ * site tell the footprint of the trees and the rules, and the bytes
+ * still live at the end are the leaked ones.
+ *
+ * The Stack and Linked-List libraries used by the conversions
+ * allocate by themselves and are not counted.
+ */
+typedef enum mexpr_alloc_site {
+    /* The token strings on the lex stack */
+    MEXPR_ALLOC_LEXER,
+
+    /* Trees, their nodes and the copies of names */
+    MEXPR_ALLOC_TREE,
+
+    /* The results of operators, allocated by the first evaluation */
+    MEXPR_ALLOC_RESULT,
+
+    /* The nodes of gen_null_tr_node() for the application */
+    MEXPR_ALLOC_APPLICATION,
+
+    /* Rule sets, rule networks and predicate indexes */
+    MEXPR_ALLOC_RULES,
+
+    /*
+     * The compiled forms and the analyses of trees : typed programs,
+     * threaded code, tiers, native code, decision diagrams, reorder
+     * plans, profiles and explanations
+     */
+    MEXPR_ALLOC_CODE,
+
+    /* CSV tables */
+    MEXPR_ALLOC_DATA,
+
+    /* The per-thread blocks of the statistics and the metrics */
+    MEXPR_ALLOC_COUNTERS,
+
+    MEXPR_ALLOC_SITES
+} mexpr_alloc_site;
+
+typedef struct mexpr_allocator {
+    void *(*malloc_fn)(size_t size, void *ctx);
+    void (*free_fn)(void *p, void *ctx);
+
+    /* Passed to the functions */
+    void *ctx;
+
+    /*
+     * Optional. Without it, the tables grow by malloc_fn(), a copy
+     * and free_fn().
+     */
+    void *(*realloc_fn)(void *p, size_t size, void *ctx);
+} mexpr_allocator;
+
+typedef struct mexpr_alloc_site_stats {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t allocated_bytes;
+    uint64_t freed_bytes;
+} mexpr_alloc_site_stats;
+
+typedef struct mexpr_alloc_stats {
+    mexpr_alloc_site_stats sites[MEXPR_ALLOC_SITES];
+} mexpr_alloc_stats;
+
+/* The number of different allocators set during the process */
+#define MEXPR_ALLOCATORS 16
+
+/*
+ * Replace the allocator for the later allocations, or restore
+ * malloc() and free() by NULL.
+ *
+ * The allocator is one for the process rather than per context,
+ * since the blocks move between the callers : rule sets keep the
+ * trees built by the parser, and the threads of a pool evaluate the
+ * trees of others. Instead, each block records the allocator that
+ * allocated it and is released and grown by it, so the allocator
+ * can be replaced at any time, even while other threads allocate.
+ * Up to MEXPR_ALLOCATORS different allocators can be set.
+ */
+void mexpr_set_allocator(const mexpr_allocator *allocator);
+
+/* Exit the process on allocation failure as the other modules do */
+void *mexpr_malloc(size_t size, mexpr_alloc_site site);
+void mexpr_free(void *p);
+
+/*
+ * realloc() of the blocks of mexpr_malloc(), or a new block when 'p'
+ * is NULL. Used for the own tables of the modules, whose bytes count
+ * for 'site'. Exit the process on failure too.
+ */
+void *mexpr_realloc(void *p, size_t size, mexpr_alloc_site site);
+
+/* strdup() of a block of mexpr_malloc() */
+char *mexpr_strdup(const char *s, mexpr_alloc_site site);
+
+/*
+ * realloc() of the programs around the library, such as the CLI and
+ * the benchmarks, which exits the process on failure. The blocks are
+ * not counted to any site and are freed by free().
+ */
+void *mexpr_xrealloc(void *p, size_t size);
+
+/* The requested size of the block of mexpr_malloc() */
+size_t mexpr_alloc_size(void *p);
+
+const char *mexpr_alloc_site_name(mexpr_alloc_site site);
+void mexpr_alloc_get_stats(mexpr_alloc_stats *stats);
+
+/* The bytes allocated and not freed yet, for all sites */
+uint64_t mexpr_alloc_live_bytes(void);
+
+/*
+ * Print the counters of each site. Called at the end of the process,
+ * the live bytes are the leaked ones.
+ */
+void mexpr_alloc_report(FILE *fp);
+
+#endif
@@ -0,0 +1,1046 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprProgram.h"
+#include "MexprPool.h"
+#include "MexprBatch.h"
+
+/*
+ * The number of rows evaluated by one pass over the program. The
+ * vectors of all instructions for one block should fit in cache.
+ */
+#define BATCH_BLOCK 1024
+#define VECTOR_ALIGN 64
+
+/*
+ * The kernels are plain loops without branches, which the compiler
+ * vectorizes with -O2 or higher. On x86-64 Linux with GCC, build an
+ * AVX2 clone in addition to the default SSE2 one and choose it at
+ * runtime if the CPU supports it.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define BATCH_KERNEL __attribute__((target_clones("avx2", "default")))
+#else
+#define BATCH_KERNEL
+#endif
+
+/* Shared among all blocks of one batch */
+typedef struct batch_plan {
+    tree *t;
+
+    /* NULL when the rows must be evaluated one by one */
+    typed_program *prog;
+
+    /* The binding of each variable of 'prog' */
+    const batch_binding **var_bindings;
+} batch_plan;
+
+/* Working memory to evaluate one block */
+typedef struct batch_scratch {
+    /* Vector of the results of each instruction */
+    void **vectors;
+
+    /* Storage of 'vectors'. Packed variables refer to the binding directly */
+    char *memory;
+
+    /* Rows that hit an error like zero division */
+    bool *failed;
+} batch_scratch;
+
+#define DEFINE_UNARY_KERNEL(name, T, R, expr)			\
+    static BATCH_KERNEL void					\
+    name(int m, const T *restrict l, R *restrict d){		\
+	int i;							\
+	for (i = 0; i < m; i++)					\
+	    d[i] = (expr);					\
+    }
+
+#define DEFINE_BINARY_KERNEL(name, T, R, expr)				\
+    static BATCH_KERNEL void						\
+    name(int m, const T *restrict l, const T *restrict r, R *restrict d){ \
+	int i;								\
+	for (i = 0; i < m; i++)						\
+	    d[i] = (expr);						\
+    }
+
+DEFINE_UNARY_KERNEL(int_to_double, int, double, (double) l[i])
+DEFINE_UNARY_KERNEL(sqr_int, int, int, l[i] * l[i])
+DEFINE_UNARY_KERNEL(sqr_double, double, double, l[i] * l[i])
+DEFINE_UNARY_KERNEL(sqrt_double, double, double, sqrt(l[i]))
+DEFINE_UNARY_KERNEL(sin_double, double, double, sin(l[i]))
+DEFINE_UNARY_KERNEL(cos_double, double, double, cos(l[i]))
+
+DEFINE_BINARY_KERNEL(plus_int, int, int, l[i] + r[i])
+DEFINE_BINARY_KERNEL(minus_int, int, int, l[i] - r[i])
+DEFINE_BINARY_KERNEL(multiply_int, int, int, l[i] * r[i])
+DEFINE_BINARY_KERNEL(min_int, int, int, l[i] < r[i] ? l[i] : r[i])
+DEFINE_BINARY_KERNEL(max_int, int, int, l[i] > r[i] ? l[i] : r[i])
+DEFINE_BINARY_KERNEL(plus_double, double, double, l[i] + r[i])
+DEFINE_BINARY_KERNEL(minus_double, double, double, l[i] - r[i])
+DEFINE_BINARY_KERNEL(multiply_double, double, double, l[i] * r[i])
+DEFINE_BINARY_KERNEL(min_double, double, double, l[i] < r[i] ? l[i] : r[i])
+DEFINE_BINARY_KERNEL(max_double, double, double, l[i] > r[i] ? l[i] : r[i])
+DEFINE_BINARY_KERNEL(pow_double, double, double, pow(l[i], r[i]))
+
+DEFINE_BINARY_KERNEL(ge_int, int, bool, l[i] >= r[i])
+DEFINE_BINARY_KERNEL(le_int, int, bool, l[i] <= r[i])
+DEFINE_BINARY_KERNEL(gt_int, int, bool, l[i] > r[i])
+DEFINE_BINARY_KERNEL(lt_int, int, bool, l[i] < r[i])
+DEFINE_BINARY_KERNEL(neq_int, int, bool, l[i] != r[i])
+DEFINE_BINARY_KERNEL(eq_int, int, bool, l[i] == r[i])
+DEFINE_BINARY_KERNEL(ge_double, double, bool, l[i] >= r[i])
+DEFINE_BINARY_KERNEL(le_double, double, bool, l[i] <= r[i])
+DEFINE_BINARY_KERNEL(gt_double, double, bool, l[i] > r[i])
+DEFINE_BINARY_KERNEL(lt_double, double, bool, l[i] < r[i])
+DEFINE_BINARY_KERNEL(neq_double, double, bool, l[i] != r[i])
+DEFINE_BINARY_KERNEL(eq_double, double, bool, l[i] == r[i])
+
+DEFINE_BINARY_KERNEL(and_bool, bool, bool, l[i] & r[i])
+DEFINE_BINARY_KERNEL(or_bool, bool, bool, l[i] | r[i])
+
+/*
+ * Division and modulo fail for zero divisor. The divisor of the
+ * failed rows is replaced by one to avoid the trap of integer
+ * division.
+ */
+static BATCH_KERNEL void
+divide_int(int m, const int *restrict l, const int *restrict r,
+	   int *restrict d, bool *restrict failed){
+    int i;
+
+    for (i = 0; i < m; i++){
+	failed[i] |= r[i] == 0;
+	d[i] = l[i] / (r[i] == 0 ? 1 : r[i]);
+    }
+}
+
+static BATCH_KERNEL void
+mod_int(int m, const int *restrict l, const int *restrict r,
+	int *restrict d, bool *restrict failed){
+    int i;
+
+    for (i = 0; i < m; i++){
+	failed[i] |= r[i] == 0;
+	d[i] = l[i] % (r[i] == 0 ? 1 : r[i]);
+    }
+}
+
+static BATCH_KERNEL void
+divide_double(int m, const double *restrict l, const double *restrict r,
+	      double *restrict d, bool *restrict failed){
+    int i;
+
+    for (i = 0; i < m; i++){
+	failed[i] |= r[i] == 0.0;
+	d[i] = l[i] / r[i];
+    }
+}
+
+static BATCH_KERNEL void
+mod_double(int m, const double *restrict l, const double *restrict r,
+	   double *restrict d, bool *restrict failed){
+    int i;
+
+    for (i = 0; i < m; i++){
+	failed[i] |= r[i] == 0.0;
+	d[i] = fmod(l[i], r[i]);
+    }
+}
+
+static size_t
+type_size(int type){
+    switch(type){
+	case INT:
+	    return sizeof(int);
+	case DOUBLE:
+	    return sizeof(double);
+	case BOOLEAN:
+	    return sizeof(bool);
+	default:
+	    assert(0);
+	    return 0;
+    }
+}
+
+static const batch_binding *
+find_binding(batch_binding *bindings, char *vname){
+    batch_binding *b;
+
+    for (b = bindings; b->vname != NULL; b++){
+	if (strcmp(b->vname, vname) == 0)
+	    return b;
+    }
+
+    return NULL;
+}
+
+/* Callback for compile_typed_program() */
+static int
+binding_type_cb(char *vname, void *data){
+    const batch_binding *b = find_binding((batch_binding *) data, vname);
+
+    return b == NULL ? INVALID : b->type;
+}
+
+static const void *
+binding_row(const batch_binding *b, size_t row){
+    size_t stride = b->stride == 0 ? type_size(b->type) : b->stride;
+
+    return (const char *) b->values + row * stride;
+}
+
+static void
+load_tr_node(const batch_binding *b, size_t row, tr_node *n){
+    const void *p = binding_row(b, row);
+
+    n->node_id = b->type;
+    switch(b->type){
+	case INT:
+	    n->unv.ival = *(const int *) p;
+	    break;
+	case DOUBLE:
+	    n->unv.dval = *(const double *) p;
+	    break;
+	case BOOLEAN:
+	    n->unv.bval = *(const bool *) p;
+	    break;
+	default:
+	    assert(0);
+	    break;
+    }
+}
+
+static void
+store_batch_value(int type, const void *vec, int i, batch_value *out){
+    out->node_id = type;
+    switch(type){
+	case INT:
+	    out->unv.ival = ((const int *) vec)[i];
+	    break;
+	case DOUBLE:
+	    out->unv.dval = ((const double *) vec)[i];
+	    break;
+	case BOOLEAN:
+	    out->unv.bval = ((const bool *) vec)[i];
+	    break;
+	default:
+	    assert(0);
+	    break;
+    }
+}
+
+/*
+ * Return false if any variable of the tree has no binding. When the
+ * result type depends on the values, 'plan->prog' is set to NULL.
+ */
+static bool
+prepare_batch_plan(batch_plan *plan, tree *t, batch_binding *bindings){
+    tr_node *n;
+    int i;
+
+    plan->t = t;
+    plan->prog = NULL;
+    plan->var_bindings = NULL;
+
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id == VARIABLE &&
+	    find_binding(bindings, n->unv.vval.vname) == NULL){
+	    fprintf(stderr, "variable '%s' has no binding\n",
+		    n->unv.vval.vname);
+	    return false;
+	}
+    }
+
+    if ((plan->prog = compile_typed_program(t, binding_type_cb,
+					    bindings)) == NULL)
+	return true;
+
+    plan->var_bindings = (const batch_binding **)
+	malloc(sizeof(batch_binding *) * (plan->prog->nvars + 1));
+    if (plan->var_bindings == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    for (i = 0; i < plan->prog->nvars; i++)
+	plan->var_bindings[i] = find_binding(bindings,
+					     plan->prog->vars[i].vname);
+
+    return true;
+}
+
+static void
+release_batch_plan(batch_plan *plan){
+    if (plan->prog != NULL)
+	destroy_typed_program(plan->prog);
+    free(plan->var_bindings);
+}
+
+static void
+init_batch_scratch(batch_plan *plan, batch_scratch *scratch){
+    typed_program *prog = plan->prog;
+    size_t vector_len = BATCH_BLOCK * sizeof(double);
+    typed_inst *inst;
+    int i, j;
+
+    scratch->vectors = (void **) malloc(sizeof(void *) * prog->ninsts);
+    scratch->failed = (bool *) malloc(sizeof(bool) * BATCH_BLOCK);
+    if (scratch->vectors == NULL || scratch->failed == NULL ||
+	posix_memalign((void **) &scratch->memory, VECTOR_ALIGN,
+		       vector_len * prog->ninsts) != 0){
+	perror("malloc");
+	exit(-1);
+    }
+
+    for (i = 0; i < prog->ninsts; i++){
+	inst = &prog->insts[i];
+	scratch->vectors[i] = scratch->memory + vector_len * i;
+
+	/* Constants never change among blocks */
+	for (j = 0; j < BATCH_BLOCK; j++){
+	    switch(inst->opcode){
+		case INT:
+		    ((int *) scratch->vectors[i])[j] = inst->imm.ival;
+		    break;
+		case DOUBLE:
+		    ((double *) scratch->vectors[i])[j] = inst->imm.dval;
+		    break;
+		case BOOLEAN:
+		    ((bool *) scratch->vectors[i])[j] = inst->imm.bval;
+		    break;
+		default:
+		    break;
+	    }
+	}
+    }
+}
+
+static void
+release_batch_scratch(batch_scratch *scratch){
+    free(scratch->vectors);
+    free(scratch->memory);
+    free(scratch->failed);
+}
+
+/*
+ * Set the vector of VARIABLE to the rows [base, base + m). Packed
+ * arrays are referred in place. Others are gathered to the scratch.
+ */
+static void
+load_variable(batch_plan *plan, batch_scratch *scratch, int idx,
+	      size_t base, int m){
+    typed_inst *inst = &plan->prog->insts[idx];
+    const batch_binding *b = plan->var_bindings[inst->var];
+    size_t size = type_size(b->type);
+    char *dst;
+    int i;
+
+    if (b->stride == 0 || b->stride == size){
+	scratch->vectors[idx] = (void *) binding_row(b, base);
+	return;
+    }
+
+    dst = scratch->memory + BATCH_BLOCK * sizeof(double) * idx;
+    for (i = 0; i < m; i++)
+	memcpy(dst + size * i, binding_row(b, base + i), size);
+    scratch->vectors[idx] = dst;
+}
+
+static void
+run_inst(typed_program *prog, int idx, batch_scratch *scratch, int m){
+    typed_inst *inst = &prog->insts[idx];
+    void **vec = scratch->vectors, *d = vec[idx];
+    void *l = inst->left >= 0 ? vec[inst->left] : NULL;
+    void *r = inst->right >= 0 ? vec[inst->right] : NULL;
+    bool int_operands = inst->left >= 0 &&
+	prog->insts[inst->left].type == INT;
+
+    switch(inst->opcode){
+	case INT_TO_DOUBLE:
+	    int_to_double(m, l, d);
+	    break;
+	case SQR:
+	    if (inst->type == INT)
+		sqr_int(m, l, d);
+	    else
+		sqr_double(m, l, d);
+	    break;
+	case SQRT:
+	    sqrt_double(m, l, d);
+	    break;
+	case SIN:
+	    sin_double(m, l, d);
+	    break;
+	case COS:
+	    cos_double(m, l, d);
+	    break;
+	case PLUS:
+	    if (int_operands)
+		plus_int(m, l, r, d);
+	    else
+		plus_double(m, l, r, d);
+	    break;
+	case MINUS:
+	    if (int_operands)
+		minus_int(m, l, r, d);
+	    else
+		minus_double(m, l, r, d);
+	    break;
+	case MULTIPLY:
+	    if (int_operands)
+		multiply_int(m, l, r, d);
+	    else
+		multiply_double(m, l, r, d);
+	    break;
+	case DIVIDE:
+	    if (int_operands)
+		divide_int(m, l, r, d, scratch->failed);
+	    else
+		divide_double(m, l, r, d, scratch->failed);
+	    break;
+	case MOD:
+	    if (int_operands)
+		mod_int(m, l, r, d, scratch->failed);
+	    else
+		mod_double(m, l, r, d, scratch->failed);
+	    break;
+	case MIN:
+	    if (int_operands)
+		min_int(m, l, r, d);
+	    else
+		min_double(m, l, r, d);
+	    break;
+	case MAX:
+	    if (int_operands)
+		max_int(m, l, r, d);
+	    else
+		max_double(m, l, r, d);
+	    break;
+	case POW:
+	    pow_double(m, l, r, d);
+	    break;
+	case GREATER_THAN_OR_EQUAL_TO:
+	    if (int_operands)
+		ge_int(m, l, r, d);
+	    else
+		ge_double(m, l, r, d);
+	    break;
+	case LESS_THAN_OR_EQUAL_TO:
+	    if (int_operands)
+		le_int(m, l, r, d);
+	    else
+		le_double(m, l, r, d);
+	    break;
+	case GREATER_THAN:
+	    if (int_operands)
+		gt_int(m, l, r, d);
+	    else
+		gt_double(m, l, r, d);
+	    break;
+	case LESS_THAN:
+	    if (int_operands)
+		lt_int(m, l, r, d);
+	    else
+		lt_double(m, l, r, d);
+	    break;
+	case NEQ:
+	    if (int_operands)
+		neq_int(m, l, r, d);
+	    else
+		neq_double(m, l, r, d);
+	    break;
+	case EQ:
+	    if (int_operands)
+		eq_int(m, l, r, d);
+	    else
+		eq_double(m, l, r, d);
+	    break;
+	case AND:
+	    and_bool(m, l, r, d);
+	    break;
+	case OR:
+	    or_bool(m, l, r, d);
+	    break;
+	default:
+	    assert(0);
+	    break;
+    }
+}
+
+/* Evaluate the rows [base, base + m) and write the results to 'out' */
+static void
+run_batch_block(batch_plan *plan, batch_scratch *scratch,
+		size_t base, int m, batch_value *out){
+    typed_program *prog = plan->prog;
+    typed_inst *inst;
+    int i, root = prog->ninsts - 1;
+
+    memset(scratch->failed, 0, sizeof(bool) * m);
+
+    for (i = 0; i < prog->ninsts; i++){
+	inst = &prog->insts[i];
+	switch(inst->opcode){
+	    case INT:
+	    case DOUBLE:
+	    case BOOLEAN:
+		break;
+	    case VARIABLE:
+		load_variable(plan, scratch, i, base, m);
+		break;
+	    default:
+		run_inst(prog, i, scratch, m);
+		break;
+	}
+    }
+
+    for (i = 0; i < m; i++){
+	if (scratch->failed[i])
+	    out[i].node_id = INVALID;
+	else
+	    store_batch_value(prog->insts[root].type,
+			      scratch->vectors[root], i, &out[i]);
+    }
+}
+
+/*
+ * Evaluate the rows one by one with evaluate_node(). This is used
+ * when the result type of the tree depends on the values.
+ *
+ * The VARIABLE nodes temporarily refer to the values of bindings.
+ * The original resolution is restored at the end.
+ */
+static void
+evaluate_rows_by_tree(tree *t, size_t begin, size_t end,
+		      batch_binding *bindings, batch_value *out){
+    const batch_binding **leaf_bindings;
+    bool saved_resolved = t->resolved;
+    tr_node **saved_vdata, *values, *n, *result;
+    int nleaves = 0, i;
+    size_t row;
+
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id == VARIABLE)
+	    nleaves++;
+    }
+
+    leaf_bindings = (const batch_binding **)
+	malloc(sizeof(batch_binding *) * (nleaves + 1));
+    saved_vdata = (tr_node **) malloc(sizeof(tr_node *) * (nleaves + 1));
+    values = (tr_node *) malloc(sizeof(tr_node) * (nleaves + 1));
+    if (leaf_bindings == NULL || saved_vdata == NULL || values == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    i = 0;
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id != VARIABLE)
+	    continue;
+	leaf_bindings[i] = find_binding(bindings, n->unv.vval.vname);
+	saved_vdata[i] = n->unv.vval.vdata;
+	n->unv.vval.vdata = &values[i];
+	i++;
+    }
+    t->resolved = true;
+
+    /* The results of operators don't belong to the original values */
+    t->values_cached = false;
+
+    for (row = begin; row < end; row++){
+	for (i = 0; i < nleaves; i++)
+	    load_tr_node(leaf_bindings[i], row, &values[i]);
+
+	t->computation_failed = false;
+	t->error = MEXPR_OK;
+	t->evaluated_nodes = 0;
+	result = evaluate_node(t->root, t);
+
+	if (t->computation_failed){
+	    out[row - begin].node_id = INVALID;
+	    continue;
+	}
+
+	out[row - begin].node_id = result->node_id;
+	switch(result->node_id){
+	    case INT:
+		out[row - begin].unv.ival = result->unv.ival;
+		break;
+	    case DOUBLE:
+		out[row - begin].unv.dval = result->unv.dval;
+		break;
+	    case BOOLEAN:
+		out[row - begin].unv.bval = result->unv.bval;
+		break;
+	    default:
+		assert(0);
+		break;
+	}
+    }
+
+    i = 0;
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id == VARIABLE)
+	    n->unv.vval.vdata = saved_vdata[i++];
+    }
+    t->resolved = saved_resolved;
+    t->computation_failed = false;
+    t->error = MEXPR_OK;
+
+    free(leaf_bindings);
+    free(saved_vdata);
+    free(values);
+}
+
+static void
+evaluate_batch_range(batch_plan *plan, batch_scratch *scratch,
+		     size_t begin, size_t end, batch_value *out){
+    size_t base, i;
+    int m;
+
+    if (plan->prog->type_error){
+	for (i = begin; i < end; i++)
+	    out[i - begin].node_id = INVALID;
+	return;
+    }
+
+    for (base = begin; base < end; base += BATCH_BLOCK){
+	m = end - base < BATCH_BLOCK ? end - base : BATCH_BLOCK;
+	run_batch_block(plan, scratch, base, m, out + (base - begin));
+    }
+}
+
+/*
+ * Parallel evaluation splits the rows into tasks of PARALLEL_CHUNK
+ * rows, which is a multiple of BATCH_BLOCK and FILTER_WORD_BITS.
+ * Each task writes its own slice of the output, so that the results
+ * come out in row order. Each worker has its own scratch.
+ */
+#define PARALLEL_CHUNK (64 * BATCH_BLOCK)
+
+typedef struct batch_job {
+    batch_plan *plan;
+    size_t n;
+
+    /* Indexed by worker */
+    batch_scratch *scratches;
+    struct filter_state *filters;
+
+    batch_value *out;
+    uint64_t *bitmap;
+} batch_job;
+
+static int
+job_workers(mexpr_pool *pool){
+    return pool == NULL ? 1 : mexpr_pool_size(pool);
+}
+
+/* Run the tasks on the pool, or on the current thread without pool */
+static void
+run_batch_job(mexpr_pool *pool, batch_job *job, mexpr_task task){
+    size_t ntasks = (job->n + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, i;
+
+    if (pool == NULL){
+	for (i = 0; i < ntasks; i++)
+	    task(i, 0, job);
+	return;
+    }
+
+    mexpr_pool_run(pool, ntasks, task, job);
+}
+
+static void
+batch_task(size_t index, int worker, void *arg){
+    batch_job *job = (batch_job *) arg;
+    size_t begin = index * PARALLEL_CHUNK;
+    size_t end = job->n - begin < PARALLEL_CHUNK ?
+	job->n : begin + PARALLEL_CHUNK;
+
+    evaluate_batch_range(job->plan, &job->scratches[worker],
+			 begin, end, job->out + begin);
+}
+
+/*
+ * Evaluate the tree for 'n' rows and write the result of each row
+ * to 'out', which must have 'n' elements.
+ *
+ * 'bindings' is terminated by the element whose 'vname' is NULL and
+ * must bind all the variables of the tree. The results are the same
+ * as the ones of evaluate_tree() for each row. The rows that fail
+ * the evaluation get INVALID.
+ *
+ * Return false if any variable has no binding.
+ */
+bool
+evaluate_batch(tree *t, size_t n, batch_binding *bindings,
+	       batch_value *out){
+    return evaluate_batch_parallel(t, n, bindings, out, NULL);
+}
+
+/*
+ * Same as evaluate_batch() but split the rows among the workers of
+ * 'pool'. The trees whose result type depends on the values are
+ * evaluated by the current thread, because evaluate_node() writes
+ * the results to the tree.
+ */
+bool
+evaluate_batch_parallel(tree *t, size_t n, batch_binding *bindings,
+			batch_value *out, mexpr_pool *pool){
+    batch_plan plan;
+    batch_job job;
+    int i;
+
+    assert(t != NULL && bindings != NULL);
+
+    if (!prepare_batch_plan(&plan, t, bindings))
+	return false;
+
+    if (plan.prog == NULL){
+	evaluate_rows_by_tree(t, 0, n, bindings, out);
+	return true;
+    }
+
+    job.plan = &plan;
+    job.n = n;
+    job.out = out;
+    job.bitmap = NULL;
+    job.filters = NULL;
+    if ((job.scratches = (batch_scratch *)
+	 malloc(sizeof(batch_scratch) * job_workers(pool))) == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+    for (i = 0; i < job_workers(pool); i++)
+	init_batch_scratch(&plan, &job.scratches[i]);
+
+    run_batch_job(pool, &job, batch_task);
+
+    for (i = 0; i < job_workers(pool); i++)
+	release_batch_scratch(&job.scratches[i]);
+    free(job.scratches);
+    release_batch_plan(&plan);
+
+    return true;
+}
+
+/*
+ * Filter evaluation.
+ *
+ * The predicate is evaluated into bitmaps of BATCH_BLOCK rows. The
+ * operands of 'and' and 'or' are evaluated only for the rows whose
+ * result is not decided yet : the right operand of 'and' gets the
+ * rows where the left one is true, and the right operand of 'or'
+ * gets the rows where the left one is false. When the selection is
+ * sparse, the variables are gathered to compact vectors, so that
+ * the kernels only touch the surviving rows.
+ */
+#define FILTER_WORDS (BATCH_BLOCK / FILTER_WORD_BITS)
+
+typedef struct filter_state {
+    batch_plan *plan;
+    batch_scratch *scratch;
+
+    /* The first instruction of the subtree of each instruction */
+    int *first;
+
+    /* The current block */
+    size_t base;
+    int m;
+
+    /* Offsets of the selected rows in the block */
+    unsigned short sel[BATCH_BLOCK];
+} filter_state;
+
+static int
+select_rows(const uint64_t *bits, int m, unsigned short *sel){
+    int w, nsel = 0;
+    uint64_t word;
+
+    for (w = 0; w * FILTER_WORD_BITS < m; w++){
+	for (word = bits[w]; word != 0; word &= word - 1)
+	    sel[nsel++] = w * FILTER_WORD_BITS + __builtin_ctzll(word);
+    }
+
+    return nsel;
+}
+
+static void
+load_selected_variable(filter_state *fs, int idx, int nsel){
+    typed_inst *inst = &fs->plan->prog->insts[idx];
+    const batch_binding *b = fs->plan->var_bindings[inst->var];
+    size_t size = type_size(b->type);
+    char *dst;
+    int k;
+
+    dst = fs->scratch->memory + BATCH_BLOCK * sizeof(double) * idx;
+    for (k = 0; k < nsel; k++)
+	memcpy(dst + size * k, binding_row(b, fs->base + fs->sel[k]), size);
+    fs->scratch->vectors[idx] = dst;
+}
+
+/*
+ * Evaluate the subtree of BOOLEAN instruction 'idx' other than 'and'
+ * and 'or' for the rows selected by 'in'.
+ */
+static void
+filter_predicate(filter_state *fs, int idx, const uint64_t *in,
+		 uint64_t *out, uint64_t *failed){
+    typed_program *prog = fs->plan->prog;
+    batch_scratch *scratch = fs->scratch;
+    int i, k, nsel;
+    bool dense;
+    bool *v;
+
+    memset(out, 0, sizeof(uint64_t) * FILTER_WORDS);
+    memset(failed, 0, sizeof(uint64_t) * FILTER_WORDS);
+
+    if ((nsel = select_rows(in, fs->m, fs->sel)) == 0)
+	return;
+    dense = nsel == fs->m;
+
+    memset(scratch->failed, 0, sizeof(bool) * nsel);
+    for (i = fs->first[idx]; i <= idx; i++){
+	switch(prog->insts[i].opcode){
+	    case INT:
+	    case DOUBLE:
+	    case BOOLEAN:
+		break;
+	    case VARIABLE:
+		if (dense)
+		    load_variable(fs->plan, scratch, i, fs->base, nsel);
+		else
+		    load_selected_variable(fs, i, nsel);
+		break;
+	    default:
+		run_inst(prog, i, scratch, nsel);
+		break;
+	}
+    }
+
+    v = (bool *) scratch->vectors[idx];
+    for (k = 0; k < nsel; k++){
+	int row = fs->sel[k];
+
+	out[row / FILTER_WORD_BITS] |=
+	    (uint64_t) (v[k] & !scratch->failed[k]) << (row % FILTER_WORD_BITS);
+	failed[row / FILTER_WORD_BITS] |=
+	    (uint64_t) scratch->failed[k] << (row % FILTER_WORD_BITS);
+    }
+}
+
+/*
+ * Set 'out' to the selected rows where the subtree of 'idx' is true
+ * and 'failed' to the ones where its evaluation fails.
+ */
+static void
+filter_node(filter_state *fs, int idx, const uint64_t *in,
+	    uint64_t *out, uint64_t *failed){
+    typed_inst *inst = &fs->plan->prog->insts[idx];
+    uint64_t left[FILTER_WORDS], left_failed[FILTER_WORDS];
+    uint64_t rest[FILTER_WORDS];
+    int w;
+
+    switch(inst->opcode){
+	case AND:
+	    filter_node(fs, inst->left, in, left, left_failed);
+	    filter_node(fs, inst->right, left, out, failed);
+	    for (w = 0; w < FILTER_WORDS; w++)
+		failed[w] |= left_failed[w];
+	    break;
+	case OR:
+	    filter_node(fs, inst->left, in, left, left_failed);
+	    for (w = 0; w < FILTER_WORDS; w++)
+		rest[w] = in[w] & ~left[w] & ~left_failed[w];
+	    filter_node(fs, inst->right, rest, out, failed);
+	    for (w = 0; w < FILTER_WORDS; w++){
+		out[w] |= left[w];
+		failed[w] |= left_failed[w];
+	    }
+	    break;
+	default:
+	    filter_predicate(fs, idx, in, out, failed);
+	    break;
+    }
+}
+
+static void
+filter_block(filter_state *fs, size_t base, int m, uint64_t *bitmap){
+    uint64_t in[FILTER_WORDS], out[FILTER_WORDS], failed[FILTER_WORDS];
+    int w;
+
+    fs->base = base;
+    fs->m = m;
+
+    memset(in, 0, sizeof(in));
+    for (w = 0; w < m / FILTER_WORD_BITS; w++)
+	in[w] = ~(uint64_t) 0;
+    if (m % FILTER_WORD_BITS != 0)
+	in[w] = ((uint64_t) 1 << (m % FILTER_WORD_BITS)) - 1;
+
+    filter_node(fs, fs->plan->prog->ninsts - 1, in, out, failed);
+    memcpy(bitmap, out, sizeof(uint64_t) * FILTER_BITMAP_WORDS(m));
+}
+
+/* Filter the rows with evaluate_rows_by_tree() */
+static void
+filter_rows_by_tree(tree *t, size_t n, batch_binding *bindings,
+		    uint64_t *bitmap){
+    batch_value values[BATCH_BLOCK];
+    size_t base;
+    int i, m;
+
+    for (base = 0; base < n; base += BATCH_BLOCK){
+	m = n - base < BATCH_BLOCK ? n - base : BATCH_BLOCK;
+	evaluate_rows_by_tree(t, base, base + m, bindings, values);
+	for (i = 0; i < m; i++){
+	    if (values[i].node_id == BOOLEAN && values[i].unv.bval)
+		bitmap[(base + i) / FILTER_WORD_BITS] |=
+		    (uint64_t) 1 << ((base + i) % FILTER_WORD_BITS);
+	}
+    }
+}
+
+static void
+filter_task(size_t index, int worker, void *arg){
+    batch_job *job = (batch_job *) arg;
+    size_t begin = index * PARALLEL_CHUNK, base;
+    size_t end = job->n - begin < PARALLEL_CHUNK ?
+	job->n : begin + PARALLEL_CHUNK;
+    int m;
+
+    for (base = begin; base < end; base += BATCH_BLOCK){
+	m = end - base < BATCH_BLOCK ? end - base : BATCH_BLOCK;
+	filter_block(&job->filters[worker], base, m,
+		     job->bitmap + base / FILTER_WORD_BITS);
+    }
+}
+
+/*
+ * Evaluate the predicate tree for 'n' rows as a filter. Set the bit
+ * of 'bitmap' for each row where the predicate is true. 'bitmap'
+ * must have FILTER_BITMAP_WORDS(n) words.
+ *
+ * 'and' and 'or' skip the right operand for the rows decided by the
+ * left one. Other than that, the result of each row is the same as
+ * evaluate_tree() : the rows that fail the evaluation don't match.
+ *
+ * Return false if any variable has no binding or the tree is not
+ * a predicate.
+ */
+bool
+evaluate_filter(tree *t, size_t n, batch_binding *bindings,
+		uint64_t *bitmap){
+    return evaluate_filter_parallel(t, n, bindings, bitmap, NULL);
+}
+
+/*
+ * A comparison or a logical operator at the root is a predicate even
+ * when its operands have type errors, which fail the rows as in
+ * evaluate_tree(). Otherwise, the result must be BOOLEAN.
+ */
+static bool
+is_predicate(tree *t, typed_program *prog){
+    switch(t->root->node_id){
+	case GREATER_THAN_OR_EQUAL_TO:
+	case LESS_THAN_OR_EQUAL_TO:
+	case GREATER_THAN:
+	case LESS_THAN:
+	case NEQ:
+	case EQ:
+	case AND:
+	case OR:
+	    return true;
+	default:
+	    return prog->insts[prog->ninsts - 1].type == BOOLEAN;
+    }
+}
+
+/* Same as evaluate_filter() but split the rows among the workers */
+bool
+evaluate_filter_parallel(tree *t, size_t n, batch_binding *bindings,
+			 uint64_t *bitmap, mexpr_pool *pool){
+    int i, nworkers = job_workers(pool), *first;
+    batch_plan plan;
+    batch_job job;
+
+    assert(t != NULL && bindings != NULL);
+
+    if (!prepare_batch_plan(&plan, t, bindings))
+	return false;
+
+    memset(bitmap, 0, sizeof(uint64_t) * FILTER_BITMAP_WORDS(n));
+
+    if (plan.prog == NULL){
+	filter_rows_by_tree(t, n, bindings, bitmap);
+	return true;
+    }
+
+    if (!is_predicate(t, plan.prog)){
+	fprintf(stderr, "the expression is not a predicate\n");
+	release_batch_plan(&plan);
+	return false;
+    }
+
+    if (plan.prog->type_error){
+	release_batch_plan(&plan);
+	return true;
+    }
+
+    if ((first = (int *) malloc(sizeof(int) * plan.prog->ninsts)) == NULL ||
+	(job.scratches = (batch_scratch *)
+	 malloc(sizeof(batch_scratch) * nworkers)) == NULL ||
+	(job.filters = (filter_state *)
+	 malloc(sizeof(filter_state) * nworkers)) == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    /* Postorder places the subtree just before its root */
+    for (i = 0; i < plan.prog->ninsts; i++){
+	typed_inst *inst = &plan.prog->insts[i];
+
+	first[i] = inst->left >= 0 ? first[inst->left] : i;
+    }
+
+    for (i = 0; i < nworkers; i++){
+	init_batch_scratch(&plan, &job.scratches[i]);
+	job.filters[i].plan = &plan;
+	job.filters[i].scratch = &job.scratches[i];
+	job.filters[i].first = first;
+    }
+
+    job.plan = &plan;
+    job.n = n;
+    job.out = NULL;
+    job.bitmap = bitmap;
+    run_batch_job(pool, &job, filter_task);
+
+    for (i = 0; i < nworkers; i++)
+	release_batch_scratch(&job.scratches[i]);
+    free(job.scratches);
+    free(job.filters);
+    free(first);
+    release_batch_plan(&plan);
+
+    return true;
+}
+
+/*
+ * Write the row numbers set in the bitmap of 'n' rows to 'rows' in
+ * ascending order. Return the number of them.
+ */
+size_t
+filter_bitmap_to_rows(const uint64_t *bitmap, size_t n, size_t *rows){
+    size_t w, nrows = 0;
+    uint64_t word;
+
+    for (w = 0; w < FILTER_BITMAP_WORDS(n); w++){
+	for (word = bitmap[w]; word != 0; word &= word - 1)
+	    rows[nrows++] = w * FILTER_WORD_BITS + __builtin_ctzll(word);
+    }
+
+    return nrows;
+}
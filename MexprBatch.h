@@ -0,0 +1,63 @@
+#ifndef __MEXPR_BATCH__
+#define __MEXPR_BATCH__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "MexprTree.h"
+#include "MexprPool.h"
+
+/*
+ * Evaluate one tree for many rows at once.
+ *
+ * Each variable is bound to a contiguous typed array instead of
+ * being resolved by the application callback. The rows are
+ * processed by blocks, and each operator runs as one loop over
+ * the block, which the compiler can vectorize.
+ */
+
+typedef struct batch_binding {
+    /* Variable name. NULL terminates the array of bindings */
+    char *vname;
+
+    /* INT, DOUBLE or BOOLEAN */
+    int type;
+
+    /* int *, double * or bool * pointing to the value of the first row */
+    const void *values;
+
+    /* Bytes between the values of two rows. 0 means the size of type */
+    size_t stride;
+} batch_binding;
+
+typedef struct batch_value {
+    /* INT, DOUBLE, BOOLEAN or INVALID if the evaluation failed */
+    int node_id;
+
+    union {
+	int ival;
+	double dval;
+	bool bval;
+    } unv;
+} batch_value;
+
+bool evaluate_batch(tree *t, size_t n, batch_binding *bindings,
+		    batch_value *out);
+bool evaluate_batch_parallel(tree *t, size_t n, batch_binding *bindings,
+			     batch_value *out, mexpr_pool *pool);
+
+/*
+ * Filter evaluation of predicates built by the inequality or logical
+ * parser. The matching rows are set in a bitmap whose bit 'i' is
+ * the bit (i % 64) of the word (i / 64).
+ */
+#define FILTER_WORD_BITS 64
+#define FILTER_BITMAP_WORDS(n) (((n) + FILTER_WORD_BITS - 1) / FILTER_WORD_BITS)
+
+bool evaluate_filter(tree *t, size_t n, batch_binding *bindings,
+		     uint64_t *bitmap);
+bool evaluate_filter_parallel(tree *t, size_t n, batch_binding *bindings,
+			      uint64_t *bitmap, mexpr_pool *pool);
+size_t filter_bitmap_to_rows(const uint64_t *bitmap, size_t n, size_t *rows);
+
+#endif
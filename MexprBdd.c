@@ -0,0 +1,496 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+#include "MexprAlloc.h"
+#include "MexprBdd.h"
+
+/* The terminals */
+#define BDD_FALSE 0
+#define BDD_TRUE 1
+
+/* The number of entries of the cache of apply(). Power of two */
+#define BDD_CACHE_SIZE 4096
+
+typedef struct bdd_node {
+    /* The index of the atom, ordered from the root */
+    int var;
+    int low;
+    int high;
+} bdd_node;
+
+typedef struct bdd_cache_entry {
+    int op;
+    int left;
+    int right;
+    int result;
+} bdd_cache_entry;
+
+typedef struct bdd_atom {
+    tr_node *root;
+
+    /* True when it can fail by zero division */
+    bool divides;
+
+    /* The evaluation that evaluated the atom last */
+    unsigned long epoch;
+} bdd_atom;
+
+struct bdd_tree {
+    tree *t;
+    int max_nodes;
+
+    int natoms;
+    bdd_atom *atoms;
+
+    /* The atoms that can fail by zero division */
+    int ndividing;
+    int *dividing;
+
+    int nnodes;
+    bdd_node *nodes;
+    int root;
+
+    /* Open addressing table of (var, low, high) to the node index */
+    int *unique;
+    int unique_size;
+
+    bdd_cache_entry *cache;
+
+    /* The VARIABLE leaves and their types of the last check */
+    int nvars;
+    tr_node **var_nodes;
+    int *var_types;
+    bool types_checked;
+    bool type_error;
+
+    unsigned long epoch;
+};
+
+static bool
+has_division(tr_node *n){
+    if (n == NULL)
+	return false;
+
+    if ((n->node_id == DIVIDE || n->node_id == MOD) &&
+	!tree_is_nonzero_constant(n->right))
+	return true;
+
+    return has_division(n->left) || has_division(n->right);
+}
+
+/* Return the index of the atom, adding it if it's new */
+static int
+find_atom(bdd_tree *bt, tr_node *n){
+    int i;
+
+    for (i = 0; i < bt->natoms; i++)
+	if (tree_same_subtree(bt->atoms[i].root, n))
+	    return i;
+
+    bt->atoms = (bdd_atom *) mexpr_realloc(bt->atoms,
+					   sizeof(bdd_atom) * (bt->natoms + 1),
+					   MEXPR_ALLOC_CODE);
+    bt->atoms[i].root = n;
+    bt->atoms[i].divides = has_division(n);
+    bt->atoms[i].epoch = 0;
+
+    if (bt->atoms[i].divides){
+	bt->dividing = (int *) mexpr_realloc(bt->dividing,
+					     sizeof(int) * (bt->ndividing + 1),
+					     MEXPR_ALLOC_CODE);
+	bt->dividing[bt->ndividing++] = i;
+    }
+
+    return bt->natoms++;
+}
+
+static unsigned int
+hash_triple(int a, int b, int c){
+    uint32_t h = 2166136261u;
+
+    h = (h ^ (uint32_t) a) * 16777619u;
+    h = (h ^ (uint32_t) b) * 16777619u;
+    h = (h ^ (uint32_t) c) * 16777619u;
+
+    return h;
+}
+
+static void
+unique_insert(bdd_tree *bt, int index){
+    bdd_node *n = &bt->nodes[index];
+    unsigned int h = hash_triple(n->var, n->low, n->high);
+    int mask = bt->unique_size - 1, i;
+
+    for (i = h & mask; bt->unique[i] >= 0; i = (i + 1) & mask)
+	;
+    bt->unique[i] = index;
+}
+
+static void
+unique_grow(bdd_tree *bt){
+    int i;
+
+    bt->unique_size = bt->unique_size == 0 ? 64 : bt->unique_size * 2;
+    bt->unique = (int *) mexpr_realloc(bt->unique,
+				       sizeof(int) * bt->unique_size,
+				       MEXPR_ALLOC_CODE);
+    for (i = 0; i < bt->unique_size; i++)
+	bt->unique[i] = -1;
+    for (i = 2; i < bt->nnodes; i++)
+	unique_insert(bt, i);
+}
+
+/*
+ * Return the node of the decision, sharing the equal one. Return -1
+ * when the budget is exceeded.
+ */
+static int
+make_node(bdd_tree *bt, int var, int low, int high){
+    unsigned int h;
+    int mask, i, index;
+    bdd_node *n;
+
+    /* Redundant test */
+    if (low == high)
+	return low;
+
+    h = hash_triple(var, low, high);
+    mask = bt->unique_size - 1;
+    for (i = h & mask; bt->unique[i] >= 0; i = (i + 1) & mask){
+	n = &bt->nodes[bt->unique[i]];
+	if (n->var == var && n->low == low && n->high == high)
+	    return bt->unique[i];
+    }
+
+    if (bt->nnodes >= bt->max_nodes)
+	return -1;
+
+    bt->nodes = (bdd_node *) mexpr_realloc(bt->nodes,
+					   sizeof(bdd_node) * (bt->nnodes + 1),
+					   MEXPR_ALLOC_CODE);
+    index = bt->nnodes++;
+    bt->nodes[index].var = var;
+    bt->nodes[index].low = low;
+    bt->nodes[index].high = high;
+
+    /* Keep the load under a half */
+    if (bt->nnodes * 2 > bt->unique_size)
+	unique_grow(bt);
+    else
+	unique_insert(bt, index);
+
+    return index;
+}
+
+static int
+node_var(bdd_tree *bt, int n){
+    /* The terminals come after all atoms */
+    return n <= BDD_TRUE ? bt->natoms : bt->nodes[n].var;
+}
+
+/* Combine two diagrams by AND or OR. Return -1 over the budget */
+static int
+apply(bdd_tree *bt, int op, int a, int b){
+    bdd_cache_entry *e;
+    int var, low, high, a_low, a_high, b_low, b_high, tmp;
+
+    /* The terminal cases */
+    if (op == AND){
+	if (a == BDD_FALSE || b == BDD_FALSE)
+	    return BDD_FALSE;
+	if (a == BDD_TRUE)
+	    return b;
+	if (b == BDD_TRUE || a == b)
+	    return a;
+    }else{
+	if (a == BDD_TRUE || b == BDD_TRUE)
+	    return BDD_TRUE;
+	if (a == BDD_FALSE)
+	    return b;
+	if (b == BDD_FALSE || a == b)
+	    return a;
+    }
+
+    /* Both operators are commutative */
+    if (a > b){
+	tmp = a;
+	a = b;
+	b = tmp;
+    }
+
+    e = &bt->cache[hash_triple(op, a, b) & (BDD_CACHE_SIZE - 1)];
+    if (e->op == op && e->left == a && e->right == b)
+	return e->result;
+
+    var = node_var(bt, a) < node_var(bt, b) ? node_var(bt, a) : node_var(bt, b);
+    a_low = a_high = a;
+    if (node_var(bt, a) == var){
+	a_low = bt->nodes[a].low;
+	a_high = bt->nodes[a].high;
+    }
+    b_low = b_high = b;
+    if (node_var(bt, b) == var){
+	b_low = bt->nodes[b].low;
+	b_high = bt->nodes[b].high;
+    }
+
+    if ((low = apply(bt, op, a_low, b_low)) < 0 ||
+	(high = apply(bt, op, a_high, b_high)) < 0)
+	return -1;
+    if ((tmp = make_node(bt, var, low, high)) < 0)
+	return -1;
+
+    /* 'bt->nodes' may have moved, but the entry has not */
+    e->op = op;
+    e->left = a;
+    e->right = b;
+    e->result = tmp;
+
+    return tmp;
+}
+
+/* Register the atoms in the order of appearance */
+static void
+collect_atoms(bdd_tree *bt, tr_node *n){
+    if (n->node_id == AND || n->node_id == OR){
+	collect_atoms(bt, n->left);
+	collect_atoms(bt, n->right);
+    }else
+	find_atom(bt, n);
+}
+
+static int
+build(bdd_tree *bt, tr_node *n){
+    int l, r;
+
+    if (n->node_id != AND && n->node_id != OR)
+	return make_node(bt, find_atom(bt, n), BDD_FALSE, BDD_TRUE);
+
+    if ((l = build(bt, n->left)) < 0 || (r = build(bt, n->right)) < 0)
+	return -1;
+
+    return apply(bt, n->node_id, l, r);
+}
+
+/* Move the reachable node 'n' to 'nodes', and return the new index */
+static int
+copy_reachable(bdd_tree *bt, int n, int *map, bdd_node *nodes, int *count){
+    bdd_node *src = &bt->nodes[n];
+    int low, high;
+
+    if (map[n] >= 0)
+	return map[n];
+
+    low = copy_reachable(bt, src->low, map, nodes, count);
+    high = copy_reachable(bt, src->high, map, nodes, count);
+    nodes[*count].var = src->var;
+    nodes[*count].low = low;
+    nodes[*count].high = high;
+    map[n] = (*count)++;
+
+    return map[n];
+}
+
+/* Drop the intermediate nodes of apply() that the root doesn't reach */
+static void
+compact(bdd_tree *bt){
+    bdd_node *nodes;
+    int *map, count, i;
+
+    map = (int *) mexpr_realloc(NULL,
+				sizeof(int) * bt->nnodes, MEXPR_ALLOC_CODE);
+    nodes = (bdd_node *) mexpr_realloc(NULL,
+				       sizeof(bdd_node) * bt->nnodes,
+				       MEXPR_ALLOC_CODE);
+    for (i = 0; i < bt->nnodes; i++)
+	map[i] = -1;
+    for (i = BDD_FALSE; i <= BDD_TRUE; i++){
+	nodes[i] = bt->nodes[i];
+	map[i] = i;
+    }
+    count = 2;
+
+    bt->root = copy_reachable(bt, bt->root, map, nodes, &count);
+    mexpr_free(bt->nodes);
+    mexpr_free(map);
+    bt->nodes = (bdd_node *) mexpr_realloc(nodes,
+					   sizeof(bdd_node) * count,
+					   MEXPR_ALLOC_CODE);
+    bt->nnodes = count;
+}
+
+bdd_tree *
+bdd_tree_create(tree *t, int max_nodes){
+    bdd_tree *bt;
+    tr_node *n;
+    int i;
+
+    assert(t != NULL && t->root != NULL);
+    assert(max_nodes > 2);
+
+    bt = (bdd_tree *) mexpr_realloc(NULL, sizeof(bdd_tree), MEXPR_ALLOC_CODE);
+    memset(bt, 0, sizeof(bdd_tree));
+    bt->t = t;
+    bt->max_nodes = max_nodes;
+
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id != VARIABLE)
+	    continue;
+	bt->var_nodes = (tr_node **) mexpr_realloc(bt->var_nodes,
+						   sizeof(tr_node *) * (bt->nvars + 1),
+						   MEXPR_ALLOC_CODE);
+	bt->var_nodes[bt->nvars++] = n;
+    }
+    bt->var_types = (int *) mexpr_realloc(NULL,
+					  sizeof(int) * (bt->nvars + 1),
+					  MEXPR_ALLOC_CODE);
+
+    collect_atoms(bt, t->root);
+
+    /* The terminals */
+    bt->nodes = (bdd_node *) mexpr_realloc(NULL,
+					   sizeof(bdd_node) * 2,
+					   MEXPR_ALLOC_CODE);
+    for (i = BDD_FALSE; i <= BDD_TRUE; i++){
+	bt->nodes[i].var = bt->natoms;
+	bt->nodes[i].low = bt->nodes[i].high = i;
+    }
+    bt->nnodes = 2;
+    unique_grow(bt);
+
+    bt->cache = (bdd_cache_entry *) mexpr_realloc(NULL,
+						  sizeof(bdd_cache_entry) * BDD_CACHE_SIZE,
+						  MEXPR_ALLOC_CODE);
+    for (i = 0; i < BDD_CACHE_SIZE; i++)
+	bt->cache[i].op = INVALID;
+
+    if ((bt->root = build(bt, t->root)) >= 0)
+	compact(bt);
+
+    /* The diagram is needed no more than the evaluation */
+    mexpr_free(bt->unique);
+    bt->unique = NULL;
+    mexpr_free(bt->cache);
+    bt->cache = NULL;
+
+    return bt;
+}
+
+void
+bdd_tree_destroy(bdd_tree *bt){
+    mexpr_free(bt->atoms);
+    mexpr_free(bt->dividing);
+    mexpr_free(bt->nodes);
+    mexpr_free(bt->var_nodes);
+    mexpr_free(bt->var_types);
+    mexpr_free(bt);
+}
+
+bool
+bdd_tree_is_compiled(bdd_tree *bt){
+    return bt->root >= 0;
+}
+
+int
+bdd_tree_size(bdd_tree *bt){
+    return bt->root >= 0 ? bt->nnodes : 0;
+}
+
+int
+bdd_tree_atoms(bdd_tree *bt){
+    return bt->natoms;
+}
+
+/*
+ * Any atom that isn't BOOLEAN for the current types fails every
+ * evaluation. Check it again only when the types changed.
+ */
+static void
+check_types(bdd_tree *bt){
+    bool changed = !bt->types_checked;
+    int i, type;
+
+    for (i = 0; i < bt->nvars; i++){
+	type = bt->var_nodes[i]->unv.vval.vdata->node_id;
+	if (type != bt->var_types[i]){
+	    bt->var_types[i] = type;
+	    changed = true;
+	}
+    }
+
+    if (!changed)
+	return;
+
+    bt->type_error = false;
+    for (i = 0; i < bt->natoms; i++)
+	if (tree_static_type(bt->atoms[i].root) != BOOLEAN)
+	    bt->type_error = true;
+    bt->types_checked = true;
+}
+
+/*
+ * Walk from the root to a terminal and return it. The result is
+ * meaningless when the tree failed.
+ */
+static int
+run_diagram(bdd_tree *bt){
+    tree *t = bt->t;
+    tr_node *result;
+    bdd_atom *atom;
+    int n, i;
+
+    bt->epoch++;
+    for (n = bt->root; n > BDD_TRUE; ){
+	atom = &bt->atoms[bt->nodes[n].var];
+	result = evaluate_node(atom->root, t);
+	if (t->computation_failed)
+	    return n;
+	atom->epoch = bt->epoch;
+	n = result->unv.bval ? bt->nodes[n].high : bt->nodes[n].low;
+    }
+
+    /* evaluate_tree() fails by zero division off the path as well */
+    for (i = 0; i < bt->ndividing; i++){
+	atom = &bt->atoms[bt->dividing[i]];
+	if (atom->epoch == bt->epoch)
+	    continue;
+	evaluate_node(atom->root, t);
+	if (t->computation_failed)
+	    break;
+    }
+
+    return n;
+}
+
+void
+bdd_evaluate(bdd_tree *bt, tr_node *top){
+    tree *t = bt->t;
+    node_value value;
+    int n;
+
+    if (bt->root < 0 || (t->require_resolution && !t->resolved)){
+	evaluate_tree(t, top);
+	return;
+    }
+
+    /* It fails, and the tree walker decides by which error first */
+    check_types(bt);
+    if (bt->type_error){
+	evaluate_tree(t, top);
+	return;
+    }
+
+    tree_partial_eval_begin(t);
+    n = run_diagram(bt);
+
+    if (!tree_eval_end(t))
+	return;
+
+    value.bval = n == BDD_TRUE;
+    tree_set_top(top, BOOLEAN, value);
+}
@@ -0,0 +1,42 @@
+#ifndef __MEXPR_BDD__
+#define __MEXPR_BDD__
+
+#include <stdbool.h>
+#include "MexprTree.h"
+
+/*
+ * Evaluation of logical trees by reduced ordered binary decision
+ * diagrams.
+ *
+ * The atoms of a logical tree are the maximal subtrees without 'and'
+ * and 'or', usually comparisons. Equal atoms, e.g. 'x > 1' written
+ * twice, become one decision variable, ordered by the first
+ * appearance in the expression. The evaluation walks from the root
+ * of the diagram to a terminal and evaluates each atom on the path
+ * once, instead of the whole tree.
+ *
+ * The results are the same as the ones of evaluate_tree(), which
+ * fails when any atom fails. The types of variables are checked on
+ * each evaluation, and the atoms off the path that can fail by zero
+ * division are evaluated too.
+ *
+ * When the diagram needs more than 'max_nodes' nodes, it's dropped
+ * and the tree is evaluated by evaluate_tree().
+ */
+typedef struct bdd_tree bdd_tree;
+
+/* 't' must stay alive while the diagram is used */
+bdd_tree *bdd_tree_create(tree *t, int max_nodes);
+void bdd_tree_destroy(bdd_tree *bt);
+
+/* Same as evaluate_tree() */
+void bdd_evaluate(bdd_tree *bt, tr_node *top);
+
+/* False if the diagram exceeded the budget */
+bool bdd_tree_is_compiled(bdd_tree *bt);
+
+/* The number of the nodes including the two terminals, and atoms */
+int bdd_tree_size(bdd_tree *bt);
+int bdd_tree_atoms(bdd_tree *bt);
+
+#endif
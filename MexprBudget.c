@@ -0,0 +1,58 @@
+#include <assert.h>
+#include <pthread.h>
+#include <string.h>
+#include "MexprBudget.h"
+
+/* The default budget, copied by the parses and the new trees of any thread */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static mexpr_budget current;
+
+void
+mexpr_set_budget(const mexpr_budget *budget){
+    pthread_mutex_lock(&lock);
+    if (budget == NULL)
+	memset(&current, 0, sizeof(mexpr_budget));
+    else
+	current = *budget;
+    pthread_mutex_unlock(&lock);
+}
+
+void
+mexpr_get_budget(mexpr_budget *budget){
+    pthread_mutex_lock(&lock);
+    *budget = current;
+    pthread_mutex_unlock(&lock);
+}
+
+const char *
+mexpr_error_name(mexpr_error error){
+    switch(error){
+	case MEXPR_OK:
+	    return "ok";
+	case MEXPR_ERR_SYNTAX:
+	    return "syntax error";
+	case MEXPR_ERR_FORMAT:
+	    return "invalid format";
+	case MEXPR_ERR_TOO_LONG:
+	    return "too long";
+	case MEXPR_ERR_TOKENS:
+	    return "too many tokens";
+	case MEXPR_ERR_DEPTH:
+	    return "too deep";
+	case MEXPR_ERR_PARSE_STEPS:
+	    return "too many parse steps";
+	case MEXPR_ERR_REWINDS:
+	    return "too many rewinds";
+	case MEXPR_ERR_EVALUATION:
+	    return "evaluation failure";
+	case MEXPR_ERR_ZERO_DIVISION:
+	    return "zero division";
+	case MEXPR_ERR_UNRESOLVED:
+	    return "unresolved variable";
+	case MEXPR_ERR_EVAL_NODES:
+	    return "too many evaluated nodes";
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef __MEXPR_BUDGET__
+#define __MEXPR_BUDGET__
+
+/*
+ * Budgets of resources for untrusted expressions.
+ *
+ * The parser and evaluate_tree() stop with the error code of the
+ * exceeded budget instead of running unbounded. Zero means no limit
+ * for each member. The lex stack has the hard limit MAX_STACK_INDEX
+ * of ExportedParser.h regardless of 'max_tokens'.
+ */
+typedef struct mexpr_budget {
+    /* The tokens on the lex stack, including white spaces */
+    int max_tokens;
+
+    /* The depth of the recursion of grammar rules */
+    int max_depth;
+
+    /* The tokens lexed, including the ones lexed again after rewinds */
+    unsigned long max_parse_steps;
+
+    /* The rewinds of the parser to checkpoints */
+    unsigned long max_rewinds;
+
+    /* The nodes visited by one evaluate_tree() */
+    unsigned long max_eval_nodes;
+} mexpr_budget;
+
+typedef enum mexpr_error {
+    MEXPR_OK,
+
+    /* The string doesn't match the grammar */
+    MEXPR_ERR_SYNTAX,
+
+    /* The string is NULL, too short or doesn't end with a new line */
+    MEXPR_ERR_FORMAT,
+
+    /* The string doesn't fit in the lex buffer */
+    MEXPR_ERR_TOO_LONG,
+
+    MEXPR_ERR_TOKENS,
+    MEXPR_ERR_DEPTH,
+    MEXPR_ERR_PARSE_STEPS,
+    MEXPR_ERR_REWINDS,
+
+    /* Operands of invalid types */
+    MEXPR_ERR_EVALUATION,
+
+    /* Zero division or modulo by zero */
+    MEXPR_ERR_ZERO_DIVISION,
+
+    /* A variable is not resolved */
+    MEXPR_ERR_UNRESOLVED,
+
+    MEXPR_ERR_EVAL_NODES,
+    MEXPR_ERRORS
+} mexpr_error;
+
+/*
+ * The default budget of the process. Each parse without its own
+ * budget copies it, and so does each tree when it is built, for its
+ * evaluations. Setting it doesn't change the trees built before, and
+ * is safe while other threads evaluate. NULL clears it.
+ *
+ * Callers of different trust levels pass their own budgets instead :
+ * build_mathexpr_tree_budget() of ExportedParser.h for one parse and
+ * the tree built by it, and tree_set_budget() of MexprTree.h for the
+ * later evaluations of a tree.
+ */
+void mexpr_set_budget(const mexpr_budget *budget);
+void mexpr_get_budget(mexpr_budget *budget);
+
+const char *mexpr_error_name(mexpr_error error);
+
+#endif
@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include "MexprEnums.h"
+#include "MexprProgram.h"
+#include "MexprCodegen.h"
+
+/*
+ * The generated code follows the semantics of evaluate_node() in
+ * the same way as the batch kernels : zero division and modulo by
+ * zero fail, integer arithmetic wraps around (the unit should be
+ * compiled with -fwrapv), and the operands of 'and' and 'or' are
+ * both evaluated, so the failure of either operand fails the whole.
+ */
+
+static const char *
+c_type(int type){
+    switch(type){
+	case INT:
+	    return "int";
+	case DOUBLE:
+	    return "double";
+	case BOOLEAN:
+	    return "_Bool";
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
+
+static const char *
+value_member(int type){
+    switch(type){
+	case INT:
+	    return "ival";
+	case DOUBLE:
+	    return "dval";
+	case BOOLEAN:
+	    return "bval";
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
+
+static const char *
+c_operator(int opcode){
+    switch(opcode){
+	case PLUS:
+	    return "+";
+	case MINUS:
+	    return "-";
+	case MULTIPLY:
+	    return "*";
+	case DIVIDE:
+	    return "/";
+	case MOD:
+	    return "%";
+	case GREATER_THAN_OR_EQUAL_TO:
+	    return ">=";
+	case LESS_THAN_OR_EQUAL_TO:
+	    return "<=";
+	case GREATER_THAN:
+	    return ">";
+	case LESS_THAN:
+	    return "<";
+	case NEQ:
+	    return "!=";
+	case EQ:
+	    return "==";
+	case AND:
+	    return "&";
+	case OR:
+	    return "|";
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
+
+void
+codegen_c_prologue(FILE *fp){
+    fprintf(fp,
+	    "#include <math.h>\n"
+	    "\n"
+	    "typedef union mexpr_value {\n"
+	    "    int ival;\n"
+	    "    double dval;\n"
+	    "    _Bool bval;\n"
+	    "} mexpr_value;\n"
+	    "\n");
+}
+
+static void
+emit_inst(FILE *fp, typed_program *prog, const int *slots, int i){
+    typed_inst *inst = &prog->insts[i];
+    int l = inst->left, r = inst->right;
+
+    fprintf(fp, "    %s v%d = ", c_type(inst->type), i);
+
+    switch(inst->opcode){
+	case INT:
+	    fprintf(fp, "%d;\n", inst->imm.ival);
+	    return;
+	case DOUBLE:
+	    /* Hexadecimal keeps the exact value. inf and nan aren't C */
+	    if (isnan(inst->imm.dval))
+		fprintf(fp, "NAN;\n");
+	    else if (isinf(inst->imm.dval))
+		fprintf(fp, "%sHUGE_VAL;\n", inst->imm.dval < 0 ? "-" : "");
+	    else
+		fprintf(fp, "%a;\n", inst->imm.dval);
+	    return;
+	case BOOLEAN:
+	    fprintf(fp, "%d;\n", inst->imm.bval ? 1 : 0);
+	    return;
+	case VARIABLE:
+	    fprintf(fp, "slots[%d]->%s;\n", slots[inst->var],
+		    value_member(inst->type));
+	    return;
+	case INT_TO_DOUBLE:
+	    fprintf(fp, "(double) v%d;\n", l);
+	    return;
+	case SQR:
+	    fprintf(fp, "v%d * v%d;\n", l, l);
+	    return;
+	case SQRT:
+	    fprintf(fp, "sqrt(v%d);\n", l);
+	    return;
+	case SIN:
+	    fprintf(fp, "sin(v%d);\n", l);
+	    return;
+	case COS:
+	    fprintf(fp, "cos(v%d);\n", l);
+	    return;
+	case POW:
+	    fprintf(fp, "pow(v%d, v%d);\n", l, r);
+	    return;
+	case MIN:
+	    fprintf(fp, "v%d < v%d ? v%d : v%d;\n", l, r, l, r);
+	    return;
+	case MAX:
+	    fprintf(fp, "v%d > v%d ? v%d : v%d;\n", l, r, l, r);
+	    return;
+	case DIVIDE:
+	case MOD:
+	    /* Declare the result after the check of divisor */
+	    fprintf(fp, "0;\n");
+	    fprintf(fp, "    if (v%d == 0)\n\treturn -1;\n", r);
+	    if (inst->type == DOUBLE && inst->opcode == MOD)
+		fprintf(fp, "    v%d = fmod(v%d, v%d);\n", i, l, r);
+	    else
+		fprintf(fp, "    v%d = v%d %s v%d;\n", i, l,
+			c_operator(inst->opcode), r);
+	    return;
+	default:
+	    fprintf(fp, "v%d %s v%d;\n", l, c_operator(inst->opcode), r);
+	    return;
+    }
+}
+
+void
+codegen_c_function(FILE *fp, char *name, typed_program *prog,
+		   const int *slots){
+    int i;
+
+    fprintf(fp, "int\n%s(const mexpr_value *const *slots){\n", name);
+
+    /* evaluate_node() fails for all values */
+    if (prog->type_error){
+	fprintf(fp, "    (void) slots;\n    return -1;\n}\n\n");
+	return;
+    }
+
+    assert(prog->insts[prog->ninsts - 1].type == BOOLEAN);
+
+    for (i = 0; i < prog->ninsts; i++)
+	emit_inst(fp, prog, slots, i);
+
+    fprintf(fp, "    return v%d;\n}\n\n", prog->ninsts - 1);
+}
@@ -0,0 +1,30 @@
+#ifndef __MEXPR_CODEGEN__
+#define __MEXPR_CODEGEN__
+
+#include <stdio.h>
+#include "MexprProgram.h"
+
+/*
+ * Translate typed programs into C source code.
+ *
+ * Each program becomes one function
+ *
+ *     int name(const mexpr_value *const *slots);
+ *
+ * which reads the variables from 'slots' and returns the BOOLEAN
+ * result as 1 or 0, or -1 if the computation fails. 'mexpr_value'
+ * has the same layout as the INT, DOUBLE and BOOLEAN members of
+ * node_value, so 'slots' can point to the 'unv' of tr_node.
+ */
+
+/* The declarations that the functions need. Emit once per unit */
+void codegen_c_prologue(FILE *fp);
+
+/*
+ * Emit the function of the BOOLEAN program. 'slots' maps the index
+ * of 'vars' of the program to the index of the slot array.
+ */
+void codegen_c_function(FILE *fp, char *name, typed_program *prog,
+			const int *slots);
+
+#endif
@@ -0,0 +1,464 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "MexprEnums.h"
+#include "MexprAlloc.h"
+#include "MexprCsv.h"
+
+#define FIELD_LEN 64
+
+/* Kinds of values found in one column */
+#define SAW_INT 0x1
+#define SAW_DOUBLE 0x2
+#define SAW_BOOLEAN 0x4
+
+/*
+ * The data lines are split into chunks at line boundaries and
+ * each chunk is processed by one thread. All values are parsed
+ * as double first, since the type of column is determined only
+ * after all chunks are parsed.
+ */
+typedef struct csv_chunk {
+    char *start;
+    char *end;
+
+    size_t first_row;
+    size_t rows;
+
+    /* Map from the column index of file to the index of 'names' */
+    int *needed;
+    int ncsvcols;
+    int nneeded;
+
+    /* Shared among chunks. Each chunk writes its own rows */
+    double **values;
+    bool *invalid_rows;
+
+    /* SAW_* bits per needed column */
+    int *seen;
+    bool has_invalid;
+} csv_chunk;
+
+/* Return the end of the line that starts at 'p', excluding '\r' */
+static char *
+line_end(char *p, char *end, char **next){
+    char *nl;
+
+    if ((nl = memchr(p, '\n', end - p)) == NULL)
+	nl = end;
+
+    *next = nl < end ? nl + 1 : end;
+
+    if (nl > p && nl[-1] == '\r')
+	nl--;
+
+    return nl;
+}
+
+static int
+parse_field(char *field, size_t len, double *value){
+    char buf[FIELD_LEN], *endp;
+    long long ival = 0;
+    size_t i;
+
+    while (len > 0 && *field == ' '){
+	field++;
+	len--;
+    }
+    while (len > 0 && field[len - 1] == ' ')
+	len--;
+
+    if (len == 0 || len >= FIELD_LEN)
+	return 0;
+
+    if (len == 4 && memcmp(field, "true", 4) == 0){
+	*value = 1.0;
+	return SAW_BOOLEAN;
+    }
+    if (len == 5 && memcmp(field, "false", 5) == 0){
+	*value = 0.0;
+	return SAW_BOOLEAN;
+    }
+
+    /* Integer fast path */
+    i = field[0] == '-' ? 1 : 0;
+    if (i < len && len - i <= 10){
+	for (; i < len && field[i] >= '0' && field[i] <= '9'; i++)
+	    ival = ival * 10 + (field[i] - '0');
+
+	if (i == len){
+	    if (field[0] == '-')
+		ival = -ival;
+	    if (ival >= INT_MIN && ival <= INT_MAX){
+		*value = (double) ival;
+		return SAW_INT;
+	    }
+	}
+    }
+
+    memcpy(buf, field, len);
+    buf[len] = '\0';
+    *value = strtod(buf, &endp);
+
+    return *endp == '\0' ? SAW_DOUBLE : 0;
+}
+
+static void *
+count_chunk_rows(void *arg){
+    csv_chunk *c = (csv_chunk *) arg;
+    char *p = c->start, *next;
+
+    c->rows = 0;
+    while (p < c->end){
+	if (line_end(p, c->end, &next) > p)
+	    c->rows++;
+	p = next;
+    }
+
+    return NULL;
+}
+
+static void *
+parse_chunk(void *arg){
+    csv_chunk *c = (csv_chunk *) arg;
+    char *p = c->start, *next, *eol, *field;
+    size_t row = c->first_row;
+    int col, idx, found, kind;
+    double value;
+
+    while (p < c->end){
+	eol = line_end(p, c->end, &next);
+	if (eol == p){
+	    p = next;
+	    continue;
+	}
+
+	found = 0;
+	col = 0;
+	while (p <= eol){
+	    field = p;
+	    while (p < eol && *p != ',')
+		p++;
+
+	    if (col < c->ncsvcols && (idx = c->needed[col]) >= 0){
+		if ((kind = parse_field(field, p - field, &value)) != 0){
+		    c->values[idx][row] = value;
+		    c->seen[idx] |= kind;
+		    found++;
+		}
+	    }
+
+	    col++;
+	    p++;
+	}
+
+	/*
+	 * The cells of an invalid row get 0, so that the conversion
+	 * to the column type and the kernels never read garbage.
+	 */
+	if (found != c->nneeded){
+	    for (idx = 0; idx < c->nneeded; idx++)
+		c->values[idx][row] = 0.0;
+	    c->invalid_rows[row] = true;
+	    c->has_invalid = true;
+	}
+
+	row++;
+	p = next;
+    }
+
+    return NULL;
+}
+
+static void
+run_chunks(csv_chunk *chunks, int nchunks, void *(*fn)(void *)){
+    pthread_t *threads;
+    int i;
+
+    threads = (pthread_t *) mexpr_malloc(sizeof(pthread_t) * nchunks,
+					 MEXPR_ALLOC_DATA);
+
+    for (i = 1; i < nchunks; i++){
+	if (pthread_create(&threads[i], NULL, fn, &chunks[i]) != 0){
+	    perror("pthread_create");
+	    exit(-1);
+	}
+    }
+
+    fn(&chunks[0]);
+
+    for (i = 1; i < nchunks; i++)
+	pthread_join(threads[i], NULL);
+
+    mexpr_free(threads);
+}
+
+/*
+ * Convert the parsed values to the array of column type.
+ * Return false if the column mixes booleans and numbers.
+ */
+static bool
+finalize_column(csv_column *column, double *values, size_t rows, int seen){
+    size_t i;
+
+    if ((seen & SAW_BOOLEAN) && (seen & (SAW_INT | SAW_DOUBLE))){
+	fprintf(stderr, "column '%s' mixes boolean and numeric values\n",
+		column->name);
+	mexpr_free(values);
+	return false;
+    }
+
+    if (seen & SAW_DOUBLE){
+	column->type = DOUBLE;
+	column->values = values;
+    }else if (seen & SAW_BOOLEAN){
+	bool *bvals = (bool *) mexpr_malloc(sizeof(bool) * (rows + 1),
+					    MEXPR_ALLOC_DATA);
+
+	for (i = 0; i < rows; i++)
+	    bvals[i] = values[i] != 0.0;
+	column->type = BOOLEAN;
+	column->values = bvals;
+	mexpr_free(values);
+    }else{
+	int *ivals = (int *) mexpr_malloc(sizeof(int) * (rows + 1),
+					  MEXPR_ALLOC_DATA);
+
+	for (i = 0; i < rows; i++)
+	    ivals[i] = (int) values[i];
+	column->type = INT;
+	column->values = ivals;
+	mexpr_free(values);
+    }
+
+    return true;
+}
+
+/*
+ * Return the index of 'names' for each column of the header
+ * line, or -1 for the columns not in 'names'.
+ */
+static int *
+parse_header(char *p, char *eol, char **names, int nnames, int *ncsvcols){
+    int *needed = NULL, ncols = 0, i;
+    char *field;
+    size_t len;
+
+    while (p <= eol){
+	field = p;
+	while (p < eol && *p != ',')
+	    p++;
+
+	while (field < p && *field == ' ')
+	    field++;
+	len = p - field;
+	while (len > 0 && field[len - 1] == ' ')
+	    len--;
+
+	needed = (int *) mexpr_realloc(needed, sizeof(int) * (ncols + 1),
+				       MEXPR_ALLOC_DATA);
+
+	needed[ncols] = -1;
+	for (i = 0; i < nnames; i++){
+	    if (strlen(names[i]) == len && memcmp(names[i], field, len) == 0){
+		needed[ncols] = i;
+		break;
+	    }
+	}
+
+	ncols++;
+	p++;
+    }
+
+    *ncsvcols = ncols;
+
+    return needed;
+}
+
+/*
+ * Map the CSV file at 'path' and load the columns of 'names'
+ * with 'nthreads' threads in parallel.
+ *
+ * Return NULL if the file can't be read, any of 'names' is
+ * missing in the header or repeated in it, or any column mixes
+ * booleans and numbers.
+ */
+csv_table *
+csv_load_columns(char *path, char **names, int nnames, int nthreads){
+    char *addr, *data, *end, *eol, *p;
+    csv_chunk *chunks;
+    double **values;
+    csv_table *tbl;
+    struct stat st;
+    int *needed, ncsvcols, fd, i, j, seen, found;
+    bool failed = false, has_invalid = false;
+    size_t rows;
+
+    assert(nthreads > 0);
+
+    if ((fd = open(path, O_RDONLY)) < 0){
+	perror("open");
+	return NULL;
+    }
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0){
+	fprintf(stderr, "'%s' has no header line\n", path);
+	close(fd);
+	return NULL;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED){
+	perror("mmap");
+	return NULL;
+    }
+    (void) madvise(addr, st.st_size, MADV_WILLNEED);
+
+    end = addr + st.st_size;
+    eol = line_end(addr, end, &data);
+    needed = parse_header(addr, eol, names, nnames, &ncsvcols);
+
+    /* Each name must be in exactly one column of the header */
+    for (i = 0; i < nnames; i++){
+	found = 0;
+	for (j = 0; j < ncsvcols; j++){
+	    if (needed[j] == i)
+		found++;
+	}
+	if (found == 0){
+	    fprintf(stderr, "column '%s' is not found\n", names[i]);
+	    failed = true;
+	}else if (found > 1){
+	    fprintf(stderr, "column '%s' appears %d times\n", names[i], found);
+	    failed = true;
+	}
+    }
+
+    if (failed){
+	mexpr_free(needed);
+	munmap(addr, st.st_size);
+	return NULL;
+    }
+
+    /* Split the data lines into chunks */
+    chunks = (csv_chunk *) mexpr_malloc(sizeof(csv_chunk) * nthreads,
+					MEXPR_ALLOC_DATA);
+    p = data;
+    for (i = 0; i < nthreads; i++){
+	chunks[i].start = p;
+	if (i == nthreads - 1){
+	    p = end;
+	}else{
+	    p = data + (end - data) / nthreads * (i + 1);
+	    if (p < chunks[i].start)
+		p = chunks[i].start;
+	    if ((p = memchr(p, '\n', end - p)) == NULL)
+		p = end;
+	    else
+		p++;
+	}
+	chunks[i].end = p;
+    }
+
+    run_chunks(chunks, nthreads, count_chunk_rows);
+
+    rows = 0;
+    for (i = 0; i < nthreads; i++){
+	chunks[i].first_row = rows;
+	rows += chunks[i].rows;
+    }
+
+    values = (double **) mexpr_malloc(sizeof(double *) * (nnames + 1),
+				      MEXPR_ALLOC_DATA);
+    for (i = 0; i < nnames; i++)
+	values[i] = (double *) mexpr_malloc(sizeof(double) * (rows + 1),
+					    MEXPR_ALLOC_DATA);
+
+    tbl = (csv_table *) mexpr_malloc(sizeof(csv_table), MEXPR_ALLOC_DATA);
+    tbl->rows = rows;
+    tbl->ncolumns = nnames;
+    tbl->columns = (csv_column *) mexpr_malloc(sizeof(csv_column) * (nnames + 1),
+					       MEXPR_ALLOC_DATA);
+    tbl->invalid_rows = (bool *) mexpr_malloc(sizeof(bool) * (rows + 1),
+					      MEXPR_ALLOC_DATA);
+    memset(tbl->invalid_rows, 0, sizeof(bool) * (rows + 1));
+
+    for (i = 0; i < nthreads; i++){
+	chunks[i].needed = needed;
+	chunks[i].ncsvcols = ncsvcols;
+	chunks[i].nneeded = nnames;
+	chunks[i].values = values;
+	chunks[i].invalid_rows = tbl->invalid_rows;
+	chunks[i].seen = (int *) mexpr_malloc(sizeof(int) * (nnames + 1),
+					      MEXPR_ALLOC_DATA);
+	memset(chunks[i].seen, 0, sizeof(int) * (nnames + 1));
+	chunks[i].has_invalid = false;
+    }
+
+    run_chunks(chunks, nthreads, parse_chunk);
+
+    for (i = 0; i < nnames; i++){
+	seen = 0;
+	for (j = 0; j < nthreads; j++)
+	    seen |= chunks[j].seen[i];
+
+	tbl->columns[i].name = names[i];
+	tbl->columns[i].values = NULL;
+	if (!finalize_column(&tbl->columns[i], values[i], rows, seen))
+	    failed = true;
+    }
+
+    for (i = 0; i < nthreads; i++){
+	has_invalid |= chunks[i].has_invalid;
+	mexpr_free(chunks[i].seen);
+    }
+
+    if (!has_invalid){
+	mexpr_free(tbl->invalid_rows);
+	tbl->invalid_rows = NULL;
+    }
+
+    mexpr_free(chunks);
+    mexpr_free(values);
+    mexpr_free(needed);
+    munmap(addr, st.st_size);
+
+    if (failed){
+	csv_destroy_table(tbl);
+	return NULL;
+    }
+
+    return tbl;
+}
+
+csv_column *
+csv_find_column(csv_table *tbl, char *name){
+    int i;
+
+    for (i = 0; i < tbl->ncolumns; i++){
+	if (strcmp(tbl->columns[i].name, name) == 0)
+	    return &tbl->columns[i];
+    }
+
+    return NULL;
+}
+
+void
+csv_destroy_table(csv_table *tbl){
+    int i;
+
+    for (i = 0; i < tbl->ncolumns; i++)
+	mexpr_free(tbl->columns[i].values);
+
+    mexpr_free(tbl->columns);
+    mexpr_free(tbl->invalid_rows);
+    mexpr_free(tbl);
+}
@@ -0,0 +1,45 @@
+#ifndef __MEXPR_CSV__
+#define __MEXPR_CSV__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Load the columns of CSV file into typed arrays.
+ *
+ * The first line of the file must be the header that names each
+ * column. Fields are separated by comma and not quoted. Each column
+ * gets the narrowest type that can represent all of its values :
+ * BOOLEAN for "true" and "false", INT for integers and DOUBLE for
+ * the others.
+ */
+typedef struct csv_column {
+    /* Refer to the name passed to csv_load_columns() */
+    char *name;
+
+    /* INT, DOUBLE or BOOLEAN */
+    int type;
+
+    /* int *, double * or bool * that has 'rows' elements */
+    void *values;
+} csv_column;
+
+typedef struct csv_table {
+    size_t rows;
+    int ncolumns;
+    csv_column *columns;
+
+    /*
+     * True for the rows that lack any of the columns or have
+     * a value that can't be parsed. NULL if all rows are valid.
+     * The values of these rows are 0, or false.
+     */
+    bool *invalid_rows;
+} csv_table;
+
+csv_table *csv_load_columns(char *path, char **names, int nnames,
+			    int nthreads);
+csv_column *csv_find_column(csv_table *tbl, char *name);
+void csv_destroy_table(csv_table *tbl);
+
+#endif
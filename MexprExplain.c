@@ -0,0 +1,386 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+#include "MexprProgram.h"
+#include "MexprJit.h"
+#include "MexprReorder.h"
+#include "MexprTier.h"
+#include "MexprAlloc.h"
+#include "MexprExplain.h"
+
+/* The subtrees found in the tree, in preorder */
+typedef struct subtree_list {
+    int count;
+    tr_node **nodes;
+} subtree_list;
+
+static bool
+is_leaf(tr_node *n){
+    return n->left == NULL && n->right == NULL;
+}
+
+static void
+print_leaf(FILE *fp, tr_node *n){
+    switch(n->node_id){
+	case VARIABLE:
+	    fprintf(fp, "%s", n->unv.vval.vname);
+	    break;
+	case INT:
+	    fprintf(fp, "%d", n->unv.ival);
+	    break;
+	case DOUBLE:
+	    fprintf(fp, "%g", n->unv.dval);
+	    break;
+	case BOOLEAN:
+	    fprintf(fp, "%s", n->unv.bval ? "true" : "false");
+	    break;
+	default:
+	    fprintf(fp, "?");
+	    break;
+    }
+}
+
+/* Print the subtree in the syntax of the parser */
+static void
+print_infix(FILE *fp, tr_node *n){
+    if (is_leaf(n)){
+	print_leaf(fp, n);
+	return;
+    }
+
+    switch(n->node_id){
+	case SIN:
+	case COS:
+	case SQR:
+	case SQRT:
+	    fprintf(fp, "%s(", n->unv.operator);
+	    print_infix(fp, n->left);
+	    fprintf(fp, ")");
+	    break;
+	case MIN:
+	case MAX:
+	case POW:
+	    fprintf(fp, "%s(", n->unv.operator);
+	    print_infix(fp, n->left);
+	    fprintf(fp, ", ");
+	    print_infix(fp, n->right);
+	    fprintf(fp, ")");
+	    break;
+	default:
+	    fprintf(fp, "(");
+	    print_infix(fp, n->left);
+	    fprintf(fp, " %s ", n->unv.operator);
+	    print_infix(fp, n->right);
+	    fprintf(fp, ")");
+	    break;
+    }
+}
+
+static void
+print_tree(FILE *fp, tr_node *n, int depth){
+    fprintf(fp, "  %*s", depth * 2, "");
+    if (is_leaf(n))
+	print_leaf(fp, n);
+    else
+	fprintf(fp, "%s", n->unv.operator);
+    fprintf(fp, "\n");
+
+    if (n->left != NULL)
+	print_tree(fp, n->left, depth + 1);
+    if (n->right != NULL)
+	print_tree(fp, n->right, depth + 1);
+}
+
+static void
+add_subtree(subtree_list *list, tr_node *n){
+    list->nodes = (tr_node **) mexpr_realloc(list->nodes,
+					     sizeof(tr_node *) * (list->count + 1),
+					     MEXPR_ALLOC_CODE);
+    list->nodes[list->count++] = n;
+}
+
+static bool
+has_variable(tr_node *n){
+    if (n == NULL)
+	return false;
+
+    if (is_leaf(n))
+	return n->node_id == VARIABLE;
+
+    return has_variable(n->left) || has_variable(n->right);
+}
+
+/* The largest operator subtrees without variables */
+static void
+find_constants(tr_node *n, subtree_list *list){
+    if (is_leaf(n))
+	return;
+
+    if (!has_variable(n)){
+	add_subtree(list, n);
+	return;
+    }
+
+    find_constants(n->left, list);
+    if (n->right != NULL)
+	find_constants(n->right, list);
+}
+
+static void
+collect_operators(tr_node *n, subtree_list *list){
+    if (is_leaf(n))
+	return;
+
+    add_subtree(list, n);
+    collect_operators(n->left, list);
+    if (n->right != NULL)
+	collect_operators(n->right, list);
+}
+
+static bool
+is_inside(tr_node *n, tr_node *ancestor){
+    for (n = n->parent; n != NULL; n = n->parent){
+	if (n == ancestor)
+	    return true;
+    }
+
+    return false;
+}
+
+/*
+ * Report each operator subtree written more than once, except the
+ * ones inside another repeated subtree, which are implied.
+ */
+static void
+print_repeated(FILE *fp, tree *t){
+    subtree_list ops = { 0, NULL }, reported = { 0, NULL };
+    int i, j, k, occurrences;
+    bool implied;
+
+    collect_operators(t->root, &ops);
+
+    for (i = 0; i < ops.count; i++){
+	occurrences = 1;
+	for (j = 0; j < ops.count; j++){
+	    if (j != i && tree_same_subtree(ops.nodes[i], ops.nodes[j])){
+		/* Report the first occurrence only */
+		if (j < i)
+		    break;
+		occurrences++;
+	    }
+	}
+	if (j < ops.count || occurrences == 1)
+	    continue;
+
+	implied = false;
+	for (k = 0; k < reported.count; k++){
+	    if (is_inside(ops.nodes[i], reported.nodes[k]))
+		implied = true;
+	}
+	if (implied)
+	    continue;
+
+	add_subtree(&reported, ops.nodes[i]);
+	fprintf(fp, "  ");
+	print_infix(fp, ops.nodes[i]);
+	fprintf(fp, " : computed %d times\n", occurrences);
+    }
+
+    if (reported.count == 0)
+	fprintf(fp, "  none\n");
+
+    mexpr_free(ops.nodes);
+    mexpr_free(reported.nodes);
+}
+
+/* Callback for compile_typed_program(). The current type */
+static int
+value_type_cb(char *vname, void *data){
+    tree *t = (tree *) data;
+    tr_node *n;
+
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id == VARIABLE && strcmp(n->unv.vval.vname, vname) == 0)
+	    return n->unv.vval.vdata->node_id;
+    }
+
+    return INVALID;
+}
+
+static void
+print_inst(FILE *fp, typed_program *prog, int i){
+    typed_inst *inst = &prog->insts[i];
+
+    fprintf(fp, "  v%-3d = ", i);
+    switch(inst->opcode){
+	case INT:
+	    fprintf(fp, "%d", inst->imm.ival);
+	    break;
+	case DOUBLE:
+	    fprintf(fp, "%g", inst->imm.dval);
+	    break;
+	case BOOLEAN:
+	    fprintf(fp, "%s", inst->imm.bval ? "true" : "false");
+	    break;
+	case VARIABLE:
+	    fprintf(fp, "slot %d (%s)", inst->var, prog->vars[inst->var].vname);
+	    break;
+	case INT_TO_DOUBLE:
+	    fprintf(fp, "INT_TO_DOUBLE v%d", inst->left);
+	    break;
+	default:
+	    fprintf(fp, "%s v%d", get_string_token(inst->opcode), inst->left);
+	    if (inst->right >= 0)
+		fprintf(fp, ", v%d", inst->right);
+	    break;
+    }
+    fprintf(fp, " : %s\n", get_string_token(inst->type));
+}
+
+/* Print the typed program and return the tier it allows */
+static tier
+print_program(FILE *fp, tree *t){
+    typed_program *prog;
+    int i;
+
+    if ((prog = compile_typed_program(t, value_type_cb, t)) == NULL){
+	fprintf(fp, "  none : the type of min or max depends on the values\n");
+	return TIER_GENERIC;
+    }
+
+    if (prog->type_error){
+	fprintf(fp, "  none : operands of invalid types, every evaluation fails\n");
+	destroy_typed_program(prog);
+	return TIER_GENERIC;
+    }
+
+    for (i = 0; i < prog->nvars; i++)
+	fprintf(fp, "  slot %d : %s %s\n", i, prog->vars[i].vname,
+		get_string_token(prog->vars[i].type));
+    for (i = 0; i < prog->ninsts; i++)
+	print_inst(fp, prog, i);
+
+    destroy_typed_program(prog);
+
+    return TIER_TYPED;
+}
+
+static const char *
+tier_name(tier tr){
+    switch(tr){
+	case TIER_GENERIC:
+	    return "tree walker (evaluate_tree)";
+	case TIER_TYPED:
+	    return "VM (typed program)";
+	case TIER_NATIVE:
+	    return "JIT (native code)";
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
+
+static void
+print_tier(FILE *fp, tree *t, tiered_tree *tt, tier reachable){
+    jit_code *code;
+    tier_stats stats;
+
+    if (tt != NULL){
+	tiered_get_stats(tt, &stats);
+	fprintf(fp, "  %s\n", tier_name(stats.current));
+	fprintf(fp, "  evaluations : generic %lu, typed %lu, native %lu\n",
+		stats.evaluations[TIER_GENERIC], stats.evaluations[TIER_TYPED],
+		stats.evaluations[TIER_NATIVE]);
+	fprintf(fp, "  guard failures %lu, promotions %lu, deoptimizations %lu\n",
+		stats.guard_failures, stats.promotions,
+		stats.deoptimizations);
+	return;
+    }
+
+    /* The tier that tiered_evaluate() would reach for these types */
+    if (reachable == TIER_TYPED && (code = jit_compile_tree(t)) != NULL){
+	reachable = TIER_NATIVE;
+	jit_destroy(code);
+    }
+    fprintf(fp, "  %s, once the types of variables are stable\n",
+	    tier_name(reachable));
+}
+
+static void
+print_reorderings(FILE *fp, tree *t, reorder_plan *plan){
+    subtree_list ops = { 0, NULL };
+    int i, swapped_nodes = 0;
+    bool swapped;
+
+    collect_operators(t->root, &ops);
+    for (i = 0; i < ops.count; i++){
+	if (ops.nodes[i]->node_id != AND && ops.nodes[i]->node_id != OR)
+	    continue;
+	if (!reorder_node_info(plan, ops.nodes[i], NULL, &swapped) || !swapped)
+	    continue;
+	fprintf(fp, "  right operand first : ");
+	print_infix(fp, ops.nodes[i]);
+	fprintf(fp, "\n");
+	swapped_nodes++;
+    }
+
+    if (swapped_nodes == 0)
+	fprintf(fp, "  none\n");
+
+    mexpr_free(ops.nodes);
+}
+
+void
+explain_tree(tree *t, reorder_plan *plan, tiered_tree *tt, FILE *fp){
+    subtree_list constants = { 0, NULL };
+    reorder_plan *own_plan = NULL;
+    double cost;
+    tier reachable;
+    int i;
+
+    assert(t != NULL && t->root != NULL);
+
+    fprintf(fp, "original tree :\n");
+    print_tree(fp, t->root, 0);
+
+    fprintf(fp, "constant subtrees (not folded) :\n");
+    find_constants(t->root, &constants);
+    for (i = 0; i < constants.count; i++){
+	fprintf(fp, "  ");
+	print_infix(fp, constants.nodes[i]);
+	fprintf(fp, "\n");
+    }
+    if (constants.count == 0)
+	fprintf(fp, "  none\n");
+    mexpr_free(constants.nodes);
+
+    fprintf(fp, "repeated subtrees (not shared) :\n");
+    print_repeated(fp, t);
+
+    if (t->require_resolution && !t->resolved){
+	fprintf(fp, "unresolved : no types of variables to explain the rest\n");
+	return;
+    }
+
+    fprintf(fp, "typed program :\n");
+    reachable = print_program(fp, t);
+
+    fprintf(fp, "execution tier :\n");
+    print_tier(fp, t, tt, reachable);
+
+    if (plan == NULL)
+	plan = own_plan = reorder_plan_create(t);
+
+    reorder_node_info(plan, t->root, &cost, NULL);
+    fprintf(fp, "estimated cost : %.1f\n", cost);
+
+    fprintf(fp, "and/or reorderings :\n");
+    print_reorderings(fp, t, plan);
+
+    if (own_plan != NULL)
+	reorder_plan_destroy(own_plan);
+}
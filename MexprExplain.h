@@ -0,0 +1,36 @@
+#ifndef __MEXPR_EXPLAIN__
+#define __MEXPR_EXPLAIN__
+
+#include <stdio.h>
+#include "MexprTree.h"
+#include "MexprReorder.h"
+#include "MexprTier.h"
+
+/*
+ * Report how a resolved tree is executed, to diagnose slow rules.
+ *
+ * The sections are, in order :
+ *
+ *   - the tree as parsed,
+ *   - the constant subtrees, which no pass folds, so that every
+ *     evaluation computes them again,
+ *   - the repeated subtrees, which no pass shares, so that each of
+ *     the occurrences is computed,
+ *   - the typed program of MexprProgram.h for the current types of
+ *     the variables, with the slots of the variables,
+ *   - the execution tier : the current one of 'tt', or the one the
+ *     tree would reach, the JIT, the typed program (VM) or the tree
+ *     walker of evaluate_tree(),
+ *   - the estimated cost by the cost model of MexprReorder.h, in the
+ *     units of one addition,
+ *   - the 'and' and 'or' nodes of which 'plan' evaluates the right
+ *     operand first.
+ *
+ * 'plan' and 'tt' can be NULL. Without 'plan', the order is the one
+ * the cost model chooses before any evaluation. The sections after
+ * the tree need the variables to have values, so only the tree is
+ * reported for an unresolved tree.
+ */
+void explain_tree(tree *t, reorder_plan *plan, tiered_tree *tt, FILE *fp);
+
+#endif
@@ -0,0 +1,660 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+#include "MexprProgram.h"
+#include "MexprAlloc.h"
+#include "MexprJit.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ * The generated function. 'vars' points to the values of variables
+ * in the order of 'vars' of the typed program. Return non-zero when
+ * the computation fails.
+ */
+typedef int (*jit_function)(const node_value **vars, node_value *result);
+
+struct jit_code {
+    jit_function fn;
+
+    /* Executable page */
+    void *page;
+    size_t page_len;
+
+    /* Result type */
+    int type;
+
+    /* The first VARIABLE node and the compiled type of each variable */
+    int nvars;
+    tr_node **var_nodes;
+    int *var_types;
+};
+
+static tr_node *
+find_var_node(tree *t, char *vname){
+    tr_node *n;
+
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id == VARIABLE && strcmp(n->unv.vval.vname, vname) == 0)
+	    return n;
+    }
+
+    return NULL;
+}
+
+/* Callback for compile_typed_program(). Use the current types */
+static int
+resolved_type_cb(char *vname, void *data){
+    tr_node *n = find_var_node((tree *) data, vname);
+
+    if (n == NULL || n->unv.vval.vdata == NULL)
+	return INVALID;
+
+    return n->unv.vval.vdata->node_id;
+}
+
+#ifdef JIT_SUPPORTED
+
+typedef struct code_buffer {
+    unsigned char *bytes;
+    size_t len;
+    size_t capacity;
+
+    /* Offsets of rel32 of the jumps to the failure exit */
+    size_t *fail_jumps;
+    int nfail_jumps;
+} code_buffer;
+
+/* Registers of ModRM 'reg' field */
+#define RAX 0
+#define RCX 1
+#define XMM0 0
+#define XMM1 1
+
+static void
+emit(code_buffer *cb, const unsigned char *bytes, size_t len){
+    if (cb->len + len > cb->capacity){
+	cb->capacity = (cb->len + len) * 2;
+	cb->bytes = (unsigned char *) mexpr_realloc(cb->bytes, cb->capacity,
+						    MEXPR_ALLOC_CODE);
+    }
+
+    memcpy(cb->bytes + cb->len, bytes, len);
+    cb->len += len;
+}
+
+#define EMIT(cb, ...)							\
+    do {								\
+	const unsigned char bytes__[] = { __VA_ARGS__ };		\
+	emit(cb, bytes__, sizeof(bytes__));				\
+    } while (0)
+
+static void
+emit_u32(code_buffer *cb, uint32_t v){
+    emit(cb, (unsigned char *) &v, sizeof(v));
+}
+
+static void
+emit_u64(code_buffer *cb, uint64_t v){
+    emit(cb, (unsigned char *) &v, sizeof(v));
+}
+
+/*
+ * Emit the instruction 'op' whose memory operand is [rsp + disp32]
+ * and register operand is 'reg'.
+ */
+static void
+emit_rsp_mem(code_buffer *cb, const unsigned char *op, size_t oplen,
+	     int reg, int32_t disp){
+    emit(cb, op, oplen);
+    EMIT(cb, 0x84 | (reg << 3), 0x24);
+    emit_u32(cb, (uint32_t) disp);
+}
+
+#define SLOT(i) ((int32_t) (8 * (i)))
+
+static void
+load_int(code_buffer *cb, int reg, int slot){
+    static const unsigned char op[] = { 0x8B };	/* mov r32, m32 */
+
+    emit_rsp_mem(cb, op, sizeof(op), reg, SLOT(slot));
+}
+
+static void
+store_int(code_buffer *cb, int slot){
+    static const unsigned char op[] = { 0x89 };	/* mov m32, eax */
+
+    emit_rsp_mem(cb, op, sizeof(op), RAX, SLOT(slot));
+}
+
+static void
+load_bool(code_buffer *cb, int reg, int slot){
+    static const unsigned char op[] = { 0x0F, 0xB6 }; /* movzx r32, m8 */
+
+    emit_rsp_mem(cb, op, sizeof(op), reg, SLOT(slot));
+}
+
+static void
+store_bool(code_buffer *cb, int slot){
+    static const unsigned char op[] = { 0x88 };	/* mov m8, al */
+
+    emit_rsp_mem(cb, op, sizeof(op), RAX, SLOT(slot));
+}
+
+static void
+load_double(code_buffer *cb, int reg, int slot){
+    static const unsigned char op[] = { 0xF2, 0x0F, 0x10 }; /* movsd */
+
+    emit_rsp_mem(cb, op, sizeof(op), reg, SLOT(slot));
+}
+
+static void
+store_double(code_buffer *cb, int slot){
+    static const unsigned char op[] = { 0xF2, 0x0F, 0x11 }; /* movsd */
+
+    emit_rsp_mem(cb, op, sizeof(op), XMM0, SLOT(slot));
+}
+
+static void
+store_u64(code_buffer *cb, int slot){
+    static const unsigned char op[] = { 0x48, 0x89 }; /* mov m64, rax */
+
+    emit_rsp_mem(cb, op, sizeof(op), RAX, SLOT(slot));
+}
+
+/* jz or jnz (cc = 0x84 or 0x85) to the failure exit */
+static void
+emit_fail_jump(code_buffer *cb, unsigned char cc){
+    EMIT(cb, 0x0F, cc);
+    cb->fail_jumps = (size_t *) mexpr_realloc(cb->fail_jumps, sizeof(size_t) *
+					      (cb->nfail_jumps + 1),
+					      MEXPR_ALLOC_CODE);
+    cb->fail_jumps[cb->nfail_jumps++] = cb->len;
+    emit_u32(cb, 0);
+}
+
+/* Call the libm function with xmm0 (and xmm1) and store xmm0 */
+static void
+emit_call(code_buffer *cb, void *fn){
+    EMIT(cb, 0x48, 0xB8);		/* mov rax, imm64 */
+    emit_u64(cb, (uint64_t) (uintptr_t) fn);
+    EMIT(cb, 0xFF, 0xD0);		/* call rax */
+}
+
+/* Zero division check of xmm1. Unordered compare sets ZF and PF */
+static void
+emit_double_zero_check(code_buffer *cb){
+    EMIT(cb, 0x66, 0x0F, 0x57, 0xD2);	/* xorpd xmm2, xmm2 */
+    EMIT(cb, 0x66, 0x0F, 0x2E, 0xCA);	/* ucomisd xmm1, xmm2 */
+    EMIT(cb, 0x7A, 0x06);		/* jp +6 */
+    emit_fail_jump(cb, 0x84);		/* jz fail */
+}
+
+static bool
+emit_int_inst(code_buffer *cb, typed_inst *inst, int i){
+    switch(inst->opcode){
+	case SQR:
+	    load_int(cb, RAX, inst->left);
+	    EMIT(cb, 0x0F, 0xAF, 0xC0);	/* imul eax, eax */
+	    break;
+	case PLUS:
+	case MINUS:
+	case MULTIPLY:
+	case MIN:
+	case MAX:
+	    load_int(cb, RAX, inst->left);
+	    load_int(cb, RCX, inst->right);
+	    switch(inst->opcode){
+		case PLUS:
+		    EMIT(cb, 0x01, 0xC8);	/* add eax, ecx */
+		    break;
+		case MINUS:
+		    EMIT(cb, 0x29, 0xC8);	/* sub eax, ecx */
+		    break;
+		case MULTIPLY:
+		    EMIT(cb, 0x0F, 0xAF, 0xC1);	/* imul eax, ecx */
+		    break;
+		case MIN:
+		    EMIT(cb, 0x39, 0xC8);	/* cmp eax, ecx */
+		    EMIT(cb, 0x0F, 0x4F, 0xC1);	/* cmovg eax, ecx */
+		    break;
+		default:
+		    EMIT(cb, 0x39, 0xC8);	/* cmp eax, ecx */
+		    EMIT(cb, 0x0F, 0x4C, 0xC1);	/* cmovl eax, ecx */
+		    break;
+	    }
+	    break;
+	case DIVIDE:
+	case MOD:
+	    load_int(cb, RAX, inst->left);
+	    load_int(cb, RCX, inst->right);
+	    EMIT(cb, 0x85, 0xC9);		/* test ecx, ecx */
+	    emit_fail_jump(cb, 0x84);
+	    EMIT(cb, 0x99);			/* cdq */
+	    EMIT(cb, 0xF7, 0xF9);		/* idiv ecx */
+	    if (inst->opcode == MOD)
+		EMIT(cb, 0x89, 0xD0);		/* mov eax, edx */
+	    break;
+	default:
+	    return false;
+    }
+
+    store_int(cb, i);
+
+    return true;
+}
+
+static bool
+emit_double_inst(code_buffer *cb, typed_inst *inst, int i){
+    switch(inst->opcode){
+	case INT_TO_DOUBLE:
+	    load_int(cb, RAX, inst->left);
+	    EMIT(cb, 0xF2, 0x0F, 0x2A, 0xC0);	/* cvtsi2sd xmm0, eax */
+	    break;
+	case SQR:
+	    load_double(cb, XMM0, inst->left);
+	    EMIT(cb, 0xF2, 0x0F, 0x59, 0xC0);	/* mulsd xmm0, xmm0 */
+	    break;
+	case SQRT:
+	    load_double(cb, XMM0, inst->left);
+	    EMIT(cb, 0xF2, 0x0F, 0x51, 0xC0);	/* sqrtsd xmm0, xmm0 */
+	    break;
+	case SIN:
+	    load_double(cb, XMM0, inst->left);
+	    emit_call(cb, (void *) sin);
+	    break;
+	case COS:
+	    load_double(cb, XMM0, inst->left);
+	    emit_call(cb, (void *) cos);
+	    break;
+	case PLUS:
+	case MINUS:
+	case MULTIPLY:
+	case DIVIDE:
+	case MIN:
+	case MAX:
+	    load_double(cb, XMM0, inst->left);
+	    load_double(cb, XMM1, inst->right);
+	    switch(inst->opcode){
+		case PLUS:
+		    EMIT(cb, 0xF2, 0x0F, 0x58, 0xC1);	/* addsd */
+		    break;
+		case MINUS:
+		    EMIT(cb, 0xF2, 0x0F, 0x5C, 0xC1);	/* subsd */
+		    break;
+		case MULTIPLY:
+		    EMIT(cb, 0xF2, 0x0F, 0x59, 0xC1);	/* mulsd */
+		    break;
+		case DIVIDE:
+		    emit_double_zero_check(cb);
+		    EMIT(cb, 0xF2, 0x0F, 0x5E, 0xC1);	/* divsd */
+		    break;
+		case MIN:
+		    /* l < r ? l : r */
+		    EMIT(cb, 0xF2, 0x0F, 0x5D, 0xC1);	/* minsd */
+		    break;
+		default:
+		    /* l > r ? l : r */
+		    EMIT(cb, 0xF2, 0x0F, 0x5F, 0xC1);	/* maxsd */
+		    break;
+	    }
+	    break;
+	case MOD:
+	    load_double(cb, XMM0, inst->left);
+	    load_double(cb, XMM1, inst->right);
+	    emit_double_zero_check(cb);
+	    emit_call(cb, (void *) fmod);
+	    break;
+	case POW:
+	    load_double(cb, XMM0, inst->left);
+	    load_double(cb, XMM1, inst->right);
+	    emit_call(cb, (void *) pow);
+	    break;
+	default:
+	    return false;
+    }
+
+    store_double(cb, i);
+
+    return true;
+}
+
+static bool
+emit_bool_inst(code_buffer *cb, typed_program *prog, typed_inst *inst,
+	       int i){
+    unsigned char setcc;
+
+    switch(inst->opcode){
+	case AND:
+	case OR:
+	    load_bool(cb, RAX, inst->left);
+	    load_bool(cb, RCX, inst->right);
+	    if (inst->opcode == AND)
+		EMIT(cb, 0x21, 0xC8);		/* and eax, ecx */
+	    else
+		EMIT(cb, 0x09, 0xC8);		/* or eax, ecx */
+	    store_bool(cb, i);
+	    return true;
+	case GREATER_THAN_OR_EQUAL_TO:
+	case LESS_THAN_OR_EQUAL_TO:
+	case GREATER_THAN:
+	case LESS_THAN:
+	case NEQ:
+	case EQ:
+	    break;
+	default:
+	    return false;
+    }
+
+    switch(prog->insts[inst->left].type){
+	case INT:
+	    load_int(cb, RAX, inst->left);
+	    load_int(cb, RCX, inst->right);
+	    EMIT(cb, 0x39, 0xC8);		/* cmp eax, ecx */
+	    switch(inst->opcode){
+		case GREATER_THAN_OR_EQUAL_TO:
+		    setcc = 0x9D;		/* setge */
+		    break;
+		case LESS_THAN_OR_EQUAL_TO:
+		    setcc = 0x9E;		/* setle */
+		    break;
+		case GREATER_THAN:
+		    setcc = 0x9F;		/* setg */
+		    break;
+		case LESS_THAN:
+		    setcc = 0x9C;		/* setl */
+		    break;
+		case NEQ:
+		    setcc = 0x95;		/* setne */
+		    break;
+		default:
+		    setcc = 0x94;		/* sete */
+		    break;
+	    }
+	    EMIT(cb, 0x0F, setcc, 0xC0);	/* setcc al */
+	    break;
+	case DOUBLE:
+	    load_double(cb, XMM0, inst->left);
+	    load_double(cb, XMM1, inst->right);
+	    /* Unordered operands make all comparisons false but != */
+	    switch(inst->opcode){
+		case GREATER_THAN_OR_EQUAL_TO:
+		    EMIT(cb, 0x66, 0x0F, 0x2E, 0xC1);	/* ucomisd xmm0, xmm1 */
+		    EMIT(cb, 0x0F, 0x93, 0xC0);		/* setae al */
+		    break;
+		case GREATER_THAN:
+		    EMIT(cb, 0x66, 0x0F, 0x2E, 0xC1);
+		    EMIT(cb, 0x0F, 0x97, 0xC0);		/* seta al */
+		    break;
+		case LESS_THAN_OR_EQUAL_TO:
+		    EMIT(cb, 0x66, 0x0F, 0x2E, 0xC8);	/* ucomisd xmm1, xmm0 */
+		    EMIT(cb, 0x0F, 0x93, 0xC0);
+		    break;
+		case LESS_THAN:
+		    EMIT(cb, 0x66, 0x0F, 0x2E, 0xC8);
+		    EMIT(cb, 0x0F, 0x97, 0xC0);
+		    break;
+		case NEQ:
+		    EMIT(cb, 0x66, 0x0F, 0x2E, 0xC1);
+		    EMIT(cb, 0x0F, 0x95, 0xC0);		/* setne al */
+		    EMIT(cb, 0x0F, 0x9A, 0xC1);		/* setp cl */
+		    EMIT(cb, 0x08, 0xC8);		/* or al, cl */
+		    break;
+		default:
+		    EMIT(cb, 0x66, 0x0F, 0x2E, 0xC1);
+		    EMIT(cb, 0x0F, 0x94, 0xC0);		/* sete al */
+		    EMIT(cb, 0x0F, 0x9B, 0xC1);		/* setnp cl */
+		    EMIT(cb, 0x20, 0xC8);		/* and al, cl */
+		    break;
+	    }
+	    break;
+	default:
+	    return false;
+    }
+
+    store_bool(cb, i);
+
+    return true;
+}
+
+/*
+ * Each instruction stores its result to its own 8 byte slot of the
+ * stack frame. rbx holds 'vars' and r12 holds 'result'.
+ */
+static bool
+generate_code(typed_program *prog, code_buffer *cb){
+    uint32_t frame = SLOT(prog->ninsts);
+    typed_inst *inst;
+    size_t fail;
+    uint64_t imm;
+    int i;
+
+    /* rsp is 16 byte aligned at the calls after two pushes */
+    if (frame % 16 != 8)
+	frame += 8;
+
+    EMIT(cb, 0x53);				/* push rbx */
+    EMIT(cb, 0x41, 0x54);			/* push r12 */
+    EMIT(cb, 0x48, 0x89, 0xFB);			/* mov rbx, rdi */
+    EMIT(cb, 0x49, 0x89, 0xF4);			/* mov r12, rsi */
+    EMIT(cb, 0x48, 0x81, 0xEC);			/* sub rsp, imm32 */
+    emit_u32(cb, frame);
+
+    for (i = 0; i < prog->ninsts; i++){
+	inst = &prog->insts[i];
+
+	switch(inst->opcode){
+	    case INT:
+	    case DOUBLE:
+	    case BOOLEAN:
+		imm = 0;
+		if (inst->opcode == INT)
+		    imm = (uint32_t) inst->imm.ival;
+		else if (inst->opcode == DOUBLE)
+		    memcpy(&imm, &inst->imm.dval, sizeof(double));
+		else
+		    imm = inst->imm.bval ? 1 : 0;
+		EMIT(cb, 0x48, 0xB8);		/* mov rax, imm64 */
+		emit_u64(cb, imm);
+		store_u64(cb, i);
+		continue;
+	    case VARIABLE:
+		EMIT(cb, 0x48, 0x8B, 0x83);	/* mov rax, [rbx + disp32] */
+		emit_u32(cb, (uint32_t) (8 * inst->var));
+		EMIT(cb, 0x48, 0x8B, 0x00);	/* mov rax, [rax] */
+		store_u64(cb, i);
+		continue;
+	    default:
+		break;
+	}
+
+	switch(inst->type){
+	    case INT:
+		if (!emit_int_inst(cb, inst, i))
+		    return false;
+		break;
+	    case DOUBLE:
+		if (!emit_double_inst(cb, inst, i))
+		    return false;
+		break;
+	    case BOOLEAN:
+		if (!emit_bool_inst(cb, prog, inst, i))
+		    return false;
+		break;
+	    default:
+		return false;
+	}
+    }
+
+    /* Copy the last slot to 'result' and return 0 */
+    EMIT(cb, 0x48, 0x8B, 0x84, 0x24);		/* mov rax, [rsp + disp32] */
+    emit_u32(cb, SLOT(prog->ninsts - 1));
+    EMIT(cb, 0x49, 0x89, 0x04, 0x24);		/* mov [r12], rax */
+    EMIT(cb, 0x31, 0xC0);			/* xor eax, eax */
+    EMIT(cb, 0xEB, 0x05);			/* jmp epilogue */
+
+    /* Failure exit returns 1 */
+    fail = cb->len;
+    EMIT(cb, 0xB8, 0x01, 0x00, 0x00, 0x00);	/* mov eax, 1 */
+
+    EMIT(cb, 0x48, 0x81, 0xC4);			/* add rsp, imm32 */
+    emit_u32(cb, frame);
+    EMIT(cb, 0x41, 0x5C);			/* pop r12 */
+    EMIT(cb, 0x5B);				/* pop rbx */
+    EMIT(cb, 0xC3);				/* ret */
+
+    for (i = 0; i < cb->nfail_jumps; i++){
+	int32_t rel = (int32_t) (fail - (cb->fail_jumps[i] + 4));
+
+	memcpy(cb->bytes + cb->fail_jumps[i], &rel, sizeof(rel));
+    }
+
+    return true;
+}
+
+/* Map the code into a page which is writable first and then executable */
+static bool
+install_code(jit_code *code, code_buffer *cb){
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    code->page_len = (cb->len + page_size - 1) / page_size * page_size;
+    code->page = mmap(NULL, code->page_len, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (code->page == MAP_FAILED){
+	perror("mmap");
+	return false;
+    }
+
+    memcpy(code->page, cb->bytes, cb->len);
+
+    if (mprotect(code->page, code->page_len, PROT_READ | PROT_EXEC) != 0){
+	perror("mprotect");
+	munmap(code->page, code->page_len);
+	return false;
+    }
+
+    memcpy(&code->fn, &code->page, sizeof(void *));
+
+    return true;
+}
+
+#endif
+
+jit_code *
+jit_compile_tree(tree *t){
+#ifdef JIT_SUPPORTED
+    code_buffer cb = { NULL, 0, 0, NULL, 0 };
+    typed_program *prog;
+    jit_code *code;
+    bool ok;
+    int i;
+
+    assert(t != NULL);
+
+    if (t->require_resolution && !t->resolved)
+	return NULL;
+
+    if ((prog = compile_typed_program(t, resolved_type_cb, t)) == NULL)
+	return NULL;
+
+    /* The interpreter reports the error */
+    if (prog->type_error){
+	destroy_typed_program(prog);
+	return NULL;
+    }
+
+    code = (jit_code *) mexpr_malloc(sizeof(jit_code), MEXPR_ALLOC_CODE);
+    code->var_nodes = (tr_node **) mexpr_malloc(sizeof(tr_node *) *
+						(prog->nvars + 1),
+						MEXPR_ALLOC_CODE);
+    code->var_types = (int *) mexpr_malloc(sizeof(int) * (prog->nvars + 1),
+					   MEXPR_ALLOC_CODE);
+
+    code->type = prog->insts[prog->ninsts - 1].type;
+    code->nvars = prog->nvars;
+    for (i = 0; i < prog->nvars; i++){
+	code->var_nodes[i] = find_var_node(t, prog->vars[i].vname);
+	code->var_types[i] = prog->vars[i].type;
+    }
+
+    ok = generate_code(prog, &cb) && install_code(code, &cb);
+
+    mexpr_free(cb.bytes);
+    mexpr_free(cb.fail_jumps);
+    destroy_typed_program(prog);
+
+    if (!ok){
+	mexpr_free(code->var_nodes);
+	mexpr_free(code->var_types);
+	mexpr_free(code);
+	return NULL;
+    }
+
+    return code;
+#else
+    (void) t;
+    (void) resolved_type_cb;
+
+    return NULL;
+#endif
+}
+
+void
+jit_destroy(jit_code *code){
+    if (code == NULL)
+	return;
+
+#ifdef JIT_SUPPORTED
+    munmap(code->page, code->page_len);
+#endif
+    mexpr_free(code->var_nodes);
+    mexpr_free(code->var_types);
+    mexpr_free(code);
+}
+
+bool
+jit_evaluate_tree(jit_code *code, tree *t, tr_node *top){
+    node_value value;
+    tr_node *vdata;
+    int i;
+
+    if (code == NULL || (t->require_resolution && !t->resolved)){
+	evaluate_tree(t, top);
+	return false;
+    }
+
+    const node_value *vars[code->nvars + 1];
+
+    /* The code assumes the types seen at the compilation */
+    for (i = 0; i < code->nvars; i++){
+	vdata = code->var_nodes[i]->unv.vval.vdata;
+	if (vdata->node_id != code->var_types[i]){
+	    evaluate_tree(t, top);
+	    return false;
+	}
+	vars[i] = &vdata->unv;
+    }
+
+    tree_partial_eval_begin(t);
+
+    /* The types are checked at the compilation, so only division fails */
+    if (code->fn(vars, &value) != 0){
+	t->computation_failed = true;
+	t->error = MEXPR_ERR_ZERO_DIVISION;
+    }
+
+    if (tree_eval_end(t))
+	tree_set_top(top, code->type, value);
+
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef __MEXPR_JIT__
+#define __MEXPR_JIT__
+
+#include <stdbool.h>
+#include "MexprTree.h"
+
+/*
+ * Native code compiler for x86-64.
+ *
+ * The resolved tree is type checked with the current types of its
+ * variables and translated into machine code. INT is computed by
+ * integer instructions, DOUBLE by SSE2 and sin, cos, pow and fmod
+ * by the calls of libm.
+ *
+ * The code is valid only while the variables keep the types seen
+ * at the compilation. jit_evaluate_tree() checks them and falls back
+ * to evaluate_tree() otherwise. It also falls back when the tree
+ * can't be compiled, e.g. on other architectures.
+ */
+typedef struct jit_code jit_code;
+
+/* Return NULL if the tree can't be compiled */
+jit_code *jit_compile_tree(tree *t);
+void jit_destroy(jit_code *code);
+
+/*
+ * Same as evaluate_tree(). 'code' can be NULL. Return true if the
+ * native code computed the result, false if the interpreter did.
+ */
+bool jit_evaluate_tree(jit_code *code, tree *t, tr_node *top);
+
+#endif
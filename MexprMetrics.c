@@ -0,0 +1,425 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "MexprAlloc.h"
+#include "MexprRegistry.h"
+#include "MexprMetrics.h"
+
+#define PATH_LEN 4096
+
+/* The counters of one thread */
+typedef struct metrics_block {
+    uint64_t parses;
+    uint64_t evaluations;
+    uint64_t parse_failures[MEXPR_ERRORS];
+    uint64_t eval_failures[MEXPR_ERRORS];
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    mexpr_histogram parse_latency;
+    mexpr_histogram eval_latency;
+} metrics_block;
+
+/*
+ * The start of the period of the rates : the first registered block,
+ * or the last reset
+ */
+static uint64_t epoch_ns;
+
+static _Thread_local metrics_block *own_block;
+
+static bool timing;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    char path[PATH_LEN];
+    unsigned interval_ms;
+} exporter = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+static uint64_t
+now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t
+load(const uint64_t *p){
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+/*
+ * Only the owner thread writes its counters. The relaxed atomic
+ * stores keep the readers of the other threads from torn values.
+ */
+static void
+increment(uint64_t *p){
+    __atomic_store_n(p, *p + 1, __ATOMIC_RELAXED);
+}
+
+static void
+add_histogram(mexpr_histogram *sum, const mexpr_histogram *h){
+    uint64_t max;
+    int i;
+
+    sum->count += load(&h->count);
+    sum->total_ns += load(&h->total_ns);
+    max = load(&h->max_ns);
+    if (max > sum->max_ns)
+	sum->max_ns = max;
+    for (i = 0; i < MEXPR_HIST_BUCKETS; i++)
+	sum->buckets[i] += load(&h->buckets[i]);
+}
+
+static void
+add_block(void *to, const void *from){
+    const metrics_block *b = (const metrics_block *) from;
+    metrics_block *sum = (metrics_block *) to;
+    int i;
+
+    sum->parses += load(&b->parses);
+    sum->evaluations += load(&b->evaluations);
+    for (i = 0; i < MEXPR_ERRORS; i++){
+	sum->parse_failures[i] += load(&b->parse_failures[i]);
+	sum->eval_failures[i] += load(&b->eval_failures[i]);
+    }
+    sum->cache_hits += load(&b->cache_hits);
+    sum->cache_misses += load(&b->cache_misses);
+    add_histogram(&sum->parse_latency, &b->parse_latency);
+    add_histogram(&sum->eval_latency, &b->eval_latency);
+}
+
+static mexpr_registry registry =
+    MEXPR_REGISTRY_INITIALIZER(metrics_block, add_block);
+
+static metrics_block *
+get_block(void){
+    uint64_t unset = 0;
+
+    if (own_block == NULL){
+	own_block = (metrics_block *) mexpr_registry_register(&registry);
+	__atomic_compare_exchange_n(&epoch_ns, &unset, now_ns(), false,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+    return own_block;
+}
+
+static int
+bucket_index(uint64_t v){
+    int e;
+
+    if (v < (1u << MEXPR_HIST_SUB_BITS))
+	return (int) v;
+
+    e = 63 - __builtin_clzll(v);
+
+    return ((e - MEXPR_HIST_SUB_BITS + 1) << MEXPR_HIST_SUB_BITS) +
+	(int) ((v >> (e - MEXPR_HIST_SUB_BITS)) &
+	       ((1u << MEXPR_HIST_SUB_BITS) - 1));
+}
+
+/* The largest value of the bucket */
+static uint64_t
+bucket_upper(int i){
+    int shift = (i >> MEXPR_HIST_SUB_BITS) - 1;
+    uint64_t sub = i & ((1u << MEXPR_HIST_SUB_BITS) - 1);
+
+    if (shift <= 0)
+	return (uint64_t) i;
+
+    return (((1ull << MEXPR_HIST_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+static void
+record_latency(mexpr_histogram *h, uint64_t start){
+    uint64_t ns = now_ns() - start;
+
+    increment(&h->count);
+    __atomic_store_n(&h->total_ns, h->total_ns + ns, __ATOMIC_RELAXED);
+    if (ns > h->max_ns)
+	__atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+    increment(&h->buckets[bucket_index(ns)]);
+}
+
+uint64_t
+mexpr_metrics_begin(void){
+    return __atomic_load_n(&timing, __ATOMIC_RELAXED) ? now_ns() : 0;
+}
+
+void
+mexpr_metrics_parse(mexpr_error error, uint64_t start){
+    metrics_block *b = get_block();
+
+    increment(&b->parses);
+    if (error != MEXPR_OK)
+	increment(&b->parse_failures[error]);
+    if (start != 0)
+	record_latency(&b->parse_latency, start);
+}
+
+void
+mexpr_metrics_evaluation(mexpr_error error, uint64_t start){
+    metrics_block *b = get_block();
+
+    increment(&b->evaluations);
+    if (error != MEXPR_OK)
+	increment(&b->eval_failures[error]);
+    if (start != 0)
+	record_latency(&b->eval_latency, start);
+}
+
+void
+mexpr_metrics_cache(bool hit){
+    metrics_block *b = get_block();
+
+    increment(hit ? &b->cache_hits : &b->cache_misses);
+}
+
+void
+mexpr_metrics_set_timing(bool enabled){
+    __atomic_store_n(&timing, enabled, __ATOMIC_RELAXED);
+}
+
+void
+mexpr_metrics_snapshot(mexpr_metrics *m){
+    metrics_block *sum;
+    uint64_t start;
+
+    sum = (metrics_block *) mexpr_realloc(NULL,
+					  sizeof(metrics_block),
+					  MEXPR_ALLOC_COUNTERS);
+    (void) mexpr_registry_sum(&registry, sum);
+    start = __atomic_load_n(&epoch_ns, __ATOMIC_RELAXED);
+
+    memset(m, 0, sizeof(mexpr_metrics));
+    m->elapsed_sec = start == 0 ? 0 : (now_ns() - start) / 1e9;
+    m->parses = sum->parses;
+    m->evaluations = sum->evaluations;
+    if (m->elapsed_sec > 0){
+	m->parses_per_sec = m->parses / m->elapsed_sec;
+	m->evaluations_per_sec = m->evaluations / m->elapsed_sec;
+    }
+    memcpy(m->parse_failures, sum->parse_failures,
+	   sizeof(m->parse_failures));
+    memcpy(m->eval_failures, sum->eval_failures, sizeof(m->eval_failures));
+    m->cache_hits = sum->cache_hits;
+    m->cache_misses = sum->cache_misses;
+    m->parse_latency = sum->parse_latency;
+    m->eval_latency = sum->eval_latency;
+
+    mexpr_free(sum);
+}
+
+void
+mexpr_metrics_reset(void){
+    __atomic_store_n(&epoch_ns, mexpr_registry_reset(&registry) > 0 ?
+		     now_ns() : 0, __ATOMIC_RELAXED);
+}
+
+uint64_t
+mexpr_histogram_quantile(const mexpr_histogram *h, double quantile){
+    uint64_t rank, seen = 0, upper;
+    int i;
+
+    if (h->count == 0)
+	return 0;
+
+    /* The rank of the value, counted from 1 */
+    rank = (uint64_t) (quantile * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    if (rank > h->count)
+	rank = h->count;
+
+    for (i = 0; i < MEXPR_HIST_BUCKETS; i++){
+	seen += h->buckets[i];
+	if (seen >= rank)
+	    break;
+    }
+    assert(i < MEXPR_HIST_BUCKETS);
+
+    upper = bucket_upper(i);
+
+    return upper < h->max_ns ? upper : h->max_ns;
+}
+
+/* The causes from 'first' to 'last' */
+static void
+print_failures(FILE *fp, const char *name, const char *help,
+	       const uint64_t *failures, mexpr_error first, mexpr_error last){
+    int i;
+
+    fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (i = first; i <= (int) last; i++)
+	fprintf(fp, "%s{cause=\"%s\"} %llu\n", name,
+		mexpr_error_name((mexpr_error) i),
+		(unsigned long long) failures[i]);
+}
+
+/* A summary, of which quantiles are in seconds */
+static void
+print_latency(FILE *fp, const char *name, const char *help,
+	      const mexpr_histogram *h){
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    size_t i;
+
+    fprintf(fp, "# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+    for (i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+	fprintf(fp, "%s{quantile=\"%g\"} %.9f\n", name, quantiles[i],
+		mexpr_histogram_quantile(h, quantiles[i]) / 1e9);
+    fprintf(fp, "%s_sum %.9f\n", name, h->total_ns / 1e9);
+    fprintf(fp, "%s_count %llu\n", name, (unsigned long long) h->count);
+}
+
+static void
+print_counter(FILE *fp, const char *name, const char *help,
+	      uint64_t value){
+    fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+	    name, help, name, name, (unsigned long long) value);
+}
+
+void
+mexpr_metrics_print_prometheus(const mexpr_metrics *m, FILE *fp){
+    print_counter(fp, "mexpr_parses_total",
+		  "Expressions parsed, including failures", m->parses);
+    print_failures(fp, "mexpr_parse_failures_total",
+		   "Parses failed by cause", m->parse_failures,
+		   MEXPR_ERR_SYNTAX, MEXPR_ERR_REWINDS);
+    print_counter(fp, "mexpr_evaluations_total",
+		  "Trees evaluated, including failures", m->evaluations);
+    print_failures(fp, "mexpr_evaluation_failures_total",
+		   "Evaluations failed by cause", m->eval_failures,
+		   MEXPR_ERR_EVALUATION, MEXPR_ERR_EVAL_NODES);
+    print_counter(fp, "mexpr_compile_cache_hits_total",
+		  "Compiled rule sets loaded from the cache", m->cache_hits);
+    print_counter(fp, "mexpr_compile_cache_misses_total",
+		  "Compiled rule sets built by the compiler", m->cache_misses);
+    print_latency(fp, "mexpr_parse_latency_seconds",
+		  "Latency of parses", &m->parse_latency);
+    print_latency(fp, "mexpr_evaluation_latency_seconds",
+		  "Latency of evaluations", &m->eval_latency);
+}
+
+bool
+mexpr_metrics_write_prometheus(const char *path){
+    char tmp_path[PATH_LEN];
+    mexpr_metrics *m;
+    FILE *fp;
+    bool ok;
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >=
+	(int) sizeof(tmp_path))
+	return false;
+
+    if ((fp = fopen(tmp_path, "w")) == NULL){
+	perror("fopen");
+	return false;
+    }
+
+    m = (mexpr_metrics *) mexpr_realloc(NULL,
+					sizeof(mexpr_metrics),
+					MEXPR_ALLOC_COUNTERS);
+    mexpr_metrics_snapshot(m);
+    mexpr_metrics_print_prometheus(m, fp);
+    mexpr_free(m);
+
+    ok = !ferror(fp);
+    if (fclose(fp) != 0)
+	ok = false;
+    if (ok && rename(tmp_path, path) != 0){
+	perror("rename");
+	ok = false;
+    }
+    if (!ok)
+	unlink(tmp_path);
+
+    return ok;
+}
+
+static void *
+exporter_main(void *arg){
+    struct timespec deadline;
+    int err;
+
+    (void) arg;
+
+    /* Write once more on the stop, even before the first interval */
+    pthread_mutex_lock(&exporter.lock);
+    for (;;){
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += exporter.interval_ms / 1000;
+	deadline.tv_nsec += (long) (exporter.interval_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000){
+	    deadline.tv_sec++;
+	    deadline.tv_nsec -= 1000000000;
+	}
+
+	err = 0;
+	while (!exporter.stopping && err != ETIMEDOUT)
+	    err = pthread_cond_timedwait(&exporter.cond, &exporter.lock,
+					 &deadline);
+
+	mexpr_metrics_write_prometheus(exporter.path);
+	if (exporter.stopping)
+	    break;
+    }
+    pthread_mutex_unlock(&exporter.lock);
+
+    return NULL;
+}
+
+bool
+mexpr_metrics_exporter_start(const char *path, unsigned interval_ms){
+    assert(interval_ms > 0);
+
+    pthread_mutex_lock(&exporter.lock);
+    if (exporter.running || strlen(path) >= sizeof(exporter.path)){
+	pthread_mutex_unlock(&exporter.lock);
+	return false;
+    }
+    strcpy(exporter.path, path);
+    exporter.interval_ms = interval_ms;
+    exporter.stopping = false;
+
+    if (pthread_create(&exporter.thread, NULL, exporter_main, NULL) != 0){
+	perror("pthread_create");
+	pthread_mutex_unlock(&exporter.lock);
+	return false;
+    }
+    exporter.running = true;
+    pthread_mutex_unlock(&exporter.lock);
+
+    return true;
+}
+
+void
+mexpr_metrics_exporter_stop(void){
+    pthread_mutex_lock(&exporter.lock);
+    if (!exporter.running){
+	pthread_mutex_unlock(&exporter.lock);
+	return;
+    }
+    exporter.stopping = true;
+    pthread_cond_signal(&exporter.cond);
+    pthread_mutex_unlock(&exporter.lock);
+
+    pthread_join(exporter.thread, NULL);
+
+    pthread_mutex_lock(&exporter.lock);
+    exporter.running = false;
+    pthread_mutex_unlock(&exporter.lock);
+}
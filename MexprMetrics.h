@@ -0,0 +1,109 @@
+#ifndef __MEXPR_METRICS__
+#define __MEXPR_METRICS__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "MexprBudget.h"
+
+/*
+ * Operational metrics of the library.
+ *
+ * build_mathexpr_tree() counts the parses, evaluate_tree() the
+ * evaluations, both with their failures by mexpr_error, and
+ * rule_set_compile() the hits and misses of its shared object cache.
+ * build_mathexpr_tree_any() counts one parse for all the parsers it
+ * tries, with the outcome of the last one.
+ * Each thread writes its own counters without locks nor atomic
+ * read-modify-write. The counters of all threads, including exited
+ * ones, are summed up on read.
+ *
+ * The latency histograms need two clock reads per parse and per
+ * evaluation, so they are recorded only after
+ * mexpr_metrics_set_timing(true).
+ */
+
+/*
+ * Log-linear buckets in nanoseconds, as HDR histograms do : values
+ * below 8 have one bucket each, and every power of two above is
+ * split into 8 buckets, so that any value is within 12.5% of the
+ * bounds of its bucket.
+ */
+#define MEXPR_HIST_SUB_BITS 3
+#define MEXPR_HIST_BUCKETS ((64 - MEXPR_HIST_SUB_BITS + 1) << MEXPR_HIST_SUB_BITS)
+
+typedef struct mexpr_histogram {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[MEXPR_HIST_BUCKETS];
+} mexpr_histogram;
+
+typedef struct mexpr_metrics {
+    /* The time since the first record or the last reset */
+    double elapsed_sec;
+
+    /* Including the failed ones */
+    uint64_t parses;
+    uint64_t evaluations;
+    double parses_per_sec;
+    double evaluations_per_sec;
+
+    /*
+     * Failures by cause. MEXPR_ERR_EVALUATION is the type error of
+     * operands. Index MEXPR_OK is always zero.
+     */
+    uint64_t parse_failures[MEXPR_ERRORS];
+    uint64_t eval_failures[MEXPR_ERRORS];
+
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+
+    mexpr_histogram parse_latency;
+    mexpr_histogram eval_latency;
+} mexpr_metrics;
+
+/* The sum of the counters of all threads */
+void mexpr_metrics_snapshot(mexpr_metrics *m);
+
+/* Clear the counters of all threads. Call it while nothing is recorded */
+void mexpr_metrics_reset(void);
+
+/* Record the latencies or not. Off by default */
+void mexpr_metrics_set_timing(bool enabled);
+
+/*
+ * The upper bound of the bucket under which 'quantile' (0 to 1) of
+ * the values fall, clamped to the maximum. Return 0 for no values.
+ */
+uint64_t mexpr_histogram_quantile(const mexpr_histogram *h, double quantile);
+
+/* Write the snapshot in the Prometheus text format */
+void mexpr_metrics_print_prometheus(const mexpr_metrics *m, FILE *fp);
+
+/*
+ * Write the current snapshot to 'path' in the Prometheus text format.
+ * The file is written under a temporary name and renamed, so that the
+ * collectors never read a partial file. Return false on any error.
+ */
+bool mexpr_metrics_write_prometheus(const char *path);
+
+/*
+ * Write the file every 'interval_ms' milliseconds from a background
+ * thread until mexpr_metrics_exporter_stop(), which writes it once
+ * more. Only one exporter runs at a time. Return false if it is
+ * already running or the thread can't be created.
+ */
+bool mexpr_metrics_exporter_start(const char *path, unsigned interval_ms);
+void mexpr_metrics_exporter_stop(void);
+
+/*
+ * Used by the instrumentation. mexpr_metrics_begin() returns zero
+ * if the timing is off, which the records take as no latency.
+ */
+uint64_t mexpr_metrics_begin(void);
+void mexpr_metrics_parse(mexpr_error error, uint64_t start);
+void mexpr_metrics_evaluation(mexpr_error error, uint64_t start);
+void mexpr_metrics_cache(bool hit);
+
+#endif
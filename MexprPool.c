@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "MexprPool.h"
+
+typedef struct pool_worker {
+    pthread_t thread;
+    int id;
+    struct mexpr_pool *pool;
+
+    /* The tasks [begin, end) not taken yet. Protected by 'lock' */
+    pthread_mutex_t lock;
+    size_t begin;
+    size_t end;
+} pool_worker;
+
+struct mexpr_pool {
+    int nworkers;
+    pool_worker *workers;
+
+    /* Protect the members below */
+    pthread_mutex_t lock;
+    pthread_cond_t job_started;
+    pthread_cond_t job_done;
+
+    /* Incremented for each job so that workers notice a new job */
+    unsigned long generation;
+
+    /* The number of workers that haven't finished the current job */
+    int running;
+    bool shutdown;
+
+    mexpr_task task;
+    void *arg;
+};
+
+/* Take the first task of the worker's own range */
+static bool
+take_own_task(pool_worker *w, size_t *index){
+    bool found = false;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->begin < w->end){
+	*index = w->begin++;
+	found = true;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return found;
+}
+
+/*
+ * Steal the latter half of the remaining tasks of another worker.
+ * Run the first stolen task and keep the others as own range.
+ */
+static bool
+steal_task(pool_worker *w, size_t *index){
+    mexpr_pool *pool = w->pool;
+    size_t mid, end;
+    pool_worker *victim;
+    int i;
+
+    for (i = 1; i < pool->nworkers; i++){
+	victim = &pool->workers[(w->id + i) % pool->nworkers];
+
+	pthread_mutex_lock(&victim->lock);
+	if (victim->begin >= victim->end){
+	    pthread_mutex_unlock(&victim->lock);
+	    continue;
+	}
+	mid = victim->begin + (victim->end - victim->begin) / 2;
+	end = victim->end;
+	victim->end = mid;
+	pthread_mutex_unlock(&victim->lock);
+
+	pthread_mutex_lock(&w->lock);
+	w->begin = mid + 1;
+	w->end = end;
+	pthread_mutex_unlock(&w->lock);
+
+	*index = mid;
+	return true;
+    }
+
+    return false;
+}
+
+static void *
+pool_worker_main(void *arg){
+    pool_worker *w = (pool_worker *) arg;
+    mexpr_pool *pool = w->pool;
+    unsigned long seen = 0;
+    size_t index;
+
+    while (true){
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->shutdown && pool->generation == seen)
+	    pthread_cond_wait(&pool->job_started, &pool->lock);
+	if (pool->shutdown){
+	    pthread_mutex_unlock(&pool->lock);
+	    break;
+	}
+	seen = pool->generation;
+	pthread_mutex_unlock(&pool->lock);
+
+	while (take_own_task(w, &index) || steal_task(w, &index))
+	    pool->task(index, w->id, pool->arg);
+
+	pthread_mutex_lock(&pool->lock);
+	if (--pool->running == 0)
+	    pthread_cond_signal(&pool->job_done);
+	pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+mexpr_pool *
+mexpr_pool_create(int nworkers){
+    mexpr_pool *pool;
+    int i;
+
+    assert(nworkers > 0);
+
+    if ((pool = (mexpr_pool *) malloc(sizeof(mexpr_pool))) == NULL ||
+	(pool->workers = (pool_worker *) malloc(sizeof(pool_worker) *
+						nworkers)) == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    pool->nworkers = nworkers;
+    pool->generation = 0;
+    pool->running = 0;
+    pool->shutdown = false;
+    pool->task = NULL;
+    pool->arg = NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_started, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+
+    for (i = 0; i < nworkers; i++){
+	pool_worker *w = &pool->workers[i];
+
+	w->id = i;
+	w->pool = pool;
+	w->begin = w->end = 0;
+	pthread_mutex_init(&w->lock, NULL);
+	if (pthread_create(&w->thread, NULL, pool_worker_main, w) != 0){
+	    perror("pthread_create");
+	    exit(-1);
+	}
+    }
+
+    return pool;
+}
+
+void
+mexpr_pool_destroy(mexpr_pool *pool){
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->job_started);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->nworkers; i++){
+	pthread_join(pool->workers[i].thread, NULL);
+	pthread_mutex_destroy(&pool->workers[i].lock);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->job_started);
+    pthread_cond_destroy(&pool->job_done);
+    free(pool->workers);
+    free(pool);
+}
+
+int
+mexpr_pool_size(mexpr_pool *pool){
+    return pool->nworkers;
+}
+
+/*
+ * Run 'task' for each index in [0, ntasks) and wait for all of them.
+ * Only one job can run at a time on one pool.
+ */
+void
+mexpr_pool_run(mexpr_pool *pool, size_t ntasks, mexpr_task task,
+	       void *arg){
+    size_t per_worker, rest, begin = 0;
+    int i;
+
+    if (ntasks == 0)
+	return;
+
+    per_worker = ntasks / pool->nworkers;
+    rest = ntasks % pool->nworkers;
+
+    /* No worker is running. So, the ranges can be set without lock */
+    for (i = 0; i < pool->nworkers; i++){
+	pool->workers[i].begin = begin;
+	begin += per_worker + (i < (int) rest ? 1 : 0);
+	pool->workers[i].end = begin;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    pool->running = pool->nworkers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->job_started);
+    while (pool->running > 0)
+	pthread_cond_wait(&pool->job_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
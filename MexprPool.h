@@ -0,0 +1,28 @@
+#ifndef __MEXPR_POOL__
+#define __MEXPR_POOL__
+
+#include <stddef.h>
+
+/*
+ * Thread pool that runs the tasks of one job with work stealing.
+ *
+ * The tasks of a job are numbered from zero and split evenly among
+ * the workers. A worker that runs out of its tasks steals the half
+ * of the remaining tasks of another worker. The threads stay alive
+ * until the pool is destroyed, so that the pool can run many jobs.
+ */
+typedef struct mexpr_pool mexpr_pool;
+
+/*
+ * Task of job. 'index' is the task number and 'worker' is the
+ * number of the worker running it, between zero and the pool size.
+ */
+typedef void (*mexpr_task)(size_t index, int worker, void *arg);
+
+mexpr_pool *mexpr_pool_create(int nworkers);
+void mexpr_pool_destroy(mexpr_pool *pool);
+int mexpr_pool_size(mexpr_pool *pool);
+void mexpr_pool_run(mexpr_pool *pool, size_t ntasks,
+		    mexpr_task task, void *arg);
+
+#endif
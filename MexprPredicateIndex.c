@@ -0,0 +1,316 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprAlloc.h"
+#include "MexprPredicateIndex.h"
+
+/* Operators of atomic predicates, normalized to 'var op const' */
+enum {
+    ATOM_GE,
+    ATOM_LE,
+    ATOM_GT,
+    ATOM_LT,
+    ATOM_NEQ,
+    ATOM_EQ,
+    ATOM_KINDS
+};
+
+typedef struct atom {
+    double threshold;
+    int rule;
+} atom;
+
+typedef struct atom_list {
+    int natoms;
+    int capacity;
+    atom *atoms;
+
+    /* Sorted by 'threshold' lazily at the next probe */
+    bool sorted;
+} atom_list;
+
+typedef struct var_atoms {
+    atom_list lists[ATOM_KINDS];
+} var_atoms;
+
+struct predicate_index {
+    int nvars;
+    var_atoms *vars;
+
+    /* Per rule. 'required' is zero for the rules not indexed */
+    int nrules;
+    int *required;
+    int *satisfied;
+
+    /* The rules whose 'satisfied' is not zero */
+    int ntouched;
+    int *touched;
+};
+
+predicate_index *
+predicate_index_create(void){
+    predicate_index *pi;
+
+    pi = (predicate_index *) mexpr_realloc(NULL,
+					   sizeof(predicate_index),
+					   MEXPR_ALLOC_RULES);
+    memset(pi, 0, sizeof(predicate_index));
+
+    return pi;
+}
+
+void
+predicate_index_destroy(predicate_index *pi){
+    int i, k;
+
+    for (i = 0; i < pi->nvars; i++){
+	for (k = 0; k < ATOM_KINDS; k++)
+	    mexpr_free(pi->vars[i].lists[k].atoms);
+    }
+    mexpr_free(pi->vars);
+    mexpr_free(pi->required);
+    mexpr_free(pi->satisfied);
+    mexpr_free(pi->touched);
+    mexpr_free(pi);
+}
+
+static int
+atom_kind(int node_id, bool flipped){
+    switch(node_id){
+	case GREATER_THAN_OR_EQUAL_TO:
+	    return flipped ? ATOM_LE : ATOM_GE;
+	case LESS_THAN_OR_EQUAL_TO:
+	    return flipped ? ATOM_GE : ATOM_LE;
+	case GREATER_THAN:
+	    return flipped ? ATOM_LT : ATOM_GT;
+	case LESS_THAN:
+	    return flipped ? ATOM_GT : ATOM_LT;
+	case NEQ:
+	    return ATOM_NEQ;
+	case EQ:
+	    return ATOM_EQ;
+	default:
+	    return -1;
+    }
+}
+
+static bool
+is_leaf(tr_node *n){
+    return n->left == NULL && n->right == NULL;
+}
+
+static bool
+is_number(tr_node *n){
+    return is_leaf(n) && (n->node_id == INT || n->node_id == DOUBLE);
+}
+
+static bool
+is_variable(tr_node *n){
+    return is_leaf(n) && n->node_id == VARIABLE;
+}
+
+/* Return true if the subtree is a conjunction of atomic predicates */
+static bool
+is_indexable(tr_node *n){
+    if (n->node_id == AND)
+	return is_indexable(n->left) && is_indexable(n->right);
+
+    if (atom_kind(n->node_id, false) < 0)
+	return false;
+
+    return (is_variable(n->left) && is_number(n->right)) ||
+	(is_number(n->left) && is_variable(n->right));
+}
+
+static void
+add_atom(predicate_index *pi, int var, int kind, double threshold, int rule){
+    atom_list *list;
+
+    if (var >= pi->nvars){
+	pi->vars = (var_atoms *) mexpr_realloc(pi->vars,
+					       sizeof(var_atoms) * (var + 1),
+					       MEXPR_ALLOC_RULES);
+	memset(&pi->vars[pi->nvars], 0,
+	       sizeof(var_atoms) * (var + 1 - pi->nvars));
+	pi->nvars = var + 1;
+    }
+
+    list = &pi->vars[var].lists[kind];
+    if (list->natoms == list->capacity){
+	list->capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+	list->atoms = (atom *) mexpr_realloc(list->atoms,
+					     sizeof(atom) * list->capacity,
+					     MEXPR_ALLOC_RULES);
+    }
+    list->atoms[list->natoms].threshold = threshold;
+    list->atoms[list->natoms].rule = rule;
+    list->natoms++;
+    list->sorted = false;
+}
+
+static int
+add_atoms(predicate_index *pi, int rule, tr_node *n,
+	  int (*var_id_cb)(char *, void *), void *data){
+    bool flipped;
+    tr_node *var, *num;
+
+    if (n->node_id == AND)
+	return add_atoms(pi, rule, n->left, var_id_cb, data) +
+	    add_atoms(pi, rule, n->right, var_id_cb, data);
+
+    flipped = is_number(n->left);
+    var = flipped ? n->right : n->left;
+    num = flipped ? n->left : n->right;
+
+    add_atom(pi, var_id_cb(var->unv.vval.vname, data),
+	     atom_kind(n->node_id, flipped),
+	     num->node_id == INT ? (double) num->unv.ival : num->unv.dval,
+	     rule);
+
+    return 1;
+}
+
+bool
+predicate_index_add(predicate_index *pi, int rule, tree *t,
+		    int (*var_id_cb)(char *, void *), void *data){
+    int old = pi->nrules;
+
+    assert(rule >= 0);
+
+    if (!is_indexable(t->root))
+	return false;
+
+    if (rule >= pi->nrules){
+	pi->nrules = rule + 1;
+	pi->required = (int *) mexpr_realloc(pi->required,
+					     sizeof(int) * pi->nrules,
+					     MEXPR_ALLOC_RULES);
+	pi->satisfied = (int *) mexpr_realloc(pi->satisfied,
+					      sizeof(int) * pi->nrules,
+					      MEXPR_ALLOC_RULES);
+	pi->touched = (int *) mexpr_realloc(pi->touched,
+					    sizeof(int) * pi->nrules,
+					    MEXPR_ALLOC_RULES);
+	memset(&pi->required[old], 0, sizeof(int) * (pi->nrules - old));
+	memset(&pi->satisfied[old], 0, sizeof(int) * (pi->nrules - old));
+    }
+
+    assert(pi->required[rule] == 0);
+    pi->required[rule] = add_atoms(pi, rule, t->root, var_id_cb, data);
+
+    return true;
+}
+
+static int
+compare_atoms(const void *a, const void *b){
+    double x = ((const atom *) a)->threshold, y = ((const atom *) b)->threshold;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* The first atom whose threshold is not less than 'v' */
+static int
+lower_bound(atom_list *list, double v){
+    int lo = 0, hi = list->natoms, mid;
+
+    while (lo < hi){
+	mid = lo + (hi - lo) / 2;
+	if (list->atoms[mid].threshold < v)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+/* The first atom whose threshold is greater than 'v' */
+static int
+upper_bound(atom_list *list, double v){
+    int lo = 0, hi = list->natoms, mid;
+
+    while (lo < hi){
+	mid = lo + (hi - lo) / 2;
+	if (list->atoms[mid].threshold <= v)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    return lo;
+}
+
+/* Satisfy the atoms [begin, end) of the list */
+static void
+satisfy(predicate_index *pi, atom_list *list, int begin, int end){
+    int i, rule;
+
+    for (i = begin; i < end; i++){
+	rule = list->atoms[i].rule;
+	if (pi->satisfied[rule]++ == 0)
+	    pi->touched[pi->ntouched++] = rule;
+    }
+}
+
+void
+predicate_index_probe(predicate_index *pi, int var, tr_node *value){
+    atom_list *lists;
+    double v;
+    int k;
+
+    if (var < 0 || var >= pi->nvars)
+	return;
+
+    /* Comparisons of BOOLEAN fail */
+    if (value->node_id != INT && value->node_id != DOUBLE)
+	return;
+
+    lists = pi->vars[var].lists;
+    for (k = 0; k < ATOM_KINDS; k++){
+	if (!lists[k].sorted){
+	    qsort(lists[k].atoms, lists[k].natoms, sizeof(atom), compare_atoms);
+	    lists[k].sorted = true;
+	}
+    }
+
+    v = value->node_id == INT ? (double) value->unv.ival : value->unv.dval;
+
+    /* NaN is unequal to everything, and the others are all false */
+    if (isnan(v)){
+	satisfy(pi, &lists[ATOM_NEQ], 0, lists[ATOM_NEQ].natoms);
+	return;
+    }
+
+    /* v >= c and v > c hold for the smaller thresholds */
+    satisfy(pi, &lists[ATOM_GE], 0, upper_bound(&lists[ATOM_GE], v));
+    satisfy(pi, &lists[ATOM_GT], 0, lower_bound(&lists[ATOM_GT], v));
+
+    /* v <= c and v < c hold for the larger ones */
+    satisfy(pi, &lists[ATOM_LE], lower_bound(&lists[ATOM_LE], v),
+	    lists[ATOM_LE].natoms);
+    satisfy(pi, &lists[ATOM_LT], upper_bound(&lists[ATOM_LT], v),
+	    lists[ATOM_LT].natoms);
+
+    satisfy(pi, &lists[ATOM_EQ], lower_bound(&lists[ATOM_EQ], v),
+	    upper_bound(&lists[ATOM_EQ], v));
+    satisfy(pi, &lists[ATOM_NEQ], 0, lower_bound(&lists[ATOM_NEQ], v));
+    satisfy(pi, &lists[ATOM_NEQ], upper_bound(&lists[ATOM_NEQ], v),
+	    lists[ATOM_NEQ].natoms);
+}
+
+void
+predicate_index_collect(predicate_index *pi, bool *matched){
+    int i, rule;
+
+    for (i = 0; i < pi->ntouched; i++){
+	rule = pi->touched[i];
+	if (pi->satisfied[rule] == pi->required[rule])
+	    matched[rule] = true;
+	pi->satisfied[rule] = 0;
+    }
+    pi->ntouched = 0;
+}
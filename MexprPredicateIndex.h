@@ -0,0 +1,46 @@
+#ifndef __MEXPR_PREDICATE_INDEX__
+#define __MEXPR_PREDICATE_INDEX__
+
+#include <stdbool.h>
+#include "MexprTree.h"
+
+/*
+ * Index of simple rules.
+ *
+ * A rule is indexable when it's an atomic predicate 'var op const'
+ * (or 'const op var') with op one of >=, <=, >, <, != and = and
+ * an INT or DOUBLE constant, or a conjunction of them by 'and'.
+ * The thresholds of atomic predicates are kept in sorted arrays per
+ * variable and operator. So, the value of a variable finds all the
+ * predicates that it satisfies by binary search, and a rule matches
+ * when all of its predicates are satisfied.
+ *
+ * The results are the same as evaluate_tree() : BOOLEAN values and
+ * unassigned variables don't satisfy any predicate, and NaN only
+ * satisfies '!='.
+ */
+typedef struct predicate_index predicate_index;
+
+predicate_index *predicate_index_create(void);
+void predicate_index_destroy(predicate_index *pi);
+
+/*
+ * Add the tree of 'rule' if it's indexable. 'var_id_cb' returns
+ * the id of the named variable, which is from zero and is given to
+ * predicate_index_probe(). Return false if the rule isn't indexable,
+ * in which case nothing is added.
+ */
+bool predicate_index_add(predicate_index *pi, int rule, tree *t,
+			 int (*var_id_cb)(char *, void *), void *data);
+
+/* Feed the value of each assigned variable of the record */
+void predicate_index_probe(predicate_index *pi, int var, tr_node *value);
+
+/*
+ * Set true to 'matched[rule]' for the rules whose predicates are all
+ * satisfied by the probed values, and reset the index for the next
+ * record. 'matched' of the other rules is left as it is.
+ */
+void predicate_index_collect(predicate_index *pi, bool *matched);
+
+#endif
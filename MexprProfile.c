@@ -0,0 +1,239 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+#include "MexprAlloc.h"
+#include "MexprProfile.h"
+
+typedef struct profile_entry {
+    node_profile prof;
+
+    /* Indexes of the operands, -1 when not used */
+    int left;
+    int right;
+    int depth;
+} profile_entry;
+
+struct tree_profile {
+    tree *t;
+
+    int nentries;
+    profile_entry *entries;
+
+    /* The cycles of one read of the counter */
+    uint64_t overhead;
+};
+
+static inline uint64_t
+read_cycles(void){
+#if defined(__x86_64__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r" (v));
+
+    return v;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* Add the entries of the subtree in preorder */
+static int
+add_entries(tree_profile *p, tr_node *n, int depth){
+    profile_entry *e;
+    int i, left, right;
+
+    p->entries = (profile_entry *) mexpr_realloc(p->entries,
+						 sizeof(profile_entry) * (p->nentries + 1),
+						 MEXPR_ALLOC_CODE);
+    i = p->nentries++;
+    memset(&p->entries[i], 0, sizeof(profile_entry));
+    p->entries[i].prof.node = n;
+    p->entries[i].depth = depth;
+
+    left = n->left != NULL ? add_entries(p, n->left, depth + 1) : -1;
+    right = n->right != NULL ? add_entries(p, n->right, depth + 1) : -1;
+
+    e = &p->entries[i];
+    e->left = left;
+    e->right = right;
+
+    return i;
+}
+
+/* The minimum cycles between two reads of the counter */
+static uint64_t
+measure_overhead(void){
+    uint64_t min = UINT64_MAX, t0, t1;
+    int i;
+
+    for (i = 0; i < 1000; i++){
+	t0 = read_cycles();
+	t1 = read_cycles();
+	if (t1 - t0 < min)
+	    min = t1 - t0;
+    }
+
+    return min;
+}
+
+tree_profile *
+profile_create(tree *t){
+    tree_profile *p;
+
+    assert(t != NULL && t->root != NULL);
+
+    p = (tree_profile *) mexpr_realloc(NULL,
+				       sizeof(tree_profile), MEXPR_ALLOC_CODE);
+    memset(p, 0, sizeof(tree_profile));
+    p->t = t;
+    add_entries(p, t->root, 0);
+    p->overhead = measure_overhead();
+
+    return p;
+}
+
+void
+profile_destroy(tree_profile *p){
+    mexpr_free(p->entries);
+    mexpr_free(p);
+}
+
+/*
+ * Evaluate the subtree of the entry in the same way as evaluate_node()
+ * and return its cycles. '*value' gets NULL on failure.
+ */
+static uint64_t
+profile_node_eval(tree_profile *p, int i, tr_node **value){
+    profile_entry *e = &p->entries[i];
+    tr_node *n = e->prof.node, *l = NULL, *r = NULL;
+    uint64_t start, total, children = 0;
+
+    e->prof.hits++;
+    start = read_cycles();
+
+    if (e->left < 0 && e->right < 0)
+	*value = n->node_id == VARIABLE ? n->unv.vval.vdata : n;
+    else{
+	children += profile_node_eval(p, e->left, &l);
+	if (l != NULL && e->right >= 0)
+	    children += profile_node_eval(p, e->right, &r);
+
+	if (l == NULL || (e->right >= 0 && r == NULL))
+	    *value = NULL;
+	else{
+	    *value = apply_operator(n, l, r, p->t);
+	    if (p->t->computation_failed)
+		*value = NULL;
+	}
+    }
+
+    total = read_cycles() - start;
+    total = total > p->overhead ? total - p->overhead : 0;
+
+    e->prof.total_cycles += total;
+    e->prof.self_cycles += total > children ? total - children : 0;
+
+    return total;
+}
+
+void
+profile_evaluate(tree_profile *p, tr_node *top){
+    tree *t = p->t;
+    tr_node *result;
+
+    if (t->require_resolution && !t->resolved){
+	evaluate_tree(t, top);
+	return;
+    }
+
+    tree_partial_eval_begin(t);
+
+    profile_node_eval(p, 0, &result);
+    if (result == NULL)
+	t->computation_failed = true;
+
+    if (tree_eval_end(t))
+	tree_set_top(top, result->node_id, result->unv);
+}
+
+int
+profile_node_count(tree_profile *p){
+    return p->nentries;
+}
+
+node_profile *
+profile_node(tree_profile *p, int i){
+    assert(i >= 0 && i < p->nentries);
+
+    return &p->entries[i].prof;
+}
+
+void
+profile_reset(tree_profile *p){
+    int i;
+
+    for (i = 0; i < p->nentries; i++){
+	p->entries[i].prof.hits = 0;
+	p->entries[i].prof.total_cycles = 0;
+	p->entries[i].prof.self_cycles = 0;
+    }
+}
+
+static void
+print_label(FILE *fp, tr_node *n){
+    if (n->left != NULL || n->right != NULL){
+	fprintf(fp, "%s", n->unv.operator);
+	return;
+    }
+
+    switch(n->node_id){
+	case VARIABLE:
+	    fprintf(fp, "%s", n->unv.vval.vname);
+	    break;
+	case INT:
+	    fprintf(fp, "%d", n->unv.ival);
+	    break;
+	case DOUBLE:
+	    fprintf(fp, "%g", n->unv.dval);
+	    break;
+	case BOOLEAN:
+	    fprintf(fp, "%s", n->unv.bval ? "true" : "false");
+	    break;
+	default:
+	    fprintf(fp, "?");
+	    break;
+    }
+}
+
+void
+profile_dump(tree_profile *p, FILE *fp){
+    uint64_t whole = p->entries[0].prof.total_cycles;
+    profile_entry *e;
+    int i;
+
+    fprintf(fp, "%12s %14s %8s  %s\n", "hits", "self cycles", "total", "node");
+    for (i = 0; i < p->nentries; i++){
+	e = &p->entries[i];
+	fprintf(fp, "%12lu %14lu %7.1f%%  %*s",
+		(unsigned long) e->prof.hits,
+		(unsigned long) e->prof.self_cycles,
+		whole > 0 ? 100.0 * e->prof.total_cycles / whole : 0.0,
+		e->depth * 2, "");
+	print_label(fp, e->prof.node);
+	fprintf(fp, "\n");
+    }
+}
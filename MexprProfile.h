@@ -0,0 +1,48 @@
+#ifndef __MEXPR_PROFILE__
+#define __MEXPR_PROFILE__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "MexprTree.h"
+
+/*
+ * Profiler of the nodes of one tree.
+ *
+ * profile_evaluate() evaluates the tree like evaluate_tree() and
+ * counts the hits and the cycles of each node : the time stamp
+ * counter on x86-64, the virtual counter on AArch64, or nanoseconds
+ * on the other platforms. The cost of reading the counter, measured
+ * at the creation, is subtracted from each measurement.
+ *
+ * profile_dump() prints the tree with the hits of each node, its
+ * own cycles excluding the operands, and the share of the cycles of
+ * its subtree in the whole.
+ */
+typedef struct tree_profile tree_profile;
+
+typedef struct node_profile {
+    tr_node *node;
+
+    /* The number of evaluations that reached the node */
+    uint64_t hits;
+
+    /* Cycles of the subtree, and the ones of the node itself */
+    uint64_t total_cycles;
+    uint64_t self_cycles;
+} node_profile;
+
+/* 't' must stay alive while the profile is used */
+tree_profile *profile_create(tree *t);
+void profile_destroy(tree_profile *p);
+
+/* Same as evaluate_tree() */
+void profile_evaluate(tree_profile *p, tr_node *top);
+
+/* The nodes in preorder, the root first */
+int profile_node_count(tree_profile *p);
+node_profile *profile_node(tree_profile *p, int i);
+
+void profile_reset(tree_profile *p);
+void profile_dump(tree_profile *p, FILE *fp);
+
+#endif
@@ -0,0 +1,368 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprAlloc.h"
+#include "MexprProgram.h"
+
+/*
+ * compile_typed_program() gives up and returns NULL when the result
+ * type of an operator depends on the operand values. That's min and
+ * max with INT and DOUBLE operands, which return the type of the
+ * chosen operand.
+ */
+typedef struct compile_state {
+    typed_program *prog;
+    int capacity;
+    bool value_dependent;
+    bool unknown_var;
+    int (*var_type_cb)(char *, void *);
+    void *data;
+} compile_state;
+
+static int
+emit_inst(compile_state *cs, int opcode, int type, int left, int right){
+    typed_program *prog = cs->prog;
+    typed_inst *inst;
+
+    if (prog->ninsts == cs->capacity){
+	cs->capacity = cs->capacity == 0 ? 16 : cs->capacity * 2;
+	prog->insts = (typed_inst *) mexpr_realloc(prog->insts,
+						   sizeof(typed_inst) * cs->capacity,
+						   MEXPR_ALLOC_CODE);
+    }
+
+    inst = &prog->insts[prog->ninsts];
+    inst->opcode = opcode;
+    inst->type = type;
+    inst->left = left;
+    inst->right = right;
+    inst->var = -1;
+
+    return prog->ninsts++;
+}
+
+static int
+lookup_var(compile_state *cs, char *vname){
+    typed_program *prog = cs->prog;
+    int i, type;
+
+    for (i = 0; i < prog->nvars; i++){
+	if (strcmp(prog->vars[i].vname, vname) == 0)
+	    return i;
+    }
+
+    if ((type = cs->var_type_cb(vname, cs->data)) == INVALID)
+	cs->unknown_var = true;
+
+    prog->vars = (typed_var *) mexpr_realloc(prog->vars,
+					     sizeof(typed_var) * (prog->nvars + 1),
+					     MEXPR_ALLOC_CODE);
+    prog->vars[prog->nvars].vname = vname;
+    prog->vars[prog->nvars].type = type;
+
+    return prog->nvars++;
+}
+
+static bool
+is_numeric_type(int type){
+    return type == INT || type == DOUBLE;
+}
+
+/* Convert the INT operand 'idx' into DOUBLE */
+static int
+to_double(compile_state *cs, int idx){
+    if (cs->prog->insts[idx].type == DOUBLE)
+	return idx;
+
+    return emit_inst(cs, INT_TO_DOUBLE, DOUBLE, idx, -1);
+}
+
+static int
+compile_node(compile_state *cs, tr_node *n){
+    int idx, left, right, lt, rt;
+
+    /* Leaf node */
+    if (n->left == NULL && n->right == NULL){
+	if (n->node_id == VARIABLE){
+	    int var = lookup_var(cs, n->unv.vval.vname);
+
+	    idx = emit_inst(cs, VARIABLE, cs->prog->vars[var].type, -1, -1);
+	    cs->prog->insts[idx].var = var;
+	}else{
+	    idx = emit_inst(cs, n->node_id, n->node_id, -1, -1);
+	    cs->prog->insts[idx].imm = n->unv;
+	}
+	return idx;
+    }
+
+    if (is_unary_operator(n->node_id)){
+	left = compile_node(cs, n->left);
+	lt = cs->prog->insts[left].type;
+
+	if (!is_numeric_type(lt)){
+	    cs->prog->type_error = true;
+	    return emit_inst(cs, n->node_id, DOUBLE, left, -1);
+	}
+
+	if (n->node_id == SQR)
+	    return emit_inst(cs, SQR, lt, left, -1);
+
+	return emit_inst(cs, n->node_id, DOUBLE, to_double(cs, left), -1);
+    }
+
+    assert(is_binary_operator(n->node_id));
+
+    left = compile_node(cs, n->left);
+    right = compile_node(cs, n->right);
+    lt = cs->prog->insts[left].type;
+    rt = cs->prog->insts[right].type;
+
+    switch(n->node_id){
+	case AND:
+	case OR:
+	    if (lt != BOOLEAN || rt != BOOLEAN)
+		cs->prog->type_error = true;
+	    return emit_inst(cs, n->node_id, BOOLEAN, left, right);
+	default:
+	    break;
+    }
+
+    /* The result type doesn't matter since any evaluation fails */
+    if (!is_numeric_type(lt) || !is_numeric_type(rt)){
+	cs->prog->type_error = true;
+	return emit_inst(cs, n->node_id, DOUBLE, left, right);
+    }
+
+    switch(n->node_id){
+	case PLUS:
+	case MINUS:
+	case MULTIPLY:
+	case DIVIDE:
+	case MOD:
+	    if (lt == INT && rt == INT)
+		return emit_inst(cs, n->node_id, INT, left, right);
+	    return emit_inst(cs, n->node_id, DOUBLE,
+			     to_double(cs, left), to_double(cs, right));
+	case MIN:
+	case MAX:
+	    if (lt != rt)
+		cs->value_dependent = true;
+	    return emit_inst(cs, n->node_id, lt, left, right);
+	case POW:
+	    return emit_inst(cs, POW, DOUBLE,
+			     to_double(cs, left), to_double(cs, right));
+	case GREATER_THAN_OR_EQUAL_TO:
+	case LESS_THAN_OR_EQUAL_TO:
+	case GREATER_THAN:
+	case LESS_THAN:
+	case NEQ:
+	case EQ:
+	    if (lt == rt)
+		return emit_inst(cs, n->node_id, BOOLEAN, left, right);
+	    return emit_inst(cs, n->node_id, BOOLEAN,
+			     to_double(cs, left), to_double(cs, right));
+	default:
+	    assert(0);
+	    break;
+    }
+
+    return -1;
+}
+
+/*
+ * Compile the tree into typed program.
+ *
+ * Return NULL if any variable type is unknown or the result type
+ * of any operator depends on the operand values.
+ */
+typed_program *
+compile_typed_program(tree *t, int (*var_type_cb)(char *, void *),
+		      void *data){
+    compile_state cs;
+
+    assert(t != NULL && t->root != NULL);
+
+    cs.prog = (typed_program *) mexpr_realloc(NULL,
+					      sizeof(typed_program),
+					      MEXPR_ALLOC_CODE);
+    cs.prog->ninsts = cs.prog->nvars = 0;
+    cs.prog->insts = NULL;
+    cs.prog->vars = NULL;
+    cs.prog->type_error = false;
+    cs.capacity = 0;
+    cs.value_dependent = cs.unknown_var = false;
+    cs.var_type_cb = var_type_cb;
+    cs.data = data;
+
+    (void) compile_node(&cs, t->root);
+
+    if (cs.value_dependent || cs.unknown_var){
+	destroy_typed_program(cs.prog);
+	return NULL;
+    }
+
+    return cs.prog;
+}
+
+void
+destroy_typed_program(typed_program *prog){
+    mexpr_free(prog->insts);
+    mexpr_free(prog->vars);
+    mexpr_free(prog);
+}
+
+/* Apply the arithmetic operator to the operands of the same type */
+#define TYPED_ARITHMETIC(op)					\
+    do {							\
+	if (int_operands)					\
+	    d->ival = l->ival op r->ival;			\
+	else							\
+	    d->dval = l->dval op r->dval;			\
+    } while(0)
+
+/* Apply the comparison operator to the operands of the same type */
+#define TYPED_COMPARISON(op)					\
+    do {							\
+	if (int_operands)					\
+	    d->bval = l->ival op r->ival;			\
+	else							\
+	    d->bval = l->dval op r->dval;			\
+    } while(0)
+
+/*
+ * Run the program once against the variable values 'vars', indexed
+ * same as 'vars' of the program. 'values' holds the result of each
+ * instruction and must have 'ninsts' elements. The result of the
+ * program is left in the last element.
+ *
+ * The variables must have the types of the program. Return false
+ * when the computation fails in the same way as evaluate_node().
+ */
+bool
+run_typed_program(typed_program *prog, const node_value *const *vars,
+		  node_value *values){
+    const node_value *l, *r;
+    typed_inst *inst;
+    bool int_operands;
+    node_value *d;
+    int i;
+
+    if (prog->type_error)
+	return false;
+
+    for (i = 0; i < prog->ninsts; i++){
+	inst = &prog->insts[i];
+	d = &values[i];
+	l = inst->left >= 0 ? &values[inst->left] : NULL;
+	r = inst->right >= 0 ? &values[inst->right] : NULL;
+	int_operands = l != NULL && prog->insts[inst->left].type == INT;
+
+	switch(inst->opcode){
+	    case INT:
+	    case DOUBLE:
+	    case BOOLEAN:
+		*d = inst->imm;
+		break;
+	    case VARIABLE:
+		*d = *vars[inst->var];
+		break;
+	    case INT_TO_DOUBLE:
+		d->dval = l->ival;
+		break;
+	    case SQR:
+		if (int_operands)
+		    d->ival = l->ival * l->ival;
+		else
+		    d->dval = l->dval * l->dval;
+		break;
+	    case SQRT:
+		d->dval = sqrt(l->dval);
+		break;
+	    case SIN:
+		d->dval = sin(l->dval);
+		break;
+	    case COS:
+		d->dval = cos(l->dval);
+		break;
+	    case PLUS:
+		TYPED_ARITHMETIC(+);
+		break;
+	    case MINUS:
+		TYPED_ARITHMETIC(-);
+		break;
+	    case MULTIPLY:
+		TYPED_ARITHMETIC(*);
+		break;
+	    case DIVIDE:
+		if (int_operands){
+		    if (r->ival == 0)
+			return false;
+		    d->ival = l->ival / r->ival;
+		}else{
+		    if (r->dval == 0.0)
+			return false;
+		    d->dval = l->dval / r->dval;
+		}
+		break;
+	    case MOD:
+		if (int_operands){
+		    if (r->ival == 0)
+			return false;
+		    d->ival = l->ival % r->ival;
+		}else{
+		    if (r->dval == 0.0)
+			return false;
+		    d->dval = fmod(l->dval, r->dval);
+		}
+		break;
+	    case MIN:
+		if (int_operands)
+		    d->ival = l->ival < r->ival ? l->ival : r->ival;
+		else
+		    d->dval = l->dval < r->dval ? l->dval : r->dval;
+		break;
+	    case MAX:
+		if (int_operands)
+		    d->ival = l->ival > r->ival ? l->ival : r->ival;
+		else
+		    d->dval = l->dval > r->dval ? l->dval : r->dval;
+		break;
+	    case POW:
+		d->dval = pow(l->dval, r->dval);
+		break;
+	    case GREATER_THAN_OR_EQUAL_TO:
+		TYPED_COMPARISON(>=);
+		break;
+	    case LESS_THAN_OR_EQUAL_TO:
+		TYPED_COMPARISON(<=);
+		break;
+	    case GREATER_THAN:
+		TYPED_COMPARISON(>);
+		break;
+	    case LESS_THAN:
+		TYPED_COMPARISON(<);
+		break;
+	    case NEQ:
+		TYPED_COMPARISON(!=);
+		break;
+	    case EQ:
+		TYPED_COMPARISON(==);
+		break;
+	    case AND:
+		d->bval = l->bval && r->bval;
+		break;
+	    case OR:
+		d->bval = l->bval || r->bval;
+		break;
+	    default:
+		assert(0);
+		break;
+	}
+    }
+
+    return true;
+}
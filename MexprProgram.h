@@ -0,0 +1,87 @@
+#ifndef __MEXPR_PROGRAM__
+#define __MEXPR_PROGRAM__
+
+#include <stdbool.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+
+/*
+ * Linear representation of tree whose variable types are fixed.
+ *
+ * The nodes are listed in postorder. So, each instruction refers
+ * only to the results of its preceding instructions and the last
+ * one computes the value of the root node. Since the types of all
+ * operands are known, the instructions don't need type checks at
+ * evaluation time.
+ */
+
+/*
+ * Opcode used only by typed program. Convert INT operand into DOUBLE
+ * for the operators that compute DOUBLE from INT and DOUBLE operands.
+ */
+#define INT_TO_DOUBLE (BOOLEAN + 1)
+
+typedef struct typed_inst {
+    /*
+     * Operator token code, INT_TO_DOUBLE, or INT, DOUBLE, BOOLEAN
+     * and VARIABLE for leaf nodes.
+     */
+    int opcode;
+
+    /* Result type. INT, DOUBLE or BOOLEAN */
+    int type;
+
+    /* Index of the operand instructions. -1 when not used */
+    int left;
+    int right;
+
+    /* Index of 'vars' for VARIABLE */
+    int var;
+
+    /* Value of INT, DOUBLE and BOOLEAN leaf */
+    node_value imm;
+} typed_inst;
+
+typedef struct typed_var {
+    /* Refer to the name in the tree */
+    char *vname;
+
+    /* INT, DOUBLE or BOOLEAN */
+    int type;
+} typed_var;
+
+typedef struct typed_program {
+    int ninsts;
+    typed_inst *insts;
+
+    int nvars;
+    typed_var *vars;
+
+    /*
+     * True when any operator gets operands of invalid types,
+     * e.g. BOOLEAN + INT. evaluate_node() fails for all values
+     * in this case.
+     */
+    bool type_error;
+} typed_program;
+
+/*
+ * 'var_type_cb' returns the type of variable named by its first
+ * argument, or INVALID when it's unknown.
+ */
+typed_program *compile_typed_program(tree *t,
+				     int (*var_type_cb)(char *, void *),
+				     void *data);
+void destroy_typed_program(typed_program *prog);
+
+/*
+ * Run the program once without the type checks of evaluate_node().
+ * 'vars' gives the values of the program variables, which must have
+ * the types of the program, and 'values' has 'ninsts' elements for
+ * the results of instructions. The last one is the program result.
+ * Return false if the computation fails.
+ */
+bool run_typed_program(typed_program *prog, const node_value *const *vars,
+		       node_value *values);
+
+#endif
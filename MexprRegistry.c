@@ -0,0 +1,94 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprAlloc.h"
+#include "MexprRegistry.h"
+
+struct registry_block {
+    struct registry_block *next;
+    mexpr_registry *registry;
+
+    /* The counters of the registry's 'size' */
+    max_align_t counters[];
+};
+
+/* Move the counters of the exiting thread to 'retired' */
+static void
+retire_block(void *p){
+    registry_block *b = (registry_block *) p, **pp;
+    mexpr_registry *r = b->registry;
+
+    pthread_mutex_lock(&r->lock);
+    for (pp = &r->blocks; *pp != b; pp = &(*pp)->next)
+	assert(*pp != NULL);
+    *pp = b->next;
+    if (r->retired == NULL){
+	r->retired = mexpr_realloc(NULL, r->size, MEXPR_ALLOC_COUNTERS);
+	memset(r->retired, 0, r->size);
+    }
+    r->add(r->retired, b->counters);
+    pthread_mutex_unlock(&r->lock);
+
+    mexpr_free(b);
+}
+
+void *
+mexpr_registry_register(mexpr_registry *r){
+    registry_block *b;
+
+    b = (registry_block *) mexpr_realloc(NULL, sizeof(registry_block) +
+					 r->size, MEXPR_ALLOC_COUNTERS);
+    memset(b, 0, sizeof(registry_block) + r->size);
+    b->registry = r;
+
+    pthread_mutex_lock(&r->lock);
+    if (!r->key_created){
+	if (pthread_key_create(&r->key, retire_block) != 0){
+	    perror("pthread_key_create");
+	    exit(-1);
+	}
+	r->key_created = true;
+    }
+    b->next = r->blocks;
+    r->blocks = b;
+    pthread_mutex_unlock(&r->lock);
+
+    pthread_setspecific(r->key, b);
+
+    return b->counters;
+}
+
+int
+mexpr_registry_sum(mexpr_registry *r, void *sum){
+    registry_block *b;
+    int nblocks = 0;
+
+    pthread_mutex_lock(&r->lock);
+    if (r->retired != NULL)
+	memcpy(sum, r->retired, r->size);
+    else
+	memset(sum, 0, r->size);
+    for (b = r->blocks; b != NULL; b = b->next, nblocks++)
+	r->add(sum, b->counters);
+    pthread_mutex_unlock(&r->lock);
+
+    return nblocks;
+}
+
+int
+mexpr_registry_reset(mexpr_registry *r){
+    registry_block *b;
+    int nblocks = 0;
+
+    pthread_mutex_lock(&r->lock);
+    if (r->retired != NULL)
+	memset(r->retired, 0, r->size);
+    for (b = r->blocks; b != NULL; b = b->next, nblocks++)
+	memset(b->counters, 0, r->size);
+    pthread_mutex_unlock(&r->lock);
+
+    return nblocks;
+}
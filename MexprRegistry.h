@@ -0,0 +1,55 @@
+#ifndef __MEXPR_REGISTRY__
+#define __MEXPR_REGISTRY__
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Registry of the per-thread counters of MexprStats.c and
+ * MexprMetrics.c. Internal to the library.
+ *
+ * Each thread gets its own zeroed block of 'size' bytes, which only
+ * the thread writes. The blocks of all threads are linked to the
+ * registry. When a thread exits, 'add' sums up its block to the
+ * retired counters and the block is freed, so that the sums on read
+ * keep the counts of the exited threads.
+ */
+typedef struct registry_block registry_block;
+
+typedef struct mexpr_registry {
+    pthread_mutex_t lock;
+    bool key_created;
+    pthread_key_t key;
+
+    /* The size of the counters of one block */
+    size_t size;
+
+    /* Add the counters 'block' to 'sum' */
+    void (*add)(void *sum, const void *block);
+
+    /* The counters of the exited threads, allocated on first exit */
+    void *retired;
+    registry_block *blocks;
+} mexpr_registry;
+
+#define MEXPR_REGISTRY_INITIALIZER(type, add)			\
+    { PTHREAD_MUTEX_INITIALIZER, false, 0, sizeof(type), add, NULL, NULL }
+
+/*
+ * Register a new block for the calling thread and return its counters.
+ * The caller keeps them in its own thread local variable, and calls
+ * this only once per thread.
+ */
+void *mexpr_registry_register(mexpr_registry *r);
+
+/*
+ * Set 'sum' to the counters of the exited threads plus the ones of
+ * all live threads. Return the number of live blocks.
+ */
+int mexpr_registry_sum(mexpr_registry *r, void *sum);
+
+/* Zero the counters of all threads. Return the number of live blocks */
+int mexpr_registry_reset(mexpr_registry *r);
+
+#endif
@@ -0,0 +1,330 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+#include "MexprAlloc.h"
+#include "MexprReorder.h"
+
+typedef struct plan_node {
+    tr_node *node;
+
+    /* Indexes of the plan nodes of the operands. -1 when not used */
+    int left;
+    int right;
+
+    /* Estimated cost of the subtree */
+    double cost;
+
+    /* The static type and whether the subtree can fail */
+    int type;
+    bool fail_free;
+
+    /* True when the right operand of 'and' and 'or' runs first */
+    bool swapped;
+
+    /*
+     * Per operand, 0 for left and 1 for right : the evaluations and
+     * the ones that decided the result by themselves.
+     */
+    unsigned long evaluations[2];
+    unsigned long decisive[2];
+} plan_node;
+
+struct reorder_plan {
+    tree *t;
+
+    int nnodes;
+    plan_node *nodes;
+    int root;
+
+    /* The VARIABLE leaves and their types assumed by the analysis */
+    int nvars;
+    tr_node **var_nodes;
+    int *var_types;
+    bool analyzed;
+
+    reorder_stats stats;
+};
+
+static int
+add_plan_node(reorder_plan *plan, tr_node *n){
+    plan_node *pn;
+    int i, left, right;
+
+    left = n->left != NULL ? add_plan_node(plan, n->left) : -1;
+    right = n->right != NULL ? add_plan_node(plan, n->right) : -1;
+
+    plan->nodes = (plan_node *) mexpr_realloc(plan->nodes,
+					      sizeof(plan_node) * (plan->nnodes + 1),
+					      MEXPR_ALLOC_CODE);
+    i = plan->nnodes++;
+    pn = &plan->nodes[i];
+    memset(pn, 0, sizeof(plan_node));
+    pn->node = n;
+    pn->left = left;
+    pn->right = right;
+
+    if (n->node_id == VARIABLE && left < 0 && right < 0){
+	plan->var_nodes = (tr_node **) mexpr_realloc(plan->var_nodes,
+						     sizeof(tr_node *) * (plan->nvars + 1),
+						     MEXPR_ALLOC_CODE);
+	plan->var_nodes[plan->nvars++] = n;
+    }
+
+    return i;
+}
+
+reorder_plan *
+reorder_plan_create(tree *t){
+    reorder_plan *plan;
+
+    assert(t != NULL && t->root != NULL);
+
+    plan = (reorder_plan *) mexpr_realloc(NULL,
+					  sizeof(reorder_plan),
+					  MEXPR_ALLOC_CODE);
+    memset(plan, 0, sizeof(reorder_plan));
+    plan->t = t;
+    plan->root = add_plan_node(plan, t->root);
+    plan->var_types = (int *) mexpr_realloc(NULL,
+					    sizeof(int) * (plan->nvars + 1),
+					    MEXPR_ALLOC_CODE);
+
+    return plan;
+}
+
+void
+reorder_plan_destroy(reorder_plan *plan){
+    mexpr_free(plan->nodes);
+    mexpr_free(plan->var_nodes);
+    mexpr_free(plan->var_types);
+    mexpr_free(plan);
+}
+
+/* The relative cost of each operator */
+static double
+operator_cost(int node_id){
+    switch(node_id){
+	case SIN:
+	case COS:
+	    return 10;
+	case POW:
+	    return 20;
+	case SQRT:
+	    return 4;
+	case DIVIDE:
+	case MOD:
+	    return 2;
+	case AND:
+	case OR:
+	    return 0.5;
+	default:
+	    return 1;
+    }
+}
+
+/* Compute the cost, type and 'fail_free' of the subtree */
+static void
+analyze(reorder_plan *plan, int i){
+    plan_node *pn = &plan->nodes[i], *l, *r;
+    tr_node *n = pn->node;
+
+    if (pn->left < 0 && pn->right < 0){
+	pn->fail_free = true;
+	if (n->node_id == VARIABLE){
+	    pn->cost = 1;
+	    pn->type = n->unv.vval.vdata->node_id;
+	}else{
+	    pn->cost = 0;
+	    pn->type = n->node_id;
+	}
+	return;
+    }
+
+    analyze(plan, pn->left);
+    l = &plan->nodes[pn->left];
+    pn->cost = operator_cost(n->node_id) + l->cost;
+
+    if (pn->right < 0){
+	pn->type = tree_operator_type(n->node_id, l->type, INVALID);
+	pn->fail_free = l->fail_free && pn->type != TYPE_ERROR;
+	return;
+    }
+
+    analyze(plan, pn->right);
+    l = &plan->nodes[pn->left];
+    r = &plan->nodes[pn->right];
+    pn->cost += r->cost;
+    pn->type = tree_operator_type(n->node_id, l->type, r->type);
+    pn->fail_free = pn->type != TYPE_ERROR && l->fail_free && r->fail_free;
+
+    /* Zero division is possible unless the divisor is a constant */
+    if ((n->node_id == DIVIDE || n->node_id == MOD) &&
+	!tree_is_nonzero_constant(r->node))
+	pn->fail_free = false;
+}
+
+/* The probability that the operand decides the result by itself */
+static double
+decisive_rate(plan_node *pn, int operand){
+    return (pn->decisive[operand] + 1.0) / (pn->evaluations[operand] + 2.0);
+}
+
+/* Choose the order of the operands of every 'and' and 'or' */
+static void
+decide_order(reorder_plan *plan){
+    double left_first, right_first;
+    plan_node *pn, *l, *r;
+    int i;
+
+    plan->stats.swapped_nodes = 0;
+    plan->stats.reorders++;
+
+    for (i = 0; i < plan->nnodes; i++){
+	pn = &plan->nodes[i];
+	if (pn->node->node_id != AND && pn->node->node_id != OR)
+	    continue;
+	if (pn->left < 0 || pn->right < 0)
+	    continue;
+
+	l = &plan->nodes[pn->left];
+	r = &plan->nodes[pn->right];
+
+	/* The expected cost of each order */
+	left_first = l->cost +
+	    (r->fail_free ? 1.0 - decisive_rate(pn, 0) : 1.0) * r->cost;
+	right_first = r->cost +
+	    (l->fail_free ? 1.0 - decisive_rate(pn, 1) : 1.0) * l->cost;
+
+	pn->swapped = right_first < left_first;
+	if (pn->swapped)
+	    plan->stats.swapped_nodes++;
+    }
+}
+
+/* Analyze the tree again when the types of variables changed */
+static void
+check_types(reorder_plan *plan){
+    bool changed = !plan->analyzed;
+    int i, type;
+
+    for (i = 0; i < plan->nvars; i++){
+	type = plan->var_nodes[i]->unv.vval.vdata->node_id;
+	if (type != plan->var_types[i]){
+	    plan->var_types[i] = type;
+	    changed = true;
+	}
+    }
+
+    if (changed){
+	analyze(plan, plan->root);
+	decide_order(plan);
+	plan->analyzed = true;
+    }
+}
+
+/* Return the value of the subtree, or NULL when it fails */
+static tr_node *
+run_plan(reorder_plan *plan, int i){
+    plan_node *pn = &plan->nodes[i];
+    tr_node *n = pn->node, *first, *second, *l, *r;
+    int first_idx, second_idx, first_operand;
+    bool deciding;
+
+    if (pn->left < 0 && pn->right < 0)
+	return n->node_id == VARIABLE ? n->unv.vval.vdata : n;
+
+    if (n->node_id == AND || n->node_id == OR){
+	first_operand = pn->swapped ? 1 : 0;
+	first_idx = pn->swapped ? pn->right : pn->left;
+	second_idx = pn->swapped ? pn->left : pn->right;
+	deciding = n->node_id == OR;
+
+	if ((first = run_plan(plan, first_idx)) == NULL)
+	    return NULL;
+
+	pn->evaluations[first_operand]++;
+	if (first->node_id == BOOLEAN && first->unv.bval == deciding){
+	    pn->decisive[first_operand]++;
+	    if (plan->nodes[second_idx].fail_free){
+		plan->stats.skipped_operands++;
+		return first;
+	    }
+	}
+
+	if ((second = run_plan(plan, second_idx)) == NULL)
+	    return NULL;
+
+	pn->evaluations[1 - first_operand]++;
+	if (second->node_id == BOOLEAN && second->unv.bval == deciding)
+	    pn->decisive[1 - first_operand]++;
+
+	l = pn->swapped ? second : first;
+	r = pn->swapped ? first : second;
+    }else{
+	if ((l = run_plan(plan, pn->left)) == NULL)
+	    return NULL;
+	r = NULL;
+	if (pn->right >= 0 && (r = run_plan(plan, pn->right)) == NULL)
+	    return NULL;
+    }
+
+    l = apply_operator(n, l, r, plan->t);
+
+    return plan->t->computation_failed ? NULL : l;
+}
+
+void
+reorder_evaluate(reorder_plan *plan, tr_node *top){
+    tree *t = plan->t;
+    tr_node *result;
+
+    if (t->require_resolution && !t->resolved){
+	evaluate_tree(t, top);
+	return;
+    }
+
+    check_types(plan);
+    if (plan->stats.evaluations > 0 &&
+	plan->stats.evaluations % REORDER_INTERVAL == 0)
+	decide_order(plan);
+    plan->stats.evaluations++;
+
+    tree_partial_eval_begin(t);
+
+    if ((result = run_plan(plan, plan->root)) == NULL)
+	t->computation_failed = true;
+
+    if (!tree_eval_end(t))
+	return;
+
+    tree_set_top(top, result->node_id, result->unv);
+}
+
+void
+reorder_get_stats(reorder_plan *plan, reorder_stats *stats){
+    *stats = plan->stats;
+}
+
+bool
+reorder_node_info(reorder_plan *plan, tr_node *n, double *cost,
+		  bool *swapped){
+    int i;
+
+    check_types(plan);
+
+    for (i = 0; i < plan->nnodes; i++){
+	if (plan->nodes[i].node != n)
+	    continue;
+	if (cost != NULL)
+	    *cost = plan->nodes[i].cost;
+	if (swapped != NULL)
+	    *swapped = plan->nodes[i].swapped;
+	return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,59 @@
+#ifndef __MEXPR_REORDER__
+#define __MEXPR_REORDER__
+
+#include "MexprTree.h"
+
+/*
+ * Evaluation of logical trees reordering the operands of 'and'
+ * and 'or' by their cost and selectivity.
+ *
+ * The cost of each subtree is estimated from its operators, e.g.
+ * pow() and sin() weigh more than additions, and the variables add
+ * their fetch cost. The plan counts how often each operand decides
+ * the result by itself (false for 'and', true for 'or'), and every
+ * REORDER_INTERVAL evaluations puts first the operand that minimizes
+ * the expected cost.
+ *
+ * evaluate_tree() evaluates both operands and fails when either of
+ * them fails. To keep the results identical, the second operand is
+ * skipped only when it can't fail for the current types of the
+ * variables : no zero division is possible and all the operators
+ * get operands of valid types. Otherwise both operands are evaluated
+ * in the chosen order.
+ */
+#define REORDER_INTERVAL 256
+
+typedef struct reorder_plan reorder_plan;
+
+typedef struct reorder_stats {
+    unsigned long evaluations;
+
+    /* The operands skipped because the other one decided the result */
+    unsigned long skipped_operands;
+
+    /* The 'and' and 'or' nodes currently evaluating right operand first */
+    int swapped_nodes;
+
+    /* The number of decisions of the order so far */
+    unsigned long reorders;
+} reorder_stats;
+
+/* 't' must stay alive while the plan is used */
+reorder_plan *reorder_plan_create(tree *t);
+void reorder_plan_destroy(reorder_plan *plan);
+
+/* Same as evaluate_tree() */
+void reorder_evaluate(reorder_plan *plan, tr_node *top);
+
+void reorder_get_stats(reorder_plan *plan, reorder_stats *stats);
+
+/*
+ * Give the estimated cost of the subtree of 'n' for the current types
+ * of the variables, and whether the right operand runs first when 'n'
+ * is 'and' or 'or'. Either output can be NULL. The tree must be
+ * resolved. Return false if 'n' is not a node of the tree.
+ */
+bool reorder_node_info(reorder_plan *plan, tr_node *n, double *cost,
+		       bool *swapped);
+
+#endif
@@ -0,0 +1,449 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "ExportedParser.h"
+#include "MexprAlloc.h"
+#include "MexprRuleNetwork.h"
+
+typedef struct net_var {
+    char *vname;
+    tr_node value;
+    bool assigned;
+} net_var;
+
+typedef struct net_node {
+    /* Operator token code, or INT, DOUBLE, BOOLEAN and VARIABLE */
+    int node_id;
+
+    /* Indexes of the operand nodes. -1 when not used */
+    int left;
+    int right;
+
+    /* Value of constant and index of 'vars' for VARIABLE */
+    node_value imm;
+    int var;
+
+    /* Chain of the hash table. The free list for unused nodes */
+    unsigned int hash;
+    int next;
+
+    /* The number of parent nodes and rules. Zero when unused */
+    int refcount;
+
+    /*
+     * Operand of apply_operator() for operators, or the value of
+     * constants. Its 'result' keeps the value of operators.
+     */
+    tr_node op;
+
+    /* The value in the evaluation 'epoch', NULL when it failed */
+    unsigned long epoch;
+    tr_node *value;
+} net_node;
+
+struct rule_network {
+    int nnodes;
+    int nodes_capacity;
+    net_node *nodes;
+    int free_node;
+    int live_nodes;
+
+    /* Hash table of nodes. The size is a power of two */
+    int nbuckets;
+    int *buckets;
+
+    int nvars;
+    net_var *vars;
+
+    /* The root node of each rule. -1 after the removal */
+    int nrules;
+    int *roots;
+    int live_rules;
+
+    unsigned long epoch;
+};
+
+rule_network *
+rule_network_create(void){
+    rule_network *rn;
+    int i;
+
+    rn = (rule_network *) mexpr_realloc(NULL,
+					sizeof(rule_network),
+					MEXPR_ALLOC_RULES);
+    memset(rn, 0, sizeof(rule_network));
+    rn->free_node = -1;
+    rn->nbuckets = 64;
+    rn->buckets = (int *) mexpr_realloc(NULL,
+					sizeof(int) * rn->nbuckets,
+					MEXPR_ALLOC_RULES);
+    for (i = 0; i < rn->nbuckets; i++)
+	rn->buckets[i] = -1;
+
+    return rn;
+}
+
+void
+rule_network_destroy(rule_network *rn){
+    int i;
+
+    for (i = 0; i < rn->nnodes; i++)
+	mexpr_free(rn->nodes[i].op.result);
+    for (i = 0; i < rn->nvars; i++)
+	mexpr_free(rn->vars[i].vname);
+    mexpr_free(rn->nodes);
+    mexpr_free(rn->buckets);
+    mexpr_free(rn->vars);
+    mexpr_free(rn->roots);
+    mexpr_free(rn);
+}
+
+static int
+find_var(rule_network *rn, char *vname){
+    int i;
+
+    for (i = 0; i < rn->nvars; i++){
+	if (strcmp(rn->vars[i].vname, vname) == 0)
+	    return i;
+    }
+
+    return -1;
+}
+
+static int
+register_var(rule_network *rn, char *vname){
+    int i;
+
+    if ((i = find_var(rn, vname)) >= 0)
+	return i;
+
+    rn->vars = (net_var *) mexpr_realloc(rn->vars,
+					 sizeof(net_var) * (rn->nvars + 1),
+					 MEXPR_ALLOC_RULES);
+    memset(&rn->vars[rn->nvars], 0, sizeof(net_var));
+    rn->vars[rn->nvars].vname = mexpr_strdup(vname, MEXPR_ALLOC_RULES);
+
+    return rn->nvars++;
+}
+
+/* FNV-1a over the fields that identify the node */
+static unsigned int
+hash_node(net_node *key){
+    unsigned char bytes[sizeof(int) * 4 + sizeof(double)];
+    unsigned int h = 2166136261u;
+    size_t i, len = 0;
+
+    memcpy(bytes + len, &key->node_id, sizeof(int));
+    len += sizeof(int);
+    memcpy(bytes + len, &key->left, sizeof(int));
+    len += sizeof(int);
+    memcpy(bytes + len, &key->right, sizeof(int));
+    len += sizeof(int);
+    memcpy(bytes + len, &key->var, sizeof(int));
+    len += sizeof(int);
+    switch(key->node_id){
+	case INT:
+	    memcpy(bytes + len, &key->imm.ival, sizeof(int));
+	    len += sizeof(int);
+	    break;
+	case DOUBLE:
+	    memcpy(bytes + len, &key->imm.dval, sizeof(double));
+	    len += sizeof(double);
+	    break;
+	case BOOLEAN:
+	    bytes[len++] = key->imm.bval;
+	    break;
+	default:
+	    break;
+    }
+
+    for (i = 0; i < len; i++){
+	h ^= bytes[i];
+	h *= 16777619u;
+    }
+
+    return h;
+}
+
+static bool
+same_node(net_node *a, net_node *b){
+    if (a->node_id != b->node_id || a->left != b->left ||
+	a->right != b->right || a->var != b->var)
+	return false;
+
+    switch(a->node_id){
+	case INT:
+	    return a->imm.ival == b->imm.ival;
+	case DOUBLE:
+	    /* 0.0 and -0.0 give different results, e.g. by division */
+	    return memcmp(&a->imm.dval, &b->imm.dval, sizeof(double)) == 0;
+	case BOOLEAN:
+	    return a->imm.bval == b->imm.bval;
+	default:
+	    return true;
+    }
+}
+
+static void
+rehash(rule_network *rn){
+    net_node *n;
+    int i, b;
+
+    rn->nbuckets *= 2;
+    rn->buckets = (int *) mexpr_realloc(rn->buckets,
+					sizeof(int) * rn->nbuckets,
+					MEXPR_ALLOC_RULES);
+    for (i = 0; i < rn->nbuckets; i++)
+	rn->buckets[i] = -1;
+
+    for (i = 0; i < rn->nnodes; i++){
+	n = &rn->nodes[i];
+	if (n->refcount == 0)
+	    continue;
+	b = n->hash & (rn->nbuckets - 1);
+	n->next = rn->buckets[b];
+	rn->buckets[b] = i;
+    }
+}
+
+/*
+ * Return the node equal to 'key' with a new reference, creating it
+ * if it doesn't exist. The operands of 'key' are already referenced
+ * by the caller, and the references move to the new node.
+ */
+static int
+intern_node(rule_network *rn, net_node *key){
+    unsigned int hash = hash_node(key);
+    net_node *n;
+    int i, b;
+
+    for (i = rn->buckets[hash & (rn->nbuckets - 1)]; i >= 0;
+	 i = rn->nodes[i].next){
+	n = &rn->nodes[i];
+	if (n->hash == hash && same_node(n, key)){
+	    /* The existing node already holds its operands */
+	    if (key->left >= 0)
+		rn->nodes[key->left].refcount--;
+	    if (key->right >= 0)
+		rn->nodes[key->right].refcount--;
+	    n->refcount++;
+	    return i;
+	}
+    }
+
+    if (rn->free_node >= 0){
+	i = rn->free_node;
+	rn->free_node = rn->nodes[i].next;
+    }else{
+	if (rn->nnodes == rn->nodes_capacity){
+	    rn->nodes_capacity = rn->nodes_capacity == 0 ?
+		64 : rn->nodes_capacity * 2;
+	    rn->nodes = (net_node *) mexpr_realloc(rn->nodes,
+						   sizeof(net_node) * rn->nodes_capacity,
+						   MEXPR_ALLOC_RULES);
+	}
+	i = rn->nnodes++;
+    }
+
+    n = &rn->nodes[i];
+    *n = *key;
+    n->hash = hash;
+    n->refcount = 1;
+    n->epoch = 0;
+    n->value = NULL;
+    memset(&n->op, 0, sizeof(tr_node));
+    n->op.node_id = key->node_id;
+    n->op.unv = key->imm;
+
+    b = hash & (rn->nbuckets - 1);
+    n->next = rn->buckets[b];
+    rn->buckets[b] = i;
+
+    if (++rn->live_nodes > rn->nbuckets)
+	rehash(rn);
+
+    return i;
+}
+
+/* Drop a reference of the node, releasing it when it's unused */
+static void
+release_node(rule_network *rn, int i){
+    net_node *n = &rn->nodes[i];
+    int *p, left = n->left, right = n->right;
+
+    assert(n->refcount > 0);
+    if (--n->refcount > 0)
+	return;
+
+    for (p = &rn->buckets[n->hash & (rn->nbuckets - 1)]; *p != i;
+	 p = &rn->nodes[*p].next)
+	assert(*p >= 0);
+    *p = n->next;
+
+    mexpr_free(n->op.result);
+    n->op.result = NULL;
+    n->next = rn->free_node;
+    rn->free_node = i;
+    rn->live_nodes--;
+
+    if (left >= 0)
+	release_node(rn, left);
+    if (right >= 0)
+	release_node(rn, right);
+}
+
+/* Merge the subtree into the network and return its node */
+static int
+merge_node(rule_network *rn, tr_node *tn){
+    net_node key;
+    int tmp;
+
+    memset(&key, 0, sizeof(net_node));
+    key.node_id = tn->node_id;
+    key.left = key.right = key.var = -1;
+
+    if (tn->left == NULL && tn->right == NULL){
+	if (tn->node_id == VARIABLE)
+	    key.var = register_var(rn, tn->unv.vval.vname);
+	else
+	    key.imm = tn->unv;
+    }else{
+	key.left = merge_node(rn, tn->left);
+	if (tn->right != NULL)
+	    key.right = merge_node(rn, tn->right);
+
+	/* Both operands are evaluated and the failure of either fails */
+	if ((tn->node_id == AND || tn->node_id == OR) && key.left > key.right){
+	    tmp = key.left;
+	    key.left = key.right;
+	    key.right = tmp;
+	}
+    }
+
+    return intern_node(rn, &key);
+}
+
+int
+rule_network_add(rule_network *rn, char *expression){
+    bool (*parsers[])(void) = { start_logical_mathexpr_parse,
+				start_ineq_mathexpr_parse };
+    char buf[BUFFER_LEN];
+    size_t len = strlen(expression);
+    tree *t;
+
+    /* The parser expects the new line at the end */
+    if (len + 2 > BUFFER_LEN)
+	return -1;
+    memcpy(buf, expression, len);
+    if (len == 0 || buf[len - 1] != '\n')
+	buf[len++] = '\n';
+    buf[len] = '\0';
+
+    if ((t = build_mathexpr_tree_any(parsers, 2, buf, NULL)) == NULL)
+	return -1;
+
+    rn->roots = (int *) mexpr_realloc(rn->roots,
+				      sizeof(int) * (rn->nrules + 1),
+				      MEXPR_ALLOC_RULES);
+    rn->roots[rn->nrules] = merge_node(rn, t->root);
+    rn->live_rules++;
+    destroy_tree(t);
+
+    return rn->nrules++;
+}
+
+bool
+rule_network_remove(rule_network *rn, int rule){
+    if (rule < 0 || rule >= rn->nrules || rn->roots[rule] < 0)
+	return false;
+
+    release_node(rn, rn->roots[rule]);
+    rn->roots[rule] = -1;
+    rn->live_rules--;
+
+    return true;
+}
+
+int
+rule_network_size(rule_network *rn){
+    return rn->live_rules;
+}
+
+int
+rule_network_node_count(rule_network *rn){
+    return rn->live_nodes;
+}
+
+bool
+rule_network_assign(rule_network *rn, char *vname, tr_node *value){
+    int i;
+
+    assert(value->node_id == INT || value->node_id == DOUBLE ||
+	   value->node_id == BOOLEAN);
+
+    if ((i = find_var(rn, vname)) < 0)
+	return false;
+
+    rn->vars[i].value.node_id = value->node_id;
+    rn->vars[i].value.unv = value->unv;
+    rn->vars[i].assigned = true;
+
+    return true;
+}
+
+/* Return the value of the node, computing it once per epoch */
+static tr_node *
+evaluate_net_node(rule_network *rn, int i){
+    tr_node *left, *right = NULL, *result;
+    net_node *n = &rn->nodes[i];
+    tree t;
+
+    if (n->epoch == rn->epoch)
+	return n->value;
+    n->epoch = rn->epoch;
+    n->value = NULL;
+
+    if (n->left < 0){
+	if (n->node_id != VARIABLE)
+	    n->value = &n->op;
+	else if (rn->vars[n->var].assigned)
+	    n->value = &rn->vars[n->var].value;
+	return n->value;
+    }
+
+    if ((left = evaluate_net_node(rn, n->left)) == NULL)
+	return NULL;
+    if (n->right >= 0 && (right = evaluate_net_node(rn, n->right)) == NULL)
+	return NULL;
+
+    t.computation_failed = false;
+    result = apply_operator(&n->op, left, right, &t);
+    if (!t.computation_failed)
+	n->value = result;
+
+    return n->value;
+}
+
+int
+rule_network_evaluate(rule_network *rn, int *ids){
+    tr_node *value;
+    int r, nids = 0;
+
+    rn->epoch++;
+
+    for (r = 0; r < rn->nrules; r++){
+	if (rn->roots[r] < 0)
+	    continue;
+	value = evaluate_net_node(rn, rn->roots[r]);
+	if (value != NULL && value->node_id == BOOLEAN && value->unv.bval)
+	    ids[nids++] = r;
+    }
+
+    for (r = 0; r < rn->nvars; r++)
+	rn->vars[r].assigned = false;
+
+    return nids;
+}
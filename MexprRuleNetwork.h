@@ -0,0 +1,55 @@
+#ifndef __MEXPR_RULE_NETWORK__
+#define __MEXPR_RULE_NETWORK__
+
+#include <stdbool.h>
+#include "MexprTree.h"
+
+/*
+ * Network of logical rules sharing their common subexpressions.
+ *
+ * The trees of the rules are merged into one network whose nodes
+ * are distinct : 'amount > 1000' used by thousands of rules is one
+ * node. The operands of 'and' and 'or' are ordered canonically, so
+ * 'a > 1 and b < 2' and 'b < 2 and a > 1' are one node as well.
+ * Each node reached from the rules is evaluated once per record and
+ * its value is shared by all the rules that use it.
+ *
+ * The results are the same as evaluating each rule by evaluate_tree().
+ * Rules that fail the evaluation or refer to any unassigned variable
+ * are not true.
+ */
+typedef struct rule_network rule_network;
+
+rule_network *rule_network_create(void);
+void rule_network_destroy(rule_network *rn);
+
+/*
+ * Parse the inequality or logical expression and merge it into the
+ * network. Return the rule id, or -1 if it can't be parsed. The ids
+ * are numbered from zero and not reused after the removal.
+ */
+int rule_network_add(rule_network *rn, char *expression);
+
+/*
+ * Remove the rule and the nodes no other rule uses. Return false if
+ * the rule doesn't exist.
+ */
+bool rule_network_remove(rule_network *rn, int rule);
+
+/* The number of rules and distinct nodes in the network */
+int rule_network_size(rule_network *rn);
+int rule_network_node_count(rule_network *rn);
+
+/* Same as rule_set_assign() */
+bool rule_network_assign(rule_network *rn, char *vname, tr_node *value);
+
+/*
+ * Evaluate all rules and write the ids of the true ones to 'ids' in
+ * ascending order. 'ids' must have rule_network_size() elements.
+ * All variables get unassigned at the end for the next record.
+ *
+ * Return the number of the true rules.
+ */
+int rule_network_evaluate(rule_network *rn, int *ids);
+
+#endif
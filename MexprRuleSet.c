@@ -0,0 +1,714 @@
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "ExportedParser.h"
+#include "MexprPool.h"
+#include "MexprProgram.h"
+#include "MexprCodegen.h"
+#include "MexprPredicateIndex.h"
+#include "MexprMetrics.h"
+#include "MexprAlloc.h"
+#include "MexprRuleSet.h"
+
+/* The number of rules evaluated by one task of the pool */
+#define RULE_CHUNK 128
+
+#define PATH_LEN 1024
+
+/* Function of rule compiled by rule_set_compile(). See MexprCodegen.h */
+typedef int (*rule_function)(const node_value *const *slots);
+
+/* Variable shared by the rules */
+typedef struct rule_var {
+    char *vname;
+    unsigned int hash;
+    struct rule_var *next;
+
+    /* Index of 'vars' of the rule set */
+    int index;
+
+    /* All VARIABLE nodes of this name refer to 'node' */
+    tr_node node;
+    bool assigned;
+} rule_var;
+
+typedef struct rule {
+    tree *t;
+
+    /* Indexes of 'vars' of the rule set referred by this rule */
+    int nvars;
+    int *vars;
+
+    /* Compiled function. NULL when the rule is interpreted */
+    rule_function native;
+
+    /* True when the predicate index evaluates this rule */
+    bool indexed;
+} rule;
+
+struct rule_set {
+    int nrules;
+    int rules_capacity;
+    rule *rules;
+
+    int nvars;
+    int vars_capacity;
+    rule_var **vars;
+
+    /* Hash table of 'vars'. The size is a power of two */
+    int nbuckets;
+    rule_var **buckets;
+
+    /* The result of each rule in the current evaluation */
+    bool *matched;
+
+    /* Index of the rules of simple predicates */
+    predicate_index *index;
+    int nindexed;
+
+    /*
+     * The shared object loaded by rule_set_compile(), the types of
+     * variables that the functions assume, and the values of the
+     * variables passed to the functions.
+     */
+    void *native_handle;
+    int *native_types;
+    const node_value **native_slots;
+};
+
+/* FNV-1a */
+static unsigned int
+hash_name(char *s){
+    unsigned int h = 2166136261u;
+
+    while (*s != '\0'){
+	h ^= (unsigned char) *s++;
+	h *= 16777619u;
+    }
+
+    return h;
+}
+
+static rule_var *
+lookup_var(rule_set *rs, char *vname, unsigned int hash){
+    rule_var *v;
+
+    for (v = rs->buckets[hash & (rs->nbuckets - 1)]; v != NULL; v = v->next){
+	if (v->hash == hash && strcmp(v->vname, vname) == 0)
+	    return v;
+    }
+
+    return NULL;
+}
+
+static void
+grow_buckets(rule_set *rs){
+    rule_var *v;
+    int i, b;
+
+    rs->nbuckets *= 2;
+    rs->buckets = (rule_var **) mexpr_realloc(rs->buckets,
+					      sizeof(rule_var *) * rs->nbuckets,
+					      MEXPR_ALLOC_RULES);
+    memset(rs->buckets, 0, sizeof(rule_var *) * rs->nbuckets);
+
+    for (i = 0; i < rs->nvars; i++){
+	v = rs->vars[i];
+	b = v->hash & (rs->nbuckets - 1);
+	v->next = rs->buckets[b];
+	rs->buckets[b] = v;
+    }
+}
+
+/* Return the index of the variable, registering it if it's new */
+static int
+register_var(rule_set *rs, char *vname){
+    unsigned int hash = hash_name(vname);
+    rule_var *v;
+    int b;
+
+    if ((v = lookup_var(rs, vname, hash)) != NULL)
+	return v->index;
+
+    v = (rule_var *) mexpr_malloc(sizeof(rule_var), MEXPR_ALLOC_RULES);
+    v->vname = mexpr_strdup(vname, MEXPR_ALLOC_RULES);
+    v->hash = hash;
+    v->index = rs->nvars;
+    v->assigned = false;
+
+    /* resolve_variable() rejects INVALID node */
+    memset(&v->node, 0, sizeof(tr_node));
+    v->node.node_id = INT;
+
+    if (rs->nvars == rs->vars_capacity){
+	rs->vars_capacity *= 2;
+	rs->vars = (rule_var **) mexpr_realloc(rs->vars,
+					       sizeof(rule_var *) * rs->vars_capacity,
+					       MEXPR_ALLOC_RULES);
+    }
+    rs->vars[rs->nvars++] = v;
+
+    if (rs->nvars > rs->nbuckets)
+	grow_buckets(rs);
+    else{
+	b = hash & (rs->nbuckets - 1);
+	v->next = rs->buckets[b];
+	rs->buckets[b] = v;
+    }
+
+    return rs->nvars - 1;
+}
+
+/* Callback for predicate_index_add() */
+static int
+rule_var_id_cb(char *vname, void *data){
+    return register_var((rule_set *) data, vname);
+}
+
+/* Application callback for resolve_variable() */
+static tr_node *
+rule_var_cb(char *vname, void *data){
+    rule_set *rs = (rule_set *) data;
+    int var = register_var(rs, vname);
+
+    return &rs->vars[var]->node;
+}
+
+rule_set *
+rule_set_create(void){
+    rule_set *rs;
+
+    rs = (rule_set *) mexpr_realloc(NULL, sizeof(rule_set), MEXPR_ALLOC_RULES);
+    rs->nrules = 0;
+    rs->rules_capacity = 16;
+    rs->rules = (rule *) mexpr_realloc(NULL,
+				       sizeof(rule) * rs->rules_capacity,
+				       MEXPR_ALLOC_RULES);
+    rs->nvars = 0;
+    rs->vars_capacity = 16;
+    rs->vars = (rule_var **) mexpr_realloc(NULL,
+					   sizeof(rule_var *) * rs->vars_capacity,
+					   MEXPR_ALLOC_RULES);
+    rs->nbuckets = 16;
+    rs->buckets = (rule_var **) mexpr_realloc(NULL,
+					      sizeof(rule_var *) * rs->nbuckets,
+					      MEXPR_ALLOC_RULES);
+    memset(rs->buckets, 0, sizeof(rule_var *) * rs->nbuckets);
+    rs->matched = (bool *) mexpr_realloc(NULL,
+					 sizeof(bool) * rs->rules_capacity,
+					 MEXPR_ALLOC_RULES);
+    rs->index = predicate_index_create();
+    rs->nindexed = 0;
+    rs->native_handle = NULL;
+    rs->native_types = NULL;
+    rs->native_slots = NULL;
+
+    return rs;
+}
+
+void
+rule_set_destroy(rule_set *rs){
+    int i;
+
+    for (i = 0; i < rs->nrules; i++){
+	destroy_tree(rs->rules[i].t);
+	mexpr_free(rs->rules[i].vars);
+    }
+    for (i = 0; i < rs->nvars; i++){
+	mexpr_free(rs->vars[i]->vname);
+	mexpr_free(rs->vars[i]);
+    }
+    mexpr_free(rs->rules);
+    mexpr_free(rs->vars);
+    mexpr_free(rs->buckets);
+    mexpr_free(rs->matched);
+    predicate_index_destroy(rs->index);
+    mexpr_free(rs->native_types);
+    mexpr_free(rs->native_slots);
+    if (rs->native_handle != NULL)
+	dlclose(rs->native_handle);
+    mexpr_free(rs);
+}
+
+int
+rule_set_add(rule_set *rs, char *expression){
+    bool (*parsers[])(void) = { start_logical_mathexpr_parse,
+				start_ineq_mathexpr_parse };
+    char buf[BUFFER_LEN];
+    size_t len = strlen(expression);
+    tr_node *n;
+    rule *r;
+    tree *t;
+    int i;
+
+    /* The parser expects the new line at the end */
+    if (len + 2 > BUFFER_LEN)
+	return -1;
+    memcpy(buf, expression, len);
+    if (len == 0 || buf[len - 1] != '\n')
+	buf[len++] = '\n';
+    buf[len] = '\0';
+
+    if ((t = build_mathexpr_tree_any(parsers, 2, buf, NULL)) == NULL)
+	return -1;
+
+    if (rs->nrules == rs->rules_capacity){
+	rs->rules_capacity *= 2;
+	rs->rules = (rule *) mexpr_realloc(rs->rules,
+					   sizeof(rule) * rs->rules_capacity,
+					   MEXPR_ALLOC_RULES);
+	rs->matched = (bool *) mexpr_realloc(rs->matched,
+					     sizeof(bool) * rs->rules_capacity,
+					     MEXPR_ALLOC_RULES);
+    }
+
+    r = &rs->rules[rs->nrules];
+    r->t = t;
+    r->nvars = 0;
+    r->vars = NULL;
+    r->native = NULL;
+
+    if (t->require_resolution){
+	resolve_variable(t, rs, rule_var_cb);
+	assert(t->resolved);
+
+	for (n = t->list_head; n != NULL; n = n->list_right){
+	    int var;
+
+	    if (n->node_id != VARIABLE)
+		continue;
+
+	    var = register_var(rs, n->unv.vval.vname);
+	    for (i = 0; i < r->nvars; i++){
+		if (r->vars[i] == var)
+		    break;
+	    }
+	    if (i < r->nvars)
+		continue;
+
+	    r->vars = (int *) mexpr_realloc(r->vars,
+					    sizeof(int) * (r->nvars + 1),
+					    MEXPR_ALLOC_RULES);
+	    r->vars[r->nvars++] = var;
+	}
+    }
+
+    r->indexed = predicate_index_add(rs->index, rs->nrules, t,
+				      rule_var_id_cb, rs);
+    if (r->indexed)
+	rs->nindexed++;
+
+    return rs->nrules++;
+}
+
+int
+rule_set_size(rule_set *rs){
+    return rs->nrules;
+}
+
+int
+rule_set_indexed_size(rule_set *rs){
+    return rs->nindexed;
+}
+
+bool
+rule_set_assign(rule_set *rs, char *vname, tr_node *value){
+    rule_var *v;
+
+    assert(value->node_id == INT || value->node_id == DOUBLE ||
+	   value->node_id == BOOLEAN);
+
+    if ((v = lookup_var(rs, vname, hash_name(vname))) == NULL)
+	return false;
+
+    v->node.node_id = value->node_id;
+    v->node.unv = value->unv;
+    v->assigned = true;
+
+    return true;
+}
+
+/*
+ * Each rule has its own tree. So, the workers can evaluate different
+ * rules at the same time while the variables are read only.
+ */
+static bool
+evaluate_rule(rule_set *rs, rule *r){
+    bool native = r->native != NULL;
+    rule_var *v;
+    tr_node top;
+    int i;
+
+    /* Matched by rule_set_evaluate() after the evaluation */
+    if (r->indexed)
+	return false;
+
+    for (i = 0; i < r->nvars; i++){
+	v = rs->vars[r->vars[i]];
+	if (!v->assigned)
+	    return false;
+	if (native && v->node.node_id != rs->native_types[r->vars[i]])
+	    native = false;
+    }
+
+    if (native)
+	return r->native(rs->native_slots) == 1;
+
+    evaluate_tree(r->t, &top);
+
+    return !r->t->computation_failed && top.node_id == BOOLEAN &&
+	top.unv.bval;
+}
+
+static void
+rule_task(size_t index, int worker, void *arg){
+    rule_set *rs = (rule_set *) arg;
+    int i, begin = index * RULE_CHUNK;
+    int end = rs->nrules - begin < RULE_CHUNK ?
+	rs->nrules : begin + RULE_CHUNK;
+
+    (void) worker;
+
+    for (i = begin; i < end; i++)
+	rs->matched[i] = evaluate_rule(rs, &rs->rules[i]);
+}
+
+int
+rule_set_evaluate(rule_set *rs, mexpr_pool *pool, int *ids){
+    size_t ntasks = (rs->nrules + RULE_CHUNK - 1) / RULE_CHUNK, i;
+    int r, nids = 0;
+
+    if (pool == NULL){
+	for (i = 0; i < ntasks; i++)
+	    rule_task(i, 0, rs);
+    }else
+	mexpr_pool_run(pool, ntasks, rule_task, rs);
+
+    if (rs->nindexed > 0){
+	for (r = 0; r < rs->nvars; r++){
+	    if (rs->vars[r]->assigned)
+		predicate_index_probe(rs->index, r, &rs->vars[r]->node);
+	}
+	predicate_index_collect(rs->index, rs->matched);
+    }
+
+    for (r = 0; r < rs->nrules; r++){
+	if (rs->matched[r])
+	    ids[nids++] = r;
+    }
+
+    for (r = 0; r < rs->nvars; r++)
+	rs->vars[r]->assigned = false;
+
+    return nids;
+}
+
+/* The types of the variables that the compiled functions assume */
+typedef struct native_types_ctx {
+    rule_set *rs;
+    int *types;
+} native_types_ctx;
+
+/* Callback for compile_typed_program() */
+static int
+native_type_cb(char *vname, void *data){
+    native_types_ctx *ctx = (native_types_ctx *) data;
+    rule_var *v = lookup_var(ctx->rs, vname, hash_name(vname));
+
+    return v == NULL ? INVALID : ctx->types[v->index];
+}
+
+/*
+ * Write the C source of all rules for the variables of 'types' to
+ * 'fp'. The rules whose result type depends on the values get NULL
+ * in the function table.
+ */
+static void
+generate_rule_source(rule_set *rs, int *types, FILE *fp){
+    native_types_ctx ctx = { rs, types };
+    typed_program *prog;
+    bool *compiled;
+    char name[64];
+    int i, j, *slots;
+
+    codegen_c_prologue(fp);
+
+    /* Keep the types in the source, so that they change the hash */
+    fprintf(fp, "/* slot types :");
+    for (i = 0; i < rs->nvars; i++)
+	fprintf(fp, " %s=%d", rs->vars[i]->vname, types[i]);
+    fprintf(fp, " */\n\n");
+
+    compiled = (bool *) mexpr_realloc(NULL,
+				      sizeof(bool) * (rs->nrules + 1),
+				      MEXPR_ALLOC_RULES);
+    for (i = 0; i < rs->nrules; i++){
+	prog = compile_typed_program(rs->rules[i].t, native_type_cb, &ctx);
+	if ((compiled[i] = prog != NULL) == false)
+	    continue;
+
+	slots = (int *) mexpr_realloc(NULL,
+				      sizeof(int) * (prog->nvars + 1),
+				      MEXPR_ALLOC_RULES);
+	for (j = 0; j < prog->nvars; j++)
+	    slots[j] = lookup_var(rs, prog->vars[j].vname,
+				  hash_name(prog->vars[j].vname))->index;
+
+	sprintf(name, "mexpr_rule_%d", i);
+	codegen_c_function(fp, name, prog, slots);
+
+	mexpr_free(slots);
+	destroy_typed_program(prog);
+    }
+
+    fprintf(fp, "int (*const mexpr_rule_table[%d])"
+	    "(const mexpr_value *const *) = {\n", rs->nrules + 1);
+    for (i = 0; i < rs->nrules; i++){
+	if (compiled[i])
+	    fprintf(fp, "    mexpr_rule_%d,\n", i);
+	else
+	    fprintf(fp, "    0,\n");
+    }
+    fprintf(fp, "    0,\n};\n\nconst int mexpr_rule_count = %d;\n",
+	    rs->nrules);
+
+    mexpr_free(compiled);
+}
+
+/* FNV-1a of 64 bits */
+static uint64_t
+hash_source(char *src, size_t len){
+    uint64_t h = 14695981039346656037ull;
+    size_t i;
+
+    for (i = 0; i < len; i++){
+	h ^= (unsigned char) src[i];
+	h *= 1099511628211ull;
+    }
+
+    return h;
+}
+
+/*
+ * Run the C compiler on 'c_path' into 'so_path'. The compiler is run
+ * without the shell, so that the paths are passed as they are.
+ */
+static bool
+run_compiler(char *cc, char *so_path, char *c_path){
+    pid_t pid;
+    int status;
+
+    if ((pid = fork()) < 0){
+	perror("fork");
+	return false;
+    }
+
+    if (pid == 0){
+	execlp(cc, cc, "-O2", "-fwrapv", "-fPIC", "-shared",
+	       "-o", so_path, c_path, "-lm", (char *) NULL);
+	_exit(127);
+    }
+
+    while (waitpid(pid, &status, 0) < 0){
+	perror("waitpid");
+	return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/* Compile the source into 'so_path' with the system C compiler */
+static bool
+build_shared_object(char *src, size_t len, char *so_path){
+    char c_path[PATH_LEN], tmp_path[PATH_LEN];
+    char *cc = getenv("CC");
+    FILE *fp;
+    bool built;
+
+    if (snprintf(c_path, sizeof(c_path), "%s.%d.c", so_path,
+		 (int) getpid()) >= (int) sizeof(c_path) ||
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", so_path,
+		 (int) getpid()) >= (int) sizeof(tmp_path)){
+	fprintf(stderr, "the path of the cache is too long\n");
+	return false;
+    }
+
+    if ((fp = fopen(c_path, "w")) == NULL){
+	perror("fopen");
+	return false;
+    }
+    if (fwrite(src, 1, len, fp) != len){
+	perror("fwrite");
+	fclose(fp);
+	unlink(c_path);
+	return false;
+    }
+    fclose(fp);
+
+    if (cc == NULL || *cc == '\0')
+	cc = "cc";
+    built = run_compiler(cc, tmp_path, c_path);
+    unlink(c_path);
+
+    if (!built){
+	fprintf(stderr, "failed to compile the rules with '%s'\n", cc);
+	unlink(tmp_path);
+	return false;
+    }
+
+    /* Loaded later only if private to the user, see is_private() */
+    if (chmod(tmp_path, S_IRWXU) != 0){
+	perror("chmod");
+	unlink(tmp_path);
+	return false;
+    }
+
+    /* Other processes see only the complete file */
+    if (rename(tmp_path, so_path) != 0){
+	perror("rename");
+	unlink(tmp_path);
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * The objects of the cache are loaded into the process, so no other
+ * user may write them. Return true if 'path' is a directory, or a
+ * regular file when 'dir' is false, owned by the effective user and
+ * not writable by the group and others.
+ */
+static bool
+is_private(const char *path, bool dir){
+    struct stat st;
+
+    /* A symbolic link to the object could be replaced */
+    if ((dir ? stat(path, &st) : lstat(path, &st)) != 0){
+	perror("stat");
+	return false;
+    }
+
+    if ((dir ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) ||
+	st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0){
+	fprintf(stderr, "'%s' is not private to the user\n", path);
+	return false;
+    }
+
+    return true;
+}
+
+/*
+ * Compile all rules into native functions with the system C compiler
+ * and load them. The functions assume the types of the variables
+ * last assigned (INT for the ones never assigned); the rules whose
+ * variables have other types at the evaluation are interpreted.
+ *
+ * The shared object is cached in 'cache_dir' under the name made of
+ * the hash of the generated source, so that the same rule set reuses
+ * it after restart. Return false if the rules can't be compiled, in
+ * which case the functions of the last successful compilation, if
+ * any, stay in use for the types they were compiled for, and the
+ * other rules keep being interpreted.
+ *
+ * The new types are committed together with the functions, only
+ * once the shared object is loaded, since evaluate_rule() calls a
+ * function only when the types of the values match them.
+ */
+bool
+rule_set_compile(rule_set *rs, char *cache_dir){
+    char so_path[PATH_LEN], *src = NULL;
+    rule_function *table;
+    size_t len = 0;
+    const int *count;
+    void *handle;
+    int *types;
+    FILE *fp;
+    int i;
+
+    if (!is_private(cache_dir, true))
+	return false;
+
+    types = (int *) mexpr_realloc(NULL,
+				  sizeof(int) * (rs->nvars + 1),
+				  MEXPR_ALLOC_RULES);
+    for (i = 0; i < rs->nvars; i++)
+	types[i] = rs->vars[i]->node.node_id;
+
+    if ((fp = open_memstream(&src, &len)) == NULL){
+	perror("open_memstream");
+	mexpr_free(types);
+	return false;
+    }
+    generate_rule_source(rs, types, fp);
+    fclose(fp);
+
+    if (snprintf(so_path, sizeof(so_path), "%s/mexpr_rules_%016llx.so",
+		 cache_dir, (unsigned long long) hash_source(src, len))
+	>= (int) sizeof(so_path)){
+	fprintf(stderr, "the path of the cache is too long\n");
+	free(src);
+	mexpr_free(types);
+	return false;
+    }
+
+    if (access(so_path, R_OK) == 0){
+	if (!is_private(so_path, false)){
+	    free(src);
+	    mexpr_free(types);
+	    return false;
+	}
+	mexpr_metrics_cache(true);
+    }else{
+	mexpr_metrics_cache(false);
+	if (!build_shared_object(src, len, so_path)){
+	    free(src);
+	    mexpr_free(types);
+	    return false;
+	}
+    }
+    free(src);
+
+    if ((handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL)) == NULL){
+	fprintf(stderr, "dlopen : %s\n", dlerror());
+	mexpr_free(types);
+	return false;
+    }
+
+    table = (rule_function *) dlsym(handle, "mexpr_rule_table");
+    count = (const int *) dlsym(handle, "mexpr_rule_count");
+    if (table == NULL || count == NULL || *count != rs->nrules){
+	fprintf(stderr, "'%s' doesn't match the rule set\n", so_path);
+	dlclose(handle);
+	mexpr_free(types);
+	return false;
+    }
+
+    for (i = 0; i < rs->nrules; i++)
+	rs->rules[i].native = table[i];
+
+    mexpr_free(rs->native_types);
+    rs->native_types = types;
+
+    if (rs->native_handle != NULL)
+	dlclose(rs->native_handle);
+    rs->native_handle = handle;
+
+    mexpr_free(rs->native_slots);
+    rs->native_slots = (const node_value **)
+	mexpr_realloc(NULL,
+		      sizeof(node_value *) * (rs->nvars + 1),
+		      MEXPR_ALLOC_RULES);
+    for (i = 0; i < rs->nvars; i++)
+	rs->native_slots[i] = &rs->vars[i]->node.unv;
+
+    return true;
+}
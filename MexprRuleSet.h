@@ -0,0 +1,70 @@
+#ifndef __MEXPR_RULE_SET__
+#define __MEXPR_RULE_SET__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "MexprTree.h"
+#include "MexprPool.h"
+
+/*
+ * Set of logical rules evaluated together against one record.
+ *
+ * All rules share one variable table. The variables of each rule
+ * are resolved to the table when the rule is added, so a record
+ * is bound only once by assigning the values of the table, instead
+ * of resolving every rule. The rules are evaluated in parallel by
+ * the workers of the pool, except the simple ones answered by the
+ * predicate index.
+ */
+typedef struct rule_set rule_set;
+
+rule_set *rule_set_create(void);
+void rule_set_destroy(rule_set *rs);
+
+/*
+ * Parse the inequality or logical expression and add it as a rule.
+ * Return the rule id, numbered from zero in the order of addition,
+ * or -1 if the expression can't be parsed.
+ */
+int rule_set_add(rule_set *rs, char *expression);
+int rule_set_size(rule_set *rs);
+
+/*
+ * The number of rules answered by the predicate index instead of
+ * the evaluation. See MexprPredicateIndex.h for the indexable rules.
+ */
+int rule_set_indexed_size(rule_set *rs);
+
+/*
+ * Assign the value of the variable for the next evaluation. Return
+ * false if no rule refers to the variable. 'value' must be INT,
+ * DOUBLE or BOOLEAN.
+ */
+bool rule_set_assign(rule_set *rs, char *vname, tr_node *value);
+
+/*
+ * Evaluate all rules against the assigned values and write the ids
+ * of the rules that are true to 'ids' in ascending order. 'ids' must
+ * have rule_set_size() elements. Rules that fail the evaluation or
+ * refer to any unassigned variable are not true. All variables get
+ * unassigned at the end for the next record. 'pool' can be NULL to
+ * evaluate the rules on the current thread.
+ *
+ * Return the number of the true rules.
+ */
+int rule_set_evaluate(rule_set *rs, mexpr_pool *pool, int *ids);
+
+/*
+ * Compile the rules into a shared object by the system C compiler
+ * and evaluate them natively. The object is cached in 'cache_dir'.
+ *
+ * The cached objects are loaded without other checks, so 'cache_dir'
+ * must be private : a directory owned by the effective user and not
+ * writable by the group and others, e.g. one made by mkdtemp(), not
+ * /tmp itself. Return false for other directories, for a cached
+ * object that isn't a regular file private to the user, and for the
+ * paths too long for the cache.
+ */
+bool rule_set_compile(rule_set *rs, char *cache_dir);
+
+#endif
@@ -0,0 +1,141 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "MexprRegistry.h"
+#include "MexprStats.h"
+
+#ifdef MEXPR_STATS
+
+static void
+add_stats(void *sum, const void *stats){
+    const mexpr_stats *from = (const mexpr_stats *) stats;
+    mexpr_stats *to = (mexpr_stats *) sum;
+    const mexpr_stage_stats *s;
+    mexpr_stage_stats *d;
+    uint64_t max;
+    int i;
+
+    for (i = 0; i < MEXPR_STAGES; i++){
+	s = &from->stages[i];
+	d = &to->stages[i];
+	d->count += __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+	d->total_ns += __atomic_load_n(&s->total_ns, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED);
+	if (max > d->max_ns)
+	    d->max_ns = max;
+    }
+}
+
+/* The counters of each thread are one mexpr_stats */
+static mexpr_registry registry =
+    MEXPR_REGISTRY_INITIALIZER(mexpr_stats, add_stats);
+static _Thread_local mexpr_stats *own_stats;
+
+uint64_t
+mexpr_stats_now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Only the owner thread writes its counters. The relaxed atomic
+ * stores keep the readers of the other threads from torn values.
+ */
+void
+mexpr_stats_record(mexpr_stage stage, uint64_t ns){
+    mexpr_stage_stats *s;
+
+    if (own_stats == NULL)
+	own_stats = (mexpr_stats *) mexpr_registry_register(&registry);
+    s = &own_stats->stages[stage];
+
+    __atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->total_ns, s->total_ns + ns, __ATOMIC_RELAXED);
+    if (ns > s->max_ns)
+	__atomic_store_n(&s->max_ns, ns, __ATOMIC_RELAXED);
+}
+
+bool
+mexpr_stats_enabled(void){
+    return true;
+}
+
+void
+mexpr_stats_thread(mexpr_stats *stats){
+    memset(stats, 0, sizeof(mexpr_stats));
+    if (own_stats != NULL)
+	add_stats(stats, own_stats);
+}
+
+void
+mexpr_stats_total(mexpr_stats *stats){
+    (void) mexpr_registry_sum(&registry, stats);
+}
+
+void
+mexpr_stats_reset(void){
+    (void) mexpr_registry_reset(&registry);
+}
+
+#else
+
+uint64_t
+mexpr_stats_now(void){
+    return 0;
+}
+
+void
+mexpr_stats_record(mexpr_stage stage, uint64_t ns){
+    (void) stage;
+    (void) ns;
+}
+
+bool
+mexpr_stats_enabled(void){
+    return false;
+}
+
+void
+mexpr_stats_thread(mexpr_stats *stats){
+    memset(stats, 0, sizeof(mexpr_stats));
+}
+
+void
+mexpr_stats_total(mexpr_stats *stats){
+    memset(stats, 0, sizeof(mexpr_stats));
+}
+
+void
+mexpr_stats_reset(void){
+}
+
+#endif
+
+const char *
+mexpr_stage_name(mexpr_stage stage){
+    switch(stage){
+	case MEXPR_STAGE_INIT_BUFFER:
+	    return "init_buffer";
+	case MEXPR_STAGE_PARSE:
+	    return "parse";
+	case MEXPR_STAGE_INFIX_TO_POSTFIX:
+	    return "infix_to_postfix";
+	case MEXPR_STAGE_POSTFIX_TO_TREE:
+	    return "postfix_to_tree";
+	case MEXPR_STAGE_RESOLVE:
+	    return "resolve";
+	case MEXPR_STAGE_ACCESS_CB:
+	    return "access_cb";
+	case MEXPR_STAGE_EVALUATE:
+	    return "evaluate";
+	default:
+	    assert(0);
+	    return NULL;
+    }
+}
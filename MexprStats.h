@@ -0,0 +1,66 @@
+#ifndef __MEXPR_STATS__
+#define __MEXPR_STATS__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Latency of the stages of the parse and evaluation pipeline.
+ *
+ * Built with -DMEXPR_STATS, each stage records its count and its
+ * time in nanoseconds to the counters of the calling thread. The
+ * counters of all threads, including exited ones, are summed up on
+ * read. Without the flag, the instrumentation compiles to nothing
+ * and the counters stay zero.
+ *
+ * The time of MEXPR_STAGE_RESOLVE includes the one of the callback,
+ * which is also recorded as MEXPR_STAGE_ACCESS_CB.
+ */
+typedef enum mexpr_stage {
+    MEXPR_STAGE_INIT_BUFFER,
+    MEXPR_STAGE_PARSE,
+    MEXPR_STAGE_INFIX_TO_POSTFIX,
+    MEXPR_STAGE_POSTFIX_TO_TREE,
+    MEXPR_STAGE_RESOLVE,
+    MEXPR_STAGE_ACCESS_CB,
+    MEXPR_STAGE_EVALUATE,
+    MEXPR_STAGES
+} mexpr_stage;
+
+typedef struct mexpr_stage_stats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} mexpr_stage_stats;
+
+typedef struct mexpr_stats {
+    mexpr_stage_stats stages[MEXPR_STAGES];
+} mexpr_stats;
+
+#ifdef MEXPR_STATS
+#define MEXPR_STAGE_BEGIN(start) \
+    uint64_t start = mexpr_stats_now()
+#define MEXPR_STAGE_END(stage, start) \
+    mexpr_stats_record(stage, mexpr_stats_now() - start)
+#else
+#define MEXPR_STAGE_BEGIN(start)
+#define MEXPR_STAGE_END(stage, start)
+#endif
+
+bool mexpr_stats_enabled(void);
+const char *mexpr_stage_name(mexpr_stage stage);
+
+/* The counters of the calling thread */
+void mexpr_stats_thread(mexpr_stats *stats);
+
+/* The sum of the counters of all threads */
+void mexpr_stats_total(mexpr_stats *stats);
+
+/* Clear the counters of all threads. Call it while no stage runs */
+void mexpr_stats_reset(void);
+
+/* Used by the instrumentation */
+uint64_t mexpr_stats_now(void);
+void mexpr_stats_record(mexpr_stage stage, uint64_t ns);
+
+#endif
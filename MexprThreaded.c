@@ -0,0 +1,546 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+#include "MexprAlloc.h"
+#include "MexprThreaded.h"
+
+/* Define MEXPR_SWITCH_DISPATCH to use the portable dispatch with GCC */
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(MEXPR_SWITCH_DISPATCH)
+#define DIRECT_THREADING
+#endif
+
+/* Handler of each operation. The order matches handler_table */
+typedef enum op_kind {
+    OP_LOAD,
+    OP_SIN,
+    OP_COS,
+    OP_SQR,
+    OP_SQRT,
+    OP_PLUS,
+    OP_MINUS,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_MOD,
+    OP_MIN,
+    OP_MAX,
+    OP_POW,
+    OP_GE,
+    OP_LE,
+    OP_GT,
+    OP_LT,
+    OP_NEQ,
+    OP_EQ,
+    OP_AND,
+    OP_OR,
+    OP_END
+} op_kind;
+
+/*
+ * Value tags. Small numbers to switch on the pair of operand types
+ * by one jump table.
+ */
+enum { TAG_INT, TAG_DOUBLE, TAG_BOOLEAN };
+#define TAG_PAIR(l, r) ((l)->tag * 3 + (r)->tag)
+#define II (TAG_INT * 3 + TAG_INT)
+#define ID (TAG_INT * 3 + TAG_DOUBLE)
+#define DI (TAG_DOUBLE * 3 + TAG_INT)
+#define DD (TAG_DOUBLE * 3 + TAG_DOUBLE)
+#define BB (TAG_BOOLEAN * 3 + TAG_BOOLEAN)
+
+typedef struct tagged_value {
+    int tag;
+    union {
+	int ival;
+	double dval;
+	bool bval;
+    } u;
+} tagged_value;
+
+typedef struct threaded_op {
+    /* Address of the handler, or NULL with the switch dispatch */
+    const void *handler;
+    op_kind kind;
+
+    /* Indexes of 'values' */
+    int dst;
+    int left;
+    int right;
+
+    /* VARIABLE leaf for OP_LOAD */
+    tr_node *var_node;
+} threaded_op;
+
+struct threaded_code {
+    int nops;
+    int ops_capacity;
+    threaded_op *ops;
+
+    /* One value per node. Constants are stored by the compilation */
+    int nvalues;
+    int values_capacity;
+    tagged_value *values;
+};
+
+static int
+new_value(threaded_code *code){
+    if (code->nvalues == code->values_capacity){
+	code->values_capacity = code->values_capacity == 0 ?
+	    16 : code->values_capacity * 2;
+	code->values = (tagged_value *)
+	    mexpr_realloc(code->values,
+			  sizeof(tagged_value) * code->values_capacity,
+			  MEXPR_ALLOC_CODE);
+    }
+
+    return code->nvalues++;
+}
+
+static threaded_op *
+new_op(threaded_code *code, op_kind kind, int left, int right){
+    threaded_op *op;
+
+    if (code->nops == code->ops_capacity){
+	code->ops_capacity = code->ops_capacity == 0 ?
+	    16 : code->ops_capacity * 2;
+	code->ops = (threaded_op *)
+	    mexpr_realloc(code->ops,
+			  sizeof(threaded_op) * code->ops_capacity,
+			  MEXPR_ALLOC_CODE);
+    }
+
+    op = &code->ops[code->nops++];
+    op->handler = NULL;
+    op->kind = kind;
+    op->dst = new_value(code);
+    op->left = left;
+    op->right = right;
+    op->var_node = NULL;
+
+    return op;
+}
+
+static op_kind
+operator_kind(int node_id){
+    switch(node_id){
+	case SIN:
+	    return OP_SIN;
+	case COS:
+	    return OP_COS;
+	case SQR:
+	    return OP_SQR;
+	case SQRT:
+	    return OP_SQRT;
+	case PLUS:
+	    return OP_PLUS;
+	case MINUS:
+	    return OP_MINUS;
+	case MULTIPLY:
+	    return OP_MULTIPLY;
+	case DIVIDE:
+	    return OP_DIVIDE;
+	case MOD:
+	    return OP_MOD;
+	case MIN:
+	    return OP_MIN;
+	case MAX:
+	    return OP_MAX;
+	case POW:
+	    return OP_POW;
+	case GREATER_THAN_OR_EQUAL_TO:
+	    return OP_GE;
+	case LESS_THAN_OR_EQUAL_TO:
+	    return OP_LE;
+	case GREATER_THAN:
+	    return OP_GT;
+	case LESS_THAN:
+	    return OP_LT;
+	case NEQ:
+	    return OP_NEQ;
+	case EQ:
+	    return OP_EQ;
+	case AND:
+	    return OP_AND;
+	case OR:
+	    return OP_OR;
+	default:
+	    assert(0);
+	    return OP_END;
+    }
+}
+
+static int
+node_tag(int node_id){
+    switch(node_id){
+	case INT:
+	    return TAG_INT;
+	case DOUBLE:
+	    return TAG_DOUBLE;
+	case BOOLEAN:
+	    return TAG_BOOLEAN;
+	default:
+	    assert(0);
+	    return -1;
+    }
+}
+
+/* Emit the operations of the subtree and return its value index */
+static int
+compile_node(threaded_code *code, tr_node *n){
+    tagged_value *v;
+    int left, right, idx;
+
+    if (n->left == NULL && n->right == NULL){
+	if (n->node_id == VARIABLE){
+	    idx = new_op(code, OP_LOAD, -1, -1)->dst;
+	    code->ops[code->nops - 1].var_node = n;
+	    return idx;
+	}
+
+	idx = new_value(code);
+	v = &code->values[idx];
+	v->tag = node_tag(n->node_id);
+	switch(n->node_id){
+	    case INT:
+		v->u.ival = n->unv.ival;
+		break;
+	    case DOUBLE:
+		v->u.dval = n->unv.dval;
+		break;
+	    default:
+		v->u.bval = n->unv.bval;
+		break;
+	}
+	return idx;
+    }
+
+    left = compile_node(code, n->left);
+    right = n->right != NULL ? compile_node(code, n->right) : -1;
+
+    return new_op(code, operator_kind(n->node_id), left, right)->dst;
+}
+
+static mexpr_error run_ops(threaded_code *code, const void *const **table);
+
+threaded_code *
+threaded_compile(tree *t){
+    threaded_code *code;
+    int result;
+
+    assert(t != NULL && t->root != NULL);
+
+    code = (threaded_code *) mexpr_realloc(NULL,
+					   sizeof(threaded_code),
+					   MEXPR_ALLOC_CODE);
+    memset(code, 0, sizeof(threaded_code));
+
+    result = compile_node(code, t->root);
+    new_op(code, OP_END, result, -1);
+
+#ifdef DIRECT_THREADING
+    {
+	const void *const *table;
+	int i;
+
+	run_ops(NULL, &table);
+	for (i = 0; i < code->nops; i++)
+	    code->ops[i].handler = table[code->ops[i].kind];
+    }
+#endif
+
+    return code;
+}
+
+void
+threaded_destroy(threaded_code *code){
+    if (code == NULL)
+	return;
+
+    mexpr_free(code->ops);
+    mexpr_free(code->values);
+    mexpr_free(code);
+}
+
+#define AS_DOUBLE(v) ((v)->tag == TAG_INT ? (double) (v)->u.ival : (v)->u.dval)
+
+#ifdef DIRECT_THREADING
+#define TARGET(kind) L_##kind:
+#define NEXT() do { op++; goto *op->handler; } while(0)
+#else
+#define TARGET(kind) case kind:
+#define NEXT() do { op++; goto dispatch; } while(0)
+#endif
+
+/* The operands and the destination of the current operation */
+#define L (&values[op->left])
+#define R (&values[op->right])
+#define D (&values[op->dst])
+
+#define UNARY_DOUBLE(fn)					\
+    do {							\
+	if (L->tag == TAG_BOOLEAN)				\
+	    return MEXPR_ERR_EVALUATION;			\
+	D->tag = TAG_DOUBLE;					\
+	D->u.dval = fn(AS_DOUBLE(L));				\
+    } while(0)
+
+/* INT for INT operands, DOUBLE for the other numeric operands */
+#define ARITHMETIC(operator)					\
+    do {							\
+	switch(TAG_PAIR(L, R)){					\
+	    case II:						\
+		D->tag = TAG_INT;				\
+		D->u.ival = L->u.ival operator R->u.ival;	\
+		break;						\
+	    case ID:						\
+	    case DI:						\
+	    case DD:						\
+		D->tag = TAG_DOUBLE;				\
+		D->u.dval = AS_DOUBLE(L) operator AS_DOUBLE(R);	\
+		break;						\
+	    default:						\
+		return MEXPR_ERR_EVALUATION;			\
+	}							\
+    } while(0)
+
+#define COMPARISON(operator)					\
+    do {							\
+	switch(TAG_PAIR(L, R)){					\
+	    case II:						\
+		D->u.bval = L->u.ival operator R->u.ival;	\
+		break;						\
+	    case ID:						\
+	    case DI:						\
+	    case DD:						\
+		D->u.bval = AS_DOUBLE(L) operator AS_DOUBLE(R);	\
+		break;						\
+	    default:						\
+		return MEXPR_ERR_EVALUATION;			\
+	}							\
+	D->tag = TAG_BOOLEAN;					\
+    } while(0)
+
+/* min and max return the chosen operand with its own type */
+#define CHOOSE(operator)					\
+    do {							\
+	switch(TAG_PAIR(L, R)){					\
+	    case II:						\
+		*D = L->u.ival operator R->u.ival ? *L : *R;	\
+		break;						\
+	    case ID:						\
+	    case DI:						\
+	    case DD:						\
+		*D = AS_DOUBLE(L) operator AS_DOUBLE(R) ? *L : *R;	\
+		break;						\
+	    default:						\
+		return MEXPR_ERR_EVALUATION;			\
+	}							\
+    } while(0)
+
+#define LOGICAL(operator)					\
+    do {							\
+	if (TAG_PAIR(L, R) != BB)				\
+	    return MEXPR_ERR_EVALUATION;			\
+	D->tag = TAG_BOOLEAN;					\
+	D->u.bval = L->u.bval operator R->u.bval;		\
+    } while(0)
+
+/*
+ * Run the operations. Return MEXPR_OK, or the cause of the failure
+ * as evaluate_tree() sets it.
+ *
+ * When 'code' is NULL, store the handler addresses indexed by
+ * op_kind to 'table' instead. The labels are local to this function,
+ * so threaded_compile() gets them in this way.
+ */
+static mexpr_error
+run_ops(threaded_code *code, const void *const **table){
+    threaded_op *op;
+    tagged_value *values;
+    tr_node *vdata;
+
+#ifdef DIRECT_THREADING
+    static const void *const handler_table[] = {
+	&&L_OP_LOAD, &&L_OP_SIN, &&L_OP_COS, &&L_OP_SQR, &&L_OP_SQRT,
+	&&L_OP_PLUS, &&L_OP_MINUS, &&L_OP_MULTIPLY, &&L_OP_DIVIDE,
+	&&L_OP_MOD, &&L_OP_MIN, &&L_OP_MAX, &&L_OP_POW, &&L_OP_GE,
+	&&L_OP_LE, &&L_OP_GT, &&L_OP_LT, &&L_OP_NEQ, &&L_OP_EQ,
+	&&L_OP_AND, &&L_OP_OR, &&L_OP_END,
+    };
+
+    if (code == NULL){
+	*table = handler_table;
+	return MEXPR_OK;
+    }
+#else
+    (void) table;
+#endif
+
+    op = code->ops;
+    values = code->values;
+
+#ifdef DIRECT_THREADING
+    goto *op->handler;
+#else
+dispatch:
+    switch(op->kind){
+#endif
+	TARGET(OP_LOAD)
+	    vdata = op->var_node->unv.vval.vdata;
+	    D->tag = node_tag(vdata->node_id);
+	    switch(vdata->node_id){
+		case INT:
+		    D->u.ival = vdata->unv.ival;
+		    break;
+		case DOUBLE:
+		    D->u.dval = vdata->unv.dval;
+		    break;
+		default:
+		    D->u.bval = vdata->unv.bval;
+		    break;
+	    }
+	    NEXT();
+	TARGET(OP_SIN)
+	    UNARY_DOUBLE(sin);
+	    NEXT();
+	TARGET(OP_COS)
+	    UNARY_DOUBLE(cos);
+	    NEXT();
+	TARGET(OP_SQRT)
+	    UNARY_DOUBLE(sqrt);
+	    NEXT();
+	TARGET(OP_SQR)
+	    switch(L->tag){
+		case TAG_INT:
+		    D->tag = TAG_INT;
+		    D->u.ival = L->u.ival * L->u.ival;
+		    break;
+		case TAG_DOUBLE:
+		    D->tag = TAG_DOUBLE;
+		    D->u.dval = L->u.dval * L->u.dval;
+		    break;
+		default:
+		    return MEXPR_ERR_EVALUATION;
+	    }
+	    NEXT();
+	TARGET(OP_PLUS)
+	    ARITHMETIC(+);
+	    NEXT();
+	TARGET(OP_MINUS)
+	    ARITHMETIC(-);
+	    NEXT();
+	TARGET(OP_MULTIPLY)
+	    ARITHMETIC(*);
+	    NEXT();
+	TARGET(OP_DIVIDE)
+	    if (L->tag != TAG_BOOLEAN && (R->tag == TAG_INT ? R->u.ival == 0
+		: R->tag == TAG_DOUBLE && R->u.dval == 0.0))
+		return MEXPR_ERR_ZERO_DIVISION;
+	    ARITHMETIC(/);
+	    NEXT();
+	TARGET(OP_MOD)
+	    switch(TAG_PAIR(L, R)){
+		case II:
+		    if (R->u.ival == 0)
+			return MEXPR_ERR_ZERO_DIVISION;
+		    D->tag = TAG_INT;
+		    D->u.ival = L->u.ival % R->u.ival;
+		    break;
+		case ID:
+		case DI:
+		case DD:
+		    if (AS_DOUBLE(R) == 0.0)
+			return MEXPR_ERR_ZERO_DIVISION;
+		    D->tag = TAG_DOUBLE;
+		    D->u.dval = fmod(AS_DOUBLE(L), AS_DOUBLE(R));
+		    break;
+		default:
+		    return MEXPR_ERR_EVALUATION;
+	    }
+	    NEXT();
+	TARGET(OP_MIN)
+	    CHOOSE(<);
+	    NEXT();
+	TARGET(OP_MAX)
+	    CHOOSE(>);
+	    NEXT();
+	TARGET(OP_POW)
+	    if (L->tag == TAG_BOOLEAN || R->tag == TAG_BOOLEAN)
+		return MEXPR_ERR_EVALUATION;
+	    D->tag = TAG_DOUBLE;
+	    D->u.dval = pow(AS_DOUBLE(L), AS_DOUBLE(R));
+	    NEXT();
+	TARGET(OP_GE)
+	    COMPARISON(>=);
+	    NEXT();
+	TARGET(OP_LE)
+	    COMPARISON(<=);
+	    NEXT();
+	TARGET(OP_GT)
+	    COMPARISON(>);
+	    NEXT();
+	TARGET(OP_LT)
+	    COMPARISON(<);
+	    NEXT();
+	TARGET(OP_NEQ)
+	    COMPARISON(!=);
+	    NEXT();
+	TARGET(OP_EQ)
+	    COMPARISON(==);
+	    NEXT();
+	TARGET(OP_AND)
+	    LOGICAL(&&);
+	    NEXT();
+	TARGET(OP_OR)
+	    LOGICAL(||);
+	    NEXT();
+	TARGET(OP_END)
+	    return MEXPR_OK;
+#ifndef DIRECT_THREADING
+    }
+
+    assert(0);
+    return MEXPR_ERR_EVALUATION;
+#endif
+}
+
+void
+threaded_evaluate(threaded_code *code, tree *t, tr_node *top){
+    tagged_value *result;
+    node_value value;
+    int node_id;
+
+    if (t->require_resolution && !t->resolved){
+	evaluate_tree(t, top);
+	return;
+    }
+
+    tree_partial_eval_begin(t);
+
+    if ((t->error = run_ops(code, NULL)) != MEXPR_OK)
+	t->computation_failed = true;
+
+    if (!tree_eval_end(t))
+	return;
+
+    result = &code->values[code->ops[code->nops - 1].left];
+    switch(result->tag){
+	case TAG_INT:
+	    node_id = INT;
+	    value.ival = result->u.ival;
+	    break;
+	case TAG_DOUBLE:
+	    node_id = DOUBLE;
+	    value.dval = result->u.dval;
+	    break;
+	default:
+	    node_id = BOOLEAN;
+	    value.bval = result->u.bval;
+	    break;
+    }
+    tree_set_top(top, node_id, value);
+}
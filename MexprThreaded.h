@@ -0,0 +1,31 @@
+#ifndef __MEXPR_THREADED__
+#define __MEXPR_THREADED__
+
+#include "MexprTree.h"
+
+/*
+ * Threaded code interpreter.
+ *
+ * The tree is flattened into an array of operations in postorder.
+ * With GCC and Clang, each operation holds the address of its
+ * handler and every handler jumps to the next one by 'goto *'
+ * (direct threading), so the dispatch is spread over the handlers
+ * instead of one indirect branch of the nested switch of
+ * evaluate_node(). Other compilers dispatch by a switch statement.
+ *
+ * The values keep dynamic types, so the results and failures are
+ * the same as evaluate_tree() for any types of variables.
+ */
+typedef struct threaded_code threaded_code;
+
+threaded_code *threaded_compile(tree *t);
+void threaded_destroy(threaded_code *code);
+
+/*
+ * Same as evaluate_tree() for the tree passed to threaded_compile().
+ * The code holds the intermediate values, so it must not be run by
+ * multiple threads at the same time.
+ */
+void threaded_evaluate(threaded_code *code, tree *t, tr_node *top);
+
+#endif
@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+#include "MexprProgram.h"
+#include "MexprJit.h"
+#include "MexprAlloc.h"
+#include "MexprTier.h"
+
+struct tiered_tree {
+    tree *t;
+    int threshold;
+
+    /* One VARIABLE leaf per distinct variable name */
+    int nvars;
+    tr_node **var_nodes;
+
+    /*
+     * The types of variables observed by the last generic evaluation,
+     * and the number of evaluations in a row that saw them. -1 when
+     * the tree can't be specialized for these types.
+     */
+    int *types;
+    int stable;
+
+    /* The number of guard failures in a row */
+    int guard_failures;
+
+    /*
+     * Specialized version for the types 'guard_types'. 'slots' maps
+     * 'vars' of the program to 'var_nodes'.
+     */
+    int *guard_types;
+    typed_program *prog;
+    int *slots;
+    node_value *values;
+    jit_code *code;
+
+    tier_stats stats;
+};
+
+static int
+find_var(tiered_tree *tt, char *vname){
+    int i;
+
+    for (i = 0; i < tt->nvars; i++){
+	if (strcmp(tt->var_nodes[i]->unv.vval.vname, vname) == 0)
+	    return i;
+    }
+
+    return -1;
+}
+
+/* Callback for compile_typed_program() */
+static int
+observed_type_cb(char *vname, void *data){
+    tiered_tree *tt = (tiered_tree *) data;
+    int i = find_var(tt, vname);
+
+    return i < 0 ? INVALID : tt->types[i];
+}
+
+tiered_tree *
+tiered_tree_create(tree *t, int threshold){
+    tiered_tree *tt;
+    tr_node *n;
+    int i;
+
+    assert(t != NULL && t->root != NULL);
+    assert(threshold > 0);
+
+    tt = (tiered_tree *) mexpr_realloc(NULL,
+				       sizeof(tiered_tree), MEXPR_ALLOC_CODE);
+    memset(tt, 0, sizeof(tiered_tree));
+    tt->t = t;
+    tt->threshold = threshold;
+
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id != VARIABLE || find_var(tt, n->unv.vval.vname) >= 0)
+	    continue;
+	tt->var_nodes = (tr_node **) mexpr_realloc(tt->var_nodes,
+						   sizeof(tr_node *) * (tt->nvars + 1),
+						   MEXPR_ALLOC_CODE);
+	tt->var_nodes[tt->nvars++] = n;
+    }
+    tt->types = (int *) mexpr_realloc(NULL,
+				      sizeof(int) * (tt->nvars + 1),
+				      MEXPR_ALLOC_CODE);
+    tt->guard_types = (int *) mexpr_realloc(NULL,
+					    sizeof(int) * (tt->nvars + 1),
+					    MEXPR_ALLOC_CODE);
+    for (i = 0; i < tt->nvars; i++)
+	tt->types[i] = INVALID;
+    tt->stats.current = TIER_GENERIC;
+
+    return tt;
+}
+
+/* Drop the specialized version and go back to the generic tier */
+static void
+deoptimize(tiered_tree *tt){
+    if (tt->prog != NULL)
+	destroy_typed_program(tt->prog);
+    jit_destroy(tt->code);
+    mexpr_free(tt->slots);
+    mexpr_free(tt->values);
+    tt->prog = NULL;
+    tt->code = NULL;
+    tt->slots = NULL;
+    tt->values = NULL;
+    tt->stable = 0;
+    tt->guard_failures = 0;
+    tt->stats.current = TIER_GENERIC;
+}
+
+void
+tiered_tree_destroy(tiered_tree *tt){
+    deoptimize(tt);
+    mexpr_free(tt->var_nodes);
+    mexpr_free(tt->types);
+    mexpr_free(tt->guard_types);
+    mexpr_free(tt);
+}
+
+/* Specialize the tree for the observed types */
+static void
+promote(tiered_tree *tt){
+    int i;
+
+    if ((tt->prog = compile_typed_program(tt->t, observed_type_cb,
+					  tt)) == NULL){
+	/* The result type depends on the values */
+	tt->stable = -1;
+	return;
+    }
+
+    tt->slots = (int *) mexpr_realloc(NULL,
+				      sizeof(int) * (tt->prog->nvars + 1),
+				      MEXPR_ALLOC_CODE);
+    for (i = 0; i < tt->prog->nvars; i++)
+	tt->slots[i] = find_var(tt, tt->prog->vars[i].vname);
+    tt->values = (node_value *) mexpr_realloc(NULL,
+					      sizeof(node_value) * tt->prog->ninsts,
+					      MEXPR_ALLOC_CODE);
+
+    /* The variables still have the observed types */
+    tt->code = jit_compile_tree(tt->t);
+    memcpy(tt->guard_types, tt->types, sizeof(int) * tt->nvars);
+
+    tt->guard_failures = 0;
+    tt->stats.current = tt->code != NULL ? TIER_NATIVE : TIER_TYPED;
+    tt->stats.promotions++;
+}
+
+/* Evaluate in the generic tier and record the types of variables */
+static void
+evaluate_generic(tiered_tree *tt, tr_node *top){
+    bool same = true;
+    int i, type;
+
+    tt->stats.evaluations[TIER_GENERIC]++;
+
+    if (tt->t->require_resolution && !tt->t->resolved){
+	evaluate_tree(tt->t, top);
+	return;
+    }
+
+    for (i = 0; i < tt->nvars; i++){
+	type = tt->var_nodes[i]->unv.vval.vdata->node_id;
+	if (type != tt->types[i]){
+	    tt->types[i] = type;
+	    same = false;
+	}
+    }
+
+    evaluate_tree(tt->t, top);
+
+    if (tt->stats.current != TIER_GENERIC)
+	return;
+
+    if (!same)
+	tt->stable = 1;
+    else if (tt->stable >= 0)
+	tt->stable++;
+
+    if (tt->stable >= tt->threshold)
+	promote(tt);
+}
+
+/* True when the variables have the types of the specialized version */
+static bool
+check_guard(tiered_tree *tt){
+    int i;
+
+    if (tt->t->require_resolution && !tt->t->resolved)
+	return false;
+
+    for (i = 0; i < tt->nvars; i++){
+	if (tt->var_nodes[i]->unv.vval.vdata->node_id != tt->guard_types[i])
+	    return false;
+    }
+
+    return true;
+}
+
+static void
+evaluate_typed(tiered_tree *tt, tr_node *top){
+    typed_program *prog = tt->prog;
+    const node_value *vars[prog->nvars + 1];
+    int i;
+
+    for (i = 0; i < prog->nvars; i++)
+	vars[i] = &tt->var_nodes[tt->slots[i]]->unv.vval.vdata->unv;
+
+    tree_partial_eval_begin(tt->t);
+
+    /* A program without type errors fails only by division */
+    if (!run_typed_program(prog, vars, tt->values)){
+	tt->t->computation_failed = true;
+	if (!prog->type_error)
+	    tt->t->error = MEXPR_ERR_ZERO_DIVISION;
+    }
+
+    if (tree_eval_end(tt->t))
+	tree_set_top(top, prog->insts[prog->ninsts - 1].type,
+		     tt->values[prog->ninsts - 1]);
+}
+
+void
+tiered_evaluate(tiered_tree *tt, tr_node *top){
+    if (tt->stats.current == TIER_GENERIC){
+	evaluate_generic(tt, top);
+	return;
+    }
+
+    if (!check_guard(tt)){
+	tt->stats.guard_failures++;
+	if (++tt->guard_failures >= tt->threshold){
+	    deoptimize(tt);
+	    tt->stats.deoptimizations++;
+	}
+	evaluate_generic(tt, top);
+	return;
+    }
+    tt->guard_failures = 0;
+
+    tt->stats.evaluations[tt->stats.current]++;
+    if (tt->stats.current == TIER_NATIVE)
+	(void) jit_evaluate_tree(tt->code, tt->t, top);
+    else
+	evaluate_typed(tt, top);
+}
+
+void
+tiered_get_stats(tiered_tree *tt, tier_stats *stats){
+    *stats = tt->stats;
+}
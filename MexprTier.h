@@ -0,0 +1,57 @@
+#ifndef __MEXPR_TIER__
+#define __MEXPR_TIER__
+
+#include <stdbool.h>
+#include "MexprTree.h"
+
+/*
+ * Tiered execution of a resolved tree.
+ *
+ * The tree starts in the generic interpreter, evaluate_tree(), which
+ * records the types of its variables. Once the variables keep the
+ * same types for 'threshold' evaluations in a row, the tree is
+ * specialized for those types : by the native code of MexprJit.h
+ * where it's supported, or by the typed program otherwise. Both run
+ * without the type checks per operation.
+ *
+ * Each specialized evaluation first guards the types of variables
+ * and falls back to the generic interpreter when they differ. After
+ * 'threshold' guard failures in a row, the specialized version is
+ * dropped and the tree collects the types again.
+ */
+typedef enum tier {
+    TIER_GENERIC,
+    TIER_TYPED,
+    TIER_NATIVE
+} tier;
+
+typedef struct tier_stats {
+    /* Current tier */
+    tier current;
+
+    /* Evaluations run by each tier */
+    unsigned long evaluations[TIER_NATIVE + 1];
+
+    /* Evaluations that the guard sent back to the generic tier */
+    unsigned long guard_failures;
+
+    /* Transitions from and to the generic tier */
+    unsigned long promotions;
+    unsigned long deoptimizations;
+} tier_stats;
+
+typedef struct tiered_tree tiered_tree;
+
+/*
+ * 't' must stay alive and resolved while the tiered tree is used.
+ * 'threshold' is the number of evaluations before the transitions.
+ */
+tiered_tree *tiered_tree_create(tree *t, int threshold);
+void tiered_tree_destroy(tiered_tree *tt);
+
+/* Same as evaluate_tree() */
+void tiered_evaluate(tiered_tree *tt, tr_node *top);
+
+void tiered_get_stats(tiered_tree *tt, tier_stats *stats);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __MEXPR_TRACE__
+#define __MEXPR_TRACE__
+
+/*
+ * Static tracepoints (USDT) for perf, bpftrace and SystemTap.
+ *
+ * With <sys/sdt.h> of SystemTap, each tracepoint is one nop in the
+ * code and a note in the ELF file, which the tracers patch only when
+ * they attach. Otherwise, or with -DMEXPR_NO_USDT, the tracepoints
+ * compile to nothing. The provider is "mexpr" :
+ *
+ *   parse__start(hash, expression)  build_mathexpr_tree() begins
+ *   parse__end(hash, error)         the parse ends with mexpr_error,
+ *                                   before the tree is built
+ *   rewind(rule, tokens)            the parser rewinds in the rule
+ *   tree__build(hash, nodes)        the tree is built
+ *   resolve(name, found)            the callback resolved a variable
+ *   eval__start(hash)               evaluate_tree() begins
+ *   eval__end(hash, error)          evaluate_tree() ends
+ *
+ * 'hash' is the FNV-1a hash of the expression string, which is kept
+ * in the tree. See the scripts in bpftrace/.
+ */
+#if !defined(MEXPR_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MEXPR_HAVE_USDT
+#endif
+#endif
+
+#ifdef MEXPR_HAVE_USDT
+#define MEXPR_TRACE1(name, a) \
+    DTRACE_PROBE1(mexpr, name, a)
+#define MEXPR_TRACE2(name, a, b) \
+    DTRACE_PROBE2(mexpr, name, a, b)
+#else
+#define MEXPR_TRACE1(name, a)
+#define MEXPR_TRACE2(name, a, b)
+#endif
+
+#endif
@@ -3,73 +3,68 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "MexprEnums.h"
 #include "Linked-List/linked_list.h"
 #include "Stack/stack.h"
 #include "ExportedParser.h"
 #include "MexprTree.h"
-
-/*
- * To free all memory allocated during computation of tree,
- * keep the tree as it is, and connect all the temporary
- * one-shot computation results in a linked list.
- *
- * After the root node returns the final computation result,
- * free the memory with free callback.
- */
-static linked_list *ll_tmp_calc;
-
-tr_node *evaluate_node(tr_node *self, tree *t);
-
-/* free callback */
-static void
-free_dynamic_calculated_node(void *p){
-    tr_node *n = (tr_node *) p;
-
-    switch(n->node_id){
-	case INT:
-	    break;
-	case DOUBLE:
-	    break;
-	case VARIABLE:
-	    break;
-	default:
-	    assert(0);
-    }
-}
+#include "MexprStats.h"
+#include "MexprAlloc.h"
+#include "MexprTrace.h"
+#include "MexprMetrics.h"
 
 static tree*
 gen_tree(void){
     tree *t;
 
-    t = (tree *) malloc(sizeof(tree));
-    if (t == NULL){
-	perror("malloc");
-	exit(-1);
-    }
-
+    t = (tree *) mexpr_malloc(sizeof(tree), MEXPR_ALLOC_TREE);
     t->root = t->list_head = NULL;
     t->require_resolution = t->resolved = false;
+    t->computation_failed = false;
+    t->values_cached = false;
+    t->error = MEXPR_OK;
+    t->evaluated_nodes = 0;
+    t->hash = 0;
+    tree_set_budget(t, NULL);
 
     return t;
 }
 
+static tr_node *
+alloc_tr_node(mexpr_alloc_site site){
+    tr_node *n = (tr_node *) mexpr_malloc(sizeof(tr_node), site);
+
+    n->parent = n->left = n->right
+	= n->list_left = n->list_right = n->result = NULL;
+
+    return n;
+}
+
 /*
  * Exported so that the application data can create tr_node * value easily.
+ * Free it by mexpr_free().
  */
 tr_node*
 gen_null_tr_node(void){
-    tr_node *n;
+    return alloc_tr_node(MEXPR_ALLOC_APPLICATION);
+}
 
-    if ((n = (tr_node *) malloc(sizeof(tr_node))) == NULL){
-	perror("malloc");
-	exit(-1);
-    }
+/*
+ * The token strings belong to the lex stack and get freed when
+ * the next string is set to the lex buffer. Copy them so that
+ * the tree can outlive the parse.
+ */
+static char *
+copy_token_val(char *token_val){
+    char *copy;
 
-    n->parent = n->left = n->right
-	= n->list_left = n->list_right = NULL;
+    assert(token_val != NULL);
 
-    return n;
+    copy = (char *) mexpr_malloc(strlen(token_val) + 1, MEXPR_ALLOC_TREE);
+    strcpy(copy, token_val);
+
+    return copy;
 }
 
 /*
@@ -80,7 +75,7 @@ gen_null_tr_node(void){
  */
 static tr_node*
 gen_tr_node_from_lex_data(lex_data *ld){
-    tr_node *n = gen_null_tr_node();
+    tr_node *n = alloc_tr_node(MEXPR_ALLOC_TREE);
 
     switch (ld->token_code){
 
@@ -109,7 +104,7 @@ gen_tr_node_from_lex_data(lex_data *ld){
 	case MAX:
 	case POW:
 	    n->node_id = ld->token_code;
-	    n->unv.operator = ld->token_val;
+	    n->unv.operator = copy_token_val(ld->token_val);
 	    break;
 
 	/* Inequality operator */
@@ -122,7 +117,7 @@ gen_tr_node_from_lex_data(lex_data *ld){
 	case AND:
 	case OR:
 	    n->node_id = ld->token_code;
-	    n->unv.operator = ld->token_val;
+	    n->unv.operator = copy_token_val(ld->token_val);
 	    break;
 
 	/* Logical operator */
@@ -138,7 +133,7 @@ gen_tr_node_from_lex_data(lex_data *ld){
 	case SQR:
 	case SQRT:
 	    n->node_id = ld->token_code;
-	    n->unv.operator = ld->token_val;
+	    n->unv.operator = copy_token_val(ld->token_val);
 	    break;
 
 	/*
@@ -165,7 +160,7 @@ gen_tr_node_from_lex_data(lex_data *ld){
 	     * we build it.
 	     */
 	    n->node_id = ld->token_code;
-	    n->unv.vval.vname = ld->token_val;
+	    n->unv.vval.vname = copy_token_val(ld->token_val);
 	    n->unv.vval.is_resolved = false;
 	    n->unv.vval.vdata = NULL;
 	    break;
@@ -183,9 +178,10 @@ gen_tr_node_from_lex_data(lex_data *ld){
  */
 tree*
 convert_postfix_to_tree(linked_list *postfix){
+    MEXPR_STAGE_BEGIN(start);
     stack *node_stack = stack_init(ll_get_length(postfix));
     lex_data *curr;
-    tr_node *trn, *prev;
+    tr_node *trn, *prev = NULL;
     tree *t = gen_tree();
 
     ll_begin_iter(postfix);
@@ -234,43 +230,72 @@ convert_postfix_to_tree(linked_list *postfix){
 
     stack_destroy(node_stack);
 
+    MEXPR_STAGE_END(MEXPR_STAGE_POSTFIX_TO_TREE, start);
+
     return t;
 }
 
-/*
- * Copy the calculation result (without pointers) to 'top'
- * argument.
- *
- * API user can decide dynamic allocated memory or just local
- * variable, etc for the computation result. All of calculated
- * 'tr_node's get freed internally without user intervention.
- *
- * Caller needs to check the tree's 'computation_failed' flag
- * before it accesses to the 'top' variable.
- */
-void
-evaluate_tree(tree *t, tr_node *top){
-    tr_node *result;
-
-    if (t->require_resolution && !t->resolved){
-	printf("variable included in expression but not resolved\n");
+static void
+destroy_tr_node(tr_node *n){
+    if (n == NULL)
 	return;
-    }
 
-    ll_tmp_calc = ll_init(NULL,
-			  free_dynamic_calculated_node);
+    destroy_tr_node(n->left);
+    destroy_tr_node(n->right);
 
-    top->parent = top->left = top->right = top->list_left
-	= top->list_right = NULL;
+    if (n->node_id == VARIABLE)
+	mexpr_free(n->unv.vval.vname);
+    else if (is_operator(n->node_id))
+	mexpr_free(n->unv.operator);
 
-    result = evaluate_node(t->root, t);
+    mexpr_free(n->result);
+    mexpr_free(n);
+}
 
-    /* Calculation failed. Just return */
-    if (t->computation_failed == true){
-	printf("calculation failure\n");
-	return;
-    }
+static size_t
+tr_node_live_bytes(tr_node *n){
+    size_t bytes;
+
+    if (n == NULL)
+	return 0;
+
+    bytes = mexpr_alloc_size(n) + mexpr_alloc_size(n->result);
+    if (n->node_id == VARIABLE)
+	bytes += mexpr_alloc_size(n->unv.vval.vname);
+    else if (is_operator(n->node_id))
+	bytes += mexpr_alloc_size(n->unv.operator);
 
+    return bytes + tr_node_live_bytes(n->left) + tr_node_live_bytes(n->right);
+}
+
+/*
+ * The bytes held by the tree, including the results of operators.
+ * The values of variables belong to the application.
+ */
+size_t
+tree_live_bytes(tree *t){
+    assert(t != NULL);
+
+    return mexpr_alloc_size(t) + tr_node_live_bytes(t->root);
+}
+
+/*
+ * Free the tree and all of its nodes.
+ *
+ * The resolved 'vdata' of VARIABLE nodes are provided by the
+ * application. So, they are not freed here.
+ */
+void
+destroy_tree(tree *t){
+    assert(t != NULL);
+
+    destroy_tr_node(t->root);
+    mexpr_free(t);
+}
+
+/* Copy the value of the result node to 'top' */
+static void
+store_top(tr_node *result, tr_node *top){
     switch(result->node_id){
 	case INT:
 	    top->node_id = INT;
@@ -292,65 +317,120 @@ evaluate_tree(tree *t, tr_node *top){
 	    assert(0);
 	    break;
     }
+}
 
-    /*
-     * Free all computation results created during the
-     * evaluate_node().
-     */
-    ll_destroy(ll_tmp_calc);
+void
+tree_eval_begin(tree *t){
+    t->computation_failed = false;
+    t->error = MEXPR_OK;
+    t->evaluated_nodes = 0;
+}
+
+bool
+tree_eval_end(tree *t){
+    if (!t->computation_failed)
+	return true;
+
+    if (t->error == MEXPR_OK)
+	t->error = MEXPR_ERR_EVALUATION;
+    t->values_cached = false;
+
+    return false;
+}
+
+void
+tree_set_budget(tree *t, const mexpr_budget *budget){
+    mexpr_budget dflt;
+
+    if (budget == NULL){
+	mexpr_get_budget(&dflt);
+	budget = &dflt;
+    }
+    t->max_eval_nodes = budget->max_eval_nodes;
 }
 
 /*
- * There are needs to handle exit case, like zero division.
+ * Copy the calculation result (without pointers) to 'top'
+ * argument.
  *
- * As for the paths to access the VARIABLE node, there are
- * assert() statements. This is because the recursive call
- * of evaluate_node() returns concrete value types such as
- * INT and DOUBLE.
+ * API user can decide dynamic allocated memory or just local
+ * variable, etc for the computation result. All of calculated
+ * 'tr_node's are owned by the tree and get freed by destroy_tree().
  *
- * Set 'true' to the original tree's 'computation_failed'
- * if calculation is not possible or failed.
+ * Caller needs to check the tree's 'computation_failed' flag
+ * before it accesses to the 'top' variable, and 'error' for the
+ * cause of the failure, which isn't printed. The tree can be
+ * evaluated again, for example after its variables get new values.
  */
-tr_node *
-evaluate_node(tr_node *self, tree *t){
-    tr_node *result, *left, *right;
+void
+evaluate_tree(tree *t, tr_node *top){
+    tr_node *result;
+    uint64_t metrics_start = mexpr_metrics_begin();
+    MEXPR_STAGE_BEGIN(start);
 
-    assert(self != NULL);
-    assert(t != NULL);
+    tree_eval_begin(t);
+    MEXPR_TRACE1(eval__start, t->hash);
 
-    /* Reach the leaf node ? */
-    if (self->left == NULL && self->right == NULL){
-	if (self->node_id != VARIABLE)
-	    return self;
-	else{
-	    /* VARIABLE */
-	    variable *v;
+    if (t->require_resolution && !t->resolved){
+	t->computation_failed = true;
+	t->error = MEXPR_ERR_UNRESOLVED;
+	t->values_cached = false;
+	MEXPR_TRACE2(eval__end, t->hash, (int) t->error);
+	MEXPR_STAGE_END(MEXPR_STAGE_EVALUATE, start);
+	mexpr_metrics_evaluation(t->error, metrics_start);
+	return;
+    }
 
-	    v = &self->unv.vval;
-	    assert(v != NULL);
+    top->parent = top->left = top->right = top->list_left
+	= top->list_right = top->result = NULL;
 
-	    return v->vdata;
-	}
+    result = evaluate_node(t->root, t);
+
+    /* Calculation failed. Just return */
+    if (!tree_eval_end(t)){
+	MEXPR_STAGE_END(MEXPR_STAGE_EVALUATE, start);
+	MEXPR_TRACE2(eval__end, t->hash, (int) t->error);
+	mexpr_metrics_evaluation(t->error, metrics_start);
+	return;
     }
 
-    /* If not, execute the operator */
-    if (is_unary_operator(self->node_id)){
+    t->values_cached = true;
+    store_top(result, top);
 
-	assert(self->left != NULL);
-	assert(self->right == NULL);
+    MEXPR_STAGE_END(MEXPR_STAGE_EVALUATE, start);
+    MEXPR_TRACE2(eval__end, t->hash, (int) MEXPR_OK);
+    mexpr_metrics_evaluation(MEXPR_OK, metrics_start);
+}
 
-	/* Create node and add it to the list */
-	result = gen_null_tr_node();
-	ll_insert(ll_tmp_calc, (void *) result);
+/*
+ * Each operator node owns one tr_node for its computation result.
+ * Allocate it at the first evaluation and reuse it afterwards, so
+ * that repeated evaluations of one tree don't allocate memory.
+ */
+static tr_node *
+get_result_node(tr_node *self){
+    if (self->result == NULL)
+	self->result = alloc_tr_node(MEXPR_ALLOC_RESULT);
 
-	/* Get the result of left node */
-	left = evaluate_node(self->left, t);
+    return self->result;
+}
 
-	if (t->computation_failed)
-	    return result;
+/*
+ * Compute the operator of 'self' from the values of its operands
+ * and return the result node. 'right' is NULL for unary operators.
+ * 'self' needs only 'node_id' and 'result', so that the callers can
+ * compute operators outside of trees.
+ *
+ * Set 'true' to the original tree's 'computation_failed'
+ * if calculation is not possible or failed.
+ */
+tr_node *
+apply_operator(tr_node *self, tr_node *left, tr_node *right, tree *t){
+    tr_node *result = get_result_node(self);
 
-	assert(left != NULL);
+    assert(left != NULL);
 
+    if (is_unary_operator(self->node_id)){
 	switch(left->node_id){
 	    case INT:
 		switch(self->node_id){
@@ -409,20 +489,7 @@ evaluate_node(tr_node *self, tree *t){
 		assert(0);
 		return NULL;
 	}
-    }else if (is_binary_operator(self->node_id)){
-	assert(self->left != NULL);
-	assert(self->right != NULL);
-
-	result = gen_null_tr_node();
-	left = evaluate_node(self->left, t);
-	if (t->computation_failed)
-	    return result;
-
-	right = evaluate_node(self->right, t);
-	if (t->computation_failed)
-	    return result;
-
-	assert(left != NULL);
+    }else{
 	assert(right != NULL);
 
 	switch(self->node_id){
@@ -507,6 +574,7 @@ evaluate_node(tr_node *self, tree *t){
 				assert(0);
 				break;
 			}
+			break;
 		    default:
 			assert(0);
 			break;
@@ -668,6 +736,7 @@ evaluate_node(tr_node *self, tree *t){
 				assert(0);
 				break;
 			}
+			break;
 		    default:
 			assert(0);
 			break;
@@ -685,6 +754,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 			    case DOUBLE:
@@ -694,6 +764,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 			    case VARIABLE:
@@ -718,6 +789,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 			    case DOUBLE:
@@ -727,6 +799,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 			    case VARIABLE:
@@ -754,6 +827,7 @@ evaluate_node(tr_node *self, tree *t){
 				assert(0);
 				break;
 			}
+			break;
 		    case BOOLEAN:
 			/* BOOLEAN / ? */
 			switch(right->node_id){
@@ -786,6 +860,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 				break;
@@ -797,6 +872,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 			    case VARIABLE:
@@ -822,6 +898,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 			    case DOUBLE:
@@ -832,6 +909,7 @@ evaluate_node(tr_node *self, tree *t){
 				    break;
 				}else{
 				    t->computation_failed = true;
+				    t->error = MEXPR_ERR_ZERO_DIVISION;
 				    break;
 				}
 			    case VARIABLE:
@@ -873,6 +951,7 @@ evaluate_node(tr_node *self, tree *t){
 				assert(0);
 				break;
 			}
+			break;
 		    default:
 			assert(0);
 			break;
@@ -966,6 +1045,7 @@ evaluate_node(tr_node *self, tree *t){
 				assert(0);
 				break;
 			}
+			break;
 		    default:
 			assert(0);
 			break;
@@ -1059,6 +1139,7 @@ evaluate_node(tr_node *self, tree *t){
 				assert(0);
 				break;
 			}
+			break;
 		    default:
 			assert(0);
 			break;
@@ -1338,11 +1419,11 @@ evaluate_node(tr_node *self, tree *t){
 			switch(right->node_id){
 			    case INT:
 				result->node_id = BOOLEAN;
-				result->unv.bval = right->unv.dval > (double) left->unv.ival;
+				result->unv.bval = left->unv.dval > (double) right->unv.ival;
 				break;
 			    case DOUBLE:
 				result->node_id = BOOLEAN;
-				result->unv.bval = right->unv.dval > left->unv.dval;
+				result->unv.bval = left->unv.dval > right->unv.dval;
 				break;
 			    case VARIABLE:
 				assert(0);
@@ -1572,6 +1653,7 @@ evaluate_node(tr_node *self, tree *t){
 			    case VARIABLE:
 				assert(0);
 			    case BOOLEAN:
+				t->computation_failed = true;
 				break;
 			    default:
 				assert(0);
@@ -1667,16 +1749,69 @@ evaluate_node(tr_node *self, tree *t){
 		break;
 
 	}
-    }else{
-	/*
-	 * This is a branch, but this node does not have any operator.
-	 */
-	assert(0);
     }
 
     return result;
 }
 
+/*
+ * There are needs to handle exit case, like zero division.
+ *
+ * As for the paths to access the VARIABLE node, there are
+ * assert() statements. This is because the recursive call
+ * of evaluate_node() returns concrete value types such as
+ * INT and DOUBLE.
+ *
+ * Set 'true' to the original tree's 'computation_failed'
+ * if calculation is not possible or failed.
+ */
+tr_node *
+evaluate_node(tr_node *self, tree *t){
+    tr_node *left, *right = NULL;
+
+    assert(self != NULL);
+    assert(t != NULL);
+
+    if (t->max_eval_nodes > 0 && ++t->evaluated_nodes > t->max_eval_nodes){
+	t->computation_failed = true;
+	t->error = MEXPR_ERR_EVAL_NODES;
+	return self;
+    }
+
+    /* Reach the leaf node ? */
+    if (self->left == NULL && self->right == NULL){
+	if (self->node_id != VARIABLE)
+	    return self;
+	else{
+	    /* VARIABLE */
+	    variable *v;
+
+	    v = &self->unv.vval;
+	    assert(v != NULL);
+
+	    return v->vdata;
+	}
+    }
+
+    /* If not, evaluate the operands and execute the operator */
+    assert(self->left != NULL);
+    left = evaluate_node(self->left, t);
+    if (t->computation_failed)
+	return get_result_node(self);
+
+    if (is_binary_operator(self->node_id)){
+	assert(self->right != NULL);
+	right = evaluate_node(self->right, t);
+	if (t->computation_failed)
+	    return get_result_node(self);
+    }else{
+	assert(is_unary_operator(self->node_id));
+	assert(self->right == NULL);
+    }
+
+    return apply_operator(self, left, right, t);
+}
+
 /* The minimum necessary tests */
 static bool
 is_invalid_tr_node(tr_node *trn){
@@ -1705,6 +1840,7 @@ resolve_variable(tree *t, void *app_data_src,
     tr_node *n, *tmp;
     variable *v;
     bool contain_illegal_var = false;
+    MEXPR_STAGE_BEGIN(start);
 
     assert(t != NULL);
     assert(t->list_head != NULL);
@@ -1712,13 +1848,20 @@ resolve_variable(tree *t, void *app_data_src,
     if (app_data_src == NULL || app_access_cb == NULL)
 	return;
 
+    /* The kept results refer to the old values */
+    t->values_cached = false;
     n = t->list_head;
 
     while(n != NULL){
 	if (n->node_id == VARIABLE){
 	    v = &n->unv.vval;
 
-	    tmp = app_access_cb(v->vname, app_data_src);
+	    {
+		MEXPR_STAGE_BEGIN(cb_start);
+		tmp = app_access_cb(v->vname, app_data_src);
+		MEXPR_STAGE_END(MEXPR_STAGE_ACCESS_CB, cb_start);
+		MEXPR_TRACE2(resolve, v->vname, !is_invalid_tr_node(tmp));
+	    }
 	    if (is_invalid_tr_node(tmp))
 		contain_illegal_var = true;
 	    else{
@@ -1731,4 +1874,121 @@ resolve_variable(tree *t, void *app_data_src,
 
     if (!contain_illegal_var)
 	t->resolved = true;
+
+    MEXPR_STAGE_END(MEXPR_STAGE_RESOLVE, start);
+}
+
+/* The current value of the operand node */
+static tr_node *
+operand_value(tr_node *n){
+    if (n->left != NULL || n->right != NULL)
+	return n->result;
+
+    return n->node_id == VARIABLE ? n->unv.vval.vdata : n;
+}
+
+static bool
+same_value(tr_node *a, tr_node *b){
+    if (a->node_id != b->node_id)
+	return false;
+
+    switch(a->node_id){
+	case INT:
+	    return a->unv.ival == b->unv.ival;
+	case DOUBLE:
+	    /* Compare the bits so that NaN equals NaN, and -0.0 differs */
+	    return memcmp(&a->unv.dval, &b->unv.dval, sizeof(double)) == 0;
+	case BOOLEAN:
+	    return a->unv.bval == b->unv.bval;
+	default:
+	    return false;
+    }
+}
+
+/*
+ * Recompute the paths from the leaves of 'vname' with the failure,
+ * the budget of nodes, the metrics and the tracepoints of
+ * evaluate_tree(). Each recomputed operator counts against the
+ * budget as one node.
+ */
+static int
+reevaluate_paths(tree *t, char *vname, tr_node *top){
+    uint64_t metrics_start = mexpr_metrics_begin();
+    tr_node *n, *p, *result, saved;
+    int recomputed = 0;
+    MEXPR_STAGE_BEGIN(start);
+
+    tree_eval_begin(t);
+    MEXPR_TRACE1(eval__start, t->hash);
+
+    for (n = t->list_head; n != NULL && !t->computation_failed;
+	 n = n->list_right){
+	if (n->node_id != VARIABLE || strcmp(n->unv.vval.vname, vname) != 0)
+	    continue;
+
+	for (p = n->parent; p != NULL; p = p->parent){
+	    if (t->max_eval_nodes > 0 &&
+		++t->evaluated_nodes > t->max_eval_nodes){
+		t->computation_failed = true;
+		t->error = MEXPR_ERR_EVAL_NODES;
+		break;
+	    }
+
+	    saved = *p->result;
+	    result = apply_operator(p, operand_value(p->left),
+				    p->right != NULL ?
+				    operand_value(p->right) : NULL, t);
+	    recomputed++;
+
+	    /* The ancestors don't change either */
+	    if (t->computation_failed || same_value(&saved, result))
+		break;
+	}
+    }
+
+    if (tree_eval_end(t)){
+	top->parent = top->left = top->right = top->list_left
+	    = top->list_right = top->result = NULL;
+	store_top(t->root->result, top);
+    }
+
+    MEXPR_STAGE_END(MEXPR_STAGE_EVALUATE, start);
+    MEXPR_TRACE2(eval__end, t->hash, (int) t->error);
+    mexpr_metrics_evaluation(t->error, metrics_start);
+
+    return recomputed;
+}
+
+/*
+ * Re-evaluate the tree after the value of the variable 'vname' has
+ * changed, e.g. by updating the tr_node returned by 'app_access_cb'.
+ *
+ * The results of operator nodes are kept from the last evaluation,
+ * so only the operators on the paths from the leaves of 'vname' to
+ * the root are recomputed. Each path stops at the first operator
+ * whose value is unchanged. When several variables changed, call
+ * this for each of them; 'top' is valid after the last call.
+ *
+ * The whole tree is evaluated by evaluate_tree() when the kept
+ * results are not valid : before the first successful evaluation,
+ * after any failure, or after the evaluation by the batch functions.
+ *
+ * The failure is reported by 'computation_failed' and 'error' as
+ * by evaluate_tree(), and the evaluation counts in the budget and
+ * the metrics in the same way.
+ *
+ * Return the number of recomputed operators, or -1 when the whole
+ * tree was evaluated.
+ */
+int
+reevaluate_variable(tree *t, char *vname, tr_node *top){
+    assert(t != NULL && vname != NULL);
+
+    if (!t->values_cached || t->root->result == NULL ||
+	(t->require_resolution && !t->resolved)){
+	evaluate_tree(t, top);
+	return -1;
+    }
+
+    return reevaluate_paths(t, vname, top);
 }
@@ -2,7 +2,10 @@
 #define __MATH_EXPR_TREE__
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include "Linked-List/linked_list.h"
+#include "MexprBudget.h"
 
 typedef struct tr_node tr_node;
 
@@ -71,6 +74,12 @@ typedef struct tr_node {
     struct tr_node *list_left;
     struct tr_node *list_right;
 
+    /*
+     * Computation result of this operator node. Allocated
+     * at the first evaluation and reused by later ones.
+     */
+    struct tr_node *result;
+
 } tr_node;
 
 typedef struct tree {
@@ -96,11 +105,53 @@ typedef struct tree {
     /* Did the tree hit the error during computation ? */
     bool computation_failed;
 
+    /*
+     * True when the results of all operator nodes are computed from
+     * the current values. See reevaluate_variable().
+     */
+    bool values_cached;
+
+    /*
+     * The reason of the failure of evaluate_tree(), and the nodes
+     * visited against 'max_eval_nodes' of the budget of the tree.
+     */
+    mexpr_error error;
+    unsigned long evaluated_nodes;
+    unsigned long max_eval_nodes;
+
+    /* The hash of the expression string for the tracepoints */
+    uint64_t hash;
+
 } tree;
 
 void evaluate_tree(tree *t, tr_node *top);
+
+/*
+ * The failure state shared by the evaluators of a tree. Call
+ * tree_eval_begin() before the evaluation : it resets
+ * 'computation_failed', 'error' and the nodes counted against the
+ * budget. Call tree_eval_end() after it : a failure without a more
+ * specific cause gets MEXPR_ERR_EVALUATION, and the kept results of
+ * the operators become invalid. Return false if the evaluation failed.
+ */
+void tree_eval_begin(tree *t);
+bool tree_eval_end(tree *t);
+
+/*
+ * Apply 'max_eval_nodes' of 'budget' to the later evaluations of the
+ * tree, or the one of the default budget by NULL. A tree gets the
+ * default when it is built. Don't call it during an evaluation.
+ */
+void tree_set_budget(tree *t, const mexpr_budget *budget);
+
+int reevaluate_variable(tree *t, char *vname, tr_node *top);
+tr_node *evaluate_node(tr_node *self, tree *t);
+tr_node *apply_operator(tr_node *self, tr_node *left, tr_node *right,
+			tree *t);
 tr_node *gen_null_tr_node(void);
 tree* convert_postfix_to_tree(linked_list *postfix);
+void destroy_tree(tree *t);
+size_t tree_live_bytes(tree *t);
 void resolve_variable(tree *t, void *app_data_src,
 		      tr_node *(* app_access_cb)(char *, void *));
 
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <string.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprTreeUtil.h"
+
+static bool
+is_leaf(tr_node *n){
+    return n->left == NULL && n->right == NULL;
+}
+
+bool
+tree_same_subtree(tr_node *a, tr_node *b){
+    if (a == NULL || b == NULL)
+	return a == b;
+
+    if (a->node_id != b->node_id)
+	return false;
+
+    if (is_leaf(a)){
+	if (!is_leaf(b))
+	    return false;
+	switch(a->node_id){
+	    case VARIABLE:
+		return strcmp(a->unv.vval.vname, b->unv.vval.vname) == 0;
+	    case INT:
+		return a->unv.ival == b->unv.ival;
+	    case DOUBLE:
+		return memcmp(&a->unv.dval, &b->unv.dval, sizeof(double)) == 0;
+	    case BOOLEAN:
+		return a->unv.bval == b->unv.bval;
+	    default:
+		return false;
+	}
+    }
+
+    return tree_same_subtree(a->left, b->left) &&
+	tree_same_subtree(a->right, b->right);
+}
+
+bool
+tree_is_nonzero_constant(tr_node *n){
+    if (!is_leaf(n))
+	return false;
+
+    return (n->node_id == INT && n->unv.ival != 0) ||
+	(n->node_id == DOUBLE && n->unv.dval != 0.0);
+}
+
+bool
+tree_is_numeric_type(int type){
+    return type == INT || type == DOUBLE || type == NUMERIC;
+}
+
+int
+tree_operator_type(int node_id, int lt, int rt){
+    if (node_id == AND || node_id == OR)
+	return lt == BOOLEAN && rt == BOOLEAN ? BOOLEAN : TYPE_ERROR;
+
+    if (!tree_is_numeric_type(lt))
+	return TYPE_ERROR;
+
+    if (is_unary_operator(node_id))
+	return node_id == SQR ? lt : DOUBLE;
+
+    if (!tree_is_numeric_type(rt))
+	return TYPE_ERROR;
+
+    switch(node_id){
+	case PLUS:
+	case MINUS:
+	case MULTIPLY:
+	case DIVIDE:
+	case MOD:
+	    if (lt == INT && rt == INT)
+		return INT;
+	    return lt == DOUBLE || rt == DOUBLE ? DOUBLE : NUMERIC;
+	case MIN:
+	case MAX:
+	    return lt == rt ? lt : NUMERIC;
+	case POW:
+	    return DOUBLE;
+	default:
+	    return BOOLEAN;
+    }
+}
+
+int
+tree_static_type(tr_node *n){
+    if (is_leaf(n))
+	return n->node_id == VARIABLE ? n->unv.vval.vdata->node_id
+	    : n->node_id;
+
+    return tree_operator_type(n->node_id, tree_static_type(n->left),
+			      n->right == NULL ? INVALID
+			      : tree_static_type(n->right));
+}
+
+void
+tree_partial_eval_begin(tree *t){
+    t->values_cached = false;
+    tree_eval_begin(t);
+}
+
+void
+tree_set_top(tr_node *top, int node_id, node_value value){
+    top->parent = top->left = top->right = top->list_left
+	= top->list_right = top->result = NULL;
+    top->node_id = node_id;
+    top->unv = value;
+}
@@ -0,0 +1,48 @@
+#ifndef __MEXPR_TREE_UTIL__
+#define __MEXPR_TREE_UTIL__
+
+#include <stdbool.h>
+#include "MexprTree.h"
+
+/*
+ * Helpers shared by the modules that analyze or evaluate trees
+ * outside MexprTree.c. Internal to the library, not part of the API.
+ */
+
+/*
+ * Static types of subtrees are INT, DOUBLE, BOOLEAN and these two.
+ * NUMERIC is INT or DOUBLE chosen by min/max on each evaluation.
+ * TYPE_ERROR fails every evaluation.
+ */
+#define NUMERIC (-1)
+#define TYPE_ERROR (-2)
+
+/* True if the subtrees are written the same */
+bool tree_same_subtree(tr_node *a, tr_node *b);
+
+/* True for an INT or DOUBLE constant other than zero */
+bool tree_is_nonzero_constant(tr_node *n);
+
+/* True for INT, DOUBLE and NUMERIC */
+bool tree_is_numeric_type(int type);
+
+/*
+ * The static type of the operator for the ones of its operands.
+ * 'rt' is ignored for unary operators.
+ */
+int tree_operator_type(int node_id, int lt, int rt);
+
+/* The static type of the subtree for the current types of variables */
+int tree_static_type(tr_node *n);
+
+/*
+ * Begin an evaluation that skips some operators. Their results
+ * are not the ones of evaluate_tree(), so reevaluate_variable()
+ * doesn't reuse them.
+ */
+void tree_partial_eval_begin(tree *t);
+
+/* Set the result to 'top' as evaluate_tree() does */
+void tree_set_top(tr_node *top, int node_id, node_value value);
+
+#endif
@@ -1,6 +1,26 @@
+#include <dirent.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "MexprTree.h"
+#include "MexprBatch.h"
+#include "MexprCsv.h"
+#include "MexprRuleSet.h"
+#include "MexprRuleNetwork.h"
+#include "MexprJit.h"
+#include "MexprTier.h"
+#include "MexprThreaded.h"
+#include "MexprReorder.h"
+#include "MexprBdd.h"
+#include "MexprStats.h"
+#include "MexprAlloc.h"
+#include "MexprProfile.h"
+#include "MexprMetrics.h"
+#include "MexprExplain.h"
+#include "MexprProgram.h"
 #include "ExportedParser.h"
 
 /*
@@ -491,6 +511,2060 @@ app_var_resolve_tests(){
 				  BOOLEAN, expected_val);
 }
 
+/*
+ * Build trees that outlive the parse and evaluate them repeatedly.
+ */
+static void
+app_tree_reuse_tests(){
+    tree *t1, *t2;
+    tr_node top;
+
+    t1 = build_mathexpr_tree(start_mathexpr_parse, "a + c * 2\n");
+    assert(t1 != NULL);
+    resolve_variable(t1, app_array, app_fetch_data);
+
+    /* Parsing another string must not break the first tree */
+    t2 = build_mathexpr_tree(start_mathexpr_parse, "1 / e\n");
+    assert(t2 != NULL);
+    resolve_variable(t2, app_array, app_fetch_data);
+
+    assert(build_mathexpr_tree(start_mathexpr_parse, "1 <\n") == NULL);
+
+    evaluate_tree(t1, &top);
+    assert(!t1->computation_failed);
+    assert(top.node_id == INT && top.unv.ival == 11);
+
+    evaluate_tree(t2, &top);
+    assert(t2->computation_failed);
+
+    /* The failure of the previous evaluation must not remain */
+    t2->list_head->list_right->unv.vval.vdata->unv.dval = 4.0;
+    evaluate_tree(t2, &top);
+    assert(!t2->computation_failed);
+    assert(top.node_id == DOUBLE && top.unv.dval == 0.25);
+
+    evaluate_tree(t1, &top);
+    assert(top.node_id == INT && top.unv.ival == 11);
+
+    destroy_tree(t1);
+    destroy_tree(t2);
+}
+
+#define APP_BATCH_ROWS 2500
+
+/* Values of one row for the scalar evaluation of batch tests */
+static tr_node app_batch_row[3];
+
+static tr_node *
+app_fetch_batch_row(char *s, void *data){
+    batch_binding *bindings = (batch_binding *) data;
+    int i;
+
+    for (i = 0; bindings[i].vname != NULL; i++){
+	if (strcmp(bindings[i].vname, s) == 0)
+	    return &app_batch_row[i];
+    }
+    assert(0);
+
+    return NULL;
+}
+
+/*
+ * Evaluate the expression by evaluate_batch() and compare each row
+ * with evaluate_tree().
+ */
+static void
+app_batch_test(bool (*parser)(void), char *target,
+	       batch_binding *bindings, int n){
+    batch_value *values;
+    tr_node top;
+    tree *t;
+    int i, j;
+
+    printf("Will evaluate '%s' by batch...\n", target);
+
+    t = build_mathexpr_tree(parser, target);
+    assert(t != NULL);
+    values = (batch_value *) malloc(sizeof(batch_value) * n);
+    assert(values != NULL);
+
+    assert(evaluate_batch(t, n, bindings, values));
+
+    /* The callback must return nodes of valid type */
+    for (j = 0; bindings[j].vname != NULL; j++)
+	app_batch_row[j].node_id = bindings[j].type;
+    resolve_variable(t, bindings, app_fetch_batch_row);
+    for (i = 0; i < n; i++){
+	for (j = 0; bindings[j].vname != NULL; j++){
+	    const char *p = (const char *) bindings[j].values +
+		i * bindings[j].stride;
+
+	    app_batch_row[j].node_id = bindings[j].type;
+	    if (bindings[j].type == INT)
+		app_batch_row[j].unv.ival = *(const int *) p;
+	    else if (bindings[j].type == DOUBLE)
+		app_batch_row[j].unv.dval = *(const double *) p;
+	    else
+		app_batch_row[j].unv.bval = *(const bool *) p;
+	}
+
+	evaluate_tree(t, &top);
+	if (t->computation_failed){
+	    assert(values[i].node_id == INVALID);
+	    continue;
+	}
+
+	assert(values[i].node_id == top.node_id);
+	if (top.node_id == INT)
+	    assert(values[i].unv.ival == top.unv.ival);
+	else if (top.node_id == DOUBLE)
+	    assert(values[i].unv.dval == top.unv.dval);
+	else
+	    assert(values[i].unv.bval == top.unv.bval);
+    }
+
+    free(values);
+    destroy_tree(t);
+}
+
+/*
+ * Evaluate the predicate by evaluate_filter() and compare the
+ * matching rows with evaluate_batch(). Return the number of them.
+ */
+static size_t
+app_filter_test(bool (*parser)(void), char *target,
+		batch_binding *bindings, int n){
+    uint64_t *bitmap;
+    batch_value *values;
+    size_t *rows, nrows, i, j;
+    tree *t;
+    bool bit;
+
+    printf("Will filter rows by '%s'...\n", target);
+
+    t = build_mathexpr_tree(parser, target);
+    assert(t != NULL);
+    bitmap = (uint64_t *) malloc(sizeof(uint64_t) * FILTER_BITMAP_WORDS(n));
+    values = (batch_value *) malloc(sizeof(batch_value) * n);
+    rows = (size_t *) malloc(sizeof(size_t) * n);
+    assert(bitmap != NULL && values != NULL && rows != NULL);
+
+    assert(evaluate_filter(t, n, bindings, bitmap));
+    assert(evaluate_batch(t, n, bindings, values));
+    nrows = filter_bitmap_to_rows(bitmap, n, rows);
+
+    for (i = 0, j = 0; i < (size_t) n; i++){
+	bit = (bitmap[i / FILTER_WORD_BITS] >> (i % FILTER_WORD_BITS)) & 1;
+
+	/* Failed rows can match only by skipping the failing operand */
+	if (values[i].node_id == INVALID)
+	    assert(!bit || strstr(target, " or ") != NULL);
+	else
+	    assert(bit == values[i].unv.bval);
+
+	if (bit)
+	    assert(rows[j++] == i);
+    }
+    assert(j == nrows);
+
+    free(bitmap);
+    free(values);
+    free(rows);
+    destroy_tree(t);
+
+    return nrows;
+}
+
+static void
+app_batch_tests(){
+    struct {
+	int qty;
+	double price;
+	bool flag;
+    } rows[APP_BATCH_ROWS];
+    batch_binding bindings[] = {
+	{ .vname = "qty", .type = INT, .values = &rows[0].qty,
+	  .stride = sizeof(rows[0]) },
+	{ .vname = "price", .type = DOUBLE, .values = &rows[0].price,
+	  .stride = sizeof(rows[0]) },
+	{ .vname = "flag", .type = BOOLEAN, .values = &rows[0].flag,
+	  .stride = sizeof(rows[0]) },
+	{ .vname = NULL },
+    };
+    batch_binding unbound[] = {
+	{ .vname = "qty", .type = INT, .values = &rows[0].qty,
+	  .stride = sizeof(rows[0]) },
+	{ .vname = NULL },
+    };
+    int i;
+    tree *t;
+
+    for (i = 0; i < APP_BATCH_ROWS; i++){
+	rows[i].qty = i % 7 - 3;
+	rows[i].price = (i % 11) * 0.5;
+	rows[i].flag = i % 3 == 0;
+    }
+
+    app_batch_test(start_mathexpr_parse, "qty * 2 + price / 4\n",
+		   bindings, APP_BATCH_ROWS);
+    /* Zero division fails only some rows */
+    app_batch_test(start_mathexpr_parse, "100 / qty + 100 % qty\n",
+		   bindings, APP_BATCH_ROWS);
+    app_batch_test(start_mathexpr_parse, "sqrt(sqr(price)) + pow(qty, 2)\n",
+		   bindings, APP_BATCH_ROWS);
+    /* The result type depends on the values */
+    app_batch_test(start_mathexpr_parse, "max(qty, price) * 3\n",
+		   bindings, APP_BATCH_ROWS);
+    /* Type error fails all rows */
+    app_batch_test(start_mathexpr_parse, "flag + qty\n",
+		   bindings, APP_BATCH_ROWS);
+    app_batch_test(start_ineq_mathexpr_parse, "qty * price >= 2\n",
+		   bindings, APP_BATCH_ROWS);
+    app_batch_test(start_logical_mathexpr_parse,
+		   "qty > 0 and price < 3.5 or qty = -3\n",
+		   bindings, APP_BATCH_ROWS);
+
+    app_filter_test(start_ineq_mathexpr_parse, "qty * price >= 2\n",
+		    bindings, APP_BATCH_ROWS);
+    app_filter_test(start_logical_mathexpr_parse,
+		    "qty > 0 and price < 3.5 or qty = -3\n",
+		    bindings, APP_BATCH_ROWS);
+    app_filter_test(start_logical_mathexpr_parse,
+		    "qty < 0 or price > 4 and 10 / qty > 2\n",
+		    bindings, APP_BATCH_ROWS);
+    app_filter_test(start_logical_mathexpr_parse,
+		    "max(qty, price) > 2 and qty != 3\n",
+		    bindings, APP_BATCH_ROWS);
+    /* The rows where qty is 0 fail the right operand, which is skipped */
+    assert(app_filter_test(start_logical_mathexpr_parse,
+			   "qty = 0 or 10 / qty > 100\n",
+			   bindings, 7) == 1);
+    assert(app_filter_test(start_logical_mathexpr_parse,
+			   "flag + qty > 0 or qty = 0\n",
+			   bindings, APP_BATCH_ROWS) == 0);
+    /* A comparison of a type error is a predicate that fails all rows */
+    assert(app_filter_test(start_ineq_mathexpr_parse, "flag >= qty\n",
+			   bindings, APP_BATCH_ROWS) == 0);
+
+    t = build_mathexpr_tree(start_mathexpr_parse, "qty + price\n");
+    assert(t != NULL);
+    assert(!evaluate_batch(t, APP_BATCH_ROWS, unbound, NULL));
+    destroy_tree(t);
+}
+
+#define APP_PARALLEL_ROWS (5 * 65536 + 1234)
+
+/* Parallel evaluation must give the same results in row order */
+static void
+app_parallel_batch_tests(){
+    int *qty = (int *) malloc(sizeof(int) * APP_PARALLEL_ROWS);
+    double *price = (double *) malloc(sizeof(double) * APP_PARALLEL_ROWS);
+    batch_binding bindings[] = {
+	{ .vname = "qty", .type = INT, .values = qty },
+	{ .vname = "price", .type = DOUBLE, .values = price },
+	{ .vname = NULL },
+    };
+    batch_value *v1, *v2;
+    uint64_t *b1, *b2;
+    mexpr_pool *pool;
+    size_t words = FILTER_BITMAP_WORDS(APP_PARALLEL_ROWS);
+    tree *t;
+    int i;
+
+    printf("Will evaluate rows in parallel...\n");
+
+    v1 = (batch_value *) malloc(sizeof(batch_value) * APP_PARALLEL_ROWS);
+    v2 = (batch_value *) malloc(sizeof(batch_value) * APP_PARALLEL_ROWS);
+    b1 = (uint64_t *) malloc(sizeof(uint64_t) * words);
+    b2 = (uint64_t *) malloc(sizeof(uint64_t) * words);
+    assert(qty != NULL && price != NULL && v1 != NULL && v2 != NULL &&
+	   b1 != NULL && b2 != NULL);
+
+    for (i = 0; i < APP_PARALLEL_ROWS; i++){
+	qty[i] = i % 13 - 6;
+	price[i] = (i % 17) * 0.25;
+    }
+
+    pool = mexpr_pool_create(4);
+
+    t = build_mathexpr_tree(start_mathexpr_parse, "price * 3 - 100 / qty\n");
+    assert(t != NULL);
+    assert(evaluate_batch(t, APP_PARALLEL_ROWS, bindings, v1));
+    assert(evaluate_batch_parallel(t, APP_PARALLEL_ROWS, bindings, v2, pool));
+    for (i = 0; i < APP_PARALLEL_ROWS; i++){
+	assert(v1[i].node_id == v2[i].node_id);
+	assert(v1[i].node_id == INVALID || v1[i].unv.dval == v2[i].unv.dval);
+    }
+    destroy_tree(t);
+
+    t = build_mathexpr_tree(start_logical_mathexpr_parse,
+			    "qty > 2 and price < 2.5 or qty = -6\n");
+    assert(t != NULL);
+    assert(evaluate_filter(t, APP_PARALLEL_ROWS, bindings, b1));
+    assert(evaluate_filter_parallel(t, APP_PARALLEL_ROWS, bindings, b2, pool));
+    assert(memcmp(b1, b2, sizeof(uint64_t) * words) == 0);
+    destroy_tree(t);
+
+    mexpr_pool_destroy(pool);
+    free(qty);
+    free(price);
+    free(v1);
+    free(v2);
+    free(b1);
+    free(b2);
+}
+
+/* Write 'text' to a new temporary file and return its path in 'path' */
+static void
+app_write_temp(char *path, char *text){
+    FILE *fp;
+    int fd;
+
+    assert((fd = mkstemp(path)) >= 0);
+    assert((fp = fdopen(fd, "w")) != NULL);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static void
+app_csv_tests(){
+    char path[] = "/tmp/mexpr_csv_XXXXXX";
+    char *names[] = { "qty", "price" };
+    csv_column *qty, *price;
+    csv_table *tbl;
+    int *ivals;
+    double *dvals;
+
+    /* Unparsable fields and short rows make the whole row 0 */
+    app_write_temp(path, "qty,price\n"
+		   "1,2.5\n"
+		   "2147483647,x\n"
+		   "-3\n"
+		   "4,0.5\n");
+    assert((tbl = csv_load_columns(path, names, 2, 2)) != NULL);
+    assert(tbl->rows == 4 && tbl->invalid_rows != NULL);
+    qty = csv_find_column(tbl, "qty");
+    price = csv_find_column(tbl, "price");
+    assert(qty->type == INT && price->type == DOUBLE);
+    ivals = (int *) qty->values;
+    dvals = (double *) price->values;
+    assert(!tbl->invalid_rows[0] && ivals[0] == 1 && dvals[0] == 2.5);
+    assert(tbl->invalid_rows[1] && ivals[1] == 0 && dvals[1] == 0.0);
+    assert(tbl->invalid_rows[2] && ivals[2] == 0 && dvals[2] == 0.0);
+    assert(!tbl->invalid_rows[3] && ivals[3] == 4 && dvals[3] == 0.5);
+    csv_destroy_table(tbl);
+    unlink(path);
+
+    /* A name repeated in the header is rejected */
+    strcpy(path, "/tmp/mexpr_csv_XXXXXX");
+    app_write_temp(path, "qty,price,qty\n1,2.5,3\n");
+    assert(csv_load_columns(path, names, 2, 1) == NULL);
+    unlink(path);
+}
+
+static void
+app_rule_set_tests(){
+    rule_set *rs = rule_set_create();
+    mexpr_pool *pool = mexpr_pool_create(3);
+    int ids[1000], expected[1000], i, n, nexpected;
+    char buf[64];
+    tr_node val;
+
+    printf("Will evaluate rule set...\n");
+
+    assert(rule_set_add(rs, "qty > 3 and price < 10.0") == 0);
+    assert(rule_set_add(rs, "qty / zero > 1 or price > 0") == 1);
+    assert(rule_set_add(rs, "1 <= 2\n") == 2);
+    assert(rule_set_add(rs, "qty >") == -1);
+    assert(rule_set_add(rs, "missing = 1") == 3);
+    for (i = 4; i < 1000; i++){
+	sprintf(buf, "qty * %d > %d", i % 5, i);
+	assert(rule_set_add(rs, buf) == i);
+    }
+    assert(rule_set_size(rs) == 1000);
+
+    val.node_id = INT;
+    val.unv.ival = 100;
+    assert(rule_set_assign(rs, "qty", &val));
+    val.unv.ival = 0;
+    assert(rule_set_assign(rs, "zero", &val));
+    val.node_id = DOUBLE;
+    val.unv.dval = 2.5;
+    assert(rule_set_assign(rs, "price", &val));
+    assert(!rule_set_assign(rs, "unknown", &val));
+
+    /* Zero division fails rule 1, and rule 3 lacks its variable */
+    nexpected = 0;
+    expected[nexpected++] = 0;
+    expected[nexpected++] = 2;
+    for (i = 4; i < 1000; i++){
+	if (100 * (i % 5) > i)
+	    expected[nexpected++] = i;
+    }
+
+    n = rule_set_evaluate(rs, pool, ids);
+    assert(n == nexpected);
+    assert(memcmp(ids, expected, sizeof(int) * n) == 0);
+
+    /* The variables get unassigned by the evaluation */
+    n = rule_set_evaluate(rs, NULL, ids);
+    assert(n == 1 && ids[0] == 2);
+
+    val.node_id = INT;
+    val.unv.ival = 100;
+    assert(rule_set_assign(rs, "qty", &val));
+    val.unv.ival = 0;
+    assert(rule_set_assign(rs, "zero", &val));
+    val.node_id = DOUBLE;
+    val.unv.dval = 2.5;
+    assert(rule_set_assign(rs, "price", &val));
+    n = rule_set_evaluate(rs, NULL, ids);
+    assert(n == nexpected);
+    assert(memcmp(ids, expected, sizeof(int) * n) == 0);
+
+    mexpr_pool_destroy(pool);
+    rule_set_destroy(rs);
+}
+
+/* Assign the same values to both rule sets */
+static void
+app_rule_assign_both(rule_set *rs1, rule_set *rs2, char *vname, tr_node *val){
+    assert(rule_set_assign(rs1, vname, val));
+    assert(rule_set_assign(rs2, vname, val));
+}
+
+/* Remove the directory made by mkdtemp() and the files in it */
+static void
+app_remove_dir(char *dir){
+    char path[1024];
+    struct dirent *e;
+    DIR *d;
+
+    assert((d = opendir(dir)) != NULL);
+    while ((e = readdir(d)) != NULL){
+	if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+	    continue;
+	snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+	assert(unlink(path) == 0);
+    }
+    closedir(d);
+    assert(rmdir(dir) == 0);
+}
+
+static void
+app_rule_set_compile_tests(){
+    char inf_rule[BUFFER_LEN];
+    char *rules[] = {
+	"qty > 3 and price < 10.0",
+	"qty / zero > 1 or price > 0",
+	"qty % zero = 1",
+	"price / zero > 1.5",
+	"price % 0.75 < 0.5 and qty % 3 != 0",
+	"min(qty, price) > 1 or max(price, 2.5) = 2.5",
+	"sqrt(price) + sin(qty) * cos(price) + pow(qty, 2) > 10",
+	"qty * 2147483647 < 0",
+	"flag + 1 > 0",
+	"1 <= 2",
+	/* A literal beyond DBL_MAX, which is inf */
+	inf_rule,
+	NULL,
+    };
+    int values[] = { -7, -1, 0, 1, 3, 100 };
+    int nvalues = sizeof(values) / sizeof(values[0]);
+    int ids1[16], ids2[16], i, j, k, n;
+    char cache_dir[] = "/tmp/mexpr_rules_XXXXXX", *cc;
+    char long_dir[2048];
+    rule_set *rs1, *rs2;
+    tr_node val;
+
+    printf("Will compare compiled rules with interpreter...\n");
+
+    strcpy(inf_rule, "price * 2 < 1");
+    for (i = 0; i < 320; i++)
+	strcat(inf_rule, "0");
+    strcat(inf_rule, ".0");
+    assert(mkdtemp(cache_dir) != NULL);
+
+    rs1 = rule_set_create();
+    rs2 = rule_set_create();
+    for (i = 0; rules[i] != NULL; i++){
+	assert(rule_set_add(rs1, rules[i]) == i);
+	assert(rule_set_add(rs2, rules[i]) == i);
+    }
+
+    /* A directory that others can write, or a too long path, is rejected */
+    assert(!rule_set_compile(rs1, "/tmp"));
+    assert(chmod(cache_dir, 0777) == 0);
+    assert(!rule_set_compile(rs1, cache_dir));
+    assert(chmod(cache_dir, 0700) == 0);
+    strcpy(long_dir, cache_dir);
+    for (i = strlen(long_dir); i < (int) sizeof(long_dir) - 3; i += 2)
+	strcpy(long_dir + i, "/.");
+    assert(!rule_set_compile(rs1, long_dir));
+
+    /* The types of the last assignment are compiled */
+    val.node_id = INT;
+    assert(rule_set_assign(rs1, "qty", &val));
+    assert(rule_set_assign(rs1, "zero", &val));
+    val.node_id = DOUBLE;
+    assert(rule_set_assign(rs1, "price", &val));
+    val.node_id = BOOLEAN;
+    assert(rule_set_assign(rs1, "flag", &val));
+    if (!rule_set_compile(rs1, cache_dir)){
+	/* No C compiler on this system */
+	printf("Skipped the compilation of rules\n");
+	rule_set_destroy(rs1);
+	rule_set_destroy(rs2);
+	app_remove_dir(cache_dir);
+	return;
+    }
+    rule_set_evaluate(rs1, NULL, ids1);
+
+    /* The same rules and types reuse the cached object */
+    assert(rule_set_compile(rs1, cache_dir));
+
+    for (i = 0; i < nvalues; i++){
+	for (j = 0; j < nvalues; j++){
+	    for (k = 0; k < 2; k++){
+		/* The second round gives another type to 'qty' */
+		val.node_id = k == 0 ? INT : DOUBLE;
+		if (k == 0)
+		    val.unv.ival = values[i];
+		else
+		    val.unv.dval = values[i] * 0.25;
+		app_rule_assign_both(rs1, rs2, "qty", &val);
+		val.node_id = INT;
+		val.unv.ival = values[j];
+		app_rule_assign_both(rs1, rs2, "zero", &val);
+		val.node_id = DOUBLE;
+		val.unv.dval = values[j] * 0.5;
+		app_rule_assign_both(rs1, rs2, "price", &val);
+		val.node_id = BOOLEAN;
+		val.unv.bval = values[j] > 0;
+		app_rule_assign_both(rs1, rs2, "flag", &val);
+
+		n = rule_set_evaluate(rs1, NULL, ids1);
+		assert(rule_set_evaluate(rs2, NULL, ids2) == n);
+		assert(memcmp(ids1, ids2, sizeof(int) * n) == 0);
+	    }
+	}
+    }
+
+    /*
+     * A failed compilation for other types keeps the functions for
+     * the previous ones, which must not run with the new types.
+     */
+    cc = getenv("CC");
+    assert(setenv("CC", "false", 1) == 0);
+    val.node_id = DOUBLE;
+    val.unv.dval = 7.5;
+    app_rule_assign_both(rs1, rs2, "qty", &val);
+    val.node_id = INT;
+    val.unv.ival = 2;
+    app_rule_assign_both(rs1, rs2, "zero", &val);
+    val.node_id = DOUBLE;
+    val.unv.dval = 0.5;
+    app_rule_assign_both(rs1, rs2, "price", &val);
+    val.node_id = BOOLEAN;
+    val.unv.bval = true;
+    app_rule_assign_both(rs1, rs2, "flag", &val);
+    assert(!rule_set_compile(rs1, cache_dir));
+    if (cc != NULL)
+	assert(setenv("CC", cc, 1) == 0);
+    else
+	assert(unsetenv("CC") == 0);
+    n = rule_set_evaluate(rs1, NULL, ids1);
+    assert(rule_set_evaluate(rs2, NULL, ids2) == n);
+    assert(memcmp(ids1, ids2, sizeof(int) * n) == 0);
+
+    rule_set_destroy(rs1);
+    rule_set_destroy(rs2);
+    app_remove_dir(cache_dir);
+}
+
+/* Write the random conjunction of atomic predicates to 'buf' */
+static void
+app_random_predicates(char *buf, char *suffix){
+    char *names[] = { "x", "y", "z" };
+    char *ops[] = { ">=", "<=", ">", "<", "!=", "=" };
+    int i, natoms = rand() % 3 + 1, len = 0, c = rand() % 7 - 3;
+
+    for (i = 0; i < natoms; i++){
+	if (i > 0)
+	    len += sprintf(buf + len, " and ");
+	if (rand() % 2 == 0)
+	    len += sprintf(buf + len, "%s%s %s %d%s", names[rand() % 3],
+			   suffix, ops[rand() % 6], c,
+			   rand() % 2 == 0 ? "" : ".5");
+	else
+	    len += sprintf(buf + len, "%d %s %s%s", c, ops[rand() % 6],
+			   names[rand() % 3], suffix);
+    }
+}
+
+static void
+app_predicate_index_tests(){
+    rule_set *indexed = rule_set_create(), *ref = rule_set_create();
+    int ids1[2000], ids2[2000], i, j, n, nrules = 2000;
+    double dvals[] = { -3, -2.5, 0, 0.5, 1, 2, 3.5, 0.0 / 0.0 };
+    char buf[128];
+    tr_node val;
+
+    printf("Will match rules by predicate index...\n");
+
+    /* Adding '+ 0' keeps the results but makes the rules complex */
+    for (i = 0; i < nrules; i++){
+	srand(i);
+	app_random_predicates(buf, "");
+	assert(rule_set_add(indexed, buf) == i);
+	srand(i);
+	app_random_predicates(buf, " + 0");
+	assert(rule_set_add(ref, buf) == i);
+    }
+    assert(rule_set_indexed_size(indexed) == nrules);
+    assert(rule_set_indexed_size(ref) == 0);
+
+    for (i = 0; i < 200; i++){
+	for (j = 0; j < 3; j++){
+	    char name[2] = { "xyz"[j], '\0' };
+
+	    /* Some variables are left unassigned */
+	    switch((i + j * 3) % 5){
+		case 0:
+		    continue;
+		case 1:
+		    val.node_id = BOOLEAN;
+		    val.unv.bval = true;
+		    break;
+		case 2:
+		    val.node_id = INT;
+		    val.unv.ival = (i * (j + 1)) % 9 - 4;
+		    break;
+		default:
+		    val.node_id = DOUBLE;
+		    val.unv.dval = dvals[(i + j) % 8];
+		    break;
+	    }
+	    assert(rule_set_assign(indexed, name, &val));
+	    assert(rule_set_assign(ref, name, &val));
+	}
+
+	n = rule_set_evaluate(indexed, NULL, ids1);
+	assert(rule_set_evaluate(ref, NULL, ids2) == n);
+	assert(memcmp(ids1, ids2, sizeof(int) * n) == 0);
+    }
+
+    /* Disjunctions and arithmetic are evaluated */
+    assert(rule_set_add(indexed, "x > 1 or y < 2") == nrules);
+    assert(rule_set_add(indexed, "x * 2 > 1") == nrules + 1);
+    assert(rule_set_add(indexed, "x > y") == nrules + 2);
+    assert(rule_set_indexed_size(indexed) == nrules);
+
+    rule_set_destroy(indexed);
+    rule_set_destroy(ref);
+}
+
+/* Write a random rule of shared comparisons joined by 'and' and 'or' */
+static void
+app_random_shared_rule(char *buf){
+    char *terms[] = {
+	"x > 1", "y < 2.5", "z = 3", "x / z >= 1", "y != 0", "sqr(x) <= 9",
+	"x * y > z", "min(x, y) < 0",
+    };
+    int i, nterms = rand() % 4 + 1, len = 0;
+
+    for (i = 0; i < nterms; i++){
+	if (i > 0)
+	    len += sprintf(buf + len, rand() % 2 == 0 ? " and " : " or ");
+	len += sprintf(buf + len, "%s", terms[rand() % 8]);
+    }
+}
+
+static void
+app_rule_network_tests(){
+    rule_network *rn = rule_network_create();
+    rule_set *rs = rule_set_create();
+    int ids1[600], ids2[600], i, j, n1, n2, k, nrules = 300;
+    bool removed[600];
+    char buf[256];
+    tr_node val;
+
+    printf("Will evaluate rule network...\n");
+
+    /* The operands of 'and' are ordered, so these are one node */
+    assert(rule_network_add(rn, "x > 1 and y < 2") == 0);
+    n1 = rule_network_node_count(rn);
+    assert(rule_network_add(rn, "y < 2 and x > 1") == 1);
+    assert(rule_network_node_count(rn) == n1);
+    assert(rule_network_add(rn, "x > 1 or z = 3") == 2);
+    assert(rule_network_node_count(rn) == n1 + 4);
+    assert(rule_network_add(rn, "x >") == -1);
+    assert(rule_network_remove(rn, 0));
+    assert(!rule_network_remove(rn, 0));
+    assert(rule_network_node_count(rn) == n1 + 4);
+    assert(rule_network_remove(rn, 1));
+    assert(rule_network_remove(rn, 2));
+    assert(rule_network_node_count(rn) == 0 && rule_network_size(rn) == 0);
+
+    /* The same rules as the rule set, where ids start from 3 */
+    srand(11);
+    for (i = 0; i < nrules * 2; i++){
+	app_random_shared_rule(buf);
+	assert(rule_network_add(rn, buf) == i + 3);
+	assert(rule_set_add(rs, buf) == i);
+	removed[i] = false;
+    }
+
+    for (i = 0; i < 300; i++){
+	/* Remove some rules on the way */
+	if (i % 50 == 0){
+	    for (j = 0; j < 20; j++){
+		k = rand() % (nrules * 2);
+		assert(rule_network_remove(rn, k + 3) == !removed[k]);
+		removed[k] = true;
+	    }
+	}
+
+	for (j = 0; j < 3; j++){
+	    char name[2] = { "xyz"[j], '\0' };
+
+	    if ((i + j) % 7 == 0)
+		continue;
+	    if ((i * 3 + j) % 5 == 0){
+		val.node_id = DOUBLE;
+		val.unv.dval = (i % 11) * 0.5 - 2;
+	    }else{
+		val.node_id = INT;
+		val.unv.ival = (i + j * 5) % 9 - 3;
+	    }
+	    assert(rule_network_assign(rn, name, &val));
+	    assert(rule_set_assign(rs, name, &val));
+	}
+
+	n1 = rule_network_evaluate(rn, ids1);
+	n2 = rule_set_evaluate(rs, NULL, ids2);
+	for (j = k = 0; j < n2; j++){
+	    if (!removed[ids2[j]])
+		assert(ids1[k++] == ids2[j] + 3);
+	}
+	assert(k == n1);
+    }
+
+    /* Removing every rule releases every node */
+    for (i = 0; i < nrules * 2; i++){
+	if (!removed[i])
+	    assert(rule_network_remove(rn, i + 3));
+    }
+    assert(rule_network_node_count(rn) == 0);
+
+    rule_network_destroy(rn);
+    rule_set_destroy(rs);
+}
+
+/* Values of variables for the JIT tests */
+static tr_node app_jit_vars[3];
+
+static tr_node *
+app_fetch_jit_var(char *s, void *data){
+    (void) data;
+
+    switch(s[0]){
+	case 'x':
+	    return &app_jit_vars[0];
+	case 'y':
+	    return &app_jit_vars[1];
+	default:
+	    return &app_jit_vars[2];
+    }
+}
+
+/* The evaluators that share the failure state of the tree */
+enum {
+    APP_EVAL_TREE,
+    APP_EVAL_JIT,
+    APP_EVAL_TIER,
+    APP_EVAL_THREADED,
+    APP_EVAL_REORDER,
+    APP_EVAL_BDD,
+    APP_EVAL_PROFILE,
+    APP_EVALUATORS
+};
+
+/*
+ * Evaluate 't' by 'evaluator' with 'obj' built for 't', or a temporary
+ * one if 'obj' is NULL. Return false if the JIT runs the interpreter
+ */
+static bool
+app_evaluate_by(int evaluator, void *obj, tree *t, tr_node *top){
+    threaded_code *code;
+    reorder_plan *plan;
+    tree_profile *prof;
+    tiered_tree *tt;
+    jit_code *jit;
+    bdd_tree *bt;
+    bool native = true;
+
+    switch(evaluator){
+	case APP_EVAL_TREE:
+	    evaluate_tree(t, top);
+	    break;
+	case APP_EVAL_JIT:
+	    jit = obj != NULL ? obj : jit_compile_tree(t);
+	    native = jit_evaluate_tree(jit, t, top);
+	    if (obj == NULL)
+		jit_destroy(jit);
+	    break;
+	case APP_EVAL_TIER:
+	    if (obj != NULL){
+		tiered_evaluate(obj, top);
+		break;
+	    }
+	    /* The second evaluation runs the specialized version */
+	    tt = tiered_tree_create(t, 1);
+	    tiered_evaluate(tt, top);
+	    tiered_evaluate(tt, top);
+	    tiered_tree_destroy(tt);
+	    break;
+	case APP_EVAL_THREADED:
+	    code = obj != NULL ? obj : threaded_compile(t);
+	    threaded_evaluate(code, t, top);
+	    if (obj == NULL)
+		threaded_destroy(code);
+	    break;
+	case APP_EVAL_REORDER:
+	    plan = obj != NULL ? obj : reorder_plan_create(t);
+	    reorder_evaluate(plan, top);
+	    if (obj == NULL)
+		reorder_plan_destroy(plan);
+	    break;
+	case APP_EVAL_BDD:
+	    bt = obj != NULL ? obj : bdd_tree_create(t, 1024);
+	    bdd_evaluate(bt, top);
+	    if (obj == NULL)
+		bdd_tree_destroy(bt);
+	    break;
+	case APP_EVAL_PROFILE:
+	    prof = obj != NULL ? obj : profile_create(t);
+	    profile_evaluate(prof, top);
+	    if (obj == NULL)
+		profile_destroy(prof);
+	    break;
+	default:
+	    assert(0);
+	    break;
+    }
+
+    return native;
+}
+
+/* Compare two results, doubles bit by bit */
+static void
+app_compare_value(tr_node *top, tr_node *expected){
+    assert(top->node_id == expected->node_id);
+    switch(top->node_id){
+	case INT:
+	    assert(top->unv.ival == expected->unv.ival);
+	    break;
+	case DOUBLE:
+	    assert(memcmp(&top->unv.dval, &expected->unv.dval,
+			  sizeof(double)) == 0);
+	    break;
+	default:
+	    assert(top->unv.bval == expected->unv.bval);
+	    break;
+    }
+}
+
+/*
+ * Compare app_evaluate_by() of 't' with evaluate_tree() of 'ref', which
+ * can be 't' itself. Return the result of app_evaluate_by()
+ */
+static bool
+app_compare_by(int evaluator, void *obj, tree *t, tree *ref){
+    tr_node expected, top;
+    mexpr_error error;
+    bool failed, native;
+
+    evaluate_tree(ref, &expected);
+    failed = ref->computation_failed;
+    error = ref->error;
+
+    native = app_evaluate_by(evaluator, obj, t, &top);
+    assert(t->computation_failed == failed);
+    assert(t->error == error);
+    if (!failed)
+	app_compare_value(&top, &expected);
+
+    return native;
+}
+
+static void
+app_jit_tests(){
+    struct {
+	bool (*parser)(void);
+	char *target;
+    } cases[] = {
+	{ start_mathexpr_parse, "x + y * 2 - z\n" },
+	{ start_mathexpr_parse, "x * z - x / z + x % z\n" },
+	{ start_mathexpr_parse, "y / z + sqr(x) + sqr(y)\n" },
+	{ start_mathexpr_parse, "sqrt(y) + sin(x) * cos(y) + pow(x, 2)\n" },
+	{ start_mathexpr_parse,
+	  "min(x, z) + max(x, z) + min(y, 0.5) + max(y, -1.5)\n" },
+	{ start_mathexpr_parse, "y % 0.75 + z % 3\n" },
+	{ start_ineq_mathexpr_parse, "x >= z\n" },
+	{ start_ineq_mathexpr_parse, "x <= z\n" },
+	{ start_ineq_mathexpr_parse, "x > y\n" },
+	{ start_ineq_mathexpr_parse, "x < y\n" },
+	{ start_ineq_mathexpr_parse, "y != 0.5\n" },
+	{ start_ineq_mathexpr_parse, "y = 0.5\n" },
+	{ start_logical_mathexpr_parse, "x > 0 and y < 2.0 or z = 0\n" },
+	{ NULL, NULL },
+    };
+    int values[] = { -7, -1, 0, 1, 3, 100 };
+    int nvalues = sizeof(values) / sizeof(values[0]);
+    jit_code *code;
+    bool native;
+    int i, j, k;
+    tree *t;
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+    native = true;
+#else
+    native = false;
+#endif
+
+    printf("Will compare native code with interpreter...\n");
+
+    app_jit_vars[0].node_id = INT;
+    app_jit_vars[1].node_id = DOUBLE;
+    app_jit_vars[2].node_id = INT;
+
+    for (i = 0; cases[i].parser != NULL; i++){
+	t = build_mathexpr_tree(cases[i].parser, cases[i].target);
+	assert(t != NULL);
+	resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+
+	code = jit_compile_tree(t);
+	assert((code != NULL) == native);
+
+	/* Zero division is included */
+	for (j = 0; j < nvalues; j++){
+	    for (k = 0; k < nvalues; k++){
+		app_jit_vars[0].unv.ival = values[j];
+		app_jit_vars[1].unv.dval = values[k] * 0.5;
+		app_jit_vars[2].unv.ival = values[k];
+		assert(app_compare_by(APP_EVAL_JIT, code, t, t) == native);
+	    }
+	}
+
+	/* Changed type runs the interpreter */
+	if (strchr(cases[i].target, 'y') != NULL){
+	    app_jit_vars[1].node_id = INT;
+	    app_jit_vars[1].unv.ival = 2;
+	    assert(!app_compare_by(APP_EVAL_JIT, code, t, t));
+	    app_jit_vars[1].node_id = DOUBLE;
+	}
+
+	jit_destroy(code);
+	destroy_tree(t);
+    }
+
+    /* The result type depends on the values */
+    t = build_mathexpr_tree(start_mathexpr_parse, "max(x, y)\n");
+    assert(t != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    assert(jit_compile_tree(t) == NULL);
+    assert(!app_compare_by(APP_EVAL_JIT, NULL, t, t));
+    destroy_tree(t);
+}
+
+/* Types of app_jit_vars for compile_typed_program() */
+static int
+app_jit_var_type(char *vname, void *data){
+    return app_fetch_jit_var(vname, data)->node_id;
+}
+
+static void
+app_tier_tests(){
+    char *targets[] = {
+	"x + y * 2 - z\n",
+	"x * z - x / z + x % z\n",
+	"sqrt(y) + sin(x) * cos(y) + pow(x, 2) + sqr(z)\n",
+	"min(x, z) + max(x, z) + min(y, y) + y % 0.75\n",
+	NULL,
+    };
+    int values[] = { -7, -1, 0, 1, 3, 100 };
+    int nvalues = sizeof(values) / sizeof(values[0]);
+    int i, j, k, threshold = 4;
+    node_value result[64];
+    const node_value *vars[3];
+    typed_program *prog;
+    tiered_tree *tt;
+    tier_stats stats;
+    tr_node top;
+    tree *t;
+
+    printf("Will evaluate trees by tiers...\n");
+
+    app_jit_vars[0].node_id = INT;
+    app_jit_vars[1].node_id = DOUBLE;
+    app_jit_vars[2].node_id = INT;
+
+    for (i = 0; targets[i] != NULL; i++){
+	t = build_mathexpr_tree(start_mathexpr_parse, targets[i]);
+	assert(t != NULL);
+	resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+
+	/* The typed program without the type checks */
+	prog = compile_typed_program(t, app_jit_var_type, app_jit_vars);
+	assert(prog != NULL && prog->ninsts <= 64);
+	for (j = 0; j < nvalues; j++){
+	    app_jit_vars[0].unv.ival = values[j];
+	    app_jit_vars[1].unv.dval = values[j] * 0.5;
+	    app_jit_vars[2].unv.ival = values[nvalues - 1 - j];
+	    for (k = 0; k < prog->nvars; k++)
+		vars[k] = &app_fetch_jit_var(prog->vars[k].vname, NULL)->unv;
+	    evaluate_tree(t, &top);
+	    assert(run_typed_program(prog, vars, result) ==
+		   !t->computation_failed);
+	    if (!t->computation_failed)
+		assert(memcmp(&result[prog->ninsts - 1], &top.unv,
+			      top.node_id == DOUBLE ?
+			      sizeof(double) : sizeof(int)) == 0);
+	}
+	destroy_typed_program(prog);
+
+	tt = tiered_tree_create(t, threshold);
+	for (j = 0; j < nvalues * nvalues; j++){
+	    app_jit_vars[0].unv.ival = values[j / nvalues];
+	    app_jit_vars[1].unv.dval = values[j % nvalues] * 0.5;
+	    app_jit_vars[2].unv.ival = values[j % nvalues];
+	    app_compare_by(APP_EVAL_TIER, tt, t, t);
+
+	    tiered_get_stats(tt, &stats);
+	    if (j < threshold - 1)
+		assert(stats.current == TIER_GENERIC);
+	    else
+		assert(stats.current != TIER_GENERIC);
+	}
+	assert(stats.promotions == 1);
+	assert(stats.evaluations[TIER_GENERIC] == (unsigned long) threshold);
+
+	/* The guard fails, and the tree goes back to the generic tier */
+	if (strchr(targets[i], 'y') != NULL){
+	    app_jit_vars[1].node_id = INT;
+	    app_jit_vars[1].unv.ival = 2;
+	    for (j = 0; j < threshold; j++)
+		app_compare_by(APP_EVAL_TIER, tt, t, t);
+	    tiered_get_stats(tt, &stats);
+	    assert(stats.current == TIER_GENERIC);
+	    assert(stats.guard_failures == (unsigned long) threshold);
+	    assert(stats.deoptimizations == 1);
+
+	    /* Then, it's specialized for the new types */
+	    for (j = 0; j < threshold; j++)
+		app_compare_by(APP_EVAL_TIER, tt, t, t);
+	    tiered_get_stats(tt, &stats);
+	    assert(stats.current != TIER_GENERIC && stats.promotions == 2);
+	    app_jit_vars[1].node_id = DOUBLE;
+	}
+
+	tiered_tree_destroy(tt);
+	destroy_tree(t);
+    }
+
+    /* The result type depends on the values, so it stays generic */
+    t = build_mathexpr_tree(start_mathexpr_parse, "max(x, y)\n");
+    assert(t != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    tt = tiered_tree_create(t, threshold);
+    for (j = 0; j < threshold * 2; j++)
+	app_compare_by(APP_EVAL_TIER, tt, t, t);
+    tiered_get_stats(tt, &stats);
+    assert(stats.current == TIER_GENERIC && stats.promotions == 0);
+    tiered_tree_destroy(tt);
+    destroy_tree(t);
+}
+
+static void
+app_threaded_tests(){
+    struct {
+	bool (*parser)(void);
+	char *target;
+    } cases[] = {
+	{ start_mathexpr_parse, "x + y * 2 - z\n" },
+	{ start_mathexpr_parse, "x / z + x % z - y / x + y % z\n" },
+	{ start_mathexpr_parse, "sqrt(y) + sin(x) * cos(z) + pow(x, y) - sqr(z)\n" },
+	{ start_mathexpr_parse, "min(x, y) + max(y, z) * min(2, 0.5)\n" },
+	{ start_mathexpr_parse, "max(x, y)\n" },
+	{ start_ineq_mathexpr_parse, "x >= y\n" },
+	{ start_ineq_mathexpr_parse, "x <= z\n" },
+	{ start_ineq_mathexpr_parse, "y > z\n" },
+	{ start_ineq_mathexpr_parse, "x < y\n" },
+	{ start_ineq_mathexpr_parse, "x != y\n" },
+	{ start_ineq_mathexpr_parse, "y = z\n" },
+	{ start_logical_mathexpr_parse, "x > 0 and y < 2.0 or z = 0\n" },
+	{ NULL, NULL },
+    };
+    int types[] = { INT, DOUBLE, BOOLEAN };
+    int values[] = { -3, 0, 2 };
+    int digits[] = { 1, 3, 9 };
+    threaded_code *code;
+    int i, j, k, type, value;
+    tree *t;
+
+    printf("Will compare threaded code with interpreter...\n");
+
+    for (i = 0; cases[i].parser != NULL; i++){
+	t = build_mathexpr_tree(cases[i].parser, cases[i].target);
+	assert(t != NULL);
+	resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+	code = threaded_compile(t);
+
+	/* All combinations of types and values of the variables */
+	for (j = 0; j < 27 * 27; j++){
+	    for (k = 0; k < 3; k++){
+		type = types[(j % 27 / digits[k]) % 3];
+		value = values[(j / 27 / digits[k]) % 3];
+		app_jit_vars[k].node_id = type;
+		if (type == INT)
+		    app_jit_vars[k].unv.ival = value;
+		else if (type == DOUBLE)
+		    app_jit_vars[k].unv.dval = value * 0.75;
+		else
+		    app_jit_vars[k].unv.bval = value > 0;
+	    }
+
+	    app_compare_by(APP_EVAL_THREADED, code, t, t);
+	}
+
+	threaded_destroy(code);
+	destroy_tree(t);
+    }
+}
+
+/* Compare reevaluate_variable() of 't' with evaluate_tree() of 'ref' */
+static int
+app_reevaluate_compare(tree *t, tree *ref, char *vname){
+    tr_node expected, top;
+    bool failed;
+    int n;
+
+    evaluate_tree(ref, &expected);
+    failed = ref->computation_failed;
+
+    n = reevaluate_variable(t, vname, &top);
+    assert(t->computation_failed == failed);
+    assert(t->error == ref->error);
+    if (!failed)
+	app_compare_value(&top, &expected);
+
+    return n;
+}
+
+static void
+app_incremental_tests(){
+    char *target = "x * 2 + y * 3 + sqr(z) - min(z, 10) + x / z\n";
+    char *names[] = { "x", "y", "z" };
+    mexpr_budget budget;
+    tr_node top;
+    tree *t, *ref;
+    int i;
+
+    printf("Will re-evaluate trees incrementally...\n");
+
+    t = build_mathexpr_tree(start_mathexpr_parse, target);
+    ref = build_mathexpr_tree(start_mathexpr_parse, target);
+    assert(t != NULL && ref != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    resolve_variable(ref, app_jit_vars, app_fetch_jit_var);
+
+    app_jit_vars[0].node_id = INT;
+    app_jit_vars[0].unv.ival = 7;
+    app_jit_vars[1].node_id = DOUBLE;
+    app_jit_vars[1].unv.dval = 0.5;
+    app_jit_vars[2].node_id = INT;
+    app_jit_vars[2].unv.ival = 20;
+
+    /* The first call evaluates the whole tree */
+    assert(app_reevaluate_compare(t, ref, "y") == -1);
+
+    /* y * 3 and the additions above it */
+    app_jit_vars[1].unv.dval = 1.5;
+    assert(app_reevaluate_compare(t, ref, "y") == 5);
+
+    /* min(z, 10) doesn't change, but sqr(z) and x / z do */
+    app_jit_vars[2].unv.ival = 30;
+    assert(app_reevaluate_compare(t, ref, "z") > 0);
+
+    /* The same value stops at y * 3 */
+    app_jit_vars[1].unv.dval = 1.5;
+    assert(app_reevaluate_compare(t, ref, "y") == 1);
+
+    /*
+     * min(z, 10) and x / z stay, so only the path from sqr(z) goes
+     * up to the root : 4 + 1 + 1 operators
+     */
+    app_jit_vars[2].unv.ival = 31;
+    assert(app_reevaluate_compare(t, ref, "z") == 6);
+
+    /* Zero division fails, and the next call evaluates the whole */
+    app_jit_vars[2].unv.ival = 0;
+    app_reevaluate_compare(t, ref, "z");
+    app_jit_vars[2].unv.ival = 3;
+    assert(app_reevaluate_compare(t, ref, "z") == -1);
+
+    /* The recomputed operators count against the budget */
+    memset(&budget, 0, sizeof(mexpr_budget));
+    budget.max_eval_nodes = 2;
+    tree_set_budget(t, &budget);
+    app_jit_vars[2].unv.ival = 4;
+    assert(reevaluate_variable(t, "z", &top) == 2);
+    assert(t->computation_failed && t->error == MEXPR_ERR_EVAL_NODES);
+    tree_set_budget(t, NULL);
+    assert(app_reevaluate_compare(t, ref, "z") == -1);
+    assert(!t->computation_failed && t->error == MEXPR_OK);
+
+    /* Changed type */
+    app_jit_vars[1].node_id = INT;
+    app_jit_vars[1].unv.ival = 4;
+    assert(app_reevaluate_compare(t, ref, "y") > 0);
+
+    for (i = 0; i < 300; i++){
+	switch(i % 3){
+	    case 0:
+		app_jit_vars[0].unv.ival = (i * 7) % 23 - 11;
+		break;
+	    case 1:
+		app_jit_vars[1].unv.ival = (i * 5) % 9;
+		break;
+	    default:
+		app_jit_vars[2].unv.ival = (i * 3) % 13 - 6;
+		break;
+	}
+	app_reevaluate_compare(t, ref, names[i % 3]);
+    }
+
+    destroy_tree(t);
+    destroy_tree(ref);
+}
+
+static void
+app_reorder_tests(){
+    char *targets[] = {
+	"sqrt(x) * pow(y, 2) > 1 and x < 3\n",
+	"sin(x) + cos(y) > 1.5 or x > 7\n",
+	"x / z > 1 and y < 3\n",
+	"(pow(x, y) > 2 or z % 2 != 1) and (y < 2 or z > x)\n",
+	"x + y > 1 and (x < 2 or x > 9) and y != z\n",
+    };
+    int ntargets = sizeof(targets) / sizeof(targets[0]);
+    reorder_plan *plan;
+    reorder_stats stats;
+    tree *t, *ref;
+    int i, j;
+
+    printf("Will reorder the operands of logical trees...\n");
+
+    for (i = 0; i < ntargets; i++){
+	t = build_mathexpr_tree(start_logical_mathexpr_parse, targets[i]);
+	ref = build_mathexpr_tree(start_logical_mathexpr_parse, targets[i]);
+	assert(t != NULL && ref != NULL);
+	resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+	resolve_variable(ref, app_jit_vars, app_fetch_jit_var);
+	plan = reorder_plan_create(t);
+
+	for (j = 0; j < REORDER_INTERVAL * 4; j++){
+	    app_jit_vars[0].node_id = INT;
+	    app_jit_vars[0].unv.ival = 3 + (j * 7) % 11;
+	    app_jit_vars[1].node_id = j % 5 == 0 ? INT : DOUBLE;
+	    if (app_jit_vars[1].node_id == INT)
+		app_jit_vars[1].unv.ival = j % 4;
+	    else
+		app_jit_vars[1].unv.dval = (j % 9) * 0.5;
+	    app_jit_vars[2].node_id = INT;
+	    app_jit_vars[2].unv.ival = (j * 3) % 5;
+
+	    /* Variables of BOOLEAN fail the comparisons */
+	    if (j % 97 == 0){
+		app_jit_vars[2].node_id = BOOLEAN;
+		app_jit_vars[2].unv.bval = true;
+	    }
+
+	    app_compare_by(APP_EVAL_REORDER, plan, t, ref);
+	}
+
+	reorder_get_stats(plan, &stats);
+	assert(stats.evaluations == REORDER_INTERVAL * 4);
+	assert(stats.reorders > 0);
+
+	/* The cheap and decisive right operands run first */
+	if (i < 2){
+	    assert(stats.swapped_nodes == 1);
+	    assert(stats.skipped_operands > 0);
+	}
+
+	/*
+	 * x / z can fail, so it is evaluated whatever y < 3 is, and
+	 * running y < 3 first saves nothing
+	 */
+	if (i == 2)
+	    assert(stats.swapped_nodes == 0);
+
+	reorder_plan_destroy(plan);
+	destroy_tree(t);
+	destroy_tree(ref);
+    }
+}
+
+static void
+app_bdd_tests(){
+    struct {
+	char *expr;
+	int atoms;
+    } targets[] = {
+	{ "(x > 1 and y < 2) or (x > 1 and z > 3) or (y < 2 and z > 3)\n", 3 },
+	{ "(x > 1 or y < 2) and (x > 1 or z != 3) and y < 2\n", 3 },
+	{ "x / z > 1 or y < 2\n", 2 },
+	{ "(x > 2 and y < 1) or (x < 5 and y < 1)\n", 3 },
+	{ "x % z != 1 and (min(x, y) > 1 or pow(y, 2) < 3)\n", 3 },
+	{ "x >= z and x >= z\n", 1 },
+    };
+    int ntargets = sizeof(targets) / sizeof(targets[0]);
+    bdd_tree *bt;
+    tree *t, *ref;
+    int i, j;
+
+    printf("Will evaluate logical trees by decision diagrams...\n");
+
+    for (i = 0; i < ntargets; i++){
+	t = build_mathexpr_tree(start_logical_mathexpr_parse, targets[i].expr);
+	ref = build_mathexpr_tree(start_logical_mathexpr_parse, targets[i].expr);
+	assert(t != NULL && ref != NULL);
+	resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+	resolve_variable(ref, app_jit_vars, app_fetch_jit_var);
+
+	bt = bdd_tree_create(t, 1024);
+	assert(bdd_tree_is_compiled(bt));
+	assert(bdd_tree_atoms(bt) == targets[i].atoms);
+	/* The terminals and at most one node per atom and path */
+	assert(bdd_tree_size(bt) <= 2 + (1 << targets[i].atoms));
+
+	for (j = 0; j < 500; j++){
+	    app_jit_vars[0].node_id = j % 7 == 0 ? DOUBLE : INT;
+	    if (app_jit_vars[0].node_id == INT)
+		app_jit_vars[0].unv.ival = (j * 7) % 9 - 2;
+	    else
+		app_jit_vars[0].unv.dval = (j % 13) * 0.5;
+	    app_jit_vars[1].node_id = j % 3 == 0 ? BOOLEAN : DOUBLE;
+	    if (app_jit_vars[1].node_id == BOOLEAN)
+		app_jit_vars[1].unv.bval = j % 2;
+	    else
+		app_jit_vars[1].unv.dval = (j % 11) * 0.5 - 1;
+	    app_jit_vars[2].node_id = INT;
+	    app_jit_vars[2].unv.ival = (j * 5) % 6;
+
+	    app_compare_by(APP_EVAL_BDD, bt, t, ref);
+	}
+
+	bdd_tree_destroy(bt);
+
+	/* Over the budget, the tree is evaluated as it is */
+	bt = bdd_tree_create(t, 3);
+	if (targets[i].atoms > 1){
+	    assert(!bdd_tree_is_compiled(bt));
+	    assert(bdd_tree_size(bt) == 0);
+	}
+	app_compare_by(APP_EVAL_BDD, bt, t, ref);
+	bdd_tree_destroy(bt);
+
+	destroy_tree(t);
+	destroy_tree(ref);
+    }
+}
+
+/* Evaluate the tree on another thread for the aggregation of stats */
+static void *
+app_stats_worker(void *arg){
+    tr_node top;
+    int i;
+
+    for (i = 0; i < 10; i++)
+	evaluate_tree((tree *) arg, &top);
+
+    return NULL;
+}
+
+static void
+app_stats_tests(){
+    mexpr_stats own, total;
+    pthread_t th;
+    tr_node top;
+    tree *t;
+    int i;
+
+    printf("Will collect the latency of stages...\n");
+
+    mexpr_stats_reset();
+
+    t = build_mathexpr_tree(start_mathexpr_parse, "x * 2 + sqrt(y)\n");
+    assert(t != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    evaluate_tree(t, &top);
+
+    assert(pthread_create(&th, NULL, app_stats_worker, t) == 0);
+    pthread_join(th, NULL);
+
+    mexpr_stats_thread(&own);
+    mexpr_stats_total(&total);
+
+    for (i = 0; i < MEXPR_STAGES; i++){
+	assert(mexpr_stage_name(i) != NULL);
+	if (!mexpr_stats_enabled()){
+	    assert(total.stages[i].count == 0);
+	    continue;
+	}
+	assert(total.stages[i].total_ns >= own.stages[i].total_ns);
+	assert(total.stages[i].max_ns <= total.stages[i].total_ns);
+	printf("%-18s %8lu %12lu ns\n", mexpr_stage_name(i),
+	       (unsigned long) total.stages[i].count,
+	       (unsigned long) total.stages[i].total_ns);
+    }
+
+    if (mexpr_stats_enabled()){
+	assert(own.stages[MEXPR_STAGE_INIT_BUFFER].count == 1);
+	assert(own.stages[MEXPR_STAGE_PARSE].count == 1);
+	assert(own.stages[MEXPR_STAGE_INFIX_TO_POSTFIX].count == 1);
+	assert(own.stages[MEXPR_STAGE_POSTFIX_TO_TREE].count == 1);
+	assert(own.stages[MEXPR_STAGE_RESOLVE].count == 1);
+	assert(own.stages[MEXPR_STAGE_ACCESS_CB].count == 2);
+	assert(own.stages[MEXPR_STAGE_EVALUATE].count == 1);
+
+	/* The exited worker is summed up too */
+	assert(total.stages[MEXPR_STAGE_EVALUATE].count == 11);
+	assert(total.stages[MEXPR_STAGE_RESOLVE].total_ns >=
+	       total.stages[MEXPR_STAGE_ACCESS_CB].total_ns);
+    }
+
+    destroy_tree(t);
+}
+
+/* The allocator hook counts the blocks alive in its context */
+static void *
+app_counting_malloc(size_t size, void *ctx){
+    (*(long *) ctx)++;
+
+    return malloc(size);
+}
+
+static void
+app_counting_free(void *p, void *ctx){
+    (*(long *) ctx)--;
+    free(p);
+}
+
+static void
+app_alloc_tests(){
+    long blocks = 0;
+    mexpr_allocator allocator = { app_counting_malloc, app_counting_free,
+				  &blocks };
+    mexpr_alloc_stats before, after;
+    uint64_t tree_bytes;
+    char rule[32];
+    rule_set *rs;
+    tr_node top;
+    tree *t;
+    int i;
+
+    printf("Will account the allocations...\n");
+
+    /* Release the tokens of the previous parse */
+    parser_stack_reset();
+    mexpr_set_allocator(&allocator);
+    mexpr_alloc_get_stats(&before);
+
+    /* The parser backtracks over the inequality before the 'and' */
+    t = build_mathexpr_tree(start_logical_mathexpr_parse,
+			    "(x + 1 > y and y < 2) or sqrt(z) >= 1\n");
+    assert(t != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    app_jit_vars[0].node_id = INT;
+    app_jit_vars[0].unv.ival = 3;
+    app_jit_vars[1].node_id = INT;
+    app_jit_vars[1].unv.ival = 1;
+    app_jit_vars[2].node_id = DOUBLE;
+    app_jit_vars[2].unv.dval = 4.0;
+    evaluate_tree(t, &top);
+    assert(top.node_id == BOOLEAN && top.unv.bval == true);
+
+    mexpr_alloc_get_stats(&after);
+    assert(blocks > 0);
+
+    /* The tree holds its own blocks and the results of operators */
+    tree_bytes = after.sites[MEXPR_ALLOC_TREE].allocated_bytes -
+	before.sites[MEXPR_ALLOC_TREE].allocated_bytes +
+	after.sites[MEXPR_ALLOC_RESULT].allocated_bytes -
+	before.sites[MEXPR_ALLOC_RESULT].allocated_bytes;
+    assert(tree_live_bytes(t) == tree_bytes);
+    assert(after.sites[MEXPR_ALLOC_LEXER].allocations >
+	   before.sites[MEXPR_ALLOC_LEXER].allocations);
+
+    /* Only the tokens of the last parse stay, even after the rewinds */
+    destroy_tree(t);
+    parser_stack_reset();
+    mexpr_alloc_get_stats(&after);
+    assert(after.sites[MEXPR_ALLOC_LEXER].allocated_bytes -
+	   after.sites[MEXPR_ALLOC_LEXER].freed_bytes ==
+	   before.sites[MEXPR_ALLOC_LEXER].allocated_bytes -
+	   before.sites[MEXPR_ALLOC_LEXER].freed_bytes);
+    assert(after.sites[MEXPR_ALLOC_TREE].allocated_bytes -
+	   after.sites[MEXPR_ALLOC_TREE].freed_bytes ==
+	   before.sites[MEXPR_ALLOC_TREE].allocated_bytes -
+	   before.sites[MEXPR_ALLOC_TREE].freed_bytes);
+    assert(blocks == 0);
+
+    /*
+     * The tables of a rule set count for their own site. They grow
+     * without realloc_fn, and are released by the allocator of their
+     * blocks after it's replaced.
+     */
+    rs = rule_set_create();
+    for (i = 0; i < 100; i++){
+	snprintf(rule, sizeof(rule), "v%c%c > %d", 'a' + i / 26, 'a' + i % 26,
+		 i);
+	assert(rule_set_add(rs, rule) == i);
+    }
+    mexpr_set_allocator(NULL);
+    mexpr_alloc_get_stats(&after);
+    assert(after.sites[MEXPR_ALLOC_RULES].allocated_bytes -
+	   after.sites[MEXPR_ALLOC_RULES].freed_bytes >
+	   before.sites[MEXPR_ALLOC_RULES].allocated_bytes -
+	   before.sites[MEXPR_ALLOC_RULES].freed_bytes);
+    assert(blocks > 0);
+    rule_set_destroy(rs);
+    parser_stack_reset();
+    mexpr_alloc_get_stats(&after);
+    assert(after.sites[MEXPR_ALLOC_RULES].allocated_bytes -
+	   after.sites[MEXPR_ALLOC_RULES].freed_bytes ==
+	   before.sites[MEXPR_ALLOC_RULES].allocated_bytes -
+	   before.sites[MEXPR_ALLOC_RULES].freed_bytes);
+    assert(blocks == 0);
+
+    mexpr_alloc_report(stdout);
+}
+
+/*
+ * The parser of another grammar, "VARIABLE , VARIABLE" or "VARIABLE",
+ * which rewinds to its checkpoint for the second rule.
+ */
+static bool
+app_variable_pair_parse(void){
+    int CKP;
+
+    CHECKPOINT(CKP);
+    if (cyylex() == VARIABLE && cyylex() == COMMA && cyylex() == VARIABLE &&
+	cyylex() == PARSER_EOF)
+	return true;
+    RESTORE_CHECKPOINT(CKP);
+
+    return cyylex() == VARIABLE && cyylex() == PARSER_EOF;
+}
+
+static void
+app_parse_stats_tests(){
+    parse_stats shallow, deep;
+    unsigned long rewound;
+    tree *t;
+    int i;
+
+    printf("Will count the rewinds of the parser...\n");
+
+    t = build_mathexpr_tree(start_mathexpr_parse, "(1) + 2\n");
+    assert(t != NULL);
+    parse_get_stats(&shallow);
+    destroy_tree(t);
+
+    t = build_mathexpr_tree(start_mathexpr_parse, "((((1)))) + 2\n");
+    assert(t != NULL);
+    parse_get_stats(&deep);
+    destroy_tree(t);
+
+    /* Each parse starts from zero */
+    assert(shallow.tokens_lexed < deep.tokens_lexed);
+    assert(shallow.max_depth < deep.max_depth);
+
+    /* The new tokens are the 11 tokens and the end of the input */
+    assert(deep.tokens_lexed - deep.tokens_relexed == 12);
+
+    for (rewound = 0, i = 0; i < PARSE_RULES; i++){
+	assert(parse_rule_name(i) != NULL);
+	assert(deep.rewinds[i] <= deep.rewound_tokens[i]);
+	rewound += deep.rewound_tokens[i];
+    }
+    assert(rewound >= deep.tokens_relexed);
+
+    /* The dollar of E' and T' rewinds after each parenthesis */
+    assert(deep.rewinds[PARSE_RULE_E] > 0 && deep.rewinds[PARSE_RULE_T] > 0);
+    assert(deep.rewinds[PARSE_RULE_OTHER] == 0);
+
+    /* The rewinds of other parsers don't belong to the math grammar */
+    init_buffer("a\n");
+    assert(app_variable_pair_parse() == true);
+    parse_get_stats(&shallow);
+    assert(shallow.rewinds[PARSE_RULE_OTHER] == 1);
+    assert(shallow.rewound_tokens[PARSE_RULE_OTHER] == 2);
+    for (i = 0; i < PARSE_RULE_OTHER; i++)
+	assert(shallow.rewinds[i] == 0);
+    assert(strcmp(parse_rule_name(PARSE_RULE_OTHER), "other") == 0);
+}
+
+/* Parse 'expr' under 'budget' and return the error */
+static mexpr_error
+app_parse_with_budget(mexpr_budget *budget, char *expr){
+    mexpr_error error;
+    tree *t;
+
+    t = build_mathexpr_tree_budget(start_mathexpr_parse, expr, budget);
+    error = parse_last_error();
+    assert((t != NULL) == (error == MEXPR_OK));
+    if (t != NULL)
+	destroy_tree(t);
+
+    return error;
+}
+
+static void
+app_budget_tests(){
+    char *nested = "((((1)))) + 2\n", buf[BUFFER_LEN * 2];
+    mexpr_budget budget, strict;
+    tr_node top;
+    tree *t, *t2;
+    int i;
+
+    printf("Will parse and evaluate under budgets...\n");
+
+    memset(&budget, 0, sizeof(mexpr_budget));
+    assert(app_parse_with_budget(&budget, nested) == MEXPR_OK);
+    assert(app_parse_with_budget(&budget, "1 +\n") == MEXPR_ERR_SYNTAX);
+    assert(app_parse_with_budget(&budget, "1 + 2") == MEXPR_ERR_FORMAT);
+
+    budget.max_tokens = 5;
+    assert(app_parse_with_budget(&budget, nested) == MEXPR_ERR_TOKENS);
+    budget.max_tokens = 0;
+
+    budget.max_depth = 6;
+    assert(app_parse_with_budget(&budget, nested) == MEXPR_ERR_DEPTH);
+    budget.max_depth = 0;
+
+    budget.max_parse_steps = 10;
+    assert(app_parse_with_budget(&budget, nested) == MEXPR_ERR_PARSE_STEPS);
+    budget.max_parse_steps = 0;
+
+    budget.max_rewinds = 3;
+    assert(app_parse_with_budget(&budget, nested) == MEXPR_ERR_REWINDS);
+    budget.max_rewinds = 0;
+
+    /* Large enough budgets */
+    budget.max_tokens = 64;
+    budget.max_depth = 64;
+    budget.max_parse_steps = 1000;
+    budget.max_rewinds = 1000;
+    assert(app_parse_with_budget(&budget, nested) == MEXPR_OK);
+
+    /* The hard limits of the lex buffer and the lex stack */
+    for (i = 0; i < BUFFER_LEN; i++)
+	buf[i] = i % 2 == 0 ? '1' : '+';
+    strcpy(buf + BUFFER_LEN + 1, "\n");
+    buf[BUFFER_LEN] = '1';
+    assert(app_parse_with_budget(NULL, buf) == MEXPR_ERR_TOO_LONG);
+    strcpy(buf + MAX_STACK_INDEX + 1, "\n");
+    assert(app_parse_with_budget(NULL, buf) == MEXPR_ERR_TOKENS);
+
+    /* Evaluation */
+    t = build_mathexpr_tree(start_mathexpr_parse, "1 + 2 * 3\n");
+    assert(t != NULL);
+    memset(&budget, 0, sizeof(mexpr_budget));
+    budget.max_eval_nodes = 3;
+    tree_set_budget(t, &budget);
+    evaluate_tree(t, &top);
+    assert(t->computation_failed && t->error == MEXPR_ERR_EVAL_NODES);
+    budget.max_eval_nodes = 5;
+    tree_set_budget(t, &budget);
+    evaluate_tree(t, &top);
+    assert(!t->computation_failed && t->error == MEXPR_OK);
+    assert(top.node_id == INT && top.unv.ival == 7);
+    destroy_tree(t);
+
+    /*
+     * The default budget applies to the parses without their own and
+     * to the trees built after it, so the trees of two callers keep
+     * their own limits.
+     */
+    memset(&strict, 0, sizeof(mexpr_budget));
+    strict.max_tokens = 8;
+    strict.max_eval_nodes = 3;
+    mexpr_set_budget(&strict);
+    assert(build_mathexpr_tree(start_mathexpr_parse, nested) == NULL);
+    assert(parse_last_error() == MEXPR_ERR_TOKENS);
+    memset(&budget, 0, sizeof(mexpr_budget));
+    t = build_mathexpr_tree_budget(start_mathexpr_parse, "1 + 2 * 3\n",
+				   &budget);
+    t2 = build_mathexpr_tree(start_mathexpr_parse, "1+2*3\n");
+    assert(t != NULL && t2 != NULL);
+    mexpr_set_budget(NULL);
+    evaluate_tree(t, &top);
+    assert(!t->computation_failed && top.unv.ival == 7);
+    evaluate_tree(t2, &top);
+    assert(t2->computation_failed && t2->error == MEXPR_ERR_EVAL_NODES);
+    destroy_tree(t);
+    destroy_tree(t2);
+
+    t = build_mathexpr_tree(start_mathexpr_parse, "1 / 0\n");
+    assert(t != NULL);
+    evaluate_tree(t, &top);
+    assert(t->computation_failed && t->error == MEXPR_ERR_ZERO_DIVISION);
+    destroy_tree(t);
+
+    for (i = MEXPR_OK; i < MEXPR_ERRORS; i++)
+	assert(mexpr_error_name(i) != NULL);
+}
+
+static void
+app_trace_tests(){
+    tree *t1, *t2, *t3;
+
+    printf("Will identify the expressions for the tracepoints...\n");
+
+    t1 = build_mathexpr_tree(start_mathexpr_parse, "a * 2\n");
+    t2 = build_mathexpr_tree(start_mathexpr_parse, "a * 2\n");
+    t3 = build_mathexpr_tree(start_mathexpr_parse, "a * 3\n");
+    assert(t1 != NULL && t2 != NULL && t3 != NULL);
+
+    assert(t1->hash != 0);
+    assert(t1->hash == t2->hash);
+    assert(t1->hash != t3->hash);
+
+    destroy_tree(t1);
+    destroy_tree(t2);
+    destroy_tree(t3);
+}
+
+static void
+app_profile_tests(){
+    tree_profile *p;
+    tr_node top;
+    node_profile *np;
+    char line[256];
+    bool found = false;
+    tree *t, *ref;
+    FILE *fp;
+    int i;
+
+    printf("Will profile the nodes of a tree...\n");
+
+    t = build_mathexpr_tree(start_mathexpr_parse,
+			    "pow(x, 2) + sqrt(y) * 3 - x / z\n");
+    ref = build_mathexpr_tree(start_mathexpr_parse,
+			      "pow(x, 2) + sqrt(y) * 3 - x / z\n");
+    assert(t != NULL && ref != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    resolve_variable(ref, app_jit_vars, app_fetch_jit_var);
+    p = profile_create(t);
+
+    app_jit_vars[0].node_id = INT;
+    app_jit_vars[1].node_id = DOUBLE;
+    app_jit_vars[2].node_id = INT;
+    for (i = 0; i < 1000; i++){
+	app_jit_vars[0].unv.ival = i % 17;
+	app_jit_vars[1].unv.dval = i * 0.25;
+	app_jit_vars[2].unv.ival = i % 10 + 1;
+	app_compare_by(APP_EVAL_PROFILE, p, t, ref);
+	assert(!t->computation_failed);
+    }
+
+    /* Every node is reached by each evaluation */
+    for (i = 0; i < profile_node_count(p); i++){
+	np = profile_node(p, i);
+	assert(np->hits == 1000);
+	assert(np->self_cycles <= np->total_cycles);
+	assert(np->total_cycles <= profile_node(p, 0)->total_cycles);
+    }
+
+    /* Zero division stops the evaluation as evaluate_tree() does */
+    profile_reset(p);
+    app_jit_vars[2].unv.ival = 0;
+    profile_evaluate(p, &top);
+    assert(t->computation_failed && t->error == MEXPR_ERR_ZERO_DIVISION);
+    assert(profile_node(p, 0)->hits == 1);
+
+    assert((fp = tmpfile()) != NULL);
+    profile_dump(p, fp);
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp) != NULL)
+	if (strstr(line, "pow") != NULL)
+	    found = true;
+    assert(found);
+    fclose(fp);
+
+    profile_destroy(p);
+    destroy_tree(t);
+    destroy_tree(ref);
+}
+
+static void *
+app_metrics_worker(void *arg){
+    tr_node top;
+    int i;
+
+    for (i = 0; i < 10; i++)
+	evaluate_tree((tree *) arg, &top);
+
+    return NULL;
+}
+
+static void
+app_metrics_tests(){
+    char path[] = "/tmp/mexpr_metrics_XXXXXX", line[256];
+    char cache_dir[] = "/tmp/mexpr_rules_XXXXXX";
+    mexpr_metrics m;
+    mexpr_histogram h;
+    bool found = false;
+    rule_set *rs;
+    pthread_t th;
+    tr_node top, val;
+    tree *t;
+    FILE *fp;
+    int fd, i;
+
+    printf("Will collect the metrics of parses and evaluations...\n");
+
+    mexpr_metrics_reset();
+    mexpr_metrics_set_timing(true);
+
+    assert(build_mathexpr_tree(start_mathexpr_parse, "1 + * 2\n") == NULL);
+    t = build_mathexpr_tree(start_mathexpr_parse, "x / z + y\n");
+    assert(t != NULL);
+
+    /* Unresolved, evaluated, zero division and type error */
+    evaluate_tree(t, &top);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    app_jit_vars[0].node_id = INT;
+    app_jit_vars[0].unv.ival = 6;
+    app_jit_vars[1].node_id = INT;
+    app_jit_vars[1].unv.ival = 1;
+    app_jit_vars[2].node_id = INT;
+    app_jit_vars[2].unv.ival = 3;
+    evaluate_tree(t, &top);
+    assert(!t->computation_failed && top.unv.ival == 3);
+    app_jit_vars[2].unv.ival = 0;
+    evaluate_tree(t, &top);
+    assert(t->error == MEXPR_ERR_ZERO_DIVISION);
+    app_jit_vars[1].node_id = BOOLEAN;
+    app_jit_vars[2].unv.ival = 3;
+    evaluate_tree(t, &top);
+    assert(t->error == MEXPR_ERR_EVALUATION);
+    app_jit_vars[1].node_id = INT;
+
+    /* The counters of exited threads are kept */
+    assert(pthread_create(&th, NULL, app_metrics_worker, t) == 0);
+    assert(pthread_join(th, NULL) == 0);
+
+    mexpr_metrics_snapshot(&m);
+    assert(m.parses == 2 && m.parse_failures[MEXPR_ERR_SYNTAX] == 1);
+    assert(m.evaluations == 14);
+    assert(m.eval_failures[MEXPR_ERR_UNRESOLVED] == 1);
+    assert(m.eval_failures[MEXPR_ERR_ZERO_DIVISION] == 1);
+    assert(m.eval_failures[MEXPR_ERR_EVALUATION] == 1);
+    assert(m.eval_failures[MEXPR_OK] == 0);
+    assert(m.parse_latency.count == 2 && m.eval_latency.count == 14);
+    assert(m.elapsed_sec > 0 && m.evaluations_per_sec > 0);
+    assert(mexpr_histogram_quantile(&m.eval_latency, 1.0) ==
+	   m.eval_latency.max_ns);
+
+    /* The bounds of buckets are within 12.5% of the values */
+    memset(&h, 0, sizeof(h));
+    for (i = 1; i <= 1000; i++){
+	h.buckets[i < 8 ? i : (63 - __builtin_clzll(i) - 2) * 8 +
+		  ((i >> (63 - __builtin_clzll(i) - 3)) & 7)]++;
+	h.count++;
+    }
+    h.max_ns = 1000;
+    assert(mexpr_histogram_quantile(&h, 0) == 1);
+    assert(mexpr_histogram_quantile(&h, 0.5) >= 500);
+    assert(mexpr_histogram_quantile(&h, 0.5) <= 500 * 1.125);
+    assert(mexpr_histogram_quantile(&h, 0.99) >= 990);
+    assert(mexpr_histogram_quantile(&h, 0.99) <= 1000);
+
+    /* The same rule set hits the cache of shared objects once built */
+    rs = rule_set_create();
+    assert(rule_set_add(rs, "metrics > 1") == 0);
+    assert(rule_set_add(rs, "metrics >") == -1);
+
+    /* One parse per rule, not per parser tried */
+    mexpr_metrics_snapshot(&m);
+    assert(m.parses == 4 && m.parse_failures[MEXPR_ERR_SYNTAX] == 2);
+    val.node_id = INT;
+    assert(rule_set_assign(rs, "metrics", &val));
+    assert(mkdtemp(cache_dir) != NULL);
+    if (rule_set_compile(rs, cache_dir)){
+	assert(rule_set_compile(rs, cache_dir));
+	mexpr_metrics_snapshot(&m);
+	assert(m.cache_hits == 1 && m.cache_misses == 1);
+    }
+    rule_set_destroy(rs);
+    app_remove_dir(cache_dir);
+
+    assert((fd = mkstemp(path)) >= 0);
+    close(fd);
+    assert(mexpr_metrics_exporter_start(path, 10));
+    assert(!mexpr_metrics_exporter_start(path, 10));
+    mexpr_metrics_exporter_stop();
+    assert((fp = fopen(path, "r")) != NULL);
+    while (fgets(line, sizeof(line), fp) != NULL)
+	if (strcmp(line, "mexpr_evaluation_failures_total"
+		   "{cause=\"zero division\"} 1\n") == 0)
+	    found = true;
+    assert(found);
+    fclose(fp);
+    unlink(path);
+
+    mexpr_metrics_set_timing(false);
+    mexpr_metrics_reset();
+    evaluate_tree(t, &top);
+    mexpr_metrics_snapshot(&m);
+    assert(m.evaluations == 1 && m.eval_latency.count == 0);
+
+    destroy_tree(t);
+}
+
+/* Return the report of explain_tree() in a buffer to be freed */
+static char *
+app_explain_text(tree *t, reorder_plan *plan, tiered_tree *tt){
+    char *text = NULL;
+    size_t len = 0;
+    FILE *fp;
+
+    assert((fp = open_memstream(&text, &len)) != NULL);
+    explain_tree(t, plan, tt, fp);
+    fclose(fp);
+
+    return text;
+}
+
+static void
+app_explain_tests(){
+    reorder_plan *plan;
+    tiered_tree *tt;
+    tr_node top;
+    char *text;
+    tree *t;
+    int i;
+
+    printf("Will explain the execution of trees...\n");
+
+    t = build_mathexpr_tree(start_logical_mathexpr_parse,
+			    "sqrt(x) + sqrt(x) * (2 * 3) > y and x < 10\n");
+    assert(t != NULL);
+
+    /* Only the structure is known before the resolution */
+    text = app_explain_text(t, NULL, NULL);
+    assert(strstr(text, "original tree :\n  and\n    >\n") != NULL);
+    assert(strstr(text, "  (2 * 3)\n") != NULL);
+    assert(strstr(text, "  sqrt(x) : computed 2 times\n") != NULL);
+    assert(strstr(text, "unresolved") != NULL);
+    assert(strstr(text, "typed program") == NULL);
+    free(text);
+
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    app_jit_vars[0].node_id = INT;
+    app_jit_vars[0].unv.ival = 4;
+    app_jit_vars[1].node_id = DOUBLE;
+    app_jit_vars[1].unv.dval = 1.5;
+    text = app_explain_text(t, NULL, NULL);
+    assert(strstr(text, "  slot 0 : x INT\n  slot 1 : y DOUBLE\n") != NULL);
+    assert(strstr(text, "= SQRT v1 : DOUBLE\n") != NULL);
+    assert(strstr(text, "JIT (native code)") != NULL ||
+	   strstr(text, "VM (typed program)") != NULL);
+    assert(strstr(text, "estimated cost : ") != NULL);
+    free(text);
+
+    /* The types fail every evaluation */
+    app_jit_vars[1].node_id = BOOLEAN;
+    text = app_explain_text(t, NULL, NULL);
+    assert(strstr(text, "every evaluation fails") != NULL);
+    assert(strstr(text, "tree walker (evaluate_tree)") != NULL);
+    free(text);
+    app_jit_vars[1].node_id = DOUBLE;
+
+    /* The current tier of the tiered tree */
+    tt = tiered_tree_create(t, 4);
+    for (i = 0; i < 10; i++)
+	tiered_evaluate(tt, &top);
+    text = app_explain_text(t, NULL, tt);
+    assert(strstr(text, "evaluations : generic 4,") != NULL);
+    free(text);
+    tiered_tree_destroy(tt);
+    destroy_tree(t);
+
+    /* The expensive operand is put after the cheap one */
+    t = build_mathexpr_tree(start_logical_mathexpr_parse,
+			    "pow(x, 2) + sin(y) > 1 and x < 0\n");
+    assert(t != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+    plan = reorder_plan_create(t);
+    reorder_evaluate(plan, &top);
+    text = app_explain_text(t, plan, NULL);
+    assert(strstr(text, "and/or reorderings :\n  right operand first : "
+		  "(((pow(x, 2) + sin(y)) > 1) and (x < 0))\n") != NULL);
+    assert(strstr(text, "constant subtrees (not folded) :\n  none\n") != NULL);
+    free(text);
+    reorder_plan_destroy(plan);
+    destroy_tree(t);
+}
+
+static void
+app_evaluator_error_tests(){
+    tr_node top;
+    tree *t;
+    int i;
+
+    printf("Will fail and succeed by each evaluator...\n");
+
+    t = build_mathexpr_tree(start_logical_mathexpr_parse,
+			    "x / z > 1 and y < 3\n");
+    assert(t != NULL);
+    resolve_variable(t, app_jit_vars, app_fetch_jit_var);
+
+    for (i = 0; i < APP_EVALUATORS; i++){
+	app_jit_vars[0].node_id = INT;
+	app_jit_vars[0].unv.ival = 4;
+	app_jit_vars[1].node_id = INT;
+	app_jit_vars[1].unv.ival = 1;
+	app_jit_vars[2].node_id = INT;
+	app_jit_vars[2].unv.ival = 0;
+
+	app_evaluate_by(i, NULL, t, &top);
+	assert(t->computation_failed && t->error == MEXPR_ERR_ZERO_DIVISION);
+
+	/* The failure doesn't stay for the next evaluation */
+	app_jit_vars[2].unv.ival = 2;
+	app_evaluate_by(i, NULL, t, &top);
+	assert(!t->computation_failed && t->error == MEXPR_OK);
+	assert(top.node_id == BOOLEAN && top.unv.bval == true);
+
+	app_jit_vars[1].node_id = BOOLEAN;
+	app_jit_vars[1].unv.bval = true;
+	app_evaluate_by(i, NULL, t, &top);
+	assert(t->computation_failed && t->error == MEXPR_ERR_EVALUATION);
+
+	app_jit_vars[1].node_id = INT;
+	app_evaluate_by(i, NULL, t, &top);
+	assert(!t->computation_failed && t->error == MEXPR_OK);
+    }
+
+    destroy_tree(t);
+}
+
 static void
 app_error_handle_tests(){
     printf("Will evaluate some invalid math expressions...\n");
@@ -516,6 +2590,48 @@ main(int argc, char **argv){
     app_var_resolve_tests();
     /* Error handling */
     app_error_handle_tests();
+    /* Tree reuse */
+    app_tree_reuse_tests();
+    /* Batch evaluation */
+    app_batch_tests();
+    app_parallel_batch_tests();
+    /* Columns of CSV files */
+    app_csv_tests();
+    /* Rule set */
+    app_rule_set_tests();
+    app_rule_set_compile_tests();
+    app_predicate_index_tests();
+    app_rule_network_tests();
+    /* Native code */
+    app_jit_tests();
+    /* Tiered execution */
+    app_tier_tests();
+    /* Threaded code */
+    app_threaded_tests();
+    /* Incremental evaluation */
+    app_incremental_tests();
+    /* Reordering of logical operands */
+    app_reorder_tests();
+    /* Decision diagrams */
+    app_bdd_tests();
+    /* Latency of stages */
+    app_stats_tests();
+    /* Memory accounting */
+    app_alloc_tests();
+    /* Parser statistics */
+    app_parse_stats_tests();
+    /* Resource budgets */
+    app_budget_tests();
+    /* Tracepoints */
+    app_trace_tests();
+    /* Profiler of nodes */
+    app_profile_tests();
+    /* Operational metrics */
+    app_metrics_tests();
+    /* Explanation of execution */
+    app_explain_tests();
+    /* Failure state of the evaluators */
+    app_evaluator_error_tests();
 
     printf("All tests are done gracefully.\n");
 
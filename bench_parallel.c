@@ -0,0 +1,185 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "MexprTree.h"
+#include "MexprBatch.h"
+#include "ExportedParser.h"
+
+/*
+ * Measure how parallel batch evaluation scales with threads.
+ *
+ * usage: bench_parallel [-n rows] [-t max_threads] [-r repeat]
+ *
+ * Evaluate a math expression by evaluate_batch_parallel() and
+ * a logical one by evaluate_filter_parallel() over 'rows' generated
+ * rows, with the pool of 1 to 'max_threads' threads. The best time
+ * of 'repeat' runs is reported for each number of threads, together
+ * with the speedup against one thread.
+ */
+
+#define MATH_EXPRESSION "a * b + sqrt(c) - b / 3\n"
+#define FILTER_EXPRESSION "a * b > 10 and c < 500 or b <= 0.5\n"
+
+typedef struct bench_data {
+    size_t rows;
+    int *a;
+    double *b;
+    int *c;
+    batch_value *values;
+    uint64_t *bitmap;
+} bench_data;
+
+static double
+now_sec(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+generate_data(bench_data *data, size_t rows){
+    size_t i;
+
+    data->rows = rows;
+    data->a = (int *) malloc(sizeof(int) * rows);
+    data->b = (double *) malloc(sizeof(double) * rows);
+    data->c = (int *) malloc(sizeof(int) * rows);
+    data->values = (batch_value *) malloc(sizeof(batch_value) * rows);
+    data->bitmap = (uint64_t *) malloc(sizeof(uint64_t) *
+				       FILTER_BITMAP_WORDS(rows));
+    if (data->a == NULL || data->b == NULL || data->c == NULL ||
+	data->values == NULL || data->bitmap == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    srand(1);
+    for (i = 0; i < rows; i++){
+	data->a[i] = rand() % 100 - 50;
+	data->b[i] = (rand() % 10000) / 1000.0;
+	data->c[i] = rand() % 1000;
+    }
+}
+
+static void
+release_data(bench_data *data){
+    free(data->a);
+    free(data->b);
+    free(data->c);
+    free(data->values);
+    free(data->bitmap);
+}
+
+/* Return the best time of 'repeat' runs */
+static double
+measure(tree *t, bench_data *data, batch_binding *bindings,
+	mexpr_pool *pool, bool filter, int repeat){
+    double best = -1, start, sec;
+    bool ret;
+    int i;
+
+    for (i = 0; i < repeat; i++){
+	start = now_sec();
+	if (filter)
+	    ret = evaluate_filter_parallel(t, data->rows, bindings,
+					   data->bitmap, pool);
+	else
+	    ret = evaluate_batch_parallel(t, data->rows, bindings,
+					  data->values, pool);
+	sec = now_sec() - start;
+	assert(ret);
+
+	if (best < 0 || sec < best)
+	    best = sec;
+    }
+
+    return best;
+}
+
+static void
+usage(char *progname){
+    fprintf(stderr, "usage: %s [-n rows] [-t max_threads] [-r repeat]\n",
+	    progname);
+    exit(1);
+}
+
+int
+main(int argc, char **argv){
+    int opt, nthreads, max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double batch_sec, filter_sec, batch_base = 0, filter_base = 0;
+    size_t rows = 50 * 1000 * 1000;
+    tree *math_tree, *filter_tree;
+    bench_data data;
+    mexpr_pool *pool;
+    int repeat = 3;
+
+    while ((opt = getopt(argc, argv, "n:r:t:")) != -1){
+	switch(opt){
+	    case 'n':
+		rows = strtoul(optarg, (char **) NULL, 10);
+		break;
+	    case 'r':
+		repeat = atoi(optarg);
+		break;
+	    case 't':
+		max_threads = atoi(optarg);
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    if (rows == 0 || repeat <= 0 || max_threads <= 0)
+	usage(argv[0]);
+
+    generate_data(&data, rows);
+
+    {
+	batch_binding bindings[] = {
+	    { .vname = "a", .type = INT, .values = data.a },
+	    { .vname = "b", .type = DOUBLE, .values = data.b },
+	    { .vname = "c", .type = INT, .values = data.c },
+	    { .vname = NULL },
+	};
+
+	math_tree = build_mathexpr_tree(start_mathexpr_parse,
+					MATH_EXPRESSION);
+	filter_tree = build_mathexpr_tree(start_logical_mathexpr_parse,
+					  FILTER_EXPRESSION);
+	assert(math_tree != NULL && filter_tree != NULL);
+
+	printf("%zu rows\n", rows);
+	printf("%-8s %16s %8s %16s %8s\n", "threads",
+	       "batch rows/sec", "speedup", "filter rows/sec", "speedup");
+
+	for (nthreads = 1; nthreads <= max_threads; nthreads++){
+	    pool = mexpr_pool_create(nthreads);
+
+	    batch_sec = measure(math_tree, &data, bindings, pool,
+				false, repeat);
+	    filter_sec = measure(filter_tree, &data, bindings, pool,
+				 true, repeat);
+	    if (nthreads == 1){
+		batch_base = batch_sec;
+		filter_base = filter_sec;
+	    }
+
+	    printf("%-8d %16.0f %8.2f %16.0f %8.2f\n", nthreads,
+		   rows / batch_sec, batch_base / batch_sec,
+		   rows / filter_sec, filter_base / filter_sec);
+
+	    mexpr_pool_destroy(pool);
+	}
+    }
+
+    destroy_tree(math_tree);
+    destroy_tree(filter_tree);
+    release_data(&data);
+
+    return 0;
+}
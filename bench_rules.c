@@ -0,0 +1,162 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprRuleSet.h"
+
+/*
+ * Measure the latency of rule set evaluation per record.
+ *
+ * usage: bench_rules [-n rules] [-v variables] [-r records] [-t threads]
+ *
+ * Generate 'rules' random logical rules over 'variables' variables
+ * and evaluate all of them against 'records' random records with
+ * the pool of 'threads' threads. The percentiles of the latency to
+ * bind one record and collect the true rules are reported.
+ */
+
+#define RULE_LEN 128
+#define VNAME_LEN 16
+
+static double
+now_usec(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int
+compare_double(const void *a, const void *b){
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* The lexer doesn't accept '0' in variable names. So, use letters */
+static void
+variable_name(char *buf, int i){
+    *buf++ = 'v';
+    do {
+	*buf++ = 'a' + i % 26;
+	i /= 26;
+    } while (i > 0);
+    *buf = '\0';
+}
+
+static void
+generate_rule(char *buf, int nvars){
+    char x[VNAME_LEN], y[VNAME_LEN], z[VNAME_LEN];
+
+    variable_name(x, rand() % nvars);
+    variable_name(y, rand() % nvars);
+    variable_name(z, rand() % nvars);
+
+    switch(rand() % 3){
+	case 0:
+	    sprintf(buf, "%s > %d and %s <= %d.5",
+		    x, rand() % 100 + 1, y, rand() % 100 + 1);
+	    break;
+	case 1:
+	    sprintf(buf, "%s + %s > %d or %s = %d",
+		    x, y, rand() % 200 + 1, z, rand() % 100 + 1);
+	    break;
+	default:
+	    sprintf(buf, "%s * 2 < %s - %d", x, y, rand() % 50 + 1);
+	    break;
+    }
+}
+
+static void
+usage(char *progname){
+    fprintf(stderr,
+	    "usage: %s [-n rules] [-v variables] [-r records] [-t threads]\n",
+	    progname);
+    exit(1);
+}
+
+int
+main(int argc, char **argv){
+    int opt, nrules = 20000, nvars = 64, nrecords = 2000;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    char buf[RULE_LEN], vname[VNAME_LEN];
+    double *latency, start;
+    long matched = 0;
+    mexpr_pool *pool;
+    tr_node value;
+    rule_set *rs;
+    int i, j, *ids;
+
+    while ((opt = getopt(argc, argv, "n:r:t:v:")) != -1){
+	switch(opt){
+	    case 'n':
+		nrules = atoi(optarg);
+		break;
+	    case 'r':
+		nrecords = atoi(optarg);
+		break;
+	    case 't':
+		nthreads = atoi(optarg);
+		break;
+	    case 'v':
+		nvars = atoi(optarg);
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    if (nrules <= 0 || nvars <= 0 || nrecords <= 0 || nthreads <= 0)
+	usage(argv[0]);
+
+    srand(1);
+    rs = rule_set_create();
+    for (i = 0; i < nrules; i++){
+	generate_rule(buf, nvars);
+	if (rule_set_add(rs, buf) < 0){
+	    fprintf(stderr, "failed to parse '%s'\n", buf);
+	    return 1;
+	}
+    }
+
+    pool = mexpr_pool_create(nthreads);
+    ids = (int *) malloc(sizeof(int) * nrules);
+    latency = (double *) malloc(sizeof(double) * nrecords);
+    if (ids == NULL || latency == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    for (i = 0; i < nrecords; i++){
+	start = now_usec();
+	for (j = 0; j < nvars; j++){
+	    variable_name(vname, j);
+	    value.node_id = INT;
+	    value.unv.ival = rand() % 100;
+	    (void) rule_set_assign(rs, vname, &value);
+	}
+	matched += rule_set_evaluate(rs, pool, ids);
+	latency[i] = now_usec() - start;
+    }
+
+    qsort(latency, nrecords, sizeof(double), compare_double);
+
+    printf("%d rules, %d variables, %d records, %d threads\n",
+	   nrules, nvars, nrecords, nthreads);
+    printf("latency usec : p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n",
+	   latency[nrecords / 2], latency[nrecords * 9 / 10],
+	   latency[nrecords * 99 / 100], latency[nrecords - 1]);
+    printf("%.1f true rules per record\n", (double) matched / nrecords);
+
+    mexpr_pool_destroy(pool);
+    rule_set_destroy(rs);
+    free(ids);
+    free(latency);
+
+    return 0;
+}
@@ -0,0 +1,726 @@
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprAlloc.h"
+#include "ExportedParser.h"
+
+/*
+ * Measure how the pipeline scales with the size and the shape of the
+ * expression, and with the number of threads.
+ *
+ * usage: bench_scale [-m max_exponent] [-N max_tokens] [-o output_file]
+ *                    [-s thread_tokens] [-t max_threads] [-w work]
+ *
+ * The expressions are generated in these shapes :
+ *
+ *   left_deep   a + 2 + b + 3 + ...
+ *   right_deep  a + (2 + (b + (3 + ...)))
+ *   balanced    ((a + 2) + (b + 3)) + ((c + 1) + (a + 2)) ...
+ *   parens      (((a))) + (((2))) + (((b))) + ...
+ *   and_or      a > 1 and b < 2 or c > 3 and a < 1 ...
+ *
+ * The size sweep grows each shape from 5 to 'max_tokens' tokens
+ * (100000 by default) in the steps of 1, 2 and 5, and times three
+ * stages on one thread :
+ *
+ *   parse     init_buffer() and the parser entry point
+ *   build     convert_infix_to_postfix() and convert_postfix_to_tree()
+ *             of the generated tokens, and the freeing of both
+ *   evaluate  evaluate_tree() of the resolved tree
+ *
+ * The parser keeps its input in the buffer of BUFFER_LEN bytes and
+ * the tokens on the lex stack of MAX_STACK_INDEX, so 'parse' is only
+ * measured for the texts that fit. "make bench-scale" builds the
+ * library and this program with a BUFFER_LEN large enough for the
+ * default 'max_tokens'; with the default limits, 'parse' stops at
+ * about 200 tokens. 'build' takes the generated tokens as the parser
+ * would leave them on the lex stack, so it is measured up to any size.
+ *
+ * The thread sweep runs 'build' and 'evaluate' of 'thread_tokens'
+ * tokens (10000 by default) on 1, 2, 4 ... 'max_threads' threads (64
+ * by default), each with its own tree. The parser has global state,
+ * so it is left out.
+ *
+ * Each stage runs about 'work' tokens (500000 by default) in total
+ * per thread. The CSV records have the nanoseconds and the bytes
+ * allocated by mexpr_malloc() per token. A time per token that grows
+ * with the size is super-linear, as is a time per token that grows
+ * with the threads below the number of CPUs. For each shape and stage
+ * of the size sweep, the exponent of the time over the size is fitted
+ * on a log-log scale. It is printed to stderr, and the exit status is
+ * 2 if one is above 'max_exponent' (1.3 by default), which leaves
+ * room for the cache misses of the large trees. Plot the records
+ * with bench_scale.gp.
+ */
+
+#define DEFAULT_MAX_TOKENS 100000
+#define DEFAULT_THREAD_TOKENS 10000
+#define DEFAULT_MAX_THREADS 64
+#define DEFAULT_WORK 500000
+#define DEFAULT_MAX_EXPONENT 1.3
+
+/* Parentheses around each operand of the 'parens' shape */
+#define PAREN_DEPTH 3
+
+/* The exponent is fitted from this size up, above the fixed costs */
+#define FIT_MIN_TOKENS 20
+
+/* The stack of each thread per token, for the recursion of the tree */
+#define STACK_PER_TOKEN 1024
+#define MIN_STACK_SIZE (8 << 20)
+
+typedef enum bench_stage {
+    STAGE_PARSE,
+    STAGE_BUILD,
+    STAGE_EVALUATE,
+    STAGES
+} bench_stage;
+
+static const char *stage_names[STAGES] = { "parse", "build", "evaluate" };
+
+/* The generated tokens, as the parser leaves them on the lex stack */
+typedef struct workload {
+    lex_data *tokens;
+    int ntokens;
+    int capacity;
+} workload;
+
+typedef struct bench_shape {
+    const char *name;
+    void (*generate)(workload *w, int operands);
+    bool (*parser)(void);
+} bench_shape;
+
+typedef struct bench_record {
+    /* "size" or "threads" */
+    const char *sweep;
+    const char *shape;
+    bench_stage stage;
+    int tokens;
+    int threads;
+    int repeats;
+    double ns_per_token;
+    double bytes_per_token;
+} bench_record;
+
+typedef struct thread_arg {
+    workload *w;
+    int repeats;
+    pthread_barrier_t *barrier;
+} thread_arg;
+
+static char *var_names[] = { "a", "b", "c" };
+static char *int_values[] = { "1", "2", "3" };
+
+/* The values of the variables 'a', 'b' and 'c' */
+static tr_node bench_vars[3];
+
+static int max_tokens = DEFAULT_MAX_TOKENS;
+static int thread_tokens = DEFAULT_THREAD_TOKENS;
+static int max_threads = DEFAULT_MAX_THREADS;
+static long work = DEFAULT_WORK;
+
+static bench_record *records;
+static int nrecords;
+
+static uint64_t
+now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static tr_node *
+bench_fetch_var(char *vname, void *data){
+    tr_node *vars = (tr_node *) data;
+
+    if (vname[1] != '\0' || vname[0] < 'a' || vname[0] > 'c')
+	return NULL;
+
+    return &vars[vname[0] - 'a'];
+}
+
+/* The bytes allocated by mexpr_malloc() so far, for all sites */
+static uint64_t
+allocated_bytes(void){
+    mexpr_alloc_stats stats;
+    uint64_t sum = 0;
+    int i;
+
+    mexpr_alloc_get_stats(&stats);
+    for (i = 0; i < MEXPR_ALLOC_SITES; i++)
+	sum += stats.sites[i].allocated_bytes;
+
+    return sum;
+}
+
+static void
+push_token(workload *w, int code, char *val){
+    if (w->ntokens == w->capacity){
+	w->capacity = w->capacity == 0 ? 64 : w->capacity * 2;
+	w->tokens = (lex_data *) mexpr_xrealloc(w->tokens,
+						sizeof(lex_data) * w->capacity);
+    }
+
+    w->tokens[w->ntokens].token_code = code;
+    w->tokens[w->ntokens].token_len = strlen(val);
+    w->tokens[w->ntokens].token_val = val;
+    w->ntokens++;
+}
+
+/* The variables and the integers alternate */
+static void
+push_operand(workload *w, int i){
+    if (i % 2 == 0)
+	push_token(w, VARIABLE, var_names[(i / 2) % 3]);
+    else
+	push_token(w, INT, int_values[(i / 2) % 3]);
+}
+
+static void
+gen_left_deep(workload *w, int operands){
+    int i;
+
+    for (i = 0; i < operands; i++){
+	if (i > 0)
+	    push_token(w, PLUS, "+");
+	push_operand(w, i);
+    }
+}
+
+static void
+gen_right_deep(workload *w, int operands){
+    int i;
+
+    for (i = 0; i < operands - 1; i++){
+	push_operand(w, i);
+	push_token(w, PLUS, "+");
+	if (i < operands - 2)
+	    push_token(w, BRACKET_START, "(");
+    }
+    push_operand(w, operands - 1);
+    for (i = 0; i < operands - 2; i++)
+	push_token(w, BRACKET_END, ")");
+}
+
+static void
+gen_balanced_from(workload *w, int first, int operands){
+    if (operands == 1){
+	push_operand(w, first);
+	return;
+    }
+
+    push_token(w, BRACKET_START, "(");
+    gen_balanced_from(w, first, operands / 2);
+    push_token(w, PLUS, "+");
+    gen_balanced_from(w, first + operands / 2, operands - operands / 2);
+    push_token(w, BRACKET_END, ")");
+}
+
+static void
+gen_balanced(workload *w, int operands){
+    gen_balanced_from(w, 0, operands);
+}
+
+static void
+gen_parens(workload *w, int operands){
+    int i, j;
+
+    for (i = 0; i < operands; i++){
+	if (i > 0)
+	    push_token(w, PLUS, "+");
+	for (j = 0; j < PAREN_DEPTH; j++)
+	    push_token(w, BRACKET_START, "(");
+	push_operand(w, i);
+	for (j = 0; j < PAREN_DEPTH; j++)
+	    push_token(w, BRACKET_END, ")");
+    }
+}
+
+/* The operands are comparisons joined by 'and' and 'or' */
+static void
+gen_and_or(workload *w, int operands){
+    int i;
+
+    for (i = 0; i < operands; i++){
+	if (i > 0){
+	    if (i % 3 == 2)
+		push_token(w, OR, "or");
+	    else
+		push_token(w, AND, "and");
+	}
+	push_token(w, VARIABLE, var_names[i % 3]);
+	if (i % 2 == 0)
+	    push_token(w, GREATER_THAN, ">");
+	else
+	    push_token(w, LESS_THAN, "<");
+	push_token(w, INT, int_values[i % 3]);
+    }
+}
+
+static bench_shape shapes[] = {
+    { "left_deep", gen_left_deep, start_mathexpr_parse },
+    { "right_deep", gen_right_deep, start_mathexpr_parse },
+    { "balanced", gen_balanced, start_mathexpr_parse },
+    { "parens", gen_parens, start_mathexpr_parse },
+    { "and_or", gen_and_or, start_logical_mathexpr_parse },
+};
+
+#define SHAPES ((int) (sizeof(shapes) / sizeof(shapes[0])))
+
+static void
+generate(const bench_shape *shape, workload *w, int operands){
+    w->ntokens = 0;
+    shape->generate(w, operands);
+}
+
+/* The fewest operands for at least 'target' tokens */
+static void
+generate_tokens(const bench_shape *shape, workload *w, int target){
+    int low = 1, high = target, mid;
+
+    while (low < high){
+	mid = low + (high - low) / 2;
+	generate(shape, w, mid);
+	if (w->ntokens >= target)
+	    high = mid;
+	else
+	    low = mid + 1;
+    }
+    generate(shape, w, low);
+}
+
+/*
+ * Write the tokens as the text for the parser. Only the tokens that
+ * would merge are separated by a space, since the spaces take the
+ * room of the lex stack too. Return false if the text or its tokens
+ * exceed the limits of the parser.
+ */
+static bool
+render_text(workload *w, char *buf){
+    int i, len = 0, lexed = 0;
+    char *val;
+
+    for (i = 0; i < w->ntokens; i++){
+	val = w->tokens[i].token_val;
+	if (len > 0 && isalnum((unsigned char) buf[len - 1]) &&
+	    isalnum((unsigned char) val[0])){
+	    if (len + 1 >= BUFFER_LEN - 1)
+		return false;
+	    buf[len++] = ' ';
+	    lexed++;
+	}
+	if (len + (int) strlen(val) >= BUFFER_LEN - 1)
+	    return false;
+	strcpy(buf + len, val);
+	len += strlen(val);
+	lexed++;
+    }
+    strcpy(buf + len, "\n");
+
+    return lexed < MAX_STACK_INDEX;
+}
+
+static int
+repeats_for(int tokens){
+    long repeats = work / tokens;
+
+    return repeats > 0 ? (int) repeats : 1;
+}
+
+static void
+add_record(const char *sweep, const char *shape, bench_stage stage,
+	   int tokens, int threads, int repeats, uint64_t ns, uint64_t bytes){
+    bench_record *r;
+
+    records = (bench_record *) mexpr_xrealloc(records,
+					      sizeof(bench_record) * (nrecords + 1));
+    r = &records[nrecords++];
+    r->sweep = sweep;
+    r->shape = shape;
+    r->stage = stage;
+    r->tokens = tokens;
+    r->threads = threads;
+    r->repeats = repeats;
+    r->ns_per_token = (double) ns / repeats / tokens;
+    r->bytes_per_token = (double) bytes / tokens;
+}
+
+static tree *
+build_tree(workload *w){
+    linked_list *postfix;
+    tree *t;
+
+    postfix = convert_infix_to_postfix(w->tokens, w->ntokens);
+    t = convert_postfix_to_tree(postfix);
+    ll_destroy(postfix);
+
+    return t;
+}
+
+static void
+measure_parse(const bench_shape *shape, workload *w, int repeats){
+    /* Too large for the stack when BUFFER_LEN is raised */
+    static char text[BUFFER_LEN];
+    uint64_t start, ns, bytes;
+    bool parsed = true;
+    int i;
+
+    if (!render_text(w, text))
+	return;
+
+    bytes = allocated_bytes();
+    init_buffer(text);
+    parsed = shape->parser();
+    bytes = allocated_bytes() - bytes;
+    assert(parsed);
+
+    start = now_ns();
+    for (i = 0; i < repeats; i++){
+	init_buffer(text);
+	parsed = shape->parser() && parsed;
+    }
+    ns = now_ns() - start;
+    assert(parsed);
+
+    add_record("size", shape->name, STAGE_PARSE, w->ntokens, 1, repeats,
+	       ns, bytes);
+}
+
+static void
+measure_size(const bench_shape *shape, workload *w){
+    int repeats = repeats_for(w->ntokens), i;
+    uint64_t start, ns, bytes;
+    tr_node top;
+    tree *t;
+
+    measure_parse(shape, w, repeats);
+
+    bytes = allocated_bytes();
+    t = build_tree(w);
+    bytes = allocated_bytes() - bytes;
+    destroy_tree(t);
+
+    start = now_ns();
+    for (i = 0; i < repeats; i++)
+	destroy_tree(build_tree(w));
+    ns = now_ns() - start;
+    add_record("size", shape->name, STAGE_BUILD, w->ntokens, 1, repeats,
+	       ns, bytes);
+
+    t = build_tree(w);
+    resolve_variable(t, bench_vars, bench_fetch_var);
+    assert(t->resolved);
+
+    bytes = allocated_bytes();
+    evaluate_tree(t, &top);
+    bytes = allocated_bytes() - bytes;
+    assert(!t->computation_failed);
+
+    start = now_ns();
+    for (i = 0; i < repeats; i++)
+	evaluate_tree(t, &top);
+    ns = now_ns() - start;
+    assert(!t->computation_failed);
+    add_record("size", shape->name, STAGE_EVALUATE, w->ntokens, 1, repeats,
+	       ns, bytes);
+
+    destroy_tree(t);
+}
+
+/* Run on a thread with the stack for the deepest tree */
+static void *
+size_sweep(void *arg){
+    static const int steps[] = { 1, 2, 5 };
+    workload w = { NULL, 0, 0 };
+    int s, scale, step, last;
+
+    (void) arg;
+
+    for (s = 0; s < SHAPES; s++){
+	last = 0;
+	for (scale = 1; scale <= max_tokens; scale *= 10){
+	    for (step = 0; step < 3; step++){
+		if (scale * steps[step] < 5 || scale * steps[step] > max_tokens)
+		    continue;
+		generate_tokens(&shapes[s], &w, scale * steps[step]);
+		/* The small sizes of some shapes round up to the same */
+		if (w.ntokens == last)
+		    continue;
+		last = w.ntokens;
+		measure_size(&shapes[s], &w);
+	    }
+	}
+    }
+    free(w.tokens);
+
+    return NULL;
+}
+
+static void *
+thread_worker(void *arg){
+    thread_arg *ta = (thread_arg *) arg;
+    tr_node top;
+    tree *t;
+    int i;
+
+    pthread_barrier_wait(ta->barrier);
+    for (i = 0; i < ta->repeats; i++)
+	destroy_tree(build_tree(ta->w));
+    pthread_barrier_wait(ta->barrier);
+
+    t = build_tree(ta->w);
+    resolve_variable(t, bench_vars, bench_fetch_var);
+    evaluate_tree(t, &top);
+    pthread_barrier_wait(ta->barrier);
+    for (i = 0; i < ta->repeats; i++)
+	evaluate_tree(t, &top);
+    assert(!t->computation_failed);
+    pthread_barrier_wait(ta->barrier);
+
+    destroy_tree(t);
+
+    return NULL;
+}
+
+static size_t
+stack_size_for(int tokens){
+    size_t size = (size_t) tokens * STACK_PER_TOKEN;
+
+    return size > MIN_STACK_SIZE ? size : MIN_STACK_SIZE;
+}
+
+static void
+start_thread(pthread_t *thread, void *(*func)(void *), void *arg,
+	     size_t stack_size){
+    pthread_attr_t attr;
+    int err;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+    if ((err = pthread_create(thread, &attr, func, arg)) != 0){
+	fprintf(stderr, "pthread_create: %s\n", strerror(err));
+	exit(-1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/*
+ * Each thread does the work of one thread of the size sweep, so the
+ * time per token stays the same while the threads scale linearly.
+ */
+static void
+measure_threads(const bench_shape *shape, workload *w, int threads){
+    int repeats = repeats_for(w->ntokens), i;
+    uint64_t build_start, eval_start, build_bytes, eval_bytes;
+    pthread_barrier_t barrier;
+    pthread_t *tids;
+    thread_arg ta;
+    tr_node top;
+    tree *t;
+
+    /* The bytes per token of one thread, measured alone */
+    build_bytes = allocated_bytes();
+    t = build_tree(w);
+    build_bytes = allocated_bytes() - build_bytes;
+    resolve_variable(t, bench_vars, bench_fetch_var);
+    eval_bytes = allocated_bytes();
+    evaluate_tree(t, &top);
+    eval_bytes = allocated_bytes() - eval_bytes;
+    destroy_tree(t);
+
+    ta.w = w;
+    ta.repeats = repeats;
+    ta.barrier = &barrier;
+    pthread_barrier_init(&barrier, NULL, threads + 1);
+    tids = (pthread_t *) mexpr_xrealloc(NULL, sizeof(pthread_t) * threads);
+    for (i = 0; i < threads; i++)
+	start_thread(&tids[i], thread_worker, &ta, stack_size_for(w->ntokens));
+
+    pthread_barrier_wait(&barrier);
+    build_start = now_ns();
+    pthread_barrier_wait(&barrier);
+    add_record("threads", shape->name, STAGE_BUILD, w->ntokens, threads,
+	       repeats, now_ns() - build_start, build_bytes);
+
+    pthread_barrier_wait(&barrier);
+    eval_start = now_ns();
+    pthread_barrier_wait(&barrier);
+    add_record("threads", shape->name, STAGE_EVALUATE, w->ntokens, threads,
+	       repeats, now_ns() - eval_start, eval_bytes);
+
+    for (i = 0; i < threads; i++)
+	pthread_join(tids[i], NULL);
+    pthread_barrier_destroy(&barrier);
+    free(tids);
+}
+
+static void *
+thread_sweep(void *arg){
+    workload w = { NULL, 0, 0 };
+    int s, threads;
+
+    (void) arg;
+
+    for (s = 0; s < SHAPES; s++){
+	generate_tokens(&shapes[s], &w, thread_tokens);
+	for (threads = 1; threads <= max_threads; threads *= 2)
+	    measure_threads(&shapes[s], &w, threads);
+    }
+    free(w.tokens);
+
+    return NULL;
+}
+
+/*
+ * The slope of log(time per run) over log(tokens) by least squares,
+ * 1 for linear. Return false for less than 3 sizes.
+ */
+static bool
+fit_exponent(const char *shape, bench_stage stage, double *exponent){
+    double x, y, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    bench_record *r;
+    int i, n = 0;
+
+    for (i = 0; i < nrecords; i++){
+	r = &records[i];
+	if (strcmp(r->sweep, "size") != 0 || strcmp(r->shape, shape) != 0 ||
+	    r->stage != stage || r->tokens < FIT_MIN_TOKENS)
+	    continue;
+	x = log(r->tokens);
+	y = log(r->ns_per_token * r->tokens);
+	sx += x;
+	sy += y;
+	sxx += x * x;
+	sxy += x * y;
+	n++;
+    }
+
+    if (n < 3)
+	return false;
+
+    *exponent = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+
+    return true;
+}
+
+/* Return the number of stages above 'max_exponent' */
+static int
+print_exponents(double max_exponent){
+    double exponent;
+    int s, stage, superlinear = 0;
+
+    fprintf(stderr, "%-12s %-10s %s\n", "shape", "stage", "exponent");
+    for (s = 0; s < SHAPES; s++){
+	for (stage = 0; stage < STAGES; stage++){
+	    if (!fit_exponent(shapes[s].name, stage, &exponent))
+		continue;
+	    fprintf(stderr, "%-12s %-10s %.2f%s\n", shapes[s].name,
+		    stage_names[stage], exponent,
+		    exponent > max_exponent ? "  super-linear" : "");
+	    if (exponent > max_exponent)
+		superlinear++;
+	}
+    }
+
+    return superlinear;
+}
+
+static void
+print_csv(FILE *fp){
+    bench_record *r;
+    int i;
+
+    fprintf(fp, "sweep,shape,stage,tokens,threads,repeats,"
+	    "ns_per_token,bytes_per_token\n");
+    for (i = 0; i < nrecords; i++){
+	r = &records[i];
+	fprintf(fp, "%s,%s,%s,%d,%d,%d,%.2f,%.1f\n", r->sweep, r->shape,
+		stage_names[r->stage], r->tokens, r->threads, r->repeats,
+		r->ns_per_token, r->bytes_per_token);
+    }
+}
+
+static void
+usage(char *progname){
+    fprintf(stderr,
+	    "usage: %s [-m max_exponent] [-N max_tokens] [-o output_file]\n"
+	    "       [-s thread_tokens] [-t max_threads] [-w work]\n",
+	    progname);
+    exit(1);
+}
+
+int
+main(int argc, char **argv){
+    double max_exponent = DEFAULT_MAX_EXPONENT;
+    char *output_path = NULL;
+    FILE *output = stdout;
+    pthread_t sweeper;
+    int opt, superlinear;
+
+    while ((opt = getopt(argc, argv, "m:N:o:s:t:w:")) != -1){
+	switch(opt){
+	    case 'm':
+		max_exponent = atof(optarg);
+		break;
+	    case 'N':
+		max_tokens = atoi(optarg);
+		break;
+	    case 'o':
+		output_path = optarg;
+		break;
+	    case 's':
+		thread_tokens = atoi(optarg);
+		break;
+	    case 't':
+		max_threads = atoi(optarg);
+		break;
+	    case 'w':
+		work = atol(optarg);
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    if (optind != argc || max_exponent <= 0 || max_tokens < 5 ||
+	thread_tokens < 1 || max_threads < 1 || work < 1)
+	usage(argv[0]);
+
+    bench_vars[0].node_id = INT;
+    bench_vars[0].unv.ival = 3;
+    bench_vars[1].node_id = INT;
+    bench_vars[1].unv.ival = 5;
+    bench_vars[2].node_id = DOUBLE;
+    bench_vars[2].unv.dval = 2.5;
+
+    start_thread(&sweeper, size_sweep, NULL, stack_size_for(max_tokens));
+    pthread_join(sweeper, NULL);
+    start_thread(&sweeper, thread_sweep, NULL, stack_size_for(thread_tokens));
+    pthread_join(sweeper, NULL);
+
+    if (output_path != NULL && (output = fopen(output_path, "w")) == NULL){
+	perror("fopen");
+	return 1;
+    }
+    print_csv(output);
+    if (output != stdout)
+	fclose(output);
+
+    fprintf(stderr, "%ld CPUs\n", sysconf(_SC_NPROCESSORS_ONLN));
+    superlinear = print_exponents(max_exponent);
+    free(records);
+
+    return superlinear > 0 ? 2 : 0;
+}
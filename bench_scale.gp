@@ -0,0 +1,57 @@
+# Plot the records of bench_scale.
+#
+# usage: gnuplot -c bench_scale.gp bench_scale.csv [bench_scale.svg]
+#
+# The first two rows are the size sweep, the time and the bytes per
+# token of each stage over the tokens. A flat line is linear, a rising
+# one super-linear. The last row is the thread sweep, the time per
+# token over the threads, which stays flat up to the number of CPUs
+# while the threads scale.
+
+data = ARG1
+plot_file = ARGC >= 2 ? ARG2 : "bench_scale.svg"
+shapes = "left_deep right_deep balanced parens and_or"
+stages = "parse build evaluate"
+
+set datafile separator ","
+set terminal svg size 1500,1200 dynamic noenhanced font "sans,10"
+set output plot_file
+set key top left
+set grid
+
+# The column 'col' of the records of 'sweep', 'shape' and 'stage'
+select(sweep, shape, stage, col) = \
+    (strcol(1) eq sweep && strcol(2) eq shape && strcol(3) eq stage) ? \
+    column(col) : NaN
+
+set multiplot layout 3,3 title "bench_scale"
+
+set logscale x 10
+set xlabel "tokens"
+do for [stage in stages] {
+    set title sprintf("%s : time per token", stage)
+    set ylabel "ns / token"
+    plot for [shape in shapes] data \
+	using (select("size", shape, stage, 4)):(select("size", shape, stage, 7)) \
+	with linespoints title shape
+}
+
+do for [stage in stages] {
+    set title sprintf("%s : memory per token", stage)
+    set ylabel "bytes allocated / token"
+    plot for [shape in shapes] data \
+	using (select("size", shape, stage, 4)):(select("size", shape, stage, 8)) \
+	with linespoints title shape
+}
+
+set logscale x 2
+set xlabel "threads"
+do for [stage in "build evaluate"] {
+    set title sprintf("%s : time per token and thread", stage)
+    set ylabel "ns / token"
+    plot for [shape in shapes] data \
+	using (select("threads", shape, stage, 5)):(select("threads", shape, stage, 7)) \
+	with linespoints title shape
+}
+
+unset multiplot
@@ -0,0 +1,339 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "ExportedParser.h"
+
+/*
+ * Measure each stage of the pipeline separately.
+ *
+ * usage: bench_stages [-f json|csv] [-n iterations] [-o output_file]
+ *
+ * For each expression of the corpus, the stages below are run
+ * 'iterations' times after a warm-up, each run timed on its own :
+ *
+ *   lex              init_buffer() and cyylex() up to the new line
+ *   parse_<entry>    the parser entry point of the expression, with
+ *                    the lexing it drives, after init_buffer()
+ *   infix_to_postfix convert_infix_to_postfix() of the parsed tokens
+ *   postfix_to_tree  convert_postfix_to_tree()
+ *   build_tree       build_mathexpr_tree(), all of the above
+ *   resolve          resolve_variable()
+ *   evaluate         evaluate_tree()
+ *
+ * The freeing of the results is not timed, and the cost of reading
+ * the clock is subtracted. The results are written in JSON (default)
+ * or CSV, one record per stage and expression with the minimum,
+ * median, 99th percentile and mean in nanoseconds, for tracking
+ * regressions across builds.
+ */
+
+#define DEFAULT_ITERATIONS 20000
+#define WARMUP_ITERATIONS 1000
+
+typedef struct bench_expr {
+    /* arithmetic, inequality or logical */
+    const char *category;
+
+    /* The stage name of the parser entry point */
+    const char *parse_stage;
+    bool (*parser)(void);
+    char *text;
+} bench_expr;
+
+typedef struct bench_result {
+    const char *stage;
+    const bench_expr *expr;
+    int iterations;
+    double min_ns;
+    double p50_ns;
+    double p99_ns;
+    double mean_ns;
+} bench_result;
+
+static bench_expr corpus[] = {
+    { "arithmetic", "parse_math", start_mathexpr_parse,
+      "a + b * c - 4 / 2\n" },
+    { "arithmetic", "parse_math", start_mathexpr_parse,
+      "(a + 1.5) * (b - c) / (a + 2)\n" },
+    { "arithmetic", "parse_math", start_mathexpr_parse,
+      "sqrt(a * a + b * b) + pow(c, 2) - min(a, b)\n" },
+    { "arithmetic", "parse_math", start_mathexpr_parse,
+      "sin(a) * cos(b) + sqr(c) % 7\n" },
+    { "inequality", "parse_ineq", start_ineq_mathexpr_parse,
+      "a + b > c * 2\n" },
+    { "inequality", "parse_ineq", start_ineq_mathexpr_parse,
+      "sqrt(a) * 3 <= max(b, c) + 1.5\n" },
+    { "logical", "parse_logical", start_logical_mathexpr_parse,
+      "a > 1 and b < 2\n" },
+    { "logical", "parse_logical", start_logical_mathexpr_parse,
+      "a + b > c or a * 2 < b and c != 3\n" },
+    { "logical", "parse_logical", start_logical_mathexpr_parse,
+      "(a > 1 or b < 2) and (c >= 3 or a <= b)\n" },
+};
+
+#define CORPUS_SIZE ((int) (sizeof(corpus) / sizeof(corpus[0])))
+
+/* The values of the variables 'a', 'b' and 'c' */
+static tr_node bench_vars[3];
+
+static int iterations = DEFAULT_ITERATIONS;
+static double clock_overhead;
+static uint64_t *samples;
+
+static uint64_t
+now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+compare_u64(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* The median of back-to-back reads of the clock */
+static double
+measure_clock_overhead(void){
+    uint64_t start;
+    int i;
+
+    for (i = 0; i < iterations; i++){
+	start = now_ns();
+	samples[i] = now_ns() - start;
+    }
+    qsort(samples, iterations, sizeof(uint64_t), compare_u64);
+
+    return (double) samples[iterations / 2];
+}
+
+static tr_node *
+bench_fetch_var(char *vname, void *data){
+    tr_node *vars = (tr_node *) data;
+
+    if (vname[1] != '\0' || vname[0] < 'a' || vname[0] > 'c')
+	return NULL;
+
+    return &vars[vname[0] - 'a'];
+}
+
+static double
+adjusted(uint64_t ns){
+    return ns > clock_overhead ? ns - clock_overhead : 0;
+}
+
+static void
+summarize(bench_result *r, const char *stage, const bench_expr *expr){
+    double sum = 0;
+    int i;
+
+    qsort(samples, iterations, sizeof(uint64_t), compare_u64);
+    for (i = 0; i < iterations; i++)
+	sum += adjusted(samples[i]);
+
+    r->stage = stage;
+    r->expr = expr;
+    r->iterations = iterations;
+    r->min_ns = adjusted(samples[0]);
+    r->p50_ns = adjusted(samples[iterations / 2]);
+    r->p99_ns = adjusted(samples[(int) (iterations * 0.99)]);
+    r->mean_ns = sum / iterations;
+}
+
+/* Time 'body' for the warm-up and the iterations */
+#define MEASURE(setup, body, teardown)					\
+    do {								\
+	uint64_t start_;						\
+	int i_;								\
+	for (i_ = -WARMUP_ITERATIONS; i_ < iterations; i_++){		\
+	    setup;							\
+	    start_ = now_ns();						\
+	    body;							\
+	    if (i_ >= 0)						\
+		samples[i_] = now_ns() - start_;			\
+	    teardown;							\
+	}								\
+    } while(0)
+
+static void
+lex_all(void){
+    int code;
+
+    while ((code = cyylex()) != PARSER_EOF && code != 0)
+	;
+}
+
+static int
+bench_expression(const bench_expr *e, bench_result *results){
+    linked_list *postfix;
+    bench_result *r = results;
+    bool parsed = true;
+    tr_node top;
+    tree *t;
+
+    MEASURE(, { init_buffer(e->text); lex_all(); }, );
+    summarize(r++, "lex", e);
+
+    MEASURE(init_buffer(e->text), parsed = e->parser() && parsed, );
+    summarize(r++, e->parse_stage, e);
+    assert(parsed);
+
+    /* The tokens of the last parse stay on the lex stack */
+    MEASURE(, postfix = convert_infix_to_postfix(lstack.main_data,
+						 lex_stack_pointer()),
+	    ll_destroy(postfix));
+    summarize(r++, "infix_to_postfix", e);
+
+    postfix = convert_infix_to_postfix(lstack.main_data, lex_stack_pointer());
+    MEASURE(, t = convert_postfix_to_tree(postfix), destroy_tree(t));
+    summarize(r++, "postfix_to_tree", e);
+    ll_destroy(postfix);
+
+    MEASURE(, t = build_mathexpr_tree(e->parser, e->text), destroy_tree(t));
+    summarize(r++, "build_tree", e);
+
+    t = build_mathexpr_tree(e->parser, e->text);
+    assert(t != NULL);
+    MEASURE(, resolve_variable(t, bench_vars, bench_fetch_var), );
+    summarize(r++, "resolve", e);
+    assert(t->resolved);
+
+    MEASURE(, evaluate_tree(t, &top), );
+    summarize(r++, "evaluate", e);
+    assert(!t->computation_failed);
+    destroy_tree(t);
+
+    return r - results;
+}
+
+/* The expressions end with a new line, which is not printed */
+static void
+print_text(FILE *fp, const char *text){
+    for (; *text != '\0' && *text != '\n'; text++)
+	fputc(*text, fp);
+}
+
+static void
+print_json(FILE *fp, bench_result *results, int n){
+    bench_result *r;
+    int i;
+
+    fprintf(fp, "{\n  \"benchmark\": \"bench_stages\",\n");
+#ifdef __OPTIMIZE__
+    fprintf(fp, "  \"optimized\": true,\n");
+#else
+    fprintf(fp, "  \"optimized\": false,\n");
+#endif
+    fprintf(fp, "  \"iterations\": %d,\n", iterations);
+    fprintf(fp, "  \"clock_overhead_ns\": %.1f,\n", clock_overhead);
+    fprintf(fp, "  \"results\": [\n");
+    for (i = 0; i < n; i++){
+	r = &results[i];
+	fprintf(fp, "    {\"stage\": \"%s\", \"category\": \"%s\", "
+		"\"expression\": \"", r->stage, r->expr->category);
+	print_text(fp, r->expr->text);
+	fprintf(fp, "\", \"min_ns\": %.1f, \"p50_ns\": %.1f, "
+		"\"p99_ns\": %.1f, \"mean_ns\": %.1f}%s\n",
+		r->min_ns, r->p50_ns, r->p99_ns, r->mean_ns,
+		i == n - 1 ? "" : ",");
+    }
+    fprintf(fp, "  ]\n}\n");
+}
+
+static void
+print_csv(FILE *fp, bench_result *results, int n){
+    bench_result *r;
+    int i;
+
+    fprintf(fp, "stage,category,expression,iterations,"
+	    "min_ns,p50_ns,p99_ns,mean_ns\n");
+    for (i = 0; i < n; i++){
+	r = &results[i];
+	fprintf(fp, "%s,%s,\"", r->stage, r->expr->category);
+	print_text(fp, r->expr->text);
+	fprintf(fp, "\",%d,%.1f,%.1f,%.1f,%.1f\n", r->iterations,
+		r->min_ns, r->p50_ns, r->p99_ns, r->mean_ns);
+    }
+}
+
+static void
+usage(char *progname){
+    fprintf(stderr,
+	    "usage: %s [-f json|csv] [-n iterations] [-o output_file]\n",
+	    progname);
+    exit(1);
+}
+
+int
+main(int argc, char **argv){
+    char *format = "json", *output_path = NULL;
+    bench_result *results;
+    FILE *output = stdout;
+    int opt, i, n = 0;
+
+    while ((opt = getopt(argc, argv, "f:n:o:")) != -1){
+	switch(opt){
+	    case 'f':
+		format = optarg;
+		break;
+	    case 'n':
+		iterations = atoi(optarg);
+		break;
+	    case 'o':
+		output_path = optarg;
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    if (optind != argc || iterations <= 0 ||
+	(strcmp(format, "json") != 0 && strcmp(format, "csv") != 0))
+	usage(argv[0]);
+
+    samples = (uint64_t *) malloc(sizeof(uint64_t) * iterations);
+    results = (bench_result *) malloc(sizeof(bench_result) * CORPUS_SIZE * 8);
+    if (samples == NULL || results == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+
+    bench_vars[0].node_id = INT;
+    bench_vars[0].unv.ival = 3;
+    bench_vars[1].node_id = DOUBLE;
+    bench_vars[1].unv.dval = 2.5;
+    bench_vars[2].node_id = INT;
+    bench_vars[2].unv.ival = 4;
+
+    clock_overhead = measure_clock_overhead();
+
+    for (i = 0; i < CORPUS_SIZE; i++)
+	n += bench_expression(&corpus[i], &results[n]);
+
+    if (output_path != NULL && (output = fopen(output_path, "w")) == NULL){
+	perror("fopen");
+	return 1;
+    }
+
+    if (strcmp(format, "json") == 0)
+	print_json(output, results, n);
+    else
+	print_csv(output, results, n);
+
+    if (output != stdout)
+	fclose(output);
+    free(samples);
+    free(results);
+
+    return 0;
+}
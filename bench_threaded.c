@@ -0,0 +1,159 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "MexprEnums.h"
+#include "MexprTree.h"
+#include "MexprThreaded.h"
+#include "ExportedParser.h"
+
+/*
+ * Compare the threaded code interpreter with the tree walker.
+ *
+ * usage: bench_threaded [-n evaluations] [-r repeat]
+ *
+ * Each expression of application.c below is scaled up by adding its
+ * copies until the expression fills the parser stack, then both
+ * interpreters evaluate it 'evaluations' times. The best time per
+ * evaluation of 'repeat' runs is reported. Build the library with
+ * -DMEXPR_SWITCH_DISPATCH to measure the portable switch dispatch.
+ */
+
+static char *expressions[] = {
+    "a + 2 + 3",
+    "a / 2 / 3",
+    "( 1 + 2 ) * (3 * 4)",
+    "( 1 + 2 * (3 - 4 ) ) / 5 - 6",
+    "max(a, b)",
+    "a + sqrt(b) * sqrt(c) + pow(d, e)",
+    "((-1 * b) + sqrt(sqr(b) - 4 * a * c)) / (2 * a)",
+    "sqr(3) + min(10, 0) + sqrt(25.0)",
+    NULL,
+};
+
+static tr_node bench_vars[5];
+
+static tr_node *
+fetch_var(char *vname, void *data){
+    (void) data;
+
+    return &bench_vars[vname[0] - 'a'];
+}
+
+static double
+now_sec(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Join the copies of 'expr' by '+' within the parser buffer */
+static int
+scale_expression(char *expr, char *buf){
+    size_t len = strlen(expr), used = 0;
+    int copies = 0;
+
+    while (used + len + 6 < MAX_STACK_INDEX){
+	used += sprintf(buf + used, "%s(%s)", copies == 0 ? "" : " + ", expr);
+	copies++;
+    }
+    strcpy(buf + used, "\n");
+
+    return copies;
+}
+
+/* Return the best nanoseconds per evaluation of 'repeat' runs */
+static double
+measure(tree *t, threaded_code *code, long n, int repeat){
+    double best = -1, start, sec;
+    tr_node top;
+    long i;
+    int r;
+
+    for (r = 0; r < repeat; r++){
+	start = now_sec();
+	for (i = 0; i < n; i++){
+	    bench_vars[0].unv.ival = (int) (i & 7) + 1;
+	    if (code != NULL)
+		threaded_evaluate(code, t, &top);
+	    else
+		evaluate_tree(t, &top);
+	}
+	sec = now_sec() - start;
+	assert(!t->computation_failed);
+
+	if (best < 0 || sec < best)
+	    best = sec;
+    }
+
+    return best / n * 1e9;
+}
+
+static void
+usage(char *progname){
+    fprintf(stderr, "usage: %s [-n evaluations] [-r repeat]\n", progname);
+    exit(1);
+}
+
+int
+main(int argc, char **argv){
+    double walker_ns, threaded_ns;
+    long n = 200 * 1000;
+    char buf[BUFFER_LEN];
+    threaded_code *code;
+    int opt, repeat = 3, i, copies;
+    tree *t;
+
+    while ((opt = getopt(argc, argv, "n:r:")) != -1){
+	switch(opt){
+	    case 'n':
+		n = atol(optarg);
+		break;
+	    case 'r':
+		repeat = atoi(optarg);
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    if (n <= 0 || repeat <= 0)
+	usage(argv[0]);
+
+    bench_vars[0].node_id = INT;
+    bench_vars[0].unv.ival = 3;
+    bench_vars[1].node_id = DOUBLE;
+    bench_vars[1].unv.dval = 7.5;
+    bench_vars[2].node_id = INT;
+    bench_vars[2].unv.ival = 2;
+    bench_vars[3].node_id = INT;
+    bench_vars[3].unv.ival = 2;
+    bench_vars[4].node_id = DOUBLE;
+    bench_vars[4].unv.dval = 0.5;
+
+    printf("%-50s %6s %12s %12s %8s\n", "expression", "copies",
+	   "walker ns", "threaded ns", "speedup");
+
+    for (i = 0; expressions[i] != NULL; i++){
+	copies = scale_expression(expressions[i], buf);
+	t = build_mathexpr_tree(start_mathexpr_parse, buf);
+	assert(t != NULL);
+	resolve_variable(t, bench_vars, fetch_var);
+	code = threaded_compile(t);
+
+	walker_ns = measure(t, NULL, n, repeat);
+	threaded_ns = measure(t, code, n, repeat);
+
+	printf("%-50s %6d %12.1f %12.1f %8.2f\n", expressions[i], copies,
+	       walker_ns, threaded_ns, walker_ns / threaded_ns);
+
+	threaded_destroy(code);
+	destroy_tree(t);
+    }
+
+    return 0;
+}
@@ -0,0 +1,867 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "MexprTree.h"
+#include "MexprCsv.h"
+#include "MexprBatch.h"
+#include "MexprProfile.h"
+#include "MexprReorder.h"
+#include "MexprExplain.h"
+#include "MexprAlloc.h"
+#include "ExportedParser.h"
+
+/*
+ * Evaluate math expressions in bulk.
+ *
+ * usage: mexpr_eval [-b] [-p] [-q] expression_file
+ *        mexpr_eval [-b] [-p] [-P | -x] [-q] -e expression record_file
+ *        mexpr_eval [-p] [-q] [-f] [-j threads] -c -e expression -o output_file csv_file
+ *
+ * The first form evaluates each line of 'expression_file' as one
+ * math expression. The second form parses 'expression' only once and
+ * evaluates it against each line of 'record_file', which lists the
+ * variables like "a=1 b=3.0, c=true".
+ *
+ * The third form loads the columns named by the variables of
+ * 'expression' from 'csv_file' with 'threads' threads, and evaluates
+ * the expression for each row by evaluate_batch_parallel() with the
+ * same number of threads. The results are written to 'output_file'
+ * as the column of 'result_record'. With '-f', the expression is
+ * evaluated as a filter by evaluate_filter_parallel() and the numbers
+ * of the matching rows are written one per line.
+ *
+ * Results are written to stdout, one line per input line, or in the
+ * fixed size 'result_record' format with '-b'. A blank line gets a
+ * failure, so that the n-th result belongs to the n-th line. '-q' suppresses the
+ * results. The throughput is reported to stderr at the end.
+ *
+ * '-p' logs the statistics of the parse of each expression to stderr,
+ * summed up for the parsers tried in order : the tokens lexed and
+ * re-lexed after rewinds, the maximum depth of the recursion and the
+ * rewinds per grammar rule.
+ *
+ * '-P' profiles the nodes of the expression of the second form and
+ * prints the tree annotated with the hits and cycles of each node to
+ * stderr at the end.
+ *
+ * '-x' evaluates the expression of the second form reordering the
+ * operands of 'and' and 'or', and explains its execution for the
+ * types of the last record to stderr at the end. See MexprExplain.h.
+ * It can't be combined with '-P', which evaluates the tree as it is.
+ */
+
+/*
+ * The input file is mapped and read sequentially. Request the kernel
+ * to read ahead 'READ_WINDOW' bytes in advance and drop the pages
+ * already processed, so that the memory usage stays bounded even for
+ * huge files.
+ */
+#define READ_WINDOW (8 * 1024 * 1024)
+#define OUTPUT_BUFFER_LEN (1024 * 1024)
+#define VALUE_LEN 64
+/* Rows evaluated at once in the CSV mode, split among the threads */
+#define CSV_BATCH_ROWS (1024 * 1024)
+
+typedef struct mapped_file {
+    char *addr;
+    size_t size;
+
+    /* The offset up to which the read-ahead is requested */
+    size_t advised;
+
+    /* The offset below which the pages are released */
+    size_t released;
+} mapped_file;
+
+/* Binary output format. All results have the same size */
+typedef struct result_record {
+    /* INT, DOUBLE, BOOLEAN or INVALID if the evaluation failed */
+    int32_t node_id;
+    int32_t padding;
+    union {
+	int64_t ival;
+	double dval;
+    } value;
+} result_record;
+
+/* One variable of the expression evaluated with '-e' */
+typedef struct binding {
+    char *vname;
+    int vname_len;
+    bool assigned;
+    tr_node node;
+
+    /* The column bound to this variable in the CSV mode */
+    csv_column *column;
+} binding;
+
+typedef struct binding_table {
+    int size;
+    binding *bindings;
+} binding_table;
+
+static FILE *output;
+static bool binary_output = false;
+static bool quiet = false;
+static bool filter_rows = false;
+static bool parse_log = false;
+static bool profile_nodes = false;
+static bool explain = false;
+static unsigned long evaluations = 0;
+static unsigned long failures = 0;
+
+static bool
+map_file(char *path, mapped_file *mf){
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0){
+	perror("open");
+	return false;
+    }
+
+    if (fstat(fd, &st) < 0){
+	perror("fstat");
+	close(fd);
+	return false;
+    }
+
+    mf->size = st.st_size;
+    mf->advised = mf->released = 0;
+    mf->addr = NULL;
+
+    if (mf->size > 0){
+	mf->addr = mmap(NULL, mf->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mf->addr == MAP_FAILED){
+	    perror("mmap");
+	    close(fd);
+	    return false;
+	}
+	(void) madvise(mf->addr, mf->size, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    return true;
+}
+
+static void
+unmap_file(mapped_file *mf){
+    if (mf->addr != NULL)
+	munmap(mf->addr, mf->size);
+}
+
+/* Move the read-ahead window along with the current position 'pos' */
+static void
+advance_window(mapped_file *mf, size_t pos){
+    size_t len;
+
+    if (pos + READ_WINDOW > mf->advised && mf->advised < mf->size){
+	len = mf->size - mf->advised < READ_WINDOW ?
+	    mf->size - mf->advised : READ_WINDOW;
+	(void) madvise(mf->addr + mf->advised, len, MADV_WILLNEED);
+	mf->advised += len;
+    }
+
+    while (pos >= mf->released + READ_WINDOW){
+	(void) madvise(mf->addr + mf->released, READ_WINDOW, MADV_DONTNEED);
+	mf->released += READ_WINDOW;
+    }
+}
+
+/*
+ * Find the next line from 'pos'. Return false at the end of file.
+ * The line doesn't include the trailing new line or carriage return.
+ */
+static bool
+next_line(mapped_file *mf, size_t *pos, char **line, size_t *len){
+    char *start, *end;
+
+    if (*pos >= mf->size)
+	return false;
+
+    advance_window(mf, *pos);
+
+    start = mf->addr + *pos;
+    if ((end = memchr(start, '\n', mf->size - *pos)) == NULL)
+	end = mf->addr + mf->size;
+
+    *line = start;
+    *len = end - start;
+    *pos += *len + 1;
+
+    if (*len > 0 && start[*len - 1] == '\r')
+	(*len)--;
+
+    return true;
+}
+
+/*
+ * Copy the line to 'buf' in the format init_buffer() expects.
+ * Return false if the line doesn't fit in the lex buffer.
+ */
+static bool
+prepare_expression(char *buf, char *line, size_t len){
+    if (len + 2 > BUFFER_LEN)
+	return false;
+
+    memcpy(buf, line, len);
+    buf[len] = '\n';
+    buf[len + 1] = '\0';
+
+    return true;
+}
+
+static void
+emit_result(tr_node *top, bool succeeded){
+    result_record rec;
+
+    evaluations++;
+    if (!succeeded)
+	failures++;
+
+    if (quiet)
+	return;
+
+    if (binary_output){
+	memset(&rec, 0, sizeof(rec));
+	if (!succeeded){
+	    rec.node_id = INVALID;
+	}else{
+	    rec.node_id = top->node_id;
+	    switch(top->node_id){
+		case INT:
+		    rec.value.ival = top->unv.ival;
+		    break;
+		case DOUBLE:
+		    rec.value.dval = top->unv.dval;
+		    break;
+		case BOOLEAN:
+		    rec.value.ival = top->unv.bval;
+		    break;
+		default:
+		    assert(0);
+		    break;
+	    }
+	}
+	fwrite(&rec, sizeof(rec), 1, output);
+	return;
+    }
+
+    if (!succeeded){
+	fputs("error\n", output);
+	return;
+    }
+
+    switch(top->node_id){
+	case INT:
+	    fprintf(output, "%d\n", top->unv.ival);
+	    break;
+	case DOUBLE:
+	    fprintf(output, "%.17g\n", top->unv.dval);
+	    break;
+	case BOOLEAN:
+	    fputs(top->unv.bval ? "true\n" : "false\n", output);
+	    break;
+	default:
+	    assert(0);
+	    break;
+    }
+}
+
+static void
+log_parse_stats(char *expression, parse_stats *stats){
+    int i;
+
+    fprintf(stderr, "parse: parsers %d, tokens %lu, re-lexed %lu, depth %d, rewinds",
+	    stats->parsers, stats->tokens_lexed, stats->tokens_relexed,
+	    stats->max_depth);
+    for (i = 0; i < PARSE_RULES; i++)
+	if (stats->rewinds[i] > 0)
+	    fprintf(stderr, " %s=%lu/%lu", parse_rule_name(i),
+		    stats->rewinds[i], stats->rewound_tokens[i]);
+    /* The expression ends with the newline */
+    fprintf(stderr, " : %s", expression);
+}
+
+/*
+ * Try the parsers in the order described in README.md and
+ * return the tree built by the first successful one.
+ */
+static tree *
+build_any_tree(char *expression){
+    bool (*parsers[])(void) = { start_mathexpr_parse,
+				start_ineq_mathexpr_parse,
+				start_logical_mathexpr_parse };
+    parse_stats sum;
+    tree *t;
+
+    t = build_mathexpr_tree_any(parsers, 3, expression,
+				parse_log ? &sum : NULL);
+    if (parse_log)
+	log_parse_stats(expression, &sum);
+
+    return t;
+}
+
+static void
+evaluate_expression_file(mapped_file *mf){
+    char buf[BUFFER_LEN], *line;
+    size_t pos = 0, len;
+    tr_node top;
+    tree *t;
+
+    while (next_line(mf, &pos, &line, &len)){
+	/* Keep one result per line for the alignment with the input */
+	if (len == 0){
+	    emit_result(NULL, false);
+	    continue;
+	}
+
+	if (!prepare_expression(buf, line, len)){
+	    emit_result(NULL, false);
+	    continue;
+	}
+
+	if ((t = build_any_tree(buf)) == NULL){
+	    emit_result(NULL, false);
+	    continue;
+	}
+
+	evaluate_tree(t, &top);
+	emit_result(&top, !t->computation_failed);
+
+	destroy_tree(t);
+    }
+}
+
+static binding *
+lookup_binding(binding_table *table, char *vname, int len){
+    int i;
+
+    for (i = 0; i < table->size; i++){
+	if (table->bindings[i].vname_len == len &&
+	    memcmp(table->bindings[i].vname, vname, len) == 0)
+	    return &table->bindings[i];
+    }
+
+    return NULL;
+}
+
+/* Application callback for resolve_variable() */
+static tr_node *
+binding_access_cb(char *vname, void *data){
+    binding *b;
+
+    b = lookup_binding((binding_table *) data, vname, strlen(vname));
+
+    return b == NULL ? NULL : &b->node;
+}
+
+/*
+ * Register each variable of the tree once. All VARIABLE nodes
+ * refer to the 'node' of the binding after the resolution, so
+ * that the record values can be assigned without any further
+ * resolution.
+ */
+static void
+bind_variables(tree *t, binding_table *table){
+    tr_node *n;
+    binding *b;
+    int len;
+
+    table->size = 0;
+    table->bindings = NULL;
+
+    for (n = t->list_head; n != NULL; n = n->list_right){
+	if (n->node_id != VARIABLE)
+	    continue;
+
+	len = strlen(n->unv.vval.vname);
+	if (lookup_binding(table, n->unv.vval.vname, len) != NULL)
+	    continue;
+
+	table->bindings = (binding *) mexpr_xrealloc(table->bindings,
+						     sizeof(binding) * (table->size + 1));
+
+	b = &table->bindings[table->size++];
+	b->vname = n->unv.vval.vname;
+	b->vname_len = len;
+	b->assigned = false;
+	b->node.node_id = INT;
+	b->node.unv.ival = 0;
+	b->node.parent = b->node.left = b->node.right = b->node.list_left
+	    = b->node.list_right = b->node.result = NULL;
+	b->column = NULL;
+    }
+
+    if (t->require_resolution)
+	resolve_variable(t, table, binding_access_cb);
+}
+
+/*
+ * Parse a value of record in the same manner as the lexer. Return
+ * false if the whole value isn't a number or a boolean, or if it
+ * doesn't fit in its type.
+ */
+static bool
+assign_value(binding *b, char *value, size_t len){
+    char buf[VALUE_LEN], *end;
+    double dval;
+    long ival;
+
+    if (len == 0 || len >= VALUE_LEN)
+	return false;
+
+    memcpy(buf, value, len);
+    buf[len] = '\0';
+
+    errno = 0;
+    if (strcmp(buf, "true") == 0 || strcmp(buf, "false") == 0){
+	b->node.node_id = BOOLEAN;
+	b->node.unv.bval = buf[0] == 't';
+    }else if (strpbrk(buf, ".eE") != NULL){
+	dval = strtod(buf, &end);
+	if (*end != '\0' || errno == ERANGE)
+	    return false;
+	b->node.node_id = DOUBLE;
+	b->node.unv.dval = dval;
+    }else{
+	ival = strtol(buf, &end, 10);
+	if (*end != '\0' || errno == ERANGE || ival < INT_MIN ||
+	    ival > INT_MAX)
+	    return false;
+	b->node.node_id = INT;
+	b->node.unv.ival = ival;
+    }
+
+    b->assigned = true;
+
+    return true;
+}
+
+/*
+ * Assign all "name=value" pairs in the line. Return false if any
+ * value is invalid or any variable is left unassigned.
+ */
+static bool
+assign_record(binding_table *table, char *line, size_t len){
+    char *end = line + len, *name, *value;
+    binding *b;
+    int i;
+
+    for (i = 0; i < table->size; i++)
+	table->bindings[i].assigned = false;
+
+    while (line < end){
+	if (*line == ' ' || *line == '\t' || *line == ','){
+	    line++;
+	    continue;
+	}
+
+	name = line;
+	while (line < end && *line != '=')
+	    line++;
+
+	if (line == end)
+	    return false;
+
+	b = lookup_binding(table, name, line - name);
+
+	value = ++line;
+	while (line < end && *line != ' ' && *line != '\t' && *line != ',')
+	    line++;
+
+	if (b != NULL && !assign_value(b, value, line - value))
+	    return false;
+    }
+
+    for (i = 0; i < table->size; i++){
+	if (!table->bindings[i].assigned)
+	    return false;
+    }
+
+    return true;
+}
+
+static bool
+evaluate_record_file(char *expression, mapped_file *mf){
+    char buf[BUFFER_LEN], *line;
+    tree_profile *profile = NULL;
+    reorder_plan *plan = NULL;
+    binding_table table;
+    size_t pos = 0, len;
+    tr_node top;
+    tree *t;
+
+    if (!prepare_expression(buf, expression, strlen(expression))){
+	fprintf(stderr, "the expression is too long\n");
+	return false;
+    }
+
+    if ((t = build_any_tree(buf)) == NULL){
+	fprintf(stderr, "failed to parse the expression : %s\n",
+		mexpr_error_name(parse_last_error()));
+	return false;
+    }
+
+    bind_variables(t, &table);
+    if (profile_nodes)
+	profile = profile_create(t);
+    if (explain)
+	plan = reorder_plan_create(t);
+
+    while (next_line(mf, &pos, &line, &len)){
+	/* Keep one result per line for the alignment with the input */
+	if (len == 0){
+	    emit_result(NULL, false);
+	    continue;
+	}
+
+	if (!assign_record(&table, line, len)){
+	    emit_result(NULL, false);
+	    continue;
+	}
+
+	if (profile != NULL)
+	    profile_evaluate(profile, &top);
+	else if (plan != NULL)
+	    reorder_evaluate(plan, &top);
+	else
+	    evaluate_tree(t, &top);
+	emit_result(&top, !t->computation_failed);
+    }
+
+    if (profile != NULL){
+	profile_dump(profile, stderr);
+	profile_destroy(profile);
+    }
+
+    if (plan != NULL){
+	explain_tree(t, plan, NULL, stderr);
+	reorder_plan_destroy(plan);
+    }
+
+    free(table.bindings);
+    destroy_tree(t);
+
+    return true;
+}
+
+static size_t
+column_value_size(csv_column *column){
+    switch(column->type){
+	case INT:
+	    return sizeof(int);
+	case DOUBLE:
+	    return sizeof(double);
+	case BOOLEAN:
+	    return sizeof(bool);
+	default:
+	    assert(0);
+	    return 0;
+    }
+}
+
+static void
+emit_batch_value(batch_value *value){
+    tr_node top;
+
+    if (value->node_id == INVALID){
+	emit_result(NULL, false);
+	return;
+    }
+
+    top.node_id = value->node_id;
+    switch(value->node_id){
+	case INT:
+	    top.unv.ival = value->unv.ival;
+	    break;
+	case DOUBLE:
+	    top.unv.dval = value->unv.dval;
+	    break;
+	case BOOLEAN:
+	    top.unv.bval = value->unv.bval;
+	    break;
+	default:
+	    assert(0);
+	    break;
+    }
+    emit_result(&top, true);
+}
+
+/*
+ * Write the numbers of the rows in [base, base + m) that match the
+ * filter. Rows start from zero after the header line.
+ */
+static void
+emit_matching_rows(csv_table *tbl, size_t base, size_t m,
+		   uint64_t *bitmap, size_t *rows){
+    size_t i, nrows;
+
+    evaluations += m;
+
+    if (tbl->invalid_rows != NULL){
+	for (i = 0; i < m; i++){
+	    if (tbl->invalid_rows[base + i]){
+		bitmap[i / FILTER_WORD_BITS] &=
+		    ~((uint64_t) 1 << (i % FILTER_WORD_BITS));
+		failures++;
+	    }
+	}
+    }
+
+    nrows = filter_bitmap_to_rows(bitmap, m, rows);
+
+    if (quiet)
+	return;
+
+    for (i = 0; i < nrows; i++)
+	fprintf(output, "%zu\n", base + rows[i]);
+}
+
+static bool
+evaluate_csv_file(char *expression, char *path, int nthreads){
+    char buf[BUFFER_LEN], **names;
+    size_t base, row, m, *rows;
+    binding_table table;
+    batch_value *values;
+    uint64_t *bitmap;
+    csv_column *column;
+    batch_binding *bb;
+    mexpr_pool *pool;
+    bool ret = true;
+    csv_table *tbl;
+    tree *t;
+    int i;
+
+    if (!prepare_expression(buf, expression, strlen(expression))){
+	fprintf(stderr, "the expression is too long\n");
+	return false;
+    }
+
+    if ((t = build_any_tree(buf)) == NULL){
+	fprintf(stderr, "failed to parse the expression : %s\n",
+		mexpr_error_name(parse_last_error()));
+	return false;
+    }
+
+    bind_variables(t, &table);
+
+    names = (char **) malloc(sizeof(char *) * (table.size + 1));
+    if (names == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+    for (i = 0; i < table.size; i++)
+	names[i] = table.bindings[i].vname;
+
+    if ((tbl = csv_load_columns(path, names, table.size, nthreads)) == NULL){
+	free(names);
+	free(table.bindings);
+	destroy_tree(t);
+	return false;
+    }
+
+    for (i = 0; i < table.size; i++)
+	table.bindings[i].column = csv_find_column(tbl, names[i]);
+
+    /* Evaluate CSV_BATCH_ROWS rows at once by the vectorized evaluator */
+    pool = mexpr_pool_create(nthreads);
+    bb = (batch_binding *) malloc(sizeof(batch_binding) * (table.size + 1));
+    values = (batch_value *) malloc(sizeof(batch_value) * CSV_BATCH_ROWS);
+    bitmap = (uint64_t *) malloc(sizeof(uint64_t) *
+				 FILTER_BITMAP_WORDS(CSV_BATCH_ROWS));
+    rows = (size_t *) malloc(sizeof(size_t) * CSV_BATCH_ROWS);
+    if (bb == NULL || values == NULL || bitmap == NULL || rows == NULL){
+	perror("malloc");
+	exit(-1);
+    }
+    bb[table.size].vname = NULL;
+
+    for (base = 0; base < tbl->rows; base += CSV_BATCH_ROWS){
+	m = tbl->rows - base < CSV_BATCH_ROWS ? tbl->rows - base : CSV_BATCH_ROWS;
+
+	for (i = 0; i < table.size; i++){
+	    column = table.bindings[i].column;
+	    bb[i].vname = names[i];
+	    bb[i].type = column->type;
+	    bb[i].values = (char *) column->values +
+		column_value_size(column) * base;
+	    bb[i].stride = 0;
+	}
+
+	if (filter_rows){
+	    if (!evaluate_filter_parallel(t, m, bb, bitmap, pool)){
+		ret = false;
+		break;
+	    }
+	    emit_matching_rows(tbl, base, m, bitmap, rows);
+	    continue;
+	}
+
+	if (!evaluate_batch_parallel(t, m, bb, values, pool)){
+	    ret = false;
+	    break;
+	}
+
+	for (row = 0; row < m; row++){
+	    if (tbl->invalid_rows != NULL && tbl->invalid_rows[base + row])
+		emit_result(NULL, false);
+	    else
+		emit_batch_value(&values[row]);
+	}
+    }
+
+    mexpr_pool_destroy(pool);
+    free(bb);
+    free(values);
+    free(bitmap);
+    free(rows);
+    csv_destroy_table(tbl);
+    free(names);
+    free(table.bindings);
+    destroy_tree(t);
+
+    return ret;
+}
+
+static double
+elapsed_sec(struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) +
+	(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+usage(char *progname){
+    fprintf(stderr,
+	    "usage: %s [-b] [-p] [-q] expression_file\n"
+	    "       %s [-b] [-p] [-P | -x] [-q] -e expression record_file\n"
+	    "       %s [-p] [-q] [-f] [-j threads] -c -e expression -o output_file csv_file\n",
+	    progname, progname, progname);
+    exit(1);
+}
+
+int
+main(int argc, char **argv){
+    char *expression = NULL, *output_path = NULL;
+    int opt, nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool csv_input = false, ret;
+    struct timespec start;
+    size_t input_size;
+    mapped_file mf;
+    double sec;
+
+    while ((opt = getopt(argc, argv, "bce:fj:o:pPqx")) != -1){
+	switch(opt){
+	    case 'b':
+		binary_output = true;
+		break;
+	    case 'c':
+		csv_input = true;
+		break;
+	    case 'e':
+		expression = optarg;
+		break;
+	    case 'f':
+		filter_rows = true;
+		break;
+	    case 'j':
+		nthreads = atoi(optarg);
+		break;
+	    case 'o':
+		output_path = optarg;
+		break;
+	    case 'p':
+		parse_log = true;
+		break;
+	    case 'P':
+		profile_nodes = true;
+		break;
+	    case 'q':
+		quiet = true;
+		break;
+	    case 'x':
+		explain = true;
+		break;
+	    default:
+		usage(argv[0]);
+	}
+    }
+
+    if (optind != argc - 1 || nthreads <= 0)
+	usage(argv[0]);
+
+    /* The CSV mode writes the result column to the output file */
+    if (csv_input && (expression == NULL || output_path == NULL))
+	usage(argv[0]);
+
+    if (filter_rows && !csv_input)
+	usage(argv[0]);
+
+    /* The profile and the plan would evaluate the records in each way */
+    if (profile_nodes && explain)
+	usage(argv[0]);
+
+    output = stdout;
+    if (output_path != NULL){
+	if ((output = fopen(output_path, "w")) == NULL){
+	    perror("fopen");
+	    return 1;
+	}
+	binary_output = csv_input && !filter_rows ? true : binary_output;
+    }
+
+    setvbuf(output, NULL, _IOFBF, OUTPUT_BUFFER_LEN);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (csv_input){
+	struct stat st;
+
+	input_size = stat(argv[optind], &st) == 0 ? st.st_size : 0;
+	ret = evaluate_csv_file(expression, argv[optind], nthreads);
+    }else{
+	if (!map_file(argv[optind], &mf))
+	    return 1;
+
+	input_size = mf.size;
+	if (expression == NULL){
+	    evaluate_expression_file(&mf);
+	    ret = true;
+	}else{
+	    ret = evaluate_record_file(expression, &mf);
+	}
+	unmap_file(&mf);
+    }
+
+    fflush(output);
+    sec = elapsed_sec(&start);
+
+    if (output != stdout)
+	fclose(output);
+
+    if (!ret)
+	return 1;
+
+    fprintf(stderr,
+	    "%lu evaluations (%lu failed) in %.3f sec : %.0f evaluations/sec, %.1f MB/sec\n",
+	    evaluations, failures, sec,
+	    sec > 0 ? evaluations / sec : 0.0,
+	    sec > 0 ? input_size / sec / (1024 * 1024) : 0.0);
+
+    return 0;
+}